@@ -0,0 +1,168 @@
+#include <cstdlib>
+#include <boost/bind.hpp>
+#include "BotClient.h"
+#include "BotPacketBuilder.h"
+
+BotClient::BotClient( boost::asio::io_service &io, const BotConfig &config, BotStats &stats, int port, const std::string &roomId, const std::string &userId )
+	: config_(config), stats_(stats), counters_(stats.newCounters()), port_(port), roomId_(roomId), userId_(userId), joined_(false), failed_(false)
+	, strand_(io), socket_(io), timer_(io) {
+}
+
+void BotClient::start( void ) {
+	boost::asio::ip::tcp::endpoint endpoint( boost::asio::ip::address::from_string( config_.host ), port_ );
+	socket_.async_connect( endpoint, strand_.wrap( boost::bind( &BotClient::handleConnect, shared_from_this(), boost::asio::placeholders::error ) ) );
+}
+
+void BotClient::fail( const boost::system::error_code &error ) {
+	if( failed_ )
+		return;
+	failed_ = true;
+	counters_->errors++;
+	if( joined_ )
+		counters_->connected--;
+
+	boost::system::error_code ignored;
+	timer_.cancel( ignored );
+	socket_.close( ignored );
+	fprintf( stderr, "%s : %s\n", userId_.c_str(), error.message().c_str() );
+}
+
+void BotClient::handleConnect( const boost::system::error_code &error ) {
+	if( error ) {
+		fail( error );
+		return;
+	}
+
+	boost::asio::ip::tcp::no_delay option( true );
+	socket_.set_option( option );
+
+	send( BotPacketBuilder::JoinToServer::make( roomId_, userId_, userId_ ) );
+	read();
+}
+
+void BotClient::read( void ) {
+	boost::asio::async_read( socket_, boost::asio::buffer( readBuf_ ), boost::asio::transfer_at_least( 1 ),
+		strand_.wrap( boost::bind( &BotClient::handleRead, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred ) ) );
+}
+
+void BotClient::handleRead( const boost::system::error_code &error, size_t bytes ) {
+	if( error ) {
+		fail( error );
+		return;
+	}
+
+	recvBuf_.append( readBuf_, bytes );
+
+	// | magic 2 | code 2 | from id 1 + n | to id 1 + n | body size 4 | body |
+	size_t pos = 0;
+	try {
+		while( true ) {
+			size_t p = pos;
+			boost::uint16_t magic, code;
+			boost::uint8_t len;
+			boost::uint32_t bodySize;
+
+			if( recvBuf_.size() < p + 5 )
+				break;
+			p += PacketBufferUtil::readInt16( recvBuf_, p, magic, true );
+			p += PacketBufferUtil::readInt16( recvBuf_, p, code, true );
+			if( magic != BotPacketBuilder::NET_MAGIC_CODE ) {
+				fail( boost::asio::error::invalid_argument );
+				return;
+			}
+			p += PacketBufferUtil::readInt8( recvBuf_, p, len ) + len;
+			if( recvBuf_.size() < p + 1 )
+				break;
+			p += PacketBufferUtil::readInt8( recvBuf_, p, len ) + len;
+			if( recvBuf_.size() < p + 4 )
+				break;
+			p += PacketBufferUtil::readInt32( recvBuf_, p, bodySize, true );
+			if( recvBuf_.size() < p + bodySize )
+				break;
+
+			onPacket( code, recvBuf_.substr( p, bodySize ) );
+			pos = p + bodySize;
+		}
+	} catch(...) {
+		fail( boost::asio::error::invalid_argument );
+		return;
+	}
+
+	recvBuf_.erase( 0, pos );
+	read();
+}
+
+void BotClient::onPacket( boost::uint16_t code, const std::string &body ) {
+
+	code &= ~CODE_FLAG_COMPRESSED;	// the bots never compress, a bot packet is never flagged
+
+	if( code == CODE_SYSTEM_RES_JOIN && !joined_ ) {
+		joined_ = true;
+		counters_->connected++;
+		scheduleAction();
+	} else {
+		boost::uint32_t seq;
+		if( BotPacketBuilder::parseSequence( code, body, seq ) )
+			stats_.onDelivered( *counters_, seq, body.size() );
+	}
+}
+
+void BotClient::scheduleAction( void ) {
+	// spread the first action, not to make all the bots tick together
+	int msec = config_.intervalMsec / 2 + rand() % (config_.intervalMsec + 1);
+	timer_.expires_from_now( boost::posix_time::milliseconds( msec ) );
+	timer_.async_wait( strand_.wrap( boost::bind( &BotClient::handleAction, shared_from_this(), boost::asio::placeholders::error ) ) );
+}
+
+void BotClient::handleAction( const boost::system::error_code &error ) {
+	if( error || failed_ )
+		return;
+
+	int total = config_.lineRatio + config_.imageRatio + config_.moveRatio + config_.chatRatio;
+	int pick = total > 0 ? rand() % total : 0;
+
+	// the sequence is taken right before the packet is made, so the latency includes our own send queue
+	std::string packet;
+	if( (pick -= config_.lineRatio) < 0 ) {
+		boost::uint32_t seq = stats_.nextSequence();
+		packet = BotPacketBuilder::CreateLineItem::make( userId_, seq, config_.linePoints );
+	} else if( (pick -= config_.imageRatio) < 0 ) {
+		boost::uint32_t seq = stats_.nextSequence();
+		packet = BotPacketBuilder::CreateImageItem::make( userId_, seq, config_.imageSize );
+	} else if( (pick -= config_.moveRatio) < 0 ) {
+		boost::uint32_t seq = stats_.nextSequence();
+		packet = BotPacketBuilder::MoveItemTask::make( userId_, seq );
+	} else {
+		boost::uint32_t seq = stats_.nextSequence();
+		packet = BotPacketBuilder::ChatMessage::make( userId_, userId_, seq );
+	}
+	counters_->sent++;
+	counters_->sentBytes += packet.size();
+	send( packet );
+
+	timer_.expires_from_now( boost::posix_time::milliseconds( config_.intervalMsec ) );
+	timer_.async_wait( strand_.wrap( boost::bind( &BotClient::handleAction, shared_from_this(), boost::asio::placeholders::error ) ) );
+}
+
+void BotClient::send( const std::string &packet ) {
+	bool idle = sendQueue_.empty();
+	sendQueue_.push_back( packet );
+	if( idle )
+		writeNext();
+}
+
+void BotClient::writeNext( void ) {
+	boost::asio::async_write( socket_, boost::asio::buffer( sendQueue_.front() ),
+		strand_.wrap( boost::bind( &BotClient::handleWrite, shared_from_this(), boost::asio::placeholders::error ) ) );
+}
+
+void BotClient::handleWrite( const boost::system::error_code &error ) {
+	if( error ) {
+		fail( error );
+		return;
+	}
+
+	sendQueue_.pop_front();
+	if( !sendQueue_.empty() )
+		writeNext();
+}
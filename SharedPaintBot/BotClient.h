@@ -0,0 +1,62 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include "BotStats.h"
+
+struct BotConfig {
+	BotConfig( void ) : intervalMsec(100), linePoints(50), imageSize(64 * 1024),
+		lineRatio(60), imageRatio(5), moveRatio(30), chatRatio(5) { }
+	std::string host;
+	std::vector<int> ports;	// the relay nodes, the bots are spread over them
+	int intervalMsec;	// one action per bot per interval
+	int linePoints;
+	int imageSize;
+	int lineRatio;		// the action mix
+	int imageRatio;
+	int moveRatio;
+	int chatRatio;
+};
+
+// one headless SharedPainter user.
+// joins a room through the relay, then draws, moves and chats on a timer and counts what the others send.
+class BotClient : public boost::enable_shared_from_this<BotClient>
+{
+public:
+	BotClient( boost::asio::io_service &io, const BotConfig &config, BotStats &stats, int port, const std::string &roomId, const std::string &userId );
+
+	void start( void );
+
+private:
+	void handleConnect( const boost::system::error_code &error );
+	void read( void );
+	void handleRead( const boost::system::error_code &error, size_t bytes );
+	void onPacket( boost::uint16_t code, const std::string &body );
+	void scheduleAction( void );
+	void handleAction( const boost::system::error_code &error );
+	void send( const std::string &packet );
+	void writeNext( void );
+	void handleWrite( const boost::system::error_code &error );
+	void fail( const boost::system::error_code &error );
+
+private:
+	const BotConfig &config_;
+	BotStats &stats_;
+	BotStats::Counters *counters_;
+	int port_;
+	std::string roomId_;
+	std::string userId_;
+	bool joined_;
+	bool failed_;
+
+	boost::asio::io_service::strand strand_;
+	boost::asio::ip::tcp::socket socket_;
+	boost::asio::deadline_timer timer_;
+
+	char readBuf_[64 * 1024];
+	std::string recvBuf_;
+	std::deque<std::string> sendQueue_;
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cassert>
+#include <arpa/inet.h>
+#include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+#include "PacketBuffer.h"			// SharedPaintServer
+#include "SharedPaintCodeDefine.h"	// SharedPaintServer
+
+// the few packets a bot speaks, in the same encoding as the SharedPainter client.
+// every bot packet carries a sequence number, so a receiver can find when it was sent (BotStats).
+namespace BotPacketBuilder {
+
+	enum {
+		NET_MAGIC_CODE = 0xBEBE,
+	};
+
+	// the client's PaintItemType and TaskType
+	enum {
+		PT_LINE = 0,
+		PT_IMAGE = 1,
+		Task_MoveItem = 3,
+	};
+
+	inline std::string makePacket( boost::uint16_t code, const std::string &body ) {
+		std::string packet;
+		size_t pos = 0;
+		pos += PacketBufferUtil::writeInt16( packet, pos, NET_MAGIC_CODE, true );
+		pos += PacketBufferUtil::writeInt16( packet, pos, code, true );
+		pos += PacketBufferUtil::writeString8( packet, pos, "" );
+		pos += PacketBufferUtil::writeString8( packet, pos, "" );
+		pos += PacketBufferUtil::writeInt32( packet, pos, body.size(), true );
+		packet += body;
+		return packet;
+	}
+
+	// CPaintItem::writeBasicData()
+	inline size_t writeItemBasicData( std::string &body, size_t pos, const std::string &owner, boost::uint32_t itemId ) {
+		size_t start = pos;
+		pos += PacketBufferUtil::writeString8( body, pos, owner );
+		pos += PacketBufferUtil::writeInt32( body, pos, itemId, true );
+		pos += PacketBufferUtil::writeInt8( body, pos, 1 );
+		pos += PacketBufferUtil::writeDouble( body, pos, 10.0, true );
+		pos += PacketBufferUtil::writeDouble( body, pos, 10.0, true );
+		pos += PacketBufferUtil::writeDouble( body, pos, 1.0, true );
+		return pos - start;
+	}
+
+	class JoinToServer {
+		public:
+			// the relay's CPaintUser::deserialize()
+			static std::string make( const std::string &roomId, const std::string &userId, const std::string &nickName ) {
+				std::string body;
+				size_t pos = 0;
+				pos += PacketBufferUtil::writeString8( body, pos, roomId );
+				pos += PacketBufferUtil::writeString8( body, pos, userId );
+				pos += PacketBufferUtil::writeString8( body, pos, nickName );
+				pos += PacketBufferUtil::writeString8( body, pos, "" );	// view ip, the relay fills it
+				pos += PacketBufferUtil::writeString8( body, pos, "127.0.0.1" );
+				pos += PacketBufferUtil::writeInt16( body, pos, 0, true );	// no listen port, never a super peer
+				pos += PacketBufferUtil::writeInt8( body, pos, 0 );
+				pos += PacketBufferUtil::writeInt8( body, pos, 0 );
+				pos += PacketBufferUtil::writeInt8( body, pos, 0 );
+				return makePacket( CODE_SYSTEM_JOIN_TO_SERVER, body );
+			}
+	};
+
+	class CreateLineItem {
+		public:
+			// CLineItem::serializeTo()
+			static std::string make( const std::string &owner, boost::uint32_t seq, int pointCount ) {
+				std::string body;
+				size_t pos = 0;
+				pos += PacketBufferUtil::writeInt16( body, pos, PT_LINE, true );
+				pos += writeItemBasicData( body, pos, owner, seq );
+				pos += PacketBufferUtil::writeInt16( body, pos, seq % 256, true );
+				pos += PacketBufferUtil::writeInt16( body, pos, 64, true );
+				pos += PacketBufferUtil::writeInt16( body, pos, 128, true );
+				pos += PacketBufferUtil::writeInt16( body, pos, 255, true );
+				pos += PacketBufferUtil::writeInt16( body, pos, 3, true );
+				pos += PacketBufferUtil::writeInt16( body, pos, pointCount, true );
+				for( int i = 0; i < pointCount; i++ ) {
+					pos += PacketBufferUtil::writeDouble( body, pos, 100.0 + i * 1.5, true );
+					pos += PacketBufferUtil::writeDouble( body, pos, 100.0 + (i % 20) * 2.5, true );
+				}
+				return makePacket( CODE_PAINT_CREATE_ITEM, body );
+			}
+	};
+
+	class CreateImageItem {
+		public:
+			// CImageItem::serializeTo(), the pixmap is just filler
+			static std::string make( const std::string &owner, boost::uint32_t seq, size_t imageSize ) {
+				std::string body;
+				size_t pos = 0;
+				pos += PacketBufferUtil::writeInt16( body, pos, PT_IMAGE, true );
+				pos += writeItemBasicData( body, pos, owner, seq );
+				pos += PacketBufferUtil::writeInt32( body, pos, imageSize, true );
+				body.append( imageSize, (char)(seq & 0xff) );
+				return makePacket( CODE_PAINT_CREATE_ITEM, body );
+			}
+	};
+
+	class MoveItemTask {
+		public:
+			// CMoveItemTask::serializeTo()
+			static std::string make( const std::string &owner, boost::uint32_t seq ) {
+				std::string body;
+				size_t pos = 0;
+				pos += PacketBufferUtil::writeInt16( body, pos, Task_MoveItem, true );
+				pos += PacketBufferUtil::writeString8( body, pos, owner );
+				pos += PacketBufferUtil::writeInt32( body, pos, seq, true );
+				pos += PacketBufferUtil::writeDouble( body, pos, 10.0, true );
+				pos += PacketBufferUtil::writeDouble( body, pos, 10.0, true );
+				pos += PacketBufferUtil::writeDouble( body, pos, 20.0 + seq % 100, true );
+				pos += PacketBufferUtil::writeDouble( body, pos, 20.0 + seq % 50, true );
+				return makePacket( CODE_TASK_EXECUTE, body );
+			}
+	};
+
+	class ChatMessage {
+		public:
+			static std::string make( const std::string &userId, const std::string &nickName, boost::uint32_t seq ) {
+				char msg[32];
+				snprintf( msg, sizeof(msg), "bot %u", seq );
+
+				std::string body;
+				size_t pos = 0;
+				pos += PacketBufferUtil::writeString8( body, pos, userId );
+				pos += PacketBufferUtil::writeString8( body, pos, nickName );
+				pos += PacketBufferUtil::writeString8( body, pos, msg );
+				return makePacket( CODE_SYSTEM_CHAT_MESSAGE, body );
+			}
+	};
+
+	// the sequence number of a bot packet, false for the others
+	inline bool parseSequence( boost::uint16_t code, const std::string &body, boost::uint32_t &seq ) {
+		try {
+			size_t pos = 0;
+			std::string owner;
+			boost::uint16_t type;
+
+			switch( code ) {
+				case CODE_PAINT_CREATE_ITEM:
+				case CODE_TASK_EXECUTE:
+					pos += PacketBufferUtil::readInt16( body, pos, type, true );
+					pos += PacketBufferUtil::readString8( body, pos, owner );
+					pos += PacketBufferUtil::readInt32( body, pos, seq, true );
+					return true;
+				case CODE_SYSTEM_CHAT_MESSAGE: {
+					std::string userId, nickName, msg;
+					pos += PacketBufferUtil::readString8( body, pos, userId );
+					pos += PacketBufferUtil::readString8( body, pos, nickName );
+					pos += PacketBufferUtil::readString8( body, pos, msg );
+					return sscanf( msg.c_str(), "bot %u", &seq ) == 1;
+				}
+				default:
+					return false;
+			}
+		} catch(...) {
+		}
+		return false;
+	}
+};
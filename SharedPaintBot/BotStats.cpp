@@ -0,0 +1,101 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "BotStats.h"
+
+static const double BUCKET_BASE = 1.05;
+
+BotStats::BotStats( void ) : seq_(0), sendTimes_(BOT_SEND_TIME_SLOTS, 0) {
+	lastReportUsec_ = nowUsec();
+}
+
+BotStats::~BotStats( void ) {
+	for( size_t i = 0; i < counters_.size(); i++ )
+		delete counters_[i];
+}
+
+BotStats::Counters *BotStats::newCounters( void ) {
+	// the bots are made before the io threads run
+	Counters *counters = new Counters;
+	counters_.push_back( counters );
+	return counters;
+}
+
+int BotStats::bucketOf( boost::uint64_t usec ) {
+	if( usec <= 1 )
+		return 0;
+	int bucket = (int)( log( (double)usec ) / log( BUCKET_BASE ) );
+	return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+boost::uint64_t BotStats::usecOf( int bucket ) {
+	return (boost::uint64_t)pow( BUCKET_BASE, bucket + 1 );	// the upper bound
+}
+
+boost::uint32_t BotStats::nextSequence( void ) {
+	boost::uint32_t seq = __sync_fetch_and_add( &seq_, 1 );
+	sendTimes_[ seq % BOT_SEND_TIME_SLOTS ] = nowUsec();
+	return seq;
+}
+
+void BotStats::onDelivered( Counters &counters, boost::uint32_t seq, size_t size ) {
+	boost::uint64_t sendTime = sendTimes_[ seq % BOT_SEND_TIME_SLOTS ];
+	boost::uint64_t now = nowUsec();
+
+	counters.delivered++;
+	counters.deliveredBytes += size;
+	if( sendTime != 0 && now >= sendTime )
+		counters.latency[ bucketOf( now - sendTime ) ]++;
+}
+
+boost::uint64_t BotStats::percentile( const boost::uint64_t *hist, boost::uint64_t total, double p ) {
+	if( total == 0 )
+		return 0;
+	boost::uint64_t rank = (boost::uint64_t)ceil( total * p );
+	boost::uint64_t count = 0;
+	for( int i = 0; i < LATENCY_BUCKETS; i++ ) {
+		count += hist[i];
+		if( count >= rank )
+			return usecOf( i );
+	}
+	return usecOf( LATENCY_BUCKETS - 1 );
+}
+
+std::string BotStats::report( void ) {
+
+	Counters total;
+	for( size_t i = 0; i < counters_.size(); i++ ) {
+		const Counters &c = *counters_[i];
+		total.sent += c.sent;
+		total.sentBytes += c.sentBytes;
+		total.delivered += c.delivered;
+		total.deliveredBytes += c.deliveredBytes;
+		total.connected += c.connected;
+		total.errors += c.errors;
+		for( int b = 0; b < LATENCY_BUCKETS; b++ )
+			total.latency[b] += c.latency[b];
+	}
+
+	boost::uint64_t now = nowUsec();
+	double sec = (now - lastReportUsec_) / 1000000.0;
+
+	boost::uint64_t hist[LATENCY_BUCKETS];
+	boost::uint64_t samples = 0;
+	for( int b = 0; b < LATENCY_BUCKETS; b++ ) {
+		hist[b] = total.latency[b] - last_.latency[b];
+		samples += hist[b];
+	}
+
+	char buf[512];
+	snprintf( buf, sizeof(buf), 
+		"bots %llu, errors %llu | sent %.0f msg/s %.0f B/s | delivered %.0f msg/s %.0f B/s | latency usec p50 %llu p90 %llu p99 %llu p99.9 %llu",
+		(unsigned long long)total.connected, (unsigned long long)total.errors,
+		(total.sent - last_.sent) / sec, (total.sentBytes - last_.sentBytes) / sec,
+		(total.delivered - last_.delivered) / sec, (total.deliveredBytes - last_.deliveredBytes) / sec,
+		(unsigned long long)percentile( hist, samples, 0.5 ), (unsigned long long)percentile( hist, samples, 0.9 ),
+		(unsigned long long)percentile( hist, samples, 0.99 ), (unsigned long long)percentile( hist, samples, 0.999 ) );
+
+	last_ = total;
+	lastReportUsec_ = now;
+	return buf;
+}
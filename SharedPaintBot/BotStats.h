@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <cstring>
+#include <boost/cstdint.hpp>
+
+#ifndef BOT_SEND_TIME_SLOTS
+#define BOT_SEND_TIME_SLOTS		(1 << 20)	// in flight sequence numbers. a later packet reuses the slot
+#endif
+
+// all the bots run in one process, so the receivers look up the send time by the sequence number
+// instead of carrying a timestamp on the wire.
+// every bot counts into its own Counters without a lock, the report sums them up.
+class BotStats
+{
+public:
+	// latency histogram, 5% wide log buckets from 1 usec to ~100 sec
+	enum { LATENCY_BUCKETS = 400 };
+
+	struct Counters {
+		Counters( void ) : sent(0), sentBytes(0), delivered(0), deliveredBytes(0), connected(0), errors(0) {
+			memset( latency, 0, sizeof(latency) );
+		}
+		boost::uint64_t sent;
+		boost::uint64_t sentBytes;
+		boost::uint64_t delivered;
+		boost::uint64_t deliveredBytes;
+		boost::uint64_t connected;
+		boost::uint64_t errors;
+		boost::uint64_t latency[LATENCY_BUCKETS];
+	};
+
+	static boost::uint64_t nowUsec( void ) {
+		struct timespec ts;
+		clock_gettime( CLOCK_MONOTONIC, &ts );
+		return (boost::uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+
+	BotStats( void );
+	~BotStats( void );	// after the bots
+
+	boost::uint32_t nextSequence( void );
+	void onDelivered( Counters &counters, boost::uint32_t seq, size_t size );
+
+	Counters *newCounters( void );
+
+	// one line since the previous report
+	std::string report( void );
+
+private:
+	static int bucketOf( boost::uint64_t usec );
+	static boost::uint64_t usecOf( int bucket );
+	static boost::uint64_t percentile( const boost::uint64_t *hist, boost::uint64_t total, double p );
+
+private:
+	volatile boost::uint32_t seq_;
+	std::vector<boost::uint64_t> sendTimes_;
+	std::vector<Counters *> counters_;
+
+	boost::uint64_t lastReportUsec_;
+	Counters last_;
+};
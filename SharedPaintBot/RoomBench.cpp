@@ -0,0 +1,146 @@
+//
+// SharedPaintRoomBench : the relay throughput over the number of busy rooms.
+//
+// for each room count it runs a fresh set of bots (BotClient), the same number in every room, all drawing at
+// the interval, and prints the delivered messages/s of that phase. independent rooms should scale with the
+// io threads of the relay until it runs out of them, one line per room count shows where.
+// the bots are the same load generator as SharedPaintBot, so the relay runs best on other cores than the bots.
+//
+// build (linux) :
+//   g++ -O2 -I../SharedPaintServer RoomBench.cpp BotClient.cpp BotStats.cpp -lboost_system -lboost_thread -lpthread -o SharedPaintRoomBench
+// example :
+//   taskset -c 0-3 SharedPaintServer -p 10888 &
+//   taskset -c 4-7 ./SharedPaintRoomBench --rooms 1,2,4,8,16,32,64 --bots-per-room 4 --interval 10 --phase 10
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include "BotClient.h"
+#include "BotStats.h"
+
+static void usage( void ) {
+	fprintf( stderr, 
+		"usage : SharedPaintRoomBench [options]\n"
+		"  --host <ip>              relay address (127.0.0.1)\n"
+		"  --port <port>            relay port (10888)\n"
+		"  --rooms <n,n,..>         the room counts, one phase each (1,2,4,8,16,32,64)\n"
+		"  --bots-per-room <n>      (4)\n"
+		"  --threads <n>            io threads of the bots (cpu count)\n"
+		"  --interval <msec>        one action per bot per interval (10)\n"
+		"  --line-points <n>        points of a line item (50)\n"
+		"  --mix <l,i,m,c>          ratio of line, image, move and chat (60,0,40,0)\n"
+		"  --warmup <sec>           not measured, the bots join in it (2)\n"
+		"  --phase <sec>            measured, per room count (10)\n" );
+}
+
+// one room count, the bots leave the relay at its end
+static std::string runPhase( const BotConfig &config, int phase, int roomCount, int botsPerRoom, int threadCount, int warmup, int seconds ) {
+
+	BotStats stats;
+	std::string result;
+	{
+		boost::asio::io_service io;
+		boost::asio::io_service::work work( io );
+
+		std::vector< boost::shared_ptr<BotClient> > bots;
+		for( int i = 0; i < roomCount * botsPerRoom; i++ ) {
+			char roomId[32], userId[32];
+			snprintf( roomId, sizeof(roomId), "bench%d_%d", phase, i % roomCount );	// not the rooms of the previous phase
+			snprintf( userId, sizeof(userId), "bench%d_%d", phase, i );
+			bots.push_back( boost::shared_ptr<BotClient>( new BotClient( io, config, stats, config.ports[0], roomId, userId ) ) );
+		}
+
+		boost::thread_group threads;
+		for( int i = 0; i < threadCount; i++ )
+			threads.create_thread( boost::bind( &boost::asio::io_service::run, &io ) );
+
+		for( size_t i = 0; i < bots.size(); i++ )
+			bots[i]->start();
+
+		boost::this_thread::sleep( boost::posix_time::seconds( warmup ) );
+		stats.report();		// from here
+		boost::this_thread::sleep( boost::posix_time::seconds( seconds ) );
+		result = stats.report();
+
+		io.stop();
+		threads.join_all();
+		bots.clear();
+	}
+	return result;
+}
+
+int main( int argc, char *argv[] ) {
+
+	BotConfig config;
+	config.host = "127.0.0.1";
+	config.intervalMsec = 10;
+	config.lineRatio = 60;
+	config.imageRatio = 0;
+	config.moveRatio = 40;
+	config.chatRatio = 0;
+	int port = 10888;
+	std::vector<int> roomCounts;
+	int botsPerRoom = 4;
+	int threadCount = boost::thread::hardware_concurrency();
+	int warmup = 2;
+	int seconds = 10;
+
+	for( int i = 1; i < argc; i++ ) {
+		const char *opt = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+		if( !val ) {
+			usage();
+			return 1;
+		}
+		i++;
+
+		if( strcmp( opt, "--host" ) == 0 )				config.host = val;
+		else if( strcmp( opt, "--port" ) == 0 )			port = atoi( val );
+		else if( strcmp( opt, "--rooms" ) == 0 ) {
+			for( const char *p = val; p && *p; p = strchr( p, ',' ) ? strchr( p, ',' ) + 1 : NULL )
+				roomCounts.push_back( atoi( p ) );
+		}
+		else if( strcmp( opt, "--bots-per-room" ) == 0 )	botsPerRoom = atoi( val );
+		else if( strcmp( opt, "--threads" ) == 0 )		threadCount = atoi( val );
+		else if( strcmp( opt, "--interval" ) == 0 )		config.intervalMsec = atoi( val );
+		else if( strcmp( opt, "--line-points" ) == 0 )	config.linePoints = atoi( val );
+		else if( strcmp( opt, "--warmup" ) == 0 )		warmup = atoi( val );
+		else if( strcmp( opt, "--phase" ) == 0 )		seconds = atoi( val );
+		else if( strcmp( opt, "--mix" ) == 0 ) {
+			if( sscanf( val, "%d,%d,%d,%d", &config.lineRatio, &config.imageRatio, &config.moveRatio, &config.chatRatio ) != 4 ) {
+				usage();
+				return 1;
+			}
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if( roomCounts.empty() ) {
+		for( int n = 1; n <= 64; n *= 2 )
+			roomCounts.push_back( n );
+	}
+	if( botsPerRoom < 2 || config.intervalMsec <= 0 || seconds <= 0 || warmup < 0 ) {
+		usage();	// a room of one has nobody to deliver to
+		return 1;
+	}
+	if( threadCount <= 0 )
+		threadCount = 1;
+	config.ports.push_back( port );
+	config.linePoints = std::min( std::max( config.linePoints, 1 ), 0xffff );
+
+	printf( "%d bots per room -> %s:%d, interval %d msec, %d io threads\n", botsPerRoom, config.host.c_str(), port, config.intervalMsec, threadCount );
+
+	for( size_t i = 0; i < roomCounts.size(); i++ ) {
+		if( roomCounts[i] <= 0 )
+			continue;
+		std::string result = runPhase( config, (int)i, roomCounts[i], botsPerRoom, threadCount, warmup, seconds );
+		printf( "rooms %3d | %s\n", roomCounts[i], result.c_str() );
+		fflush( stdout );
+	}
+	return 0;
+}
@@ -0,0 +1,254 @@
+//
+// SharedPaintSliceBench : the receive parse of the client (CPacketSlicer) over a sync stream, in bytes/s.
+//
+// "erase" is the former slicer, kept here as the baseline : the bytes are appended to one std::string,
+// each body is copied out and the parsed packet is erased from its front.
+// "ring" is CPacketSlicer itself : the socket reads go straight into CPacketRingBuffer and a packet refers to its body there.
+// both are fed the same stream in reads of the same size, as from the socket, and touch every body.
+//
+// the stream is a saved canvas (--file, "Save" of the painter writes what a sync sends),
+// or 100 MB of CREATE_ITEM lines with an image now and then, like a busy canvas.
+//
+// build (linux) :
+//   g++ -O2 -I../SharedPainter $(pkg-config --cflags --libs QtGui QtCore) SliceBench.cpp -o SharedPaintSliceBench
+// example :
+//   ./SharedPaintSliceBench --size 100 --read-size 65536 --rounds 3
+//   ./SharedPaintSliceBench --file canvas.sp
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/asio.hpp>
+#include <QtGui>
+#include "SharedPaintPolicy.h"	// what stdafx.h of the painter gives its headers
+#include "PacketSlicer.h"
+
+static void usage( void ) {
+	fprintf( stderr,
+		"usage : SharedPaintSliceBench [options]\n"
+		"  --file <path>            a recorded stream (a saved canvas), instead of the generated one\n"
+		"  --size <mb>              size of the generated stream (100)\n"
+		"  --line-points <n>        points of a line item (50)\n"
+		"  --image-every <n>        one 1 MB image per n lines, 0 : none (2000)\n"
+		"  --read-size <bytes>      bytes per socket read (65536)\n"
+		"  --rounds <n>             runs of each slicer, the best is printed (3)\n" );
+}
+
+// the old slicer : one std::string, erased from the front after each packet
+class EraseSlicer
+{
+public:
+	struct Packet {
+		boost::uint16_t code;
+		std::string fromId;
+		std::string toId;
+		std::string body;
+	};
+
+	void addBuffer( const char *buffer, size_t len ) {
+		std::string temp( buffer, len );
+		buffer_ += temp;
+	}
+
+	// false : the stream is broken
+	bool parse( std::vector<Packet> &out ) {
+		out.clear();
+		for( ;; ) {
+			size_t pos = 0;
+			if( buffer_.size() < 4 )
+				return true;
+			boost::uint16_t magic, code;
+			memcpy( &magic, buffer_.c_str(), 2 );
+			memcpy( &code, buffer_.c_str() + 2, 2 );
+			if( magic != NET_MAGIC_CODE )
+				return false;
+			pos = 4;
+
+			std::string ids[2];
+			for( int i = 0; i < 2; i++ ) {
+				if( buffer_.size() < pos + 1 )
+					return true;
+				boost::uint8_t len = (boost::uint8_t)buffer_[pos];
+				if( buffer_.size() < pos + 1 + len )
+					return true;
+				ids[i].assign( buffer_.c_str() + pos + 1, len );
+				pos += 1 + len;
+			}
+
+			boost::uint32_t bodyLen;
+			if( buffer_.size() < pos + 4 )
+				return true;
+			memcpy( &bodyLen, buffer_.c_str() + pos, 4 );
+			pos += 4;
+			if( bodyLen > MAX_PACKET_BODY_SIZE )
+				return false;
+			if( buffer_.size() < pos + bodyLen )
+				return true;
+
+			Packet packet;
+			packet.code = code & ~CODE_FLAG_COMPRESSED;
+			packet.fromId = ids[0];
+			packet.toId = ids[1];
+			packet.body.assign( buffer_.c_str() + pos, bodyLen );
+			out.push_back( packet );
+
+			buffer_.erase( 0, pos + bodyLen );
+		}
+	}
+
+private:
+	std::string buffer_;
+};
+
+// one CREATE_ITEM of a line, laid out as CLineItem::serializeTo()
+static void appendLine( std::string &stream, int itemId, int points ) {
+	std::string owner = "bench_user";
+	size_t bodySize = 2 + CommonPacketBuilder::string8Size( owner ) + 4 + 1 + 8 * 3 + 2 * 6 + points * 16;
+	CommonPacketBuilder::CPacketWriter writer( stream, CODE_PAINT_CREATE_ITEM, bodySize, &owner );
+	writer.writeInt16( PT_LINE );
+	writer.writeString8( owner );
+	writer.writeInt32( itemId );
+	writer.writeInt8( 0 );
+	writer.writeDouble( 0 );
+	writer.writeDouble( 0 );
+	writer.writeDouble( 1 );
+	for( int i = 0; i < 4; i++ )
+		writer.writeInt16( 255 );
+	writer.writeInt16( 3 );
+	writer.writeInt16( points );
+	for( int i = 0; i < points; i++ ) {
+		writer.writeDouble( itemId % 1000 + i );
+		writer.writeDouble( i * 2 );
+	}
+}
+
+// one CREATE_ITEM of an image, laid out as CImageItem::serializeTo(). the pixmap is filler.
+static void appendImage( std::string &stream, int itemId, size_t imageSize ) {
+	std::string owner = "bench_user";
+	size_t bodySize = 2 + CommonPacketBuilder::string8Size( owner ) + 4 + 1 + 8 * 3 + 4 + imageSize;
+	CommonPacketBuilder::CPacketWriter writer( stream, CODE_PAINT_CREATE_ITEM, bodySize, &owner );
+	writer.writeInt16( PT_IMAGE );
+	writer.writeString8( owner );
+	writer.writeInt32( itemId );
+	writer.writeInt8( 1 );
+	writer.writeDouble( 10 );
+	writer.writeDouble( 10 );
+	writer.writeDouble( 1 );
+	writer.writeInt32( imageSize );
+	writer.writeBinary( std::string( imageSize, 'i' ) );
+}
+
+static double seconds( const boost::posix_time::ptime &start ) {
+	return (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000000.0;
+}
+
+// bytes/s of one run, <count> : the packets parsed, <sum> : keeps the bodies from being optimized out
+static double runErase( const std::string &stream, size_t readSize, size_t &count, size_t &sum ) {
+	EraseSlicer slicer;
+	std::vector<EraseSlicer::Packet> packets;
+	count = sum = 0;
+
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	for( size_t pos = 0; pos < stream.size(); pos += readSize ) {
+		slicer.addBuffer( stream.c_str() + pos, std::min( readSize, stream.size() - pos ) );
+		if( !slicer.parse( packets ) )
+			return 0;
+		for( size_t i = 0; i < packets.size(); i++ ) {
+			sum += (boost::uint8_t)packets[i].body[packets[i].body.size() / 2];
+			count++;
+		}
+	}
+	return stream.size() / seconds( start );
+}
+
+static double runRing( const std::string &stream, size_t readSize, size_t &count, size_t &sum ) {
+	CPacketSlicer slicer;
+	count = sum = 0;
+
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	for( size_t pos = 0; pos < stream.size(); ) {
+		size_t size = std::min( readSize, stream.size() - pos );
+		char *ptr = slicer.prepareBuffer( size );
+		size = std::min( size, stream.size() - pos );
+		memcpy( ptr, stream.c_str() + pos, size );	// the socket read
+		slicer.commitBuffer( size );
+		pos += size;
+
+		slicer.parse();
+		for( size_t i = 0; i < slicer.parsedItemCount(); i++ ) {
+			boost::shared_ptr<CPacketData> data = slicer.parsedItem( i );
+			sum += (boost::uint8_t)data->bodyPtr()[data->bodySize() / 2];
+			count++;
+		}
+	}
+	return stream.size() / seconds( start );
+}
+
+int main( int argc, char *argv[] ) {
+	std::string file;
+	int sizeMb = 100;
+	int linePoints = 50;
+	int imageEvery = 2000;
+	size_t readSize = 65536;
+	int rounds = 3;
+
+	for( int i = 1; i < argc; i++ ) {
+		std::string arg = argv[i];
+		if( i + 1 >= argc ) {
+			usage();
+			return 1;
+		}
+		if( arg == "--file" ) file = argv[++i];
+		else if( arg == "--size" ) sizeMb = atoi( argv[++i] );
+		else if( arg == "--line-points" ) linePoints = atoi( argv[++i] );
+		else if( arg == "--image-every" ) imageEvery = atoi( argv[++i] );
+		else if( arg == "--read-size" ) readSize = atoi( argv[++i] );
+		else if( arg == "--rounds" ) rounds = atoi( argv[++i] );
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if( readSize <= 0 ) {
+		usage();
+		return 1;
+	}
+
+	std::string stream;
+	if( !file.empty() ) {
+		std::ifstream in( file.c_str(), std::ios::binary );
+		if( !in ) {
+			fprintf( stderr, "cannot read %s\n", file.c_str() );
+			return 1;
+		}
+		stream.assign( (std::istreambuf_iterator<char>( in )), std::istreambuf_iterator<char>() );
+	} else {
+		size_t total = (size_t)sizeMb * 1024 * 1024;
+		for( int itemId = 1; stream.size() < total; itemId++ ) {
+			if( imageEvery > 0 && itemId % imageEvery == 0 )
+				appendImage( stream, itemId, 1024 * 1024 );
+			else
+				appendLine( stream, itemId, linePoints );
+		}
+	}
+
+	double erase = 0, ring = 0;
+	size_t eraseCount = 0, ringCount = 0, eraseSum = 0, ringSum = 0;
+	for( int i = 0; i < rounds; i++ ) {
+		erase = std::max( erase, runErase( stream, readSize, eraseCount, eraseSum ) );
+		ring = std::max( ring, runRing( stream, readSize, ringCount, ringSum ) );
+	}
+
+	printf( "%.1f MB, read size %d\n", stream.size() / (1024.0 * 1024.0), (int)readSize );
+	if( eraseCount != ringCount || eraseSum != ringSum ) {
+		fprintf( stderr, "the slicers differ : %d / %d packets\n", (int)eraseCount, (int)ringCount );
+		return 1;
+	}
+	printf( "erase : %8.1f MB/s, %d packets\n", erase / (1024.0 * 1024.0), (int)eraseCount );
+	printf( "ring  : %8.1f MB/s (x%.2f)\n", ring / (1024.0 * 1024.0), ring / erase );
+	return 0;
+}
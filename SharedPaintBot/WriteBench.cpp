@@ -0,0 +1,256 @@
+//
+// SharedPaintWriteBench : the send path of the client session (CNetPeerSession) in bytes/s.
+//
+// "chunked" is the former path, kept here as the baseline : each queued packet is copied 4 KB at a time into
+// one staging array and every chunk is its own async_write, under the session mutex.
+// "gathered" is CNetPeerSession itself : the queued packets are written from their own storage,
+// several of them in one async_write.
+// both send the same packets to a loopback receiver which only counts the bytes.
+// the default load is a sync : some 20 MB images between many small items.
+//
+// build (linux) :
+//   g++ -O2 -I../SharedPainter $(pkg-config --cflags QtCore) WriteBench.cpp -lboost_system -lboost_thread -lpthread -o SharedPaintWriteBench
+// example :
+//   ./SharedPaintWriteBench --big 5 --big-size 20 --small 20000 --rounds 5
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "PacketBuffer.h"
+#include "NetPacketData.h"
+#include "NetPeerSession.h"
+
+using boost::asio::ip::tcp;
+
+typedef std::vector< boost::shared_ptr<CNetPacketData> > PACKET_LIST;
+
+static void usage( void ) {
+	fprintf( stderr,
+		"usage : SharedPaintWriteBench [options]\n"
+		"  --big <n>                big packets, spread over the run (5)\n"
+		"  --big-size <mb>          size of a big packet (20)\n"
+		"  --small <n>              small packets (20000)\n"
+		"  --small-size <bytes>     size of a small packet (200)\n"
+		"  --rounds <n>             runs of each path, the best is printed (5)\n"
+		"  --port <port>            loopback port of the receiver (10999)\n" );
+}
+
+// the old write path of CNetPeerSession, copied 4 KB at a time
+class ChunkedWriter : public boost::enable_shared_from_this<ChunkedWriter>
+{
+public:
+	ChunkedWriter( tcp::socket &socket ) : socket_(socket) { }
+
+	void sendData( boost::shared_ptr<CNetPacketData> packet ) {
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+		bool write_in_progress = !write_buffer_list_.empty();
+		write_buffer_list_.push_back( packet );
+		if( !write_in_progress )
+			_start_write();
+	}
+
+private:
+	void _start_write( void ) {
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+		if( write_buffer_list_.empty() )
+			return;
+
+		boost::shared_ptr<CNetPacketData> packet = write_buffer_list_.front();
+
+		size_t readSize = _BUF_SIZE;
+		const void *ptr = packet->peek( readSize );
+		memcpy( curr_write_buffer_, ptr, readSize );
+		packet->fastforward( readSize );
+
+		boost::asio::async_write( socket_,
+			boost::asio::buffer( curr_write_buffer_, readSize ),
+			boost::bind( &ChunkedWriter::_handle_write, shared_from_this(), boost::asio::placeholders::error ) );
+	}
+
+	void _handle_write( const boost::system::error_code &ec ) {
+		if( ec )
+			return;
+
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+		if( write_buffer_list_.front()->remainingSize() <= 0 )
+			write_buffer_list_.pop_front();
+		if( !write_buffer_list_.empty() )
+			_start_write();
+	}
+
+private:
+	static const int _BUF_SIZE = 4096;
+
+	tcp::socket &socket_;
+	char curr_write_buffer_[_BUF_SIZE];
+	std::deque< boost::shared_ptr<CNetPacketData> > write_buffer_list_;
+	boost::recursive_mutex mutex_;
+};
+
+// the session just connects, the receiver measures
+class BenchEvent : public INetPeerSessionEvent
+{
+public:
+	BenchEvent( void ) : connected_(false) { }
+
+	void waitConnected( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		while( !connected_ )
+			cond_.wait( autolock );
+	}
+
+	virtual void onINetPeerSessionEvent_Connected( CNetPeerSession *session ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		connected_ = true;
+		cond_.notify_all();
+	}
+	virtual void onINetPeerSessionEvent_ConnectFailed( CNetPeerSession *session ) { fprintf( stderr, "connect failed\n" ); exit( 1 ); }
+	virtual char * onINetPeerSessionEvent_PrepareReceive( CNetPeerSession *session, size_t &size, boost::shared_ptr<void> &owner ) { return NULL; }
+	virtual void onINetPeerSessionEvent_Received( CNetPeerSession *session, size_t bytes ) { }
+	virtual void onINetPeerSessionEvent_Sending( CNetPeerSession *session, boost::shared_ptr<CNetPacketData> packet ) { }
+	virtual void onINetPeerSessionEvent_Disconnected( CNetPeerSession *session ) { }
+
+private:
+	bool connected_;
+	boost::mutex mutex_;
+	boost::condition_variable cond_;
+};
+
+// reads until <total> bytes have come
+static void receive( tcp::acceptor *acceptor, size_t total, boost::posix_time::ptime *done ) {
+	boost::asio::io_service io;
+	tcp::socket socket( io );
+	acceptor->accept( socket );
+
+	std::vector<char> buf( 256 * 1024 );
+	size_t received = 0;
+	while( received < total ) {
+		boost::system::error_code ec;
+		size_t len = socket.read_some( boost::asio::buffer( buf ), ec );
+		if( ec ) {
+			fprintf( stderr, "receive failed : %s\n", ec.message().c_str() );
+			exit( 1 );
+		}
+		received += len;
+	}
+	*done = boost::posix_time::microsec_clock::universal_time();
+}
+
+// a fresh read cursor for every run, the payloads are shared
+static PACKET_LIST copyPackets( const PACKET_LIST &packets ) {
+	PACKET_LIST res;
+	for( size_t i = 0; i < packets.size(); i++ )
+		res.push_back( boost::shared_ptr<CNetPacketData>( new CNetPacketData( -1, packets[i]->payload() ) ) );
+	return res;
+}
+
+// bytes/s of one run
+static double runChunked( tcp::acceptor &acceptor, int port, const PACKET_LIST &packets, size_t total ) {
+	boost::posix_time::ptime done;
+	boost::thread receiver( boost::bind( &receive, &acceptor, total, &done ) );
+
+	boost::asio::io_service io;
+	tcp::socket socket( io );
+	socket.connect( tcp::endpoint( boost::asio::ip::address_v4::loopback(), port ) );
+	boost::shared_ptr<ChunkedWriter> writer( new ChunkedWriter( socket ) );
+
+	PACKET_LIST list = copyPackets( packets );
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	for( size_t i = 0; i < list.size(); i++ )
+		writer->sendData( list[i] );
+	io.run();
+
+	receiver.join();
+	return total / ((done - start).total_microseconds() / 1000000.0);
+}
+
+static double runGathered( tcp::acceptor &acceptor, int port, const PACKET_LIST &packets, size_t total ) {
+	boost::posix_time::ptime done;
+	boost::thread receiver( boost::bind( &receive, &acceptor, total, &done ) );
+
+	// the packets are queued from another thread than the io thread, as the client does
+	BenchEvent event;
+	boost::asio::io_service io;
+	boost::shared_ptr<CNetPeerSession> session( new CNetPeerSession( io, 0 ) );
+	session->setEvent( &event );
+	session->connect( "127.0.0.1", port );
+	boost::thread ioThread( boost::bind( &boost::asio::io_service::run, &io ) );
+	event.waitConnected();
+
+	PACKET_LIST list = copyPackets( packets );
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	for( size_t i = 0; i < list.size(); i++ )
+		session->sendData( list[i] );
+	receiver.join();
+
+	session->setEvent( NULL );
+	session->close();
+	io.stop();
+	ioThread.join();
+	return total / ((done - start).total_microseconds() / 1000000.0);
+}
+
+int main( int argc, char *argv[] ) {
+	int bigCount = 5;
+	int bigSize = 20;
+	int smallCount = 20000;
+	int smallSize = 200;
+	int rounds = 5;
+	int port = 10999;
+
+	for( int i = 1; i < argc; i++ ) {
+		std::string arg = argv[i];
+		if( i + 1 >= argc ) {
+			usage();
+			return 1;
+		}
+		if( arg == "--big" ) bigCount = atoi( argv[++i] );
+		else if( arg == "--big-size" ) bigSize = atoi( argv[++i] );
+		else if( arg == "--small" ) smallCount = atoi( argv[++i] );
+		else if( arg == "--small-size" ) smallSize = atoi( argv[++i] );
+		else if( arg == "--rounds" ) rounds = atoi( argv[++i] );
+		else if( arg == "--port" ) port = atoi( argv[++i] );
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	// the big ones between the small ones, as in a sync
+	PACKET_LIST packets;
+	size_t total = 0;
+	int every = bigCount > 0 ? smallCount / (bigCount + 1) + 1 : smallCount + 1;
+	for( int i = 0, big = 0; i < smallCount || big < bigCount; i++ ) {
+		if( big < bigCount && (i % every == every - 1 || i >= smallCount) ) {
+			packets.push_back( boost::shared_ptr<CNetPacketData>( new CNetPacketData( -1, std::string( (size_t)bigSize * 1024 * 1024, 'b' ) ) ) );
+			big++;
+		}
+		if( i < smallCount )
+			packets.push_back( boost::shared_ptr<CNetPacketData>( new CNetPacketData( -1, std::string( smallSize, 's' ) ) ) );
+	}
+	for( size_t i = 0; i < packets.size(); i++ )
+		total += packets[i]->totalSize();
+
+	boost::asio::io_service io;
+	tcp::acceptor acceptor( io, tcp::endpoint( boost::asio::ip::address_v4::loopback(), port ) );
+
+	printf( "%d packets, %.1f MB\n", (int)packets.size(), total / (1024.0 * 1024.0) );
+
+	double chunked = 0, gathered = 0;
+	for( int i = 0; i < rounds; i++ ) {
+		chunked = std::max( chunked, runChunked( acceptor, port, packets, total ) );
+		gathered = std::max( gathered, runGathered( acceptor, port, packets, total ) );
+	}
+
+	printf( "chunked  : %8.1f MB/s\n", chunked / (1024.0 * 1024.0) );
+	printf( "gathered : %8.1f MB/s (x%.2f)\n", gathered / (1024.0 * 1024.0), gathered / chunked );
+	return 0;
+}
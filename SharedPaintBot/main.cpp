@@ -0,0 +1,131 @@
+//
+// SharedPaintBot : a load generator for the relay server (SharedPaintServer).
+//
+// runs thousands of headless users in one process, spread over rooms, and prints once per second
+// the sent and delivered messages/s and the end-to-end latency percentiles.
+//
+// build (linux) :
+//   g++ -O2 -I../SharedPaintServer main.cpp BotClient.cpp BotStats.cpp -lboost_system -lboost_thread -lpthread -o SharedPaintBot
+// example :
+//   ulimit -n 65536
+//   ./SharedPaintBot --bots 2000 --rooms 200 --interval 100 --mix 60,5,30,5 --duration 60
+// a local cluster of three relays :
+//   SharedPaintServer -p 10888 -c 127.0.0.1:10888,127.0.0.1:10898,127.0.0.1:10908 -n 0   (and -p 10898 -n 1, -p 10908 -n 2)
+//   ./SharedPaintBot --bots 2000 --rooms 200 --port 10888,10898,10908
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include "BotClient.h"
+#include "BotStats.h"
+
+static void usage( void ) {
+	fprintf( stderr, 
+		"usage : SharedPaintBot [options]\n"
+		"  --host <ip>              relay address (127.0.0.1)\n"
+		"  --port <port,port,..>    relay port, or the ports of the local cluster nodes (10888)\n"
+		"  --bots <n>               number of bots (100)\n"
+		"  --rooms <n>              number of rooms, the bots are spread evenly (10)\n"
+		"  --threads <n>            io threads (cpu count)\n"
+		"  --interval <msec>        one action per bot per interval (100)\n"
+		"  --line-points <n>        points of a line item (50)\n"
+		"  --image-size <bytes>     size of an image item (65536)\n"
+		"  --mix <l,i,m,c>          ratio of line, image, move and chat (60,5,30,5)\n"
+		"  --connect-rate <n>       new connections per second (1000)\n"
+		"  --duration <sec>         0 : until killed (0)\n" );
+}
+
+int main( int argc, char *argv[] ) {
+
+	BotConfig config;
+	config.host = "127.0.0.1";
+	int botCount = 100;
+	int roomCount = 10;
+	int threadCount = boost::thread::hardware_concurrency();
+	int connectRate = 1000;
+	int duration = 0;
+
+	for( int i = 1; i < argc; i++ ) {
+		const char *opt = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+		if( !val ) {
+			usage();
+			return 1;
+		}
+		i++;
+
+		if( strcmp( opt, "--host" ) == 0 )				config.host = val;
+		else if( strcmp( opt, "--port" ) == 0 ) {
+			for( const char *p = val; p && *p; p = strchr( p, ',' ) ? strchr( p, ',' ) + 1 : NULL )
+				config.ports.push_back( atoi( p ) );
+		}
+		else if( strcmp( opt, "--bots" ) == 0 )			botCount = atoi( val );
+		else if( strcmp( opt, "--rooms" ) == 0 )		roomCount = atoi( val );
+		else if( strcmp( opt, "--threads" ) == 0 )		threadCount = atoi( val );
+		else if( strcmp( opt, "--interval" ) == 0 )		config.intervalMsec = atoi( val );
+		else if( strcmp( opt, "--line-points" ) == 0 )	config.linePoints = atoi( val );
+		else if( strcmp( opt, "--image-size" ) == 0 )	config.imageSize = atoi( val );
+		else if( strcmp( opt, "--connect-rate" ) == 0 )	connectRate = atoi( val );
+		else if( strcmp( opt, "--duration" ) == 0 )		duration = atoi( val );
+		else if( strcmp( opt, "--mix" ) == 0 ) {
+			if( sscanf( val, "%d,%d,%d,%d", &config.lineRatio, &config.imageRatio, &config.moveRatio, &config.chatRatio ) != 4 ) {
+				usage();
+				return 1;
+			}
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if( botCount <= 0 || roomCount <= 0 || config.intervalMsec <= 0 || connectRate <= 0 ) {
+		usage();
+		return 1;
+	}
+	if( config.ports.empty() )
+		config.ports.push_back( 10888 );
+	if( threadCount <= 0 )
+		threadCount = 1;
+	config.linePoints = std::min( std::max( config.linePoints, 1 ), 0xffff );
+
+	boost::asio::io_service io;
+	boost::asio::io_service::work work( io );
+
+	BotStats stats;
+
+	// the counters are registered here, before the io threads run
+	std::vector< boost::shared_ptr<BotClient> > bots;
+	for( int i = 0; i < botCount; i++ ) {
+		char roomId[32], userId[32];
+		snprintf( roomId, sizeof(roomId), "botroom%d", i % roomCount );
+		snprintf( userId, sizeof(userId), "bot%d", i );
+		bots.push_back( boost::shared_ptr<BotClient>( new BotClient( io, config, stats, config.ports[i % config.ports.size()], roomId, userId ) ) );
+	}
+
+	boost::thread_group threads;
+	for( int i = 0; i < threadCount; i++ )
+		threads.create_thread( boost::bind( &boost::asio::io_service::run, &io ) );
+
+	printf( "%d bots in %d rooms -> %s, %d ports, %d io threads\n", botCount, roomCount, config.host.c_str(), (int)config.ports.size(), threadCount );
+
+	// ramp up, the relay accepts on one listener
+	const int batch = std::max( connectRate / 10, 1 );
+	for( int i = 0; i < botCount; i++ ) {
+		bots[i]->start();
+		if( (i + 1) % batch == 0 )
+			boost::this_thread::sleep( boost::posix_time::milliseconds( 100 ) );
+	}
+
+	for( int sec = 0; duration == 0 || sec < duration; sec++ ) {
+		boost::this_thread::sleep( boost::posix_time::seconds( 1 ) );
+		printf( "%s\n", stats.report().c_str() );
+		fflush( stdout );
+	}
+
+	io.stop();
+	threads.join_all();
+	return 0;
+}
@@ -18,7 +18,7 @@ struct SPaintUserInfoData
 class CPaintUser
 {
 public:
-	CPaintUser( void ) : sessionId_(0) { }
+	CPaintUser( void ) : sessionId_(0), capabilities_(0) { }
 	~CPaintUser( void ) { }
 
 	void setSessionId( int sessionId ) { sessionId_ = sessionId; }
@@ -29,6 +29,7 @@ public:
 	void setViewIPAddress( const std::string &ip ) { data_.viewIp = ip; }
 	void setLocalIPAddress( const std::string &ip ) { data_.localIp = ip; }
 	void setSyncComplete( bool flag = true ) { data_.syncComplete = flag; }
+	void setCapabilities( boost::uint32_t caps ) { capabilities_ = caps; }	// from CODE_SYSTEM_VERSION_INFO
 
 	bool isSuperPeerCandidate( void ) { return data_.superPeerCandidate; }
 	const std::string &localIPAddress( void ) { return data_.localIp; }
@@ -38,6 +39,7 @@ public:
 	const std::string &userId( void ) { return data_.userId; }
 	const std::string &nickName( void ) { return data_.nickName; }
 	boost::uint16_t listenTcpPort( void ) { return data_.listenTcpPort; }
+	boost::uint32_t capabilities( void ) { return capabilities_; }
 
 	std::string serialize( void ) {
 		std::string body;
@@ -77,4 +79,5 @@ public:
 private:
 	int sessionId_;
 	SPaintUserInfoData data_;
+	boost::uint32_t capabilities_;
 };
@@ -1,23 +1,68 @@
 #include <Coconut.h>
+#include "SharedPaintLog.h"
+#include <boost/bind.hpp>
 #include "SharedPaintManager.h"
 #include "SharedPaintClient.h"
 #include "SharedPaintController.h"
 #include "SystemPacketBuilder.h"
+#include "SharedPaintStats.h"
+#include "SharedPaintCoalescer.h"
+#include "SharedPaintCluster.h"
+#include "SharedPaintClusterLink.h"
+#include "SharedPaintMemory.h"
+#include "SharedPaintJournal.h"
 
 #define TCP_CHECK_TIMER	1111
 #define TCP_CHECK_DEADLINE_MSEC	3000 // 3sec
+#define CLOSE_TIMER				1112
+#define COALESCE_TIMER			1113
+#define PRESENCE_TIMER			1114
+#define PRESENCE_WINDOW_MSEC	200		// the joins and leaves in it go out in one CODE_SYSTEM_PRESENCE
+#define RATE_TIMER				1115
+#define FLUSH_TIMER				1116
+#define STREAM_TIMER			1117
+#define STREAM_CHECK_MSEC		1000	// the stream being read is checked for a stall (CLIENT_STREAM_STALL_SEC)
 #define SELF_PTR boost::static_pointer_cast<SharedPaintClient>(shared_from_this())
 
 IOServiceContainer *SharedPaintClient::gIOServiceContainer_;
 boost::shared_ptr<SharedPaintController::SharedPaintProtocolFactory> SharedPaintClient::gProtocolFactory_;
 
-SharedPaintClient::SharedPaintClient() : invalidSessionFlag_(false) {
+// the codes of the handlers in onSharedPaintReceived(), the others are relayed
+static bool isHandledHere( boost::uint16_t code ) {
+	switch( code ) {
+		case CODE_SYSTEM_JOIN_TO_SERVER:
+		case CODE_SYSTEM_LEFT:
+		case CODE_SYSTEM_TCPACK:
+		case CODE_SYSTEM_SYNC_REQUEST:
+		case CODE_SYSTEM_CHANGE_NICKNAME:
+		case CODE_SYSTEM_VERSION_INFO:
+		case CODE_SYSTEM_CLUSTER_PING:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static SharedPaintRateLimit::Class rateClassOf( const SharedPaintHeader &header ) {
+	if( isHandledHere( header.code() ) )
+		return SharedPaintRateLimit::CLASS_EXEMPT;
+	return SharedPaintRateLimit::classOf( header.code(), header.isBroadcast() );
+}
+
+SharedPaintClient::SharedPaintClient() : invalidSessionFlag_(false), closingFlag_(false), flushTimerFlag_(false), clusterNodeFlag_(false), handle_(0), handleFormFlag_(false), receiveCharge_(0), streamToLink_(false), streamHandleForm_(false), streamOffset_(0), 
+	rateLimit_(RATE_CLIENT_BYTES_PER_SEC, RATE_CLIENT_PACKETS_PER_SEC), delayedBytes_(0) {
 	LOG_TRACE("SharedPaintClient() %p\n", this);
 	user_ =  boost::shared_ptr<CPaintUser>(new CPaintUser);
+	SharedPaintStatsPtr()->countAccepted();
 }
 
 SharedPaintClient::~SharedPaintClient() {
 	LOG_TRACE("~SharedPaintClient() %p\n", this);
+	if( writer_ )
+		writer_->close();
+	releaseReceived();
+	clearDelayed();
+	SharedPaintStatsPtr()->countClosed();
 }
 
 void SharedPaintClient::checkIfSuperPeer() {
@@ -36,6 +81,42 @@ void SharedPaintClient::checkIfSuperPeer() {
 
  
 void SharedPaintClient::onTimer(unsigned short id) {
+	if( CLOSE_TIMER == id ) {
+		// not in the room cast that found it
+		if( writer_ )
+			writer_->close();
+		tcpSocket()->close();
+		return;
+	}
+
+	if( COALESCE_TIMER == id ) {
+		SharedPaintManagerPtr()->onCoalesceTimer( SELF_PTR );
+		return;
+	}
+
+	if( PRESENCE_TIMER == id ) {
+		SharedPaintManagerPtr()->onPresenceTimer( SELF_PTR );
+		return;
+	}
+
+	if( RATE_TIMER == id ) {
+		releaseDelayed();
+		return;
+	}
+
+	if( FLUSH_TIMER == id ) {
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+		flushTimerFlag_ = false;
+		if( !closingFlag_ )
+			flush();
+		return;
+	}
+
+	if( STREAM_TIMER == id ) {
+		checkStream();
+		return;
+	}
+
 	if( TCP_CHECK_TIMER != id )
 		return;
 	
@@ -43,18 +124,427 @@ void SharedPaintClient::onTimer(unsigned short id) {
 	testClient_ = boost::shared_ptr<TcpTestClient>();
 }
 
+void SharedPaintClient::onConnected( void ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	writer_ = boost::shared_ptr<SharedPaintSocketWriter>( new SharedPaintSocketWriter( tcpSocket()->socketFD(), 
+		boost::bind( &SharedPaintClient::onDrainedOf, boost::weak_ptr<SharedPaintClient>( SELF_PTR ) ) ) );
+}
+
+void SharedPaintClient::startCoalesceTimer( void ) {
+	setTimer( COALESCE_TIMER, COALESCE_WINDOW_MSEC, false );
+}
+
+void SharedPaintClient::startPresenceTimer( void ) {
+	setTimer( PRESENCE_TIMER, PRESENCE_WINDOW_MSEC, false );
+}
+
+void SharedPaintClient::send( boost::shared_ptr<SharedPaintProtocol> prot, bool sync ) {
+	send( makePayload( prot ), prot->code(), prot->header().fromId(), sync );
+}
+
+void SharedPaintClient::send( const SharedPaintOutboundQueue::Payload &payload, boost::uint16_t code, const std::string &fromId, bool sync ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( closingFlag_ )
+		return;
+
+	if( outQueue_.push( payload, code, fromId, sync ) != SharedPaintOutboundQueue::PUSH_DROPPED )
+		SharedPaintStatsPtr()->countOut( code, payload->size() );
+
+	if( outQueue_.isOverLimitTooLong( time( NULL ) ) ) {
+		const SharedPaintOutboundQueue::Status &status = outQueue_.status();
+		LOG_INFO("SLOW CONSUMER DISCONNECTED : %s, queued %d bytes, %d packets, dropped %d, coalesced %d", 
+			user_->userId().c_str(), (int)status.queuedBytes, (int)status.queuedPackets, (int)status.droppedPackets, (int)status.coalescedPackets );
+
+		SharedPaintStatsPtr()->countSlowConsumer();
+		closeLater();
+		return;
+	}
+
+	flushLater();
+}
+
+void SharedPaintClient::sendStream( const boost::shared_ptr<SharedPaintStream> &stream, const std::string &fromId ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( closingFlag_ )
+		return;
+
+	outQueue_.pushStream( stream, fromId );
+	SharedPaintStatsPtr()->countOut( stream->code(), stream->totalSize() );
+
+	flush();
+}
+
+void SharedPaintClient::flushStream( void ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( closingFlag_ )
+		return;
+
+	flush();
+}
+
+// the packets of the room casts within the delay go out together, a stream is not held
+void SharedPaintClient::flushLater( void ) {
+
+	if( CLIENT_FLUSH_DELAY_MSEC <= 0 || outQueue_.status().queuedBytes >= CLIENT_FLUSH_BATCH_BYTES ) {
+		flush();
+		return;
+	}
+
+	if( !flushTimerFlag_ ) {
+		flushTimerFlag_ = true;
+		setTimer( FLUSH_TIMER, CLIENT_FLUSH_DELAY_MSEC, false );
+	}
+}
+
+void SharedPaintClient::flush( void ) {
+
+	if( !writer_ )
+		return;	// not connected yet, they wait in the queue
+
+	// a window at a time, until the kernel leaves some of it to the writer, which tells when it has gone (onDrained)
+	for( ;; ) {
+		std::vector<SharedPaintOutboundQueue::Payload> packets;
+		bool intact = outQueue_.pop( packets );
+
+		// the shared payloads themselves, one vectored write
+		if( !packets.empty() ) {
+			SharedPaintStatsPtr()->countWrite();
+			writer_->write( packets );
+		}
+
+		size_t pending = writer_->pendingBytes();
+		outQueue_.onWritten( pending );
+
+		if( !intact ) {
+			LOG_INFO("STREAM CUT : %s, the sender is gone in the middle of a packet", user_->userId().c_str());
+			closeLater();
+			return;
+		}
+		if( packets.empty() || pending > 0 )
+			return;
+	}
+}
+
+// the writer thread of the socket has given some of the window to the kernel
+void SharedPaintClient::onDrainedOf( boost::weak_ptr<SharedPaintClient> client ) {
+	boost::shared_ptr<SharedPaintClient> self = client.lock();
+	if( self )
+		self->onDrained();
+}
+
+void SharedPaintClient::onDrained( void ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( closingFlag_ )
+		return;
+
+	flush();
+}
+
+void SharedPaintClient::closeLater( void ) {
+	closingFlag_ = true;
+	outQueue_.clear();
+	clearDelayed();
+	setTimer( CLOSE_TIMER, 1, false );
+}
+
+bool SharedPaintClient::admitPacket( const SharedPaintHeader &header ) {
+
+	size_t size = header.totalLength();
+
+	// a big one must be streamed, only the relayed packets of a joined client can be
+	bool streamable = clusterLink_ || (!isHandledHere( header.code() ) && !user_->roomId().empty());
+	const char *reason = NULL;
+	if( size > PACKET_MAX_SIZE )
+		reason = "too big";
+	else if( size > CLIENT_RECV_MAX_BYTES && !streamable )
+		reason = "too big to read whole";
+	else if( !SharedPaintMemoryPtr()->reserve( SharedPaintMemory::RECEIVE, size ) )
+		reason = "over the memory budget";
+
+	if( reason ) {
+		LOG_INFO("PACKET REJECTED : %s, %x, %d bytes, %s", user_->userId().c_str(), header.code(), (int)size, reason);
+		SharedPaintStatsPtr()->countRejectedPacket();
+		return false;
+	}
+
+	lock();
+	receiveCharge_ = size;
+	unlock();
+	return true;
+}
+
+void SharedPaintClient::releaseReceived( void ) {
+	lock();
+	size_t size = receiveCharge_;
+	receiveCharge_ = 0;
+	unlock();
+
+	if( size > 0 )
+		SharedPaintMemoryPtr()->release( SharedPaintMemory::RECEIVE, size );
+}
+
+bool SharedPaintClient::onStreamStart( const SharedPaintHeader &header ) {
+
+	if( clusterLink_ ) {
+		// straight to the owner node, which streams it on
+		lock();
+		streamToLink_ = true;
+		unlock();
+		return true;
+	}
+
+	if( isHandledHere( header.code() ) )
+		return false;
+
+	// over the rate, it is read whole and waits for its turn in throttle()
+	bool limited = rateClassOf( header ) != SharedPaintRateLimit::CLASS_EXEMPT;
+	size_t size = header.totalLength();
+	boost::uint64_t now = SharedPaintStats::nowUsec();
+	if( limited ) {
+		lock();
+		bool fits = delayed_.empty() && rateLimit_.has( size, now ) && (!roomRateLimit_ || roomRateLimit_->has( size, now ));
+		unlock();
+		if( !fits )
+			return false;
+	}
+
+	std::vector< boost::shared_ptr<SharedPaintClient> > recipients;
+	boost::shared_ptr<SharedPaintStream> stream = SharedPaintManagerPtr()->beginStream( SELF_PTR, header, recipients );
+	if( !stream )
+		return false;
+
+	LOG_DEBUG("STREAM START : %s, %x, %d bytes, %d recipients", user_->userId().c_str(), header.code(), header.totalLength(), (int)recipients.size());
+
+	lock();
+	stream_ = stream;
+	streamRecipients_.assign( recipients.begin(), recipients.end() );
+	streamHandleForm_ = header.isHandleForm();
+	streamOffset_ = 0;
+	// charged once, to the stream
+	stream->takeReserved();
+	receiveCharge_ = 0;
+	if( limited ) {
+		rateLimit_.charge( size, now );
+		if( roomRateLimit_ )
+			roomRateLimit_->charge( size, now );
+	}
+	unlock();
+
+	setTimer( STREAM_TIMER, STREAM_CHECK_MSEC, false );
+	return true;
+}
+
+void SharedPaintClient::onStreamChunk( const void *ptr, size_t size, bool last ) {
+
+	lock();
+	if( streamToLink_ ) {
+		if( last )
+			streamToLink_ = false;
+		unlock();
+		clusterLink_->forward( ptr, size );
+		return;
+	}
+
+	boost::shared_ptr<SharedPaintStream> stream = stream_;
+	std::vector< boost::weak_ptr<SharedPaintClient> > recipients = streamRecipients_;
+	bool handleForm = streamHandleForm_;
+	size_t offset = streamOffset_;
+	streamOffset_ += size;
+	if( last ) {
+		stream_ = boost::shared_ptr<SharedPaintStream>();
+		streamRecipients_.clear();
+	}
+	unlock();
+
+	if( !stream )
+		return;
+
+	std::string *chunk = new std::string( (const char *)ptr, size );
+	if( handleForm )
+		SharedPaintHeader::setFromHandle( *chunk, offset, handle_ );
+	stream->append( SharedPaintOutboundQueue::Payload( chunk ), last );
+
+	// not under the own lock, a recipient may be streaming to this client
+	for( size_t i = 0; i < recipients.size(); i++ ) {
+		boost::shared_ptr<SharedPaintClient> recipient = recipients[i].lock();
+		if( recipient )
+			recipient->flushStream();
+	}
+}
+
+// its recipients can't take anything else in the middle of it, a sender which stops sending is let go
+void SharedPaintClient::checkStream( void ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( !stream_ || closingFlag_ )
+		return;
+
+	if( stream_->isStalled( time( NULL ) ) ) {
+		LOG_INFO("STREAM STALLED : %s, %x, %d bytes, no chunk for %d sec", user_->userId().c_str(), stream_->code(), (int)stream_->totalSize(), CLIENT_STREAM_STALL_SEC);
+		closeLater();
+		return;
+	}
+	setTimer( STREAM_TIMER, STREAM_CHECK_MSEC, false );
+}
+
+void SharedPaintClient::abortStream( void ) {
+
+	lock();
+	boost::shared_ptr<SharedPaintStream> stream = stream_;
+	std::vector< boost::weak_ptr<SharedPaintClient> > recipients = streamRecipients_;
+	stream_ = boost::shared_ptr<SharedPaintStream>();
+	streamRecipients_.clear();
+	unlock();
+
+	if( !stream )
+		return;
+
+	stream->abort();
+	for( size_t i = 0; i < recipients.size(); i++ ) {
+		boost::shared_ptr<SharedPaintClient> recipient = recipients[i].lock();
+		if( recipient )
+			recipient->flushStream();
+	}
+}
+
+// false : over the rate, the packet waits in delayed_ for its tokens or it is dropped
+bool SharedPaintClient::throttle( boost::shared_ptr<SharedPaintProtocol> prot ) {
+
+	if( prot->isCutThrough() )
+		return true;	// its tokens are taken at its start (onStreamStart)
+
+	SharedPaintRateLimit::Class rateClass = rateClassOf( prot->header() );
+	size_t size = prot->totalSize();
+	boost::uint64_t now = SharedPaintStats::nowUsec();
+
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( closingFlag_ )
+		return false;
+
+	if( delayed_.empty() && (rateClass == SharedPaintRateLimit::CLASS_EXEMPT || takeRate( size, now )) )
+		return true;
+
+	if( rateClass == SharedPaintRateLimit::CLASS_DROPPABLE ) {
+		SharedPaintStatsPtr()->countThrottleDropped();
+		if( roomRateLimit_ )
+			roomRateLimit_->countDropped();
+		return false;
+	}
+
+	// a bot which keeps sending on is cut off. one more packet of any size may wait, its memory is reserved below
+	if( delayedBytes_ > RATE_MAX_DELAYED_BYTES ) {
+		LOG_INFO("RATE LIMIT DISCONNECTED : %s, %d bytes waiting", user_->userId().c_str(), (int)delayedBytes_);
+		SharedPaintStatsPtr()->countThrottleDisconnect();
+		closeLater();
+		return false;
+	}
+
+	// what waits is held by the relay, it counts against the budget like a packet being read
+	if( !SharedPaintMemoryPtr()->reserve( SharedPaintMemory::RECEIVE, size ) ) {
+		LOG_INFO("PACKET REJECTED : %s, %x, %d bytes, over the memory budget to wait", user_->userId().c_str(), prot->code(), (int)size);
+		SharedPaintStatsPtr()->countRejectedPacket();
+		return false;
+	}
+
+	// an exempt one waits too, behind what has come before it
+	delayed_.push_back( prot );
+	delayedBytes_ += size;
+
+	if( rateClass != SharedPaintRateLimit::CLASS_EXEMPT ) {
+		SharedPaintStatsPtr()->countThrottleDelayed();
+		if( roomRateLimit_ )
+			roomRateLimit_->countDelayed();
+	}
+
+	if( delayed_.size() == 1 )
+		setTimer( RATE_TIMER, rateWaitMsec( size, now ), false );
+	return false;
+}
+
+// under the lock. the sender's tokens and the room's, both or none
+bool SharedPaintClient::takeRate( size_t size, boost::uint64_t now ) {
+	if( !rateLimit_.has( size, now ) )
+		return false;
+	if( roomRateLimit_ && !roomRateLimit_->take( size, now ) )
+		return false;
+	rateLimit_.take( size, now );
+	return true;
+}
+
+int SharedPaintClient::rateWaitMsec( size_t size, boost::uint64_t now ) {
+	boost::uint64_t usec = rateLimit_.waitUsec( size, now );
+	if( roomRateLimit_ )
+		usec = std::max( usec, roomRateLimit_->waitUsec( size, now ) );
+	return (int)std::max<boost::uint64_t>( 1, (usec + 999) / 1000 );
+}
+
+void SharedPaintClient::releaseDelayed( void ) {
+
+	for( ;; ) {
+		boost::shared_ptr<SharedPaintProtocol> prot;
+		{
+			boost::recursive_mutex::scoped_lock autolock(mutex_);
+			if( closingFlag_ || delayed_.empty() )
+				return;
+
+			prot = delayed_.front();
+			size_t size = prot->totalSize();
+			boost::uint64_t now = SharedPaintStats::nowUsec();
+			if( rateClassOf( prot->header() ) != SharedPaintRateLimit::CLASS_EXEMPT && !takeRate( size, now ) ) {
+				setTimer( RATE_TIMER, rateWaitMsec( size, now ), false );
+				return;
+			}
+		}
+
+		// still at the front while it is handled, a packet coming meanwhile waits behind it
+		dispatch( prot );
+
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+		if( !delayed_.empty() && delayed_.front() == prot ) {
+			delayed_.pop_front();
+			delayedBytes_ -= prot->totalSize();
+			SharedPaintMemoryPtr()->release( SharedPaintMemory::RECEIVE, prot->totalSize() );
+		}
+	}
+}
+
+void SharedPaintClient::clearDelayed( void ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( delayedBytes_ > 0 )
+		SharedPaintMemoryPtr()->release( SharedPaintMemory::RECEIVE, delayedBytes_ );
+	delayed_.clear();
+	delayedBytes_ = 0;
+}
+
 void SharedPaintClient::_handle_CODE_SYSTEM_JOIN_TO_SERVER(boost::shared_ptr<SharedPaintProtocol> prot) {
 
+	if( SharedPaintMemoryPtr()->isNearLimit() ) {
+		LOG_INFO("JOIN REJECTED : %s, the memory budget is nearly used", tcpSocket()->peerAddress()->ip());
+		SharedPaintStatsPtr()->countRejectedJoin();
+		tcpSocket()->close();
+		return;
+	}
+
 	std::string body( (char *)prot->payloadBuffer()->currentPtr(), prot->payloadBuffer()->remainingSize() );
 	user_->deserialize( body );
-	user_->setViewIPAddress( tcpSocket()->peerAddress()->ip() );
+	if( !clusterNodeFlag_ )
+		user_->setViewIPAddress( tcpSocket()->peerAddress()->ip() );
+
+	const SharedPaintCluster::Node *owner = SharedPaintClusterPtr()->remoteOwnerOf( user_->roomId() );
+	if( owner ) {
+		proxyToOwner( owner->host, owner->port, body );
+		return;
+	}
 
 	bool firstFlag = false;
-	SharedPaintManagerPtr()->joinRoom( SELF_PTR, firstFlag );
-	
-	// roomcast this packet => notify new joiner
-	boost::shared_ptr<SharedPaintProtocol> notiProt = SystemPacketBuilder::NewJoiner::make( SELF_PTR );
-	SharedPaintManagerPtr()->roomCast( user_->roomId(), user_->userId(), notiProt, false );
+	SharedPaintManagerPtr()->joinRoom( SELF_PTR, firstFlag );	// the room tells the members
 
 	checkIfSuperPeer();
 
@@ -63,9 +553,36 @@ void SharedPaintClient::_handle_CODE_SYSTEM_JOIN_TO_SERVER(boost::shared_ptr<Sha
 	boost::shared_ptr<SharedPaintClient> superPeerSession = SharedPaintManagerPtr()->currentSuperPeerSession( user_->roomId() );
 	boost::shared_ptr<SharedPaintProtocol> resProt 
 		= SystemPacketBuilder::ResponseJoin::make( user_->roomId(), firstFlag, userlist, superPeerSession );
-	resProt->processWrite( tcpSocket() );
+	send( resProt );
+
+	// the relay has not seen its canvas, the journal would have nothing of the room until a second joiner syncs
+	if( firstFlag && SharedPaintJournal::isEnabled() )
+		SharedPaintManagerPtr()->seedFromFirst( user_->roomId(), user_->userId() );
+}
+
+
+void SharedPaintClient::proxyToOwner( const std::string &host, int port, const std::string &joinBody ) {
+
+	LOG_DEBUG("PROXY TO OWNER : %s, %s -> %s:%d", user_->roomId().c_str(), user_->userId().c_str(), host.c_str(), port);
+
+	boost::shared_ptr<SharedPaintClusterLink> link(new SharedPaintClusterLink( SELF_PTR ));
+	NetworkHelper::connectTcp(gIOServiceContainer_, host.c_str(), port, link);
+
+	lock();
+	clusterLink_ = link;
+	unlock();
+
+	link->forward( SystemPacketBuilder::JoinToServer::make( joinBody, user_->viewIPAddress() ) );
 }
 
+void SharedPaintClient::_handle_CODE_SYSTEM_CLUSTER_PING(boost::shared_ptr<SharedPaintProtocol> prot) {
+
+	// a node link pings first, then brings its client's join with the client's address in it
+	if( SharedPaintClusterPtr()->isNodeAddress( tcpSocket()->peerAddress()->ip() ) )
+		clusterNodeFlag_ = true;
+
+	send( prot );	// echo
+}
 
 void SharedPaintClient::_handle_CODE_SYSTEM_LEAVE(boost::shared_ptr<SharedPaintProtocol> prot) {
 
@@ -85,14 +602,37 @@ void SharedPaintClient::_handle_CODE_SYSTEM_CHANGE_NICKNAME(boost::shared_ptr<Sh
 	client->lock();
 	client->user()->setNickName( nickname );
 	client->unlock();
+	SharedPaintManagerPtr()->updateJoiner( client );
 
 	// relay!
-	if( prot->header().toId().empty() )
+	if( prot->header().isBroadcast() )
 		SharedPaintManagerPtr()->roomCast( user_->roomId(), user_->userId(), prot, false );
 	else
 		SharedPaintManagerPtr()->uniCast( user_->roomId(), prot );
 }
 
+void SharedPaintClient::_handle_CODE_SYSTEM_VERSION_INFO(boost::shared_ptr<SharedPaintProtocol> prot) {
+
+	std::string body( (char *)prot->payloadBuffer()->currentPtr(), prot->payloadBuffer()->remainingSize() );
+
+	// the capabilities tell which packets of the room snapshot this user can read
+	boost::uint32_t caps = 0;
+	if( SystemPacketBuilder::VersionInfo::parse( body, caps ) ) {
+		lock();
+		bool own = prot->header().isHandleForm() ? prot->header().fromHandle() == handle_ : prot->header().fromId() == user_->userId();
+		if( own )
+			user_->setCapabilities( caps );
+		unlock();
+
+		// the handle table goes first, the handle header after it
+		if( own && (caps & CAPS_SESSION_HANDLE) )
+			SharedPaintManagerPtr()->enableHandles( SELF_PTR );
+	}
+
+	// relay!
+	SharedPaintManagerPtr()->relay( SELF_PTR, prot );
+}
+
 void SharedPaintClient::_handle_CODE_SYSTEM_SYNC_REQUEST(boost::shared_ptr<SharedPaintProtocol> prot) {
 
 	// choose paint data sync runner by round robin for me..
@@ -104,20 +644,39 @@ void SharedPaintClient::_handle_CODE_SYSTEM_TCPACK(boost::shared_ptr<SharedPaint
 	LOG_INFO("------------------- SUPER PEER OK! -------------------- : %s:%d", tcpSocket()->peerAddress()->ip(), user()->listenTcpPort() );
 
 	user_->setSuperPeerCandidate();
+	SharedPaintManagerPtr()->updateJoiner( SELF_PTR );
 
 	SharedPaintManagerPtr()->setSuperPeerSession( SELF_PTR );
 }
 
 
 void SharedPaintClient::onClosed( void ) {
+	if( writer_ )
+		writer_->close();
+	abortStream();
+	releaseReceived();
+	clearDelayed();
 	if( invalidSessionFlag_ )
 		return;
+	if( clusterLink_ ) {
+		clusterLink_->close();	// the owner sees the leave
+		return;
+	}
 	SharedPaintManagerPtr()->leaveRoom( SELF_PTR );
 }
 
 void SharedPaintClient::onError(int error, const char *strerror) {
+	if( writer_ )
+		writer_->close();
+	abortStream();
+	releaseReceived();
+	clearDelayed();
 	if( invalidSessionFlag_ )
 		return;
+	if( clusterLink_ ) {
+		clusterLink_->close();
+		return;
+	}
 	SharedPaintManagerPtr()->leaveRoom( SELF_PTR );
 }
 
@@ -127,6 +686,24 @@ void SharedPaintClient::onSharedPaintReceived(boost::shared_ptr<SharedPaintProto
 
 	LOG_TRACE(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> !!onSharedPaintReceived() %x, %p\n", header.code(),  this);
 
+	SharedPaintStatsPtr()->countIn( prot->code(), prot->totalSize() );
+	releaseReceived();
+
+	if( clusterLink_ ) {
+		// the room lives on another node
+		if( !prot->isCutThrough() )
+			clusterLink_->forward( prot );
+		return;
+	}
+
+	if( !throttle( prot ) )
+		return;
+
+	dispatch( prot );
+}
+
+void SharedPaintClient::dispatch( boost::shared_ptr<SharedPaintProtocol> prot ) {
+
 	switch( prot->code() )
 	{
 		case CODE_SYSTEM_JOIN_TO_SERVER:
@@ -144,13 +721,16 @@ void SharedPaintClient::onSharedPaintReceived(boost::shared_ptr<SharedPaintProto
 		case CODE_SYSTEM_CHANGE_NICKNAME:
 			_handle_CODE_SYSTEM_CHANGE_NICKNAME( prot );
 			break;
+		case CODE_SYSTEM_VERSION_INFO:
+			_handle_CODE_SYSTEM_VERSION_INFO( prot );
+			break;
+		case CODE_SYSTEM_CLUSTER_PING:
+			_handle_CODE_SYSTEM_CLUSTER_PING( prot );
+			break;
 		default:
 			{
 				// just relay!
-				if( prot->header().toId().empty() )
-					SharedPaintManagerPtr()->roomCast( user_->roomId(), user_->userId(), prot, false );
-				else
-					SharedPaintManagerPtr()->uniCast( user_->roomId(), prot );
+				SharedPaintManagerPtr()->relay( SELF_PTR, prot );
 				break;
 			}
 	}
@@ -1,13 +1,20 @@
 #pragma once
 
+#include <deque>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/weak_ptr.hpp>
 #include "SharedPaintController.h"
 #include "PaintUser.h"
 #include "TcpTestClient.h"
+#include "SharedPaintOutboundQueue.h"
+#include "SharedPaintRateLimit.h"
+#include "SharedPaintSocketWriter.h"
 
 using namespace coconut;
 
 
+class SharedPaintClusterLink;
+
 class SharedPaintClient : public SharedPaintController {
 public:
 	SharedPaintClient();
@@ -31,19 +38,72 @@ public:
 
 	void setInvalidSessionFlag( void ) { invalidSessionFlag_ = true; }
 
+	// under the room lock (SharedPaintRoom::allocHandle, SharedPaintRoom::enableHandles)
+	boost::uint32_t handle( void ) const { return handle_; }
+	void setHandle( boost::uint32_t handle ) { handle_ = handle; }
+	bool acceptsHandles( void ) const { return handleFormFlag_; }	// the packets to it may have the handle header
+	void setAcceptsHandles( void ) { handleFormFlag_ = true; }
+
+	// the rate of its room, checked with its own before a packet is relayed
+	void setRoomRateLimit( const boost::shared_ptr<SharedPaintRateLimit> &rateLimit ) {
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+		roomRateLimit_ = rateLimit;
+	}
+
+	// every packet to this client goes through its outbound queue
+	void send( const SharedPaintOutboundQueue::Payload &payload, boost::uint16_t code, const std::string &fromId, bool sync = false );
+	void send( boost::shared_ptr<SharedPaintProtocol> prot, bool sync = false );
+
+	// a packet of another client which is forwarded while it is read (SharedPaintRoom::beginStream)
+	void sendStream( const boost::shared_ptr<SharedPaintStream> &stream, const std::string &fromId );
+	void flushStream( void );
+
+	SharedPaintOutboundQueue::Status queueStatus( void ) {
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+		return outQueue_.status();
+	}
+
+	void startCoalesceTimer( void );
+	void startPresenceTimer( void );
+
+	static SharedPaintOutboundQueue::Payload makePayload( boost::shared_ptr<SharedPaintProtocol> prot ) {
+		return SharedPaintOutboundQueue::Payload( new std::string( (const char *)prot->basePtr(), prot->totalSize() ) );
+	}
+
 protected:
 	void onSharedPaintReceived(boost::shared_ptr<SharedPaintProtocol> prot);
 	void onClosed( void );
 	void onError(int error, const char *strerror);
 	void onTimer(unsigned short id);
+	void onConnected( void );
+	bool admitPacket( const SharedPaintHeader &header );
+	bool onStreamStart( const SharedPaintHeader &header );
+	void onStreamChunk( const void *ptr, size_t size, bool last );
 
 private:
 	void checkIfSuperPeer( void );
+	void flush( void );
+	void flushLater( void );
+	void onDrained( void );
+	static void onDrainedOf( boost::weak_ptr<SharedPaintClient> client );
+	void closeLater( void );
+	void abortStream( void );
+	void checkStream( void );
+	void releaseReceived( void );
+	void dispatch( boost::shared_ptr<SharedPaintProtocol> prot );
+	bool throttle( boost::shared_ptr<SharedPaintProtocol> prot );
+	bool takeRate( size_t size, boost::uint64_t now );
+	int rateWaitMsec( size_t size, boost::uint64_t now );
+	void releaseDelayed( void );
+	void clearDelayed( void );
 	void _handle_CODE_SYSTEM_JOIN_TO_SERVER(boost::shared_ptr<SharedPaintProtocol> prot);
 	void _handle_CODE_SYSTEM_LEAVE(boost::shared_ptr<SharedPaintProtocol> prot);
 	void _handle_CODE_SYSTEM_TCPACK(boost::shared_ptr<SharedPaintProtocol> prot);
 	void _handle_CODE_SYSTEM_SYNC_REQUEST(boost::shared_ptr<SharedPaintProtocol> prot);
 	void _handle_CODE_SYSTEM_CHANGE_NICKNAME(boost::shared_ptr<SharedPaintProtocol> prot);
+	void _handle_CODE_SYSTEM_VERSION_INFO(boost::shared_ptr<SharedPaintProtocol> prot);
+	void _handle_CODE_SYSTEM_CLUSTER_PING(boost::shared_ptr<SharedPaintProtocol> prot);
+	void proxyToOwner( const std::string &host, int port, const std::string &joinBody );
 
 private:
 	static boost::shared_ptr<SharedPaintController::SharedPaintProtocolFactory> gProtocolFactory_;
@@ -51,7 +111,25 @@ private:
 	boost::shared_ptr<CPaintUser> user_;
 
 	bool invalidSessionFlag_;
+	bool closingFlag_;
+	bool flushTimerFlag_;		// the queued packets go out when it fires
+	bool clusterNodeFlag_;		// a link from another node, proxying its client
+	boost::uint32_t handle_;	// in its room, 0 : none
+	bool handleFormFlag_;
+	boost::shared_ptr<SharedPaintClusterLink> clusterLink_;	// this client's room is on another node
+	SharedPaintOutboundQueue outQueue_;
+	boost::shared_ptr<SharedPaintSocketWriter> writer_;	// the packets to this client are written through it
+	size_t receiveCharge_;		// to SharedPaintMemory, the packet being read
+	boost::shared_ptr<SharedPaintStream> stream_;	// the packet of this client being forwarded while it is read
+	bool streamToLink_;
+	bool streamHandleForm_;		// its from handle is written over, see SharedPaintHeader::setFromHandle
+	size_t streamOffset_;
+	std::vector< boost::weak_ptr<SharedPaintClient> > streamRecipients_;
 	boost::shared_ptr<TcpTestClient> testClient_;
+	SharedPaintRateLimit rateLimit_;
+	boost::shared_ptr<SharedPaintRateLimit> roomRateLimit_;
+	std::deque< boost::shared_ptr<SharedPaintProtocol> > delayed_;	// over the rate, in the order they have come
+	size_t delayedBytes_;
 	boost::recursive_mutex mutex_;
 };
 
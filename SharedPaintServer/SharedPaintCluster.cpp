@@ -0,0 +1,90 @@
+#include "Coconut.h"
+#include "SharedPaintLog.h"
+#include <cstdlib>
+#include "SharedPaintCluster.h"
+
+boost::uint32_t SharedPaintCluster::hashOf( const std::string &value ) {
+	// FNV-1a
+	boost::uint32_t hash = 2166136261U;
+	for( size_t i = 0; i < value.size(); i++ ) {
+		hash ^= (boost::uint8_t)value[i];
+		hash *= 16777619U;
+	}
+
+	// FNV alone clusters the similar ids ("room1", "room2"..) on the ring, mix the bits (murmur3 finalizer)
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bU;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35U;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+bool SharedPaintCluster::configure( const std::string &nodes, int myIndex ) {
+
+	nodes_.clear();
+	ring_.clear();
+	myIndex_ = -1;
+
+	size_t start = 0;
+	while( start < nodes.size() ) {
+		size_t end = nodes.find( ',', start );
+		if( end == std::string::npos )
+			end = nodes.size();
+
+		std::string item = nodes.substr( start, end - start );
+		size_t colon = item.rfind( ':' );
+		if( colon == std::string::npos || colon == 0 )
+			return false;
+
+		Node node;
+		node.host = item.substr( 0, colon );
+		node.port = atoi( item.c_str() + colon + 1 );
+		if( node.port <= 0 )
+			return false;
+		nodes_.push_back( node );
+
+		start = end + 1;
+	}
+
+	if( myIndex < 0 || myIndex >= (int)nodes_.size() )
+		return false;
+	myIndex_ = myIndex;
+
+	for( size_t i = 0; i < nodes_.size(); i++ ) {
+		for( int v = 0; v < CLUSTER_VIRTUAL_NODES; v++ ) {
+			char point[300];
+			snprintf( point, sizeof(point), "%s:%d#%d", nodes_[i].host.c_str(), nodes_[i].port, v );
+			ring_[ hashOf( point ) ] = i;
+		}
+	}
+
+	LOG_INFO("cluster : node %d of %d", myIndex_, (int)nodes_.size());
+	return true;
+}
+
+const SharedPaintCluster::Node *SharedPaintCluster::remoteOwnerOf( const std::string &roomId ) const {
+
+	if( !isEnabled() )
+		return NULL;
+
+	std::map<boost::uint32_t, size_t>::const_iterator it = ring_.lower_bound( hashOf( roomId ) );
+	if( it == ring_.end() )
+		it = ring_.begin();	// wrap around
+
+	if( (int)it->second == myIndex_ )
+		return NULL;
+	return &nodes_[ it->second ];
+}
+
+bool SharedPaintCluster::isNodeAddress( const std::string &ip ) const {
+
+	if( !isEnabled() )
+		return false;
+
+	for( size_t i = 0; i < nodes_.size(); i++ ) {
+		if( nodes_[i].host == ip )
+			return true;
+	}
+	return false;
+}
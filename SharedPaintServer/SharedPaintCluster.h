@@ -0,0 +1,50 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include "Singleton.h"
+
+#define SharedPaintClusterPtr()		CSingleton<SharedPaintCluster>::Instance()
+
+#ifndef CLUSTER_VIRTUAL_NODES
+#define CLUSTER_VIRTUAL_NODES	128		// points of a node on the hash ring
+#endif
+
+// the relay nodes of a cluster and which of them owns a room.
+// the rooms are placed on a consistent hash ring of the nodes, so adding a node moves only its share of them.
+// a client may connect to any node. a node which does not own the room proxies the client to the owner (SharedPaintClusterLink).
+// every node must be started with the same node list.
+class SharedPaintCluster
+{
+public:
+	struct Node {
+		std::string host;
+		int port;		// the client port
+	};
+
+	SharedPaintCluster( void ) : myIndex_(-1) { }
+
+	// <nodes> : "host:port,host:port,..."
+	bool configure( const std::string &nodes, int myIndex );
+
+	bool isEnabled( void ) const { return myIndex_ >= 0 && nodes_.size() > 1; }
+
+	// NULL : this node owns it
+	const Node *remoteOwnerOf( const std::string &roomId ) const;
+
+	// a proxied client connection from another node
+	bool isNodeAddress( const std::string &ip ) const;
+
+	const std::vector<Node> &nodes( void ) const { return nodes_; }
+	int myIndex( void ) const { return myIndex_; }
+
+private:
+	// the same on every node and platform, unlike boost::hash
+	static boost::uint32_t hashOf( const std::string &value );
+
+private:
+	std::vector<Node> nodes_;
+	std::map<boost::uint32_t, size_t> ring_;	// point => node index
+	int myIndex_;
+};
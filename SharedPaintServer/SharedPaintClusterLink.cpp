@@ -0,0 +1,104 @@
+#include "Coconut.h"
+#include "SharedPaintLog.h"
+#include "SharedPaintClusterLink.h"
+#include "SharedPaintClient.h"
+#include "SharedPaintStats.h"
+#include "SystemPacketBuilder.h"
+
+#define CLUSTER_PING_TIMER	1
+
+void SharedPaintClusterLink::forward( boost::shared_ptr<SharedPaintProtocol> prot ) {
+	forward( prot->basePtr(), prot->totalSize() );
+}
+
+void SharedPaintClusterLink::forward( const void *ptr, size_t size ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( closed_ )
+		return;
+
+	if( !connected_ ) {
+		pending_.append( (const char *)ptr, size );
+		return;
+	}
+	tcpSocket()->write( ptr, size );
+}
+
+void SharedPaintClusterLink::close( void ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( closed_ )
+		return;
+	closed_ = true;
+	pending_.clear();
+	if( connected_ )
+		tcpSocket()->close();
+}
+
+void SharedPaintClusterLink::onConnected( void ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( closed_ ) {
+		tcpSocket()->close();
+		return;
+	}
+	connected_ = true;
+
+	// the first ping tells the owner that this is a node link
+	sendPing();
+	if( !pending_.empty() )
+		tcpSocket()->write( pending_.c_str(), pending_.size() );
+	pending_.clear();
+
+	setTimer( CLUSTER_PING_TIMER, CLUSTER_PING_INTERVAL_MSEC, true );
+}
+
+void SharedPaintClusterLink::sendPing( void ) {
+	boost::shared_ptr<SharedPaintProtocol> prot = SystemPacketBuilder::ClusterPing::make( SharedPaintStats::nowUsec() );
+	tcpSocket()->write( prot->basePtr(), prot->totalSize() );
+}
+
+void SharedPaintClusterLink::onTimer(unsigned short id) {
+	if( CLUSTER_PING_TIMER != id )
+		return;
+
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+	if( connected_ && !closed_ )
+		sendPing();
+}
+
+void SharedPaintClusterLink::onSharedPaintReceived(boost::shared_ptr<SharedPaintProtocol> prot) {
+
+	if( prot->code() == CODE_SYSTEM_CLUSTER_PING ) {
+		std::string body( (char *)prot->payloadBuffer()->currentPtr(), prot->payloadBuffer()->remainingSize() );
+		boost::uint64_t sentUsec;
+		if( SystemPacketBuilder::ClusterPing::parse( body, sentUsec ) )
+			SharedPaintStatsPtr()->countClusterHop( (SharedPaintStats::nowUsec() - sentUsec) / 2 );	// one way
+		return;
+	}
+
+	boost::shared_ptr<SharedPaintClient> client = client_.lock();
+	if( client )
+		client->send( prot );
+}
+
+void SharedPaintClusterLink::closeClient( void ) {
+	{
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+		closed_ = true;
+	}
+
+	// the client reconnects and joins again, to the owner of the time
+	boost::shared_ptr<SharedPaintClient> client = client_.lock();
+	if( client )
+		client->tcpSocket()->close();
+}
+
+void SharedPaintClusterLink::onClosed( void ) {
+	closeClient();
+}
+
+void SharedPaintClusterLink::onError(int error, const char *strerror) {
+	LOG_INFO("cluster link error : %d, %s", error, strerror);
+	closeClient();
+}
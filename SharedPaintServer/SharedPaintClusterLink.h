@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include "SharedPaintController.h"
+
+class SharedPaintClient;
+
+#ifndef CLUSTER_PING_INTERVAL_MSEC
+#define CLUSTER_PING_INTERVAL_MSEC	5000
+#endif
+
+// the connection a node opens to the room owner node for one of its clients.
+// the owner sees it as a usual client, the packets pass through as they are both ways.
+// the ping on it measures the hop this proxying adds.
+class SharedPaintClusterLink : public SharedPaintController {
+public:
+	SharedPaintClusterLink( boost::shared_ptr<SharedPaintClient> client ) : client_(client), connected_(false), closed_(false) { }
+
+	// to the owner, kept until connected
+	void forward( boost::shared_ptr<SharedPaintProtocol> prot );
+	void forward( const void *ptr, size_t size );	// a part of a packet (SharedPaintClient::onStreamChunk)
+
+	void close( void );
+
+protected:
+	void onConnected( void );
+	void onSharedPaintReceived(boost::shared_ptr<SharedPaintProtocol> prot);
+	void onClosed( void );
+	void onError(int error, const char *strerror);
+	void onTimer(unsigned short id);
+
+private:
+	void sendPing( void );
+	void closeClient( void );
+
+private:
+	boost::weak_ptr<SharedPaintClient> client_;
+	std::string pending_;
+	bool connected_;
+	bool closed_;
+	boost::recursive_mutex mutex_;
+};
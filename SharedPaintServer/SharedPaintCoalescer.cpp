@@ -0,0 +1,105 @@
+#include "Coconut.h"
+#include "SharedPaintCoalescer.h"
+#include "SharedPaintCodeDefine.h"
+#include "PacketBuffer.h"
+
+// the client's TaskType
+#define TASK_MOVE_ITEM	3
+
+// CMoveItemTask body : | 2byte task type | owner 1byte string | 4byte item id | prev x, y double | x, y double |
+static bool moveTaskTarget( const std::string &packet, size_t bodyOffset, std::string &owner, boost::uint32_t &itemId, size_t &prevPosOffset ) {
+	try {
+		size_t pos = bodyOffset;
+		boost::uint16_t type;
+		pos += PacketBufferUtil::readInt16( packet, pos, type, true );
+		if( type != TASK_MOVE_ITEM )
+			return false;
+		pos += PacketBufferUtil::readString8( packet, pos, owner );
+		pos += PacketBufferUtil::readInt32( packet, pos, itemId, true );
+		if( packet.size() < pos + 8 * 4 )
+			return false;
+		prevPosOffset = pos;
+		return true;
+	} catch(...) {
+	}
+	return false;
+}
+
+bool SharedPaintCoalescer::keyOf( boost::uint16_t code, const std::string &packet, size_t bodyOffset, std::string &key ) {
+
+	// a compressed body is not looked into, it is not a mouse-rate event anyway
+	switch( code ) {
+		case CODE_WINDOW_RESIZE_MAIN_WND:
+		case CODE_WINDOW_RESIZE_CANVAS:
+		case CODE_WINDOW_RESIZE_WND_SPLITTER:
+		case CODE_WINDOW_CHANGE_CANVAS_SCROLL_POS:
+			key.assign( 1, (char)code );
+			return true;
+		case CODE_TASK_EXECUTE: {
+			std::string owner;
+			boost::uint32_t itemId;
+			size_t prevPosOffset;
+			if( !moveTaskTarget( packet, bodyOffset, owner, itemId, prevPosOffset ) )
+				return false;
+			key.assign( 1, (char)code );
+			key += owner;
+			key.append( (const char *)&itemId, sizeof(itemId) );
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+bool SharedPaintCoalescer::hold( const std::string &senderId, const std::string &key, boost::uint16_t code, const SharedPaintOutboundQueue::Payload &payload, size_t bodyOffset ) {
+
+	Sender &sender = senders_[ senderId ];
+
+	std::map<std::string, size_t>::iterator it = sender.index.find( key );
+	if( it == sender.index.end() ) {
+		Held held;
+		held.packet.code = code;
+		held.packet.payload = payload;
+		held.bodyOffset = bodyOffset;
+		sender.index[ key ] = sender.held.size();
+		sender.held.push_back( held );
+		return false;
+	}
+
+	Held &held = sender.held[ it->second ];
+	if( code == CODE_TASK_EXECUTE ) {
+		// the receivers undo the merged move to where the first one started
+		std::string owner;
+		boost::uint32_t itemId;
+		size_t oldPrev, newPrev;
+		if( moveTaskTarget( *held.packet.payload, held.bodyOffset, owner, itemId, oldPrev ) 
+			&& moveTaskTarget( *payload, bodyOffset, owner, itemId, newPrev ) ) {
+			std::string *merged = new std::string( *payload );
+			merged->replace( newPrev, 16, *held.packet.payload, oldPrev, 16 );
+			held.packet.payload = SharedPaintOutboundQueue::Payload( merged );
+			held.bodyOffset = bodyOffset;
+			return true;
+		}
+	}
+
+	held.packet.payload = payload;
+	held.bodyOffset = bodyOffset;
+	return true;
+}
+
+std::vector<SharedPaintCoalescer::Packet> SharedPaintCoalescer::take( const std::string &senderId ) {
+
+	std::vector<Packet> res;
+
+	std::map<std::string, Sender>::iterator it = senders_.find( senderId );
+	if( it == senders_.end() )
+		return res;
+
+	res.reserve( it->second.held.size() );
+	for( size_t i = 0; i < it->second.held.size(); i++ ) 
+		res.push_back( it->second.held[i].packet );
+
+	it->second.held.clear();
+	it->second.index.clear();
+	return res;
+}
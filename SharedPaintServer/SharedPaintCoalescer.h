@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include "SharedPaintOutboundQueue.h"
+
+#ifndef COALESCE_WINDOW_MSEC
+#define COALESCE_WINDOW_MSEC	40		// the scroll/resize/move of a sender goes out at most once per this
+#endif
+
+// latest-wins throttle of the mouse-rate events, per sender and per target.
+// the first event of a sender goes out at once and opens its window,
+// the later ones in the window replace each other and go out when it ends.
+// a superseding event is a scroll or a resize of the sender's window, or a move of one item.
+// the caller serializes the access (SharedPaintRoom::mutex_) and runs the window timer.
+class SharedPaintCoalescer {
+public:
+	struct Packet {
+		boost::uint16_t code;
+		SharedPaintOutboundQueue::Payload payload;
+	};
+
+	// <key> : what the packet supersedes, false if it is not a superseding event
+	static bool keyOf( boost::uint16_t code, const std::string &packet, size_t bodyOffset, std::string &key );
+
+	bool isOpen( const std::string &senderId ) const { return senders_.find( senderId ) != senders_.end(); }
+	void open( const std::string &senderId ) { senders_[ senderId ]; }
+	void close( const std::string &senderId ) { senders_.erase( senderId ); }
+
+	// keeps the packet until the window ends. returns true if it replaced an older one
+	bool hold( const std::string &senderId, const std::string &key, boost::uint16_t code, const SharedPaintOutboundQueue::Payload &payload, size_t bodyOffset );
+
+	// the held packets of the sender in their first arrival order. the window stays open
+	std::vector<Packet> take( const std::string &senderId );
+
+private:
+	struct Held {
+		Packet packet;
+		size_t bodyOffset;
+	};
+
+	struct Sender {
+		std::vector<Held> held;
+		std::map<std::string, size_t> index;	// key => position in held
+	};
+
+	std::map<std::string, Sender> senders_;
+};
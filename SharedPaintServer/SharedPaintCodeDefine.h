@@ -1,5 +1,6 @@
 #pragma once
 
+// must be the same as the client's PacketCodeDefine.h
 enum SharedPaintCodeType {
 	CODE_SYSTEM_JOIN_TO_SERVER,
 	CODE_SYSTEM_JOIN_TO_SUPERPEER,
@@ -14,4 +15,35 @@ enum SharedPaintCodeType {
 	CODE_SYSTEM_VERSION_INFO,
 	CODE_SYSTEM_CHANGE_NICKNAME,
 	CODE_SYSTEM_CHAT_MESSAGE,
+	CODE_SYSTEM_HISTORY_USER_LIST,
+	CODE_UDP_SERVER_INFO,
+	CODE_BROAD_PROBE_SERVER,
+	CODE_BROAD_TEXT_MESSAGE,
+	CODE_PAINT_SET_BG_IMAGE,
+	CODE_PAINT_SET_BG_COLOR,
+	CODE_PAINT_SET_BG_GRID_LINE,
+	CODE_PAINT_CLEAR_BG,
+	CODE_PAINT_CLEAR_SCREEN,
+	CODE_PAINT_CREATE_ITEM,
+	CODE_TASK_EXECUTE,
+	CODE_WINDOW_RESIZE_MAIN_WND,
+	CODE_WINDOW_RESIZE_CANVAS,
+	CODE_WINDOW_RESIZE_WND_SPLITTER,
+	CODE_WINDOW_CHANGE_CANVAS_SCROLL_POS,
+	CODE_SCREENSHARE_CHANGE_RECORD_STATUS,
+	CODE_SCREENSHARE_CHANGE_SHOW_STREAM,
+	CODE_SCREENSHARE_RES_SHOW_STREAM,
+	CODE_PAINT_FILE_CHUNK,
+	CODE_PAINT_FILE_REQUEST,
+	CODE_PAINT_LIVE_STROKE,
+	CODE_SYSTEM_CLUSTER_PING,	// between the relay nodes only, a client never gets it
+	CODE_SYSTEM_PRESENCE,		// the joins and leaves of a room, batched
+	CODE_SYSTEM_SESSION_HANDLE,	// the handles of the joiners, for the handle header (SharedPaintHeader)
 };
+
+// the high bit of the code marks a deflated body. the relay does not inflate it.
+#define CODE_FLAG_COMPRESSED	0x8000
+
+// the capability flags of CODE_SYSTEM_VERSION_INFO the relay looks at. see PacketCodeDefine.h of the client
+#define CAPS_PRESENCE_DELTA		0x00000010	// CODE_SYSTEM_PRESENCE
+#define CAPS_SESSION_HANDLE		0x00000020	// CODE_SYSTEM_SESSION_HANDLE, the handle header
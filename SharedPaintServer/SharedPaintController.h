@@ -5,18 +5,23 @@
 using namespace coconut;
 using namespace coconut::protocol;
 
-class SharedPaintController : public ClientController {
+class SharedPaintController : public ClientController, public SharedPaintReadListener {
 public:
 	class SharedPaintProtocolFactory : public protocol::BaseProtocolFactory {
 	public:
+		SharedPaintProtocolFactory( SharedPaintReadListener *listener = NULL ) : listener_(listener) { }
+
 		boost::shared_ptr<protocol::BaseProtocol> makeProtocol() {
 			boost::shared_ptr<SharedPaintProtocol> prot(new SharedPaintProtocol);
+			prot->setReadListener( listener_ );
 			return prot;
 		}
+	private:
+		SharedPaintReadListener *listener_;
 	};
 private:
 	void _onPreInitialized() {
-		boost::shared_ptr<SharedPaintProtocolFactory> factory(new SharedPaintProtocolFactory);
+		boost::shared_ptr<SharedPaintProtocolFactory> factory(new SharedPaintProtocolFactory(this));
 		setProtocolFactory(factory);
 		
 		BaseController::_onPreInitialized();
@@ -27,4 +32,9 @@ private:
 protected:
 	// SharedPaintController callback event
 	virtual void onSharedPaintReceived(boost::shared_ptr<SharedPaintProtocol> prot) = 0;
+
+	// store and forward by default
+	virtual bool admitPacket( const SharedPaintHeader &header ) { return true; }
+	virtual bool onStreamStart( const SharedPaintHeader &header ) { return false; }
+	virtual void onStreamChunk( const void *ptr, size_t size, bool last ) { }
 };
@@ -0,0 +1,418 @@
+#include "Coconut.h"
+#include "SharedPaintLog.h"
+#include "SharedPaintJournal.h"
+#include "PacketBuffer.h"
+#include "SharedPaintManager.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define JOURNAL_RECORD_HEADER_SIZE	(4 + 2 + 4)
+
+static bool readFile( const std::string &path, std::string &data ) {
+	int fd = ::open( path.c_str(), O_RDONLY );
+	if( fd < 0 )
+		return false;
+
+	char buf[64 * 1024];
+	ssize_t n;
+	while( (n = ::read( fd, buf, sizeof(buf) )) != 0 ) {
+		if( n < 0 ) {
+			if( errno == EINTR )
+				continue;
+			break;
+		}
+		data.append( buf, n );
+	}
+	::close( fd );
+	return n == 0;
+}
+
+static bool writeAll( int fd, const std::string &data ) {
+	size_t pos = 0;
+	while( pos < data.size() ) {
+		ssize_t n = ::write( fd, data.data() + pos, data.size() - pos );
+		if( n < 0 ) {
+			if( errno == EINTR )
+				continue;
+			return false;
+		}
+		pos += n;
+	}
+	return true;
+}
+
+static void syncDirectory( const std::string &dir ) {
+	int fd = ::open( dir.c_str(), O_RDONLY );
+	if( fd >= 0 ) {
+		::fsync( fd );
+		::close( fd );
+	}
+}
+
+bool SharedPaintJournal::isEnabled( void ) {
+	return !SharedPaintJournalWriterPtr()->dir().empty();
+}
+
+std::string SharedPaintJournal::directoryOf( const std::string &roomId ) {
+	// the room id is not always a safe file name
+	static const char *digits = "0123456789abcdef";
+
+	std::string name = "r";
+	for( size_t i = 0; i < roomId.size(); i++ ) {
+		name += digits[ (unsigned char)roomId[i] >> 4 ];
+		name += digits[ (unsigned char)roomId[i] & 0x0f ];
+	}
+	return SharedPaintJournalWriterPtr()->dir() + "/" + name;
+}
+
+void SharedPaintJournal::appendRecord( std::string &buf, boost::uint16_t code, boost::uint32_t caps, const std::string &packet ) {
+	PacketBufferUtil::writeInt32( buf, buf.size(), packet.size(), true );
+	PacketBufferUtil::writeInt16( buf, buf.size(), code, true );
+	PacketBufferUtil::writeInt32( buf, buf.size(), caps, true );
+	buf += packet;
+}
+
+void SharedPaintJournal::append( const SharedPaintSnapshot::Packet &packet, boost::uint32_t caps ) {
+	if( !isEnabled() || broken_ )
+		return;
+
+	std::string record;
+	appendRecord( record, packet.code, caps, *packet.payload );
+
+	if( !SharedPaintJournalWriterPtr()->append( roomId_, record ) ) {
+		LOG_DEBUG("JOURNAL BEHIND : %s", roomId_.c_str());
+		broken_ = true;
+		return;
+	}
+	size_ += record.size();
+}
+
+void SharedPaintJournal::rebase( const std::vector<SharedPaintSnapshot::Packet> &packets, boost::uint32_t requiredCaps ) {
+	if( !isEnabled() )
+		return;
+
+	// the same packets a snapshot sync sends
+	std::string records;
+	appendRecord( records, CODE_BASE, requiredCaps, "" );
+	for( size_t i = 0; i < packets.size(); i++ )
+		appendRecord( records, packets[i].code, 0, *packets[i].payload );
+
+	SharedPaintJournalWriterPtr()->rebase( roomId_, records );
+	size_ = records.size();
+	broken_ = false;
+
+	LOG_DEBUG("JOURNAL REBASED : %s, %d packets, %d bytes", roomId_.c_str(), (int)packets.size(), (int)size_);
+}
+
+void SharedPaintJournal::drop( void ) {
+	if( !isEnabled() )
+		return;
+
+	SharedPaintJournalWriterPtr()->drop( roomId_ );
+	size_ = 0;
+	broken_ = false;
+}
+
+void SharedPaintJournal::evictWhenWritten( boost::uint64_t seq ) {
+	if( !isEnabled() )
+		return;
+
+	SharedPaintJournalWriterPtr()->evict( roomId_, seq );
+}
+
+bool SharedPaintJournal::load( const std::string &roomId, std::vector<SharedPaintSnapshot::Packet> &packets, boost::uint32_t &requiredCaps ) {
+	if( !isEnabled() )
+		return false;
+
+	std::string roomDir = directoryOf( roomId );
+	std::vector<boost::uint32_t> seqs = SharedPaintJournalWriter::listSegments( roomDir );
+
+	bool based = false;
+	packets.clear();
+	requiredCaps = 0;
+
+	for( size_t i = 0; i < seqs.size(); i++ ) {
+		std::string data;
+		if( !readFile( SharedPaintJournalWriter::segmentPath( roomDir, seqs[i] ), data ) ) {
+			LOG_INFO("JOURNAL READ FAILED : %s, %u", roomId.c_str(), seqs[i]);
+			return false;
+		}
+
+		size_t pos = 0;
+		while( pos + JOURNAL_RECORD_HEADER_SIZE <= data.size() ) {
+			boost::uint32_t length = 0, caps = 0;
+			boost::uint16_t code = 0;
+			PacketBufferUtil::readInt32( data, pos, length, true );
+			PacketBufferUtil::readInt16( data, pos + 4, code, true );
+			PacketBufferUtil::readInt32( data, pos + 6, caps, true );
+
+			if( length > data.size() - pos - JOURNAL_RECORD_HEADER_SIZE )
+				break;	// torn by a crash, the next segment goes on after it
+
+			if( code == CODE_BASE ) {
+				packets.clear();
+				requiredCaps = caps;
+				based = true;
+			} else if( based ) {
+				SharedPaintOutboundQueue::Payload payload( new std::string( data, pos + JOURNAL_RECORD_HEADER_SIZE, length ) );
+				packets.push_back( SharedPaintSnapshot::Packet( code, payload ) );
+				requiredCaps |= caps;
+			}
+			pos += JOURNAL_RECORD_HEADER_SIZE + length;
+		}
+	}
+	return based;
+}
+
+
+bool SharedPaintJournalWriter::start( const std::string &dir ) {
+	if( ::mkdir( dir.c_str(), 0755 ) != 0 && errno != EEXIST )
+		return false;
+
+	dir_ = dir;
+	thread_ = boost::shared_ptr<boost::thread>( new boost::thread( boost::bind( &SharedPaintJournalWriter::run, this ) ) );
+	return true;
+}
+
+std::vector<boost::uint32_t> SharedPaintJournalWriter::listSegments( const std::string &roomDir ) {
+	std::vector<boost::uint32_t> seqs;
+
+	DIR *d = ::opendir( roomDir.c_str() );
+	if( !d )
+		return seqs;
+
+	struct dirent *entry;
+	while( (entry = ::readdir( d )) != NULL ) {
+		unsigned int seq;
+		char suffix[8] = { 0, };
+		if( sscanf( entry->d_name, "%8x.%4s", &seq, suffix ) == 2 && strcmp( suffix, "seg" ) == 0 )
+			seqs.push_back( seq );
+	}
+	::closedir( d );
+
+	std::sort( seqs.begin(), seqs.end() );
+	return seqs;
+}
+
+std::string SharedPaintJournalWriter::segmentPath( const std::string &roomDir, boost::uint32_t seq ) {
+	char name[16];
+	snprintf( name, sizeof(name), "%08x.seg", seq );
+	return roomDir + "/" + name;
+}
+
+bool SharedPaintJournalWriter::append( const std::string &roomId, const std::string &records ) {
+	boost::mutex::scoped_lock autolock(mutex_);
+
+	if( pendingBytes_ + records.size() > JOURNAL_MAX_PENDING_BYTES )
+		return false;
+
+	pendingBytes_ += records.size();
+	jobs_.push_back( Job( Job::APPEND, roomId, records ) );
+	cond_.notify_one();
+	return true;
+}
+
+void SharedPaintJournalWriter::rebase( const std::string &roomId, const std::string &records ) {
+	push( Job( Job::BASE, roomId, records ) );
+}
+
+void SharedPaintJournalWriter::drop( const std::string &roomId ) {
+	push( Job( Job::DROP, roomId, "" ) );
+}
+
+void SharedPaintJournalWriter::evict( const std::string &roomId, boost::uint64_t seq ) {
+	push( Job( Job::EVICT, roomId, "", seq ) );
+}
+
+void SharedPaintJournalWriter::push( const Job &job ) {
+	boost::mutex::scoped_lock autolock(mutex_);
+
+	pendingBytes_ += job.data.size();
+	jobs_.push_back( job );
+	cond_.notify_one();
+}
+
+void SharedPaintJournalWriter::run( void ) {
+
+	std::vector<Job> jobs;
+	for( ;; ) {
+		{
+			boost::mutex::scoped_lock autolock(mutex_);
+			while( jobs_.empty() )
+				cond_.wait( autolock );
+			jobs.swap( jobs_ );
+		}
+
+		size_t bytes = 0;
+		for( size_t i = 0; i < jobs.size(); i++ )
+			bytes += jobs[i].data.size();
+
+		commit( jobs );
+		jobs.clear();
+
+		boost::mutex::scoped_lock autolock(mutex_);
+		pendingBytes_ -= bytes;
+	}
+}
+
+void SharedPaintJournalWriter::commit( std::vector<Job> &jobs ) {
+
+	// the appends of a room in a batch go out in one write
+	std::map<std::string, std::string> appends;
+	std::vector<Job *> evictions;
+
+	for( size_t i = 0; i < jobs.size(); i++ ) {
+		Job &job = jobs[i];
+		switch( job.type ) {
+			case Job::APPEND:
+				appends[ job.roomId ] += job.data;
+				break;
+			case Job::BASE:
+				appends.erase( job.roomId );	// already in the base
+				writeBase( job.roomId, job.data );
+				break;
+			case Job::EVICT:
+				evictions.push_back( &job );
+				break;
+			case Job::DROP:
+				{
+					appends.erase( job.roomId );
+					closeSegment( job.roomId );
+					damaged_.erase( job.roomId );
+
+					std::string roomDir = SharedPaintJournal::directoryOf( job.roomId );
+					std::vector<boost::uint32_t> seqs = listSegments( roomDir );
+					for( size_t j = 0; j < seqs.size(); j++ )
+						::unlink( segmentPath( roomDir, seqs[j] ).c_str() );
+					::rmdir( roomDir.c_str() );
+				}
+				break;
+		}
+	}
+
+	std::vector<int> touched;
+	std::map<std::string, std::string>::iterator itA = appends.begin();
+	for( ; itA != appends.end(); itA++ ) {
+		std::map<std::string, Segment>::iterator itS = segments_.find( itA->first );
+		if( itS == segments_.end() ) {
+			damaged_.insert( itA->first );
+			continue;	// no base, or its base could not be written
+		}
+
+		Segment &segment = itS->second;
+		if( segment.fd >= 0 && segment.size >= JOURNAL_SEGMENT_SIZE ) {
+			::close( segment.fd );	// synced by the batch that filled it
+			segment.fd = -1;
+			segment.seq++;
+			segment.size = 0;
+		}
+
+		if( segment.fd < 0 && !openSegment( itA->first, segment ) ) {
+			LOG_INFO("JOURNAL OPEN FAILED : %s, %d", itA->first.c_str(), errno);
+			damaged_.insert( itA->first );
+			segments_.erase( itS );	// left until the next base
+			continue;
+		}
+
+		if( !writeAll( segment.fd, itA->second ) ) {
+			LOG_INFO("JOURNAL WRITE FAILED : %s, %d", itA->first.c_str(), errno);
+			damaged_.insert( itA->first );
+			closeSegment( itA->first );
+			continue;
+		}
+		segment.size += itA->second.size();
+		touched.push_back( segment.fd );
+	}
+
+	// group commit
+	for( size_t i = 0; i < touched.size(); i++ )
+		::fdatasync( touched[i] );
+
+	// an emptied room gives its canvas back once all it has sent before is on disk
+	for( size_t i = 0; i < evictions.size(); i++ ) {
+		const std::string &roomId = evictions[i]->roomId;
+		if( damaged_.find( roomId ) == damaged_.end() && segments_.find( roomId ) != segments_.end() )
+			SharedPaintManagerPtr()->evictSnapshot( roomId, evictions[i]->seq );
+	}
+
+	if( segments_.size() > JOURNAL_MAX_OPEN_FILES ) {
+		std::map<std::string, Segment>::iterator itS = segments_.begin();
+		for( ; itS != segments_.end(); itS++ ) {
+			if( itS->second.fd >= 0 && appends.find( itS->first ) == appends.end() ) {
+				::close( itS->second.fd );
+				itS->second.fd = -1;
+			}
+		}
+	}
+}
+
+bool SharedPaintJournalWriter::openSegment( const std::string &roomId, Segment &segment ) {
+	std::string path = segmentPath( SharedPaintJournal::directoryOf( roomId ), segment.seq );
+
+	// a segment is only ever continued by the process which wrote it, never after a torn tail
+	int flags = O_WRONLY | O_APPEND | O_CREAT;
+	if( segment.size == 0 )
+		flags |= O_EXCL;
+
+	segment.fd = ::open( path.c_str(), flags, 0644 );
+	return segment.fd >= 0;
+}
+
+void SharedPaintJournalWriter::writeBase( const std::string &roomId, const std::string &records ) {
+	closeSegment( roomId );
+
+	std::string roomDir = SharedPaintJournal::directoryOf( roomId );
+	if( ::mkdir( roomDir.c_str(), 0755 ) != 0 && errno != EEXIST ) {
+		LOG_INFO("JOURNAL MKDIR FAILED : %s, %d", roomId.c_str(), errno);
+		damaged_.insert( roomId );
+		return;
+	}
+
+	std::vector<boost::uint32_t> seqs = listSegments( roomDir );
+	boost::uint32_t seq = seqs.empty() ? 0 : seqs.back() + 1;
+
+	// a base segment is complete once it has its name
+	std::string tempPath = roomDir + "/base.tmp";
+	int fd = ::open( tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if( fd < 0 ) {
+		LOG_INFO("JOURNAL OPEN FAILED : %s, %d", roomId.c_str(), errno);
+		damaged_.insert( roomId );
+		return;
+	}
+
+	if( !writeAll( fd, records ) || ::fdatasync( fd ) != 0 || ::rename( tempPath.c_str(), segmentPath( roomDir, seq ).c_str() ) != 0 ) {
+		LOG_INFO("JOURNAL BASE FAILED : %s, %d", roomId.c_str(), errno);
+		::close( fd );
+		::unlink( tempPath.c_str() );
+		damaged_.insert( roomId );
+		return;
+	}
+	syncDirectory( roomDir );
+	damaged_.erase( roomId );
+
+	// compacted
+	for( size_t i = 0; i < seqs.size(); i++ )
+		::unlink( segmentPath( roomDir, seqs[i] ).c_str() );
+
+	Segment &segment = segments_[ roomId ];
+	segment.fd = fd;
+	segment.seq = seq;
+	segment.size = records.size();
+}
+
+void SharedPaintJournalWriter::closeSegment( const std::string &roomId ) {
+	std::map<std::string, Segment>::iterator itS = segments_.find( roomId );
+	if( itS == segments_.end() )
+		return;
+
+	if( itS->second.fd >= 0 )
+		::close( itS->second.fd );
+	segments_.erase( itS );
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "Singleton.h"
+#include "SharedPaintSnapshot.h"
+
+#define SharedPaintJournalWriterPtr()	CSingleton<SharedPaintJournalWriter>::Instance()
+
+#ifndef JOURNAL_SEGMENT_SIZE
+#define JOURNAL_SEGMENT_SIZE		(16 * 1024 * 1024)	// a room journal goes on in a new segment file after this
+#endif
+
+#ifndef JOURNAL_MAX_PENDING_BYTES
+#define JOURNAL_MAX_PENDING_BYTES	(64 * 1024 * 1024)	// not written yet, of all the rooms
+#endif
+
+#ifndef JOURNAL_COMPACT_SLACK
+#define JOURNAL_COMPACT_SLACK		(1024 * 1024)
+#endif
+
+#ifndef JOURNAL_MAX_OPEN_FILES
+#define JOURNAL_MAX_OPEN_FILES		256
+#endif
+
+// the room canvas on disk, so that a room outlives a restart of the server.
+// a room journal is the snapshot of the room (SharedPaintSnapshot) followed by the packets applied to it since.
+// <dir>/<hex room id>/<seq>.seg :
+//   | 4byte length | 2byte code | 4byte caps | packet | ...   (little endian)
+// a base segment starts with a BASE record, its caps are the required caps of the snapshot.
+// the journal is compacted by writing the current snapshot as a new base segment and removing the older ones.
+class SharedPaintJournal
+{
+public:
+	enum {
+		CODE_BASE = 0xffff,
+	};
+
+	SharedPaintJournal( const std::string &roomId ) : roomId_(roomId), size_(0), broken_(false) { }
+
+	static bool isEnabled( void );
+
+	// under the room lock, the writes are made by the journal writer thread
+	void append( const SharedPaintSnapshot::Packet &packet, boost::uint32_t caps );
+	void rebase( const std::vector<SharedPaintSnapshot::Packet> &packets, boost::uint32_t requiredCaps );
+	void drop( void );
+	// the room has emptied, the writer tells it (SharedPaintRoom::evictSnapshot) when the journal holds its canvas
+	void evictWhenWritten( boost::uint64_t seq );
+
+	bool isBroken( void ) const { return broken_; }
+
+	bool shouldCompact( size_t snapshotSize ) const { return broken_ || size_ > snapshotSize * 2 + JOURNAL_COMPACT_SLACK; }
+
+	// reads the journal from its last base segment, a torn tail record is left out
+	static bool load( const std::string &roomId, std::vector<SharedPaintSnapshot::Packet> &packets, boost::uint32_t &requiredCaps );
+
+	static std::string directoryOf( const std::string &roomId );
+
+private:
+	static void appendRecord( std::string &buf, boost::uint16_t code, boost::uint32_t caps, const std::string &packet );
+
+private:
+	std::string roomId_;
+	size_t size_;		// since the last base
+	bool broken_;		// an append was dropped, the next change rebases
+};
+
+
+// writes the journals of all the rooms off the io threads.
+// the jobs queued while a batch is being written make the next batch, which is synced with one fdatasync per file.
+class SharedPaintJournalWriter
+{
+public:
+	SharedPaintJournalWriter( void ) : pendingBytes_(0) { }
+
+	bool start( const std::string &dir );
+
+	const std::string &dir( void ) const { return dir_; }
+
+	// false : too far behind, the record is not queued
+	bool append( const std::string &roomId, const std::string &records );
+	void rebase( const std::string &roomId, const std::string &records );
+	void drop( const std::string &roomId );
+	void evict( const std::string &roomId, boost::uint64_t seq );
+
+	static std::vector<boost::uint32_t> listSegments( const std::string &roomDir );
+	static std::string segmentPath( const std::string &roomDir, boost::uint32_t seq );
+
+private:
+	struct Job {
+		enum Type { APPEND, BASE, DROP, EVICT };
+		Job( Type t, const std::string &r, const std::string &d, boost::uint64_t s = 0 ) : type(t), roomId(r), data(d), seq(s) { }
+		Type type;
+		std::string roomId;
+		std::string data;
+		boost::uint64_t seq;	// EVICT
+	};
+
+	struct Segment {
+		Segment( void ) : fd(-1), seq(0), size(0) { }
+		int fd;
+		boost::uint32_t seq;
+		size_t size;
+	};
+
+	void push( const Job &job );
+	void run( void );
+	void commit( std::vector<Job> &jobs );
+
+	// writer thread only
+	bool openSegment( const std::string &roomId, Segment &segment );
+	void writeBase( const std::string &roomId, const std::string &records );
+	void closeSegment( const std::string &roomId );
+
+private:
+	std::string dir_;
+	std::map<std::string, Segment> segments_;
+	std::set<std::string> damaged_;		// a write has failed since the last base, the journal misses a part of the canvas
+
+	std::vector<Job> jobs_;
+	size_t pendingBytes_;
+	boost::mutex mutex_;
+	boost::condition_variable cond_;
+	boost::shared_ptr<boost::thread> thread_;
+};
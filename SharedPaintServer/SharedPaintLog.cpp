@@ -0,0 +1,454 @@
+#include "Coconut.h"
+#include "SharedPaintLog.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+boost::atomic<int> SharedPaintLog::gLevel_( SharedPaintLog::LEVEL_DEBUG );
+
+static const char *levelName( int level ) {
+	switch( level ) {
+		case SharedPaintLog::LEVEL_TRACE: return "TRACE";
+		case SharedPaintLog::LEVEL_DEBUG: return "DEBUG";
+		case SharedPaintLog::LEVEL_INFO: return "INFO";
+		default: return "FATAL";
+	}
+}
+
+static boost::uint64_t nowUsec( void ) {
+	struct timeval tv;
+	::gettimeofday( &tv, NULL );
+	return (boost::uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+bool SharedPaintLog::parseLevel( const std::string &name, int &level ) {
+	if( name == "trace" )
+		level = LEVEL_TRACE;
+	else if( name == "debug" )
+		level = LEVEL_DEBUG;
+	else if( name == "info" )
+		level = LEVEL_INFO;
+	else
+		return false;
+	return true;
+}
+
+void SharedPaintLog::start( FILE *out ) {
+	out_ = out;
+	started_ = true;
+	thread_ = boost::shared_ptr<boost::thread>( new boost::thread( boost::bind( &SharedPaintLog::run, this ) ) );
+}
+
+void SharedPaintLog::stop( void ) {
+	if( !started_ || stopped_.exchange( true ) )
+		return;
+
+	thread_->join();
+
+	// a record pushed while the writer was ending
+	std::string out;
+	if( drain( out ) ) {
+		fwrite( out.data(), 1, out.size(), out_ );
+		fflush( out_ );
+	}
+}
+
+SharedPaintLog::Ring *SharedPaintLog::ringOfThread( void ) {
+	Ring *ring = ring_.get();
+	if( !ring ) {
+		ring = new Ring;
+		ring_.reset( ring );
+
+		boost::mutex::scoped_lock autolock( ringsMutex_ );
+		rings_.push_back( ring );
+	}
+	return ring;
+}
+
+void SharedPaintLog::write( int level, const char *fmt, ... ) {
+
+	va_list ap;
+	va_start( ap, fmt );
+
+	if( !started_ || stopped_ || level >= LEVEL_FATAL ) {
+		Record record;
+		record.level = level;
+		record.usec = nowUsec();
+		record.fmt = fmt;
+		capture( record, ap );
+		va_end( ap );
+
+		std::string line;
+		format( record, line );
+		fwrite( line.data(), 1, line.size(), out_ );
+		fflush( out_ );
+		return;
+	}
+
+	Ring *ring = ringOfThread();
+	size_t head = ring->head.load( boost::memory_order_relaxed );
+	if( head - ring->tail.load( boost::memory_order_acquire ) >= LOG_RING_RECORDS ) {
+		va_end( ap );
+		dropped_.fetch_add( 1, boost::memory_order_relaxed );
+		return;
+	}
+
+	Record &record = ring->records[head % LOG_RING_RECORDS];
+	record.level = level;
+	record.usec = nowUsec();
+	record.fmt = fmt;
+	capture( record, ap );
+	va_end( ap );
+
+	ring->head.store( head + 1, boost::memory_order_release );
+}
+
+void SharedPaintLog::run( void ) {
+	std::string out;
+	while( !stopped_ ) {
+		out.clear();
+		if( drain( out ) ) {
+			fwrite( out.data(), 1, out.size(), out_ );
+			fflush( out_ );
+		}
+		boost::this_thread::sleep( boost::posix_time::milliseconds( LOG_FLUSH_MSEC ) );
+	}
+
+	out.clear();
+	if( drain( out ) ) {
+		fwrite( out.data(), 1, out.size(), out_ );
+		fflush( out_ );
+	}
+}
+
+bool SharedPaintLog::drain( std::string &out ) {
+
+	// the rings are drained in turn, the lines are put back in time order
+	std::vector< std::pair<boost::uint64_t, std::string> > lines;
+	{
+		boost::mutex::scoped_lock autolock( ringsMutex_ );
+		for( size_t i = 0; i < rings_.size(); i++ ) {
+			Ring *ring = rings_[i];
+			size_t tail = ring->tail.load( boost::memory_order_relaxed );
+			size_t head = ring->head.load( boost::memory_order_acquire );
+			for( ; tail != head; tail++ ) {
+				const Record &record = ring->records[tail % LOG_RING_RECORDS];
+				lines.push_back( std::make_pair( record.usec, std::string() ) );
+				format( record, lines.back().second );
+				ring->tail.store( tail + 1, boost::memory_order_release );
+			}
+		}
+	}
+
+	size_t dropped = dropped_.exchange( 0, boost::memory_order_relaxed );
+	if( dropped > 0 ) {
+		char buf[64];
+		snprintf( buf, sizeof(buf), "log : %d records dropped", (int)dropped );
+		Record record;
+		record.level = LEVEL_INFO;
+		record.usec = nowUsec();
+		record.fmt = buf;
+		record.argsSize = 0;
+		record.truncated = false;
+		lines.push_back( std::make_pair( record.usec, std::string() ) );
+		format( record, lines.back().second );
+	}
+
+	if( lines.empty() )
+		return false;
+
+	std::stable_sort( lines.begin(), lines.end() );
+	for( size_t i = 0; i < lines.size(); i++ )
+		out += lines[i].second;
+	return true;
+}
+
+namespace {
+
+enum Length { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_Z, LEN_J, LEN_T, LEN_LD };
+
+// one conversion of a printf format : % flags width .precision length conversion
+struct Spec {
+	const char *begin;
+	const char *end;		// past the conversion
+	bool starWidth;
+	bool starPrecision;
+	Length length;
+	char conversion;
+};
+
+// the next conversion from p, false at the end of the format. literal text and %% are left to the caller
+bool nextSpec( const char *p, Spec &spec ) {
+	for( ; *p; p++ ) {
+		if( *p != '%' )
+			continue;
+		if( p[1] == '%' ) {
+			p++;
+			continue;
+		}
+
+		spec.begin = p++;
+		while( *p && strchr( "-+ #0'", *p ) )
+			p++;
+		spec.starWidth = (*p == '*');
+		if( spec.starWidth )
+			p++;
+		while( *p >= '0' && *p <= '9' )
+			p++;
+		spec.starPrecision = false;
+		if( *p == '.' ) {
+			p++;
+			spec.starPrecision = (*p == '*');
+			if( spec.starPrecision )
+				p++;
+			while( *p >= '0' && *p <= '9' )
+				p++;
+		}
+
+		spec.length = LEN_NONE;
+		switch( *p ) {
+			case 'h': p++; spec.length = LEN_H; if( *p == 'h' ) { p++; spec.length = LEN_HH; } break;
+			case 'l': p++; spec.length = LEN_L; if( *p == 'l' ) { p++; spec.length = LEN_LL; } break;
+			case 'q': p++; spec.length = LEN_LL; break;
+			case 'z': p++; spec.length = LEN_Z; break;
+			case 'j': p++; spec.length = LEN_J; break;
+			case 't': p++; spec.length = LEN_T; break;
+			case 'L': p++; spec.length = LEN_LD; break;
+			default: break;
+		}
+
+		if( !*p )
+			return false;
+		spec.conversion = *p;
+		spec.end = p + 1;
+		return true;
+	}
+	return false;
+}
+
+bool isIntConversion( char c ) { return c && strchr( "diouxXc", c ) != NULL; }
+bool isFloatConversion( char c ) { return c && strchr( "eEfFgGaA", c ) != NULL; }
+
+template<typename T>
+bool put( char *args, size_t &pos, const T &value ) {
+	if( pos + sizeof(T) > LOG_ARGS_SIZE )
+		return false;
+	memcpy( args + pos, &value, sizeof(T) );
+	pos += sizeof(T);
+	return true;
+}
+
+template<typename T>
+T get( const char *args, size_t &pos ) {
+	T value;
+	memcpy( &value, args + pos, sizeof(T) );
+	pos += sizeof(T);
+	return value;
+}
+
+template<typename T>
+void appendFormatted( std::string &out, const std::string &spec, T value ) {
+	char buf[256];
+	int len = snprintf( buf, sizeof(buf), spec.c_str(), value );
+	if( len < 0 )
+		return;
+	if( len < (int)sizeof(buf) ) {
+		out.append( buf, len );
+		return;
+	}
+	std::vector<char> big( len + 1 );
+	snprintf( &big[0], big.size(), spec.c_str(), value );
+	out.append( &big[0], len );
+}
+
+}
+
+// the arguments in the order of the format, a string argument as | 2byte length | chars |
+void SharedPaintLog::capture( Record &record, va_list ap ) {
+	size_t pos = 0;
+	record.truncated = false;
+
+	Spec spec;
+	for( const char *p = record.fmt; nextSpec( p, spec ); p = spec.end ) {
+		bool ok = true;
+		if( spec.starWidth )
+			ok = put( record.args, pos, va_arg( ap, int ) );
+		if( ok && spec.starPrecision )
+			ok = put( record.args, pos, va_arg( ap, int ) );
+
+		if( ok ) {
+			char c = spec.conversion;
+			if( isIntConversion( c ) ) {
+				switch( spec.length ) {
+					case LEN_L: ok = put( record.args, pos, va_arg( ap, long ) ); break;
+					case LEN_LL: ok = put( record.args, pos, va_arg( ap, long long ) ); break;
+					case LEN_Z: ok = put( record.args, pos, va_arg( ap, size_t ) ); break;
+					case LEN_J: ok = put( record.args, pos, va_arg( ap, intmax_t ) ); break;
+					case LEN_T: ok = put( record.args, pos, va_arg( ap, ptrdiff_t ) ); break;
+					default: ok = put( record.args, pos, va_arg( ap, int ) ); break;	// promoted
+				}
+			} else if( isFloatConversion( c ) ) {
+				if( spec.length == LEN_LD )
+					ok = put( record.args, pos, va_arg( ap, long double ) );
+				else
+					ok = put( record.args, pos, va_arg( ap, double ) );
+			} else if( c == 'p' ) {
+				ok = put( record.args, pos, va_arg( ap, void * ) );
+			} else if( c == 's' ) {
+				const char *s = spec.length == LEN_L ? "(wide)" : va_arg( ap, const char * );
+				if( spec.length == LEN_L )
+					va_arg( ap, void * );
+				if( !s )
+					s = "(null)";
+				size_t room = pos + sizeof(boost::uint16_t) < LOG_ARGS_SIZE ? LOG_ARGS_SIZE - pos - sizeof(boost::uint16_t) : 0;
+				size_t len = strlen( s );
+				if( len > room ) {
+					len = room;
+					record.truncated = true;
+				}
+				ok = put( record.args, pos, (boost::uint16_t)len );
+				if( ok ) {
+					memcpy( record.args + pos, s, len );
+					pos += len;
+				}
+			} else if( c == 'n' ) {
+				va_arg( ap, void * );	// never written
+			} else {
+				ok = false;		// not a printf conversion, the rest is not read
+			}
+		}
+
+		if( !ok ) {
+			record.truncated = true;
+			break;
+		}
+	}
+	record.argsSize = pos;
+}
+
+void SharedPaintLog::format( const Record &record, std::string &out ) {
+
+	time_t sec = (time_t)(record.usec / 1000000);
+	struct tm tm;
+	::localtime_r( &sec, &tm );
+	char stamp[64];
+	size_t stampLen = strftime( stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm );
+	snprintf( stamp + stampLen, sizeof(stamp) - stampLen, ".%03d [%s] ", (int)(record.usec / 1000 % 1000), levelName( record.level ) );
+	out += stamp;
+
+	const char *p = record.fmt;
+	size_t pos = 0;
+	bool complete = true;
+
+	Spec spec;
+	for( ; nextSpec( p, spec ); p = spec.end ) {
+		for( const char *q = p; q < spec.begin; q++ ) {
+			out += *q;
+			if( q[0] == '%' && q[1] == '%' )
+				q++;
+		}
+
+		// the spec with its * replaced by the captured values
+		std::string fmt;
+		const char *q = spec.begin;
+		bool ok = true;
+		for( ; q < spec.end && ok; q++ ) {
+			if( *q == '*' ) {
+				bool precision = (q > spec.begin && q[-1] == '.');
+				ok = pos + sizeof(int) <= record.argsSize;
+				if( !ok )
+					break;
+				int value = get<int>( record.args, pos );
+				if( precision && value < 0 )
+					fmt.erase( fmt.size() - 1 );	// as if it were not given
+				else {
+					char num[16];
+					snprintf( num, sizeof(num), "%d", value );
+					fmt += num;
+				}
+			} else if( *q == 'q' ) {
+				fmt += "ll";
+			} else {
+				fmt += *q;
+			}
+		}
+
+		char c = spec.conversion;
+		if( ok ) {
+			if( c == 'n' ) {
+				continue;
+			} else if( c == 's' ) {
+				ok = pos + sizeof(boost::uint16_t) <= record.argsSize;
+				if( ok ) {
+					size_t len = get<boost::uint16_t>( record.args, pos );
+					std::string s( record.args + pos, len );
+					pos += len;
+					if( spec.length == LEN_L )
+						fmt.erase( fmt.size() - 2, 1 );
+					appendFormatted( out, fmt, s.c_str() );
+				}
+			} else {
+				size_t size = 0;
+				if( isIntConversion( c ) ) {
+					switch( spec.length ) {
+						case LEN_L: size = sizeof(long); break;
+						case LEN_LL: size = sizeof(long long); break;
+						case LEN_Z: size = sizeof(size_t); break;
+						case LEN_J: size = sizeof(intmax_t); break;
+						case LEN_T: size = sizeof(ptrdiff_t); break;
+						default: size = sizeof(int); break;
+					}
+				} else if( isFloatConversion( c ) ) {
+					size = spec.length == LEN_LD ? sizeof(long double) : sizeof(double);
+				} else if( c == 'p' ) {
+					size = sizeof(void *);
+				}
+				ok = size > 0 && pos + size <= record.argsSize;
+				if( ok ) {
+					if( isIntConversion( c ) ) {
+						switch( spec.length ) {
+							case LEN_L: appendFormatted( out, fmt, get<long>( record.args, pos ) ); break;
+							case LEN_LL: appendFormatted( out, fmt, get<long long>( record.args, pos ) ); break;
+							case LEN_Z: appendFormatted( out, fmt, get<size_t>( record.args, pos ) ); break;
+							case LEN_J: appendFormatted( out, fmt, get<intmax_t>( record.args, pos ) ); break;
+							case LEN_T: appendFormatted( out, fmt, get<ptrdiff_t>( record.args, pos ) ); break;
+							default: appendFormatted( out, fmt, get<int>( record.args, pos ) ); break;
+						}
+					} else if( isFloatConversion( c ) ) {
+						if( spec.length == LEN_LD )
+							appendFormatted( out, fmt, get<long double>( record.args, pos ) );
+						else
+							appendFormatted( out, fmt, get<double>( record.args, pos ) );
+					} else {
+						appendFormatted( out, fmt, get<void *>( record.args, pos ) );
+					}
+				}
+			}
+		}
+
+		if( !ok ) {
+			complete = false;
+			break;
+		}
+	}
+
+	if( complete ) {
+		for( const char *q = p; *q; q++ ) {
+			out += *q;
+			if( q[0] == '%' && q[1] == '%' )
+				q++;
+		}
+	}
+	if( !complete || record.truncated )
+		out += "...";
+
+	// one line per record
+	while( !out.empty() && (out[out.size() - 1] == '\n' || out[out.size() - 1] == '\r') )
+		out.erase( out.size() - 1 );
+	out += '\n';
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdarg>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include "Coconut.h"
+#include "Singleton.h"
+
+#define SharedPaintLogPtr()	CSingleton<SharedPaintLog>::Instance()
+
+#ifndef LOG_RING_RECORDS
+#define LOG_RING_RECORDS	4096	// per thread, a record which does not fit is dropped and counted
+#endif
+#ifndef LOG_ARGS_SIZE
+#define LOG_ARGS_SIZE		240		// the arguments of a record, a longer string argument is cut
+#endif
+#ifndef LOG_FLUSH_MSEC
+#define LOG_FLUSH_MSEC		20
+#endif
+
+// the log of the relay, in the place of the one of coconut (LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_FATAL below).
+// a call copies its format pointer and its arguments into a ring of the calling thread, without a lock.
+// the writer thread formats them and writes them out, so an io thread never formats or writes a log line.
+// a disabled level costs a load and a compare, its arguments are not evaluated.
+// the format must be a string literal, it is read after the call has returned.
+class SharedPaintLog
+{
+public:
+	enum Level {
+		LEVEL_TRACE,
+		LEVEL_DEBUG,
+		LEVEL_INFO,
+		LEVEL_FATAL		// written at once, the process may be ending
+	};
+
+	SharedPaintLog( void ) : ring_(&keepRing), dropped_(0), started_(false), stopped_(false), out_(stdout) { }
+
+	static bool isEnabled( int level ) { return level >= gLevel_.load( boost::memory_order_relaxed ); }
+	static void setLevel( int level ) { gLevel_.store( level, boost::memory_order_relaxed ); }
+	static bool parseLevel( const std::string &name, int &level );
+
+	// the records are written at once until this
+	void start( FILE *out );
+	// writes out the rest
+	void stop( void );
+
+	void write( int level, const char *fmt, ... );
+
+private:
+	struct Record {
+		int level;
+		boost::uint64_t usec;
+		const char *fmt;
+		size_t argsSize;
+		bool truncated;		// an argument did not fit
+		char args[LOG_ARGS_SIZE];
+	};
+
+	// one producer, its thread. one consumer, the writer thread
+	struct Ring {
+		Ring( void ) : head(0), tail(0) { }
+		Record records[LOG_RING_RECORDS];
+		boost::atomic<size_t> head;
+		boost::atomic<size_t> tail;
+	};
+
+	static void keepRing( Ring * ) { }	// the rings outlive their threads, the writer may still read them
+
+	Ring *ringOfThread( void );
+	void run( void );
+	bool drain( std::string &out );
+	static void capture( Record &record, va_list ap );
+	static void format( const Record &record, std::string &out );
+
+private:
+	static boost::atomic<int> gLevel_;
+
+	boost::thread_specific_ptr<Ring> ring_;
+	std::vector<Ring *> rings_;		// of all the threads which have logged
+	boost::mutex ringsMutex_;
+	boost::atomic<size_t> dropped_;
+	boost::atomic<bool> started_;
+	boost::atomic<bool> stopped_;
+	FILE *out_;
+	boost::shared_ptr<boost::thread> thread_;
+};
+
+#define SHARED_PAINT_LOG( level, ... ) \
+	do { if( SharedPaintLog::isEnabled( level ) ) SharedPaintLogPtr()->write( level, __VA_ARGS__ ); } while( 0 )
+
+#undef LOG_TRACE
+#undef LOG_DEBUG
+#undef LOG_INFO
+#undef LOG_FATAL
+#define LOG_TRACE(...)	SHARED_PAINT_LOG( SharedPaintLog::LEVEL_TRACE, __VA_ARGS__ )
+#define LOG_DEBUG(...)	SHARED_PAINT_LOG( SharedPaintLog::LEVEL_DEBUG, __VA_ARGS__ )
+#define LOG_INFO(...)	SHARED_PAINT_LOG( SharedPaintLog::LEVEL_INFO, __VA_ARGS__ )
+#define LOG_FATAL(...)	SHARED_PAINT_LOG( SharedPaintLog::LEVEL_FATAL, __VA_ARGS__ )
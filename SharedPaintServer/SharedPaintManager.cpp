@@ -1,3 +1,4 @@
+#include "SharedPaintLog.h"
 #include "SharedPaintManager.h"
 #include "SharedPaintClient.h"
 #include "SharedPaintProtocol.h"
@@ -7,127 +8,201 @@
 SharedPaintManager::SharedPaintManager( void ) {
 }
 
-void SharedPaintManager::joinRoom( boost::shared_ptr<SharedPaintClient> client, bool &firstFlag ) {
-
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
+boost::shared_ptr<SharedPaintRoom> SharedPaintManager::findRoom( const std::string &roomid ) {
 
-	ROOM_MAP::iterator itR = roomMap_.find( client->user()->roomId() );	
+	RoomShard &shard = shardOf( roomid );
+	boost::mutex::scoped_lock autolock(shard.mutex);
 
-	if( itR != roomMap_.end() ) {
-		itR->second->addJoiner( client, firstFlag );
-	} else {
+	ROOM_MAP::iterator itR = shard.roomMap.find( roomid );
+	if( itR != shard.roomMap.end() ) {
+		return itR->second;
+	}
+	return boost::shared_ptr<SharedPaintRoom>();
+}
 
-		boost::shared_ptr<SharedPaintRoom> roomInfo(new SharedPaintRoom(client->user()->roomId()));
-		roomInfo->addJoiner( client, firstFlag );
+void SharedPaintManager::joinRoom( boost::shared_ptr<SharedPaintClient> client, bool &firstFlag ) {
 
-		// new room & new user
-		roomMap_.insert( ROOM_MAP::value_type( client->user()->roomId(), roomInfo ) );
+	boost::shared_ptr<SharedPaintRoom> roomInfo;
+	{
+		RoomShard &shard = shardOf( client->user()->roomId() );
+		boost::mutex::scoped_lock autolock(shard.mutex);
+
+		ROOM_MAP::iterator itR = shard.roomMap.find( client->user()->roomId() );	
+		if( itR != shard.roomMap.end() ) {
+			roomInfo = itR->second;
+		} else {
+			// new room & new user
+			roomInfo = boost::shared_ptr<SharedPaintRoom>(new SharedPaintRoom(client->user()->roomId()));
+			shard.roomMap.insert( ROOM_MAP::value_type( client->user()->roomId(), roomInfo ) );
+		}
 	}
 
+	roomInfo->addJoiner( client, firstFlag );
+
+	// the count of its own room, not of all of them, which would take every shard and room lock
 	LOG_DEBUG("JOIN ROOM : roomid = %s, userid = %s, room count = %d, firstFlag = %d", 
 		client->user()->roomId().c_str(), 
 		client->user()->userId().c_str(), 
-		totalUserCount(),
+		(int)roomInfo->userCount(),
 		firstFlag);
 }
 
 boost::shared_ptr<SharedPaintClient> SharedPaintManager::findUser( const std::string &roomid, const std::string &userId ) {
 	
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
-
-	ROOM_MAP::iterator itR = roomMap_.find( roomid );	
-	if( itR != roomMap_.end() ) {
-		return itR->second->findUser( userId );
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( roomid );
+	if( room ) {
+		return room->findUser( userId );
 	}
 	return boost::shared_ptr<SharedPaintClient>();
 }
 
-size_t SharedPaintManager::totalUserCount( void ) {
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
-	
-	size_t totalCnt = 0;
-	ROOM_MAP::iterator itR = roomMap_.begin();
-	for( ; itR != roomMap_.end(); itR++ ) {
-		totalCnt += itR->second->userCount();
-	}
+void SharedPaintManager::collectRoomStats( std::vector<SharedPaintStats::RoomStats> &rooms ) {
 
-	return totalCnt;
+	for( int i = 0; i < ROOM_SHARD_COUNT; i++ ) {
+		// not to hold the shard lock under the room locks
+		std::vector< boost::shared_ptr<SharedPaintRoom> > shardRooms;
+		{
+			boost::mutex::scoped_lock autolock(shards_[i].mutex);
+
+			ROOM_MAP::iterator itR = shards_[i].roomMap.begin();
+			for( ; itR != shards_[i].roomMap.end(); itR++ ) {
+				shardRooms.push_back( itR->second );
+			}
+		}
+
+		for( size_t j = 0; j < shardRooms.size(); j++ ) {
+			rooms.push_back( SharedPaintStats::RoomStats() );
+			shardRooms[j]->collectStats( rooms.back() );
+		}
+	}
 }
 
 void SharedPaintManager::leaveRoom( boost::shared_ptr<SharedPaintClient> client ) {
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
 	
 	std::string roomid = client->user()->roomId();
 	std::string userid = client->user()->userId();
 
-	ROOM_MAP::iterator itR = roomMap_.find( roomid );
-
-	if( itR != roomMap_.end() ) {
-		itR->second->removeJoiner( client );
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( roomid );
+	if( room ) {
+		room->removeJoiner( client );
 	}
 	
 	LOG_DEBUG("LEAVE ROOM : roomid = %s, userid = %s, room count = %d", 
-		client->user()->roomId().c_str(), userid.c_str(), totalUserCount() );
+		client->user()->roomId().c_str(), userid.c_str(), room ? (int)room->userCount() : 0 );
 }
 	
 std::string SharedPaintManager::serializeJoinerInfoPacket( const std::string &roomid ) {
 	
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
-
-	ROOM_MAP::iterator itR = roomMap_.find( roomid );	
-	if( itR != roomMap_.end() ) {
-		return itR->second->serializeJoinerInfoPacket();
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( roomid );
+	if( room ) {
+		return room->serializeJoinerInfoPacket();
 	}
 
 	return "";
 }
 	
+void SharedPaintManager::evictSnapshot( const std::string &roomid, boost::uint64_t seq ) {
+
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( roomid );
+	if( room ) {
+		room->evictSnapshot( seq );
+	}
+}
+
 void SharedPaintManager::syncStart( const std::string &roomid, const std::string &tartgetId ) {
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
 
-	ROOM_MAP::iterator itR = roomMap_.find( roomid );	
-	if( itR != roomMap_.end() ) {
-		itR->second->syncStart( tartgetId );
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( roomid );
+	if( room ) {
+		room->syncStart( tartgetId );
+	}
+}
+
+void SharedPaintManager::seedFromFirst( const std::string &roomid, const std::string &runnerId ) {
+
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( roomid );
+	if( room ) {
+		room->seedFromFirst( runnerId );
 	}
 }
 
 void SharedPaintManager::uniCast( const std::string &roomid, boost::shared_ptr<SharedPaintProtocol> prot ) {
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
 	
-	ROOM_MAP::iterator itR = roomMap_.find( roomid );	
-
-	if( itR != roomMap_.end() ) {
-		itR->second->uniCast( prot );
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( roomid );
+	if( room ) {
+		room->uniCast( prot );
 	}
 }
 
 void SharedPaintManager::roomCast( const std::string &roomid, const std::string &fromid, boost::shared_ptr<SharedPaintProtocol> prot, bool sendMySelf ) {
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
 	
-	ROOM_MAP::iterator itR = roomMap_.find( roomid );	
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( roomid );
+	if( room ) {
+		room->roomCast( fromid, prot, sendMySelf );
+	}
+}
+
+void SharedPaintManager::relay( boost::shared_ptr<SharedPaintClient> from, boost::shared_ptr<SharedPaintProtocol> prot ) {
+	
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( from->user()->roomId() );
+	if( room ) {
+		room->relay( from, prot );
+	}
+}
+	
+boost::shared_ptr<SharedPaintStream> SharedPaintManager::beginStream( boost::shared_ptr<SharedPaintClient> from, const SharedPaintHeader &header, std::vector< boost::shared_ptr<SharedPaintClient> > &recipients ) {
+	
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( from->user()->roomId() );
+	if( room ) {
+		return room->beginStream( from, header, recipients );
+	}
+	return boost::shared_ptr<SharedPaintStream>();
+}
+	
+void SharedPaintManager::onCoalesceTimer( boost::shared_ptr<SharedPaintClient> from ) {
+	
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( from->user()->roomId() );
+	if( room ) {
+		room->onCoalesceTimer( from );
+	}
+}
+	
+void SharedPaintManager::onPresenceTimer( boost::shared_ptr<SharedPaintClient> from ) {
+	
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( from->user()->roomId() );
+	if( room ) {
+		room->onPresenceTimer();
+	}
+}
+
+void SharedPaintManager::updateJoiner( boost::shared_ptr<SharedPaintClient> client ) {
+	
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( client->user()->roomId() );
+	if( room ) {
+		room->updateJoiner( client );
+	}
+}
 
-	if( itR != roomMap_.end() ) {
-		itR->second->roomCast( fromid, prot, sendMySelf );
+void SharedPaintManager::enableHandles( boost::shared_ptr<SharedPaintClient> client ) {
+	
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( client->user()->roomId() );
+	if( room ) {
+		room->enableHandles( client );
 	}
 }
 	
 void SharedPaintManager::setSuperPeerSession( boost::shared_ptr<SharedPaintClient> client ) {
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
 	
-	ROOM_MAP::iterator itR = roomMap_.find( client->user()->roomId() );	
-
-	if( itR != roomMap_.end() ) {
-		itR->second->setSuperPeerSession( client );
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( client->user()->roomId() );
+	if( room ) {
+		room->setSuperPeerSession( client );
 	}
 }
 
 boost::shared_ptr<SharedPaintClient> SharedPaintManager::currentSuperPeerSession( const std::string &roomid ) {
-	boost::recursive_mutex::scoped_lock autolock(mutexData_);
 	
-	ROOM_MAP::iterator itR = roomMap_.find( roomid );
-
-	if( itR != roomMap_.end() ) {
-		return itR->second->currentSuperPeerSession();
+	boost::shared_ptr<SharedPaintRoom> room = findRoom( roomid );
+	if( room ) {
+		return room->currentSuperPeerSession();
 	}
 	return boost::shared_ptr<SharedPaintClient>();
 }
@@ -1,17 +1,27 @@
 #pragma once
 
 #include "Coconut.h"
+#include <boost/functional/hash.hpp>
 #include "Singleton.h"
 #include "SharedPaintCodeDefine.h"
 #include "PaintUser.h"
+#include "SharedPaintStats.h"
 
 #define SharedPaintManagerPtr()		CSingleton<SharedPaintManager>::Instance()
 
+// the rooms are spread over the shards by the hash of the room id.
+// a shard lock only guards its room map. each room serializes its own work (SharedPaintRoom::mutex_).
+#ifndef ROOM_SHARD_COUNT
+#define ROOM_SHARD_COUNT	16
+#endif
+
 using namespace coconut;
 
 class SharedPaintRoom;
 class SharedPaintClient;
 class SharedPaintProtocol;
+class SharedPaintHeader;
+class SharedPaintStream;
 
 class SharedPaintManager 
 {
@@ -26,20 +36,43 @@ public:
 
 	void roomCast( const std::string &roomid, const std::string &fromid, boost::shared_ptr<SharedPaintProtocol> prot, bool sendMySelf = false );
 
+	void relay( boost::shared_ptr<SharedPaintClient> from, boost::shared_ptr<SharedPaintProtocol> prot );
+
+	void onCoalesceTimer( boost::shared_ptr<SharedPaintClient> from );
+	void onPresenceTimer( boost::shared_ptr<SharedPaintClient> from );
+	void updateJoiner( boost::shared_ptr<SharedPaintClient> client );
+	void enableHandles( boost::shared_ptr<SharedPaintClient> client );
+
+	boost::shared_ptr<SharedPaintStream> beginStream( boost::shared_ptr<SharedPaintClient> from, const SharedPaintHeader &header, std::vector< boost::shared_ptr<SharedPaintClient> > &recipients );
+
 	void setSuperPeerSession( boost::shared_ptr<SharedPaintClient> client );
 	boost::shared_ptr<SharedPaintClient> currentSuperPeerSession( const std::string &roomid );
 
 	std::string serializeJoinerInfoPacket( const std::string &roomid );
 
 	void syncStart( const std::string &roomid, const std::string &tartgetId );
+	void seedFromFirst( const std::string &roomid, const std::string &runnerId );
 
 	boost::shared_ptr<SharedPaintClient> findUser( const std::string &roomid, const std::string &userId );
 
-	size_t totalUserCount( void );
+	void evictSnapshot( const std::string &roomid, boost::uint64_t seq );
+
+	void collectRoomStats( std::vector<SharedPaintStats::RoomStats> &rooms );
 
 private:
 	typedef std::map< std::string, boost::shared_ptr<SharedPaintRoom> > ROOM_MAP;
-	ROOM_MAP roomMap_;
 
-	boost::recursive_mutex mutexData_;
+	struct RoomShard {
+		ROOM_MAP roomMap;
+		boost::mutex mutex;
+	};
+
+	RoomShard &shardOf( const std::string &roomid ) {
+		return shards_[ boost::hash<std::string>()( roomid ) % ROOM_SHARD_COUNT ];
+	}
+
+	boost::shared_ptr<SharedPaintRoom> findRoom( const std::string &roomid );
+
+private:
+	RoomShard shards_[ROOM_SHARD_COUNT];
 };
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <boost/thread/mutex.hpp>
+#include "Singleton.h"
+
+#define SharedPaintMemoryPtr()		CSingleton<SharedPaintMemory>::Instance()
+
+#ifndef MEMORY_BUDGET_BYTES
+#define MEMORY_BUDGET_BYTES			((size_t)1024 * 1024 * 1024)	// all the clients of the process
+#endif
+#ifndef MEMORY_ADMIT_PERCENT
+#define MEMORY_ADMIT_PERCENT		90		// no new connection or join above this
+#endif
+#ifndef CLIENT_RECV_MAX_BYTES
+#define CLIENT_RECV_MAX_BYTES		(16 * 1024 * 1024)	// a packet which is read whole, not streamed
+#endif
+#ifndef PACKET_MAX_SIZE
+#define PACKET_MAX_SIZE				(200 * 1024 * 1024)
+#endif
+#ifndef CLIENT_QUEUE_PRESSURE_BYTES
+#define CLIENT_QUEUE_PRESSURE_BYTES	(256 * 1024)	// over the budget, a queue bigger than this is over its limit
+#endif
+
+// the memory the clients can make the relay hold : the packets being read, the outbound queues and the room snapshots.
+// it is charged against one budget for the whole process, so that many clients can't add up to more than it.
+// a payload is charged once by each of its holders, a snapshot packet still queued to a joiner is counted twice for a while.
+class SharedPaintMemory
+{
+public:
+	enum Kind {
+		RECEIVE,
+		OUTBOUND,
+		SNAPSHOT,
+		KIND_COUNT,
+	};
+
+	struct Usage {
+		Usage( void ) : total(0), peak(0) { used[RECEIVE] = used[OUTBOUND] = used[SNAPSHOT] = 0; }
+		size_t used[KIND_COUNT];
+		size_t total;
+		size_t peak;
+	};
+
+	SharedPaintMemory( void ) { }
+
+	// false : it does not fit in the budget, nothing is charged
+	bool reserve( Kind kind, size_t size ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		if( usage_.total + size > MEMORY_BUDGET_BYTES )
+			return false;
+		add( kind, size );
+		return true;
+	}
+
+	// already held, it is limited elsewhere
+	void charge( Kind kind, size_t size ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		add( kind, size );
+	}
+
+	// still held, by another holder
+	void move( Kind from, Kind to, size_t size ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		usage_.used[from] -= size;
+		usage_.used[to] += size;
+	}
+
+	void release( Kind kind, size_t size ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		usage_.used[kind] -= size;
+		usage_.total -= size;
+	}
+
+	bool isOverBudget( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		return usage_.total > MEMORY_BUDGET_BYTES;
+	}
+
+	// the new connections and joins are refused
+	bool isNearLimit( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		return usage_.total > MEMORY_BUDGET_BYTES / 100 * MEMORY_ADMIT_PERCENT;
+	}
+
+	Usage usage( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		return usage_;
+	}
+
+private:
+	void add( Kind kind, size_t size ) {
+		usage_.used[kind] += size;
+		usage_.total += size;
+		if( usage_.total > usage_.peak )
+			usage_.peak = usage_.total;
+	}
+
+private:
+	Usage usage_;
+	boost::mutex mutex_;
+};
@@ -0,0 +1,244 @@
+#include "Coconut.h"
+#include "SharedPaintOutboundQueue.h"
+#include "SharedPaintCodeDefine.h"
+
+bool SharedPaintOutboundQueue::isCoalescable( boost::uint16_t code ) {
+	switch( code ) {
+		case CODE_WINDOW_RESIZE_MAIN_WND:
+		case CODE_WINDOW_RESIZE_CANVAS:
+		case CODE_WINDOW_RESIZE_WND_SPLITTER:
+		case CODE_WINDOW_CHANGE_CANVAS_SCROLL_POS:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool SharedPaintOutboundQueue::isDroppable( boost::uint16_t code ) {
+	return code == CODE_PAINT_LIVE_STROKE;
+}
+
+void SharedPaintOutboundQueue::add( const Entry &entry, int sign ) {
+	size_t size = entry.stream ? 0 : entry.payload->size();	// a stream is counted as it is sent
+	if( sign > 0 ) {
+		status_.queuedBytes += size;
+		status_.queuedPackets++;
+		if( !entry.sync ) {
+			limitedBytes_ += size;
+			limitedPackets_++;
+			if( isHeld( entry ) ) {
+				heldBytes_ += size;
+				heldPackets_++;
+			}
+		}
+	} else {
+		status_.queuedBytes -= size;
+		status_.queuedPackets--;
+		if( !entry.sync ) {
+			limitedBytes_ -= size;
+			limitedPackets_--;
+			if( isHeld( entry ) ) {
+				heldBytes_ -= size;
+				heldPackets_--;
+			}
+		}
+	}
+}
+
+SharedPaintOutboundQueue::~SharedPaintOutboundQueue( void ) {
+	if( chargedBytes_ > 0 )
+		SharedPaintMemoryPtr()->release( SharedPaintMemory::OUTBOUND, chargedBytes_ );
+}
+
+void SharedPaintOutboundQueue::updateCharge( void ) {
+	size_t held = status_.queuedBytes + status_.inFlightBytes;
+	if( held > chargedBytes_ )
+		SharedPaintMemoryPtr()->charge( SharedPaintMemory::OUTBOUND, held - chargedBytes_ );
+	else if( held < chargedBytes_ )
+		SharedPaintMemoryPtr()->release( SharedPaintMemory::OUTBOUND, chargedBytes_ - held );
+	chargedBytes_ = held;
+}
+
+void SharedPaintOutboundQueue::updateLimitState( void ) {
+	updateCharge();
+
+	if( status_.queuedBytes > status_.peakBytes )
+		status_.peakBytes = status_.queuedBytes;
+
+	if( !isOverLimit() )
+		status_.overLimitSince = 0;
+	else if( status_.overLimitSince == 0 )
+		status_.overLimitSince = time( NULL );
+}
+
+void SharedPaintOutboundQueue::dropDroppables( void ) {
+	std::deque<Entry>::iterator it = queue_.begin();
+	while( it != queue_.end() && isOverLimit() ) {
+		if( isDroppable( it->code ) && !it->stream ) {
+			add( *it, -1 );
+			status_.droppedPackets++;
+			it = queue_.erase( it );
+		} else {
+			it++;
+		}
+	}
+}
+
+SharedPaintOutboundQueue::PushResult SharedPaintOutboundQueue::push( const Payload &payload, boost::uint16_t code, const std::string &fromId, bool sync ) {
+
+	code &= ~CODE_FLAG_COMPRESSED;
+
+	if( !sync && isCoalescable( code ) ) {
+		// latest wins, at the place of the old one
+		std::deque<Entry>::iterator it = queue_.begin();
+		for( ; it != queue_.end(); it++ ) {
+			if( it->code == code && it->fromId == fromId && !it->sync && !it->stream ) {
+				add( *it, -1 );
+				it->payload = payload;
+				add( *it, 1 );
+				status_.coalescedPackets++;
+				updateLimitState();
+				return PUSH_COALESCED;
+			}
+		}
+	}
+
+	if( !sync && isDroppable( code ) && isOverLimit() ) {
+		status_.droppedPackets++;
+		return PUSH_DROPPED;
+	}
+
+	Entry entry;
+	entry.payload = payload;
+	entry.code = code;
+	entry.fromId = fromId;
+	entry.sync = sync;
+	queue_.push_back( entry );
+	add( entry, 1 );
+
+	if( isOverLimit() )
+		dropDroppables();
+
+	updateLimitState();
+	return PUSH_QUEUED;
+}
+
+void SharedPaintOutboundQueue::pushStream( const boost::shared_ptr<SharedPaintStream> &stream, const std::string &fromId ) {
+
+	Entry entry;
+	entry.code = stream->code() & ~CODE_FLAG_COMPRESSED;
+	entry.fromId = fromId;
+	entry.sync = true;
+	entry.stream = stream;
+	queue_.push_back( entry );
+	add( entry, 1 );
+
+	updateLimitState();
+}
+
+// the streams waiting for their chunks, and what is held behind them
+void SharedPaintOutboundQueue::updateHeld( void ) {
+
+	heldSenders_.clear();
+	wireHeld_ = false;
+	heldBytes_ = 0;
+	heldPackets_ = 0;
+
+	std::deque<Entry>::iterator it = queue_.begin();
+	for( ; it != queue_.end(); it++ ) {
+		if( isHeld( *it ) ) {
+			if( !it->sync && !it->stream ) {
+				heldBytes_ += it->payload->size();
+				heldPackets_++;
+			}
+			continue;
+		}
+		if( !it->stream )
+			continue;
+
+		Payload payload;
+		if( it->stream->chunk( it->nextChunk, payload ) != SharedPaintStream::RECEIVING || payload )
+			continue;
+		if( it->nextChunk > 0 )
+			wireHeld_ = true;
+		else
+			heldSenders_.insert( it->fromId );
+	}
+}
+
+bool SharedPaintOutboundQueue::pop( std::vector<Payload> &out ) {
+
+	bool intact = true;
+	std::set<std::string> held;		// their stream waits for its first chunk, so do their later packets
+	std::deque<Entry>::iterator it = queue_.begin();
+	while( it != queue_.end() ) {
+		if( held.find( it->fromId ) != held.end() ) {
+			it++;
+			continue;
+		}
+
+		Payload payload = it->payload;
+		if( it->stream ) {
+			SharedPaintStream::State state = it->stream->chunk( it->nextChunk, payload );
+			if( !payload ) {
+				if( state == SharedPaintStream::RECEIVING ) {
+					if( it->nextChunk > 0 )
+						break;	// the client is in the middle of it, the rest is on its way
+					held.insert( it->fromId );
+					it++;
+					continue;
+				}
+				if( state == SharedPaintStream::ABORTED && it->nextChunk > 0 ) {
+					intact = false;
+					break;
+				}
+				// complete, or aborted before any of it went out
+				if( state == SharedPaintStream::COMPLETE )
+					status_.sentPackets++;
+				add( *it, -1 );
+				it = queue_.erase( it );
+				continue;
+			}
+		}
+
+		if( !fitsInWindow( payload->size() ) )
+			break;
+
+		status_.inFlightBytes += payload->size();
+		status_.sentBytes += payload->size();
+		out.push_back( payload );
+
+		if( it->stream ) {
+			if( it->nextChunk == 0 && it != queue_.begin() ) {
+				// started, it is at the front until it is complete
+				Entry entry = *it;
+				queue_.erase( it );
+				queue_.push_front( entry );
+				it = queue_.begin();
+			}
+			it->nextChunk++;
+		} else {
+			status_.sentPackets++;
+			add( *it, -1 );
+			it = queue_.erase( it );
+		}
+	}
+
+	updateHeld();
+	updateLimitState();
+	return intact;
+}
+
+void SharedPaintOutboundQueue::clear( void ) {
+	queue_.clear();
+	limitedBytes_ = 0;
+	limitedPackets_ = 0;
+	heldBytes_ = 0;
+	heldPackets_ = 0;
+	heldSenders_.clear();
+	wireHeld_ = false;
+	status_.queuedBytes = 0;
+	status_.queuedPackets = 0;
+	status_.overLimitSince = 0;
+	updateCharge();
+}
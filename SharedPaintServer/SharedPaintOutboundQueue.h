@@ -0,0 +1,206 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <set>
+#include <string>
+#include <ctime>
+#include <boost/thread/mutex.hpp>
+#include "SharedPaintMemory.h"
+
+#ifndef CLIENT_QUEUE_MAX_BYTES
+#define CLIENT_QUEUE_MAX_BYTES			(8 * 1024 * 1024)
+#endif
+#ifndef CLIENT_QUEUE_MAX_PACKETS
+#define CLIENT_QUEUE_MAX_PACKETS		4096
+#endif
+#ifndef CLIENT_QUEUE_OVER_LIMIT_SEC
+#define CLIENT_QUEUE_OVER_LIMIT_SEC		10		// a client over its limit for this long is disconnected
+#endif
+#ifndef CLIENT_STREAM_STALL_SEC
+#define CLIENT_STREAM_STALL_SEC			10		// a sender whose stream has not moved for this long is disconnected
+#endif
+#ifndef CLIENT_SEND_WINDOW_BYTES
+#define CLIENT_SEND_WINDOW_BYTES		(256 * 1024)	// handed to the socket writer and not taken by the kernel yet
+#endif
+#ifndef CLIENT_FLUSH_DELAY_MSEC
+#define CLIENT_FLUSH_DELAY_MSEC			2		// the packets to a client within this go out in one write, 0 : at once
+#endif
+#ifndef CLIENT_FLUSH_BATCH_BYTES
+#define CLIENT_FLUSH_BATCH_BYTES		(64 * 1024)	// queued, they go out without waiting for the rest of the delay
+#endif
+
+// a big packet forwarded while it is still being received (SharedPaintProtocol::processRead).
+// the receiving client appends its bytes, the outbound queues of all its recipients send them from here.
+class SharedPaintStream {
+public:
+	typedef boost::shared_ptr<const std::string> Payload;
+
+	enum State {
+		RECEIVING,
+		COMPLETE,
+		ABORTED,	// the sender is gone in the middle of it
+	};
+
+	SharedPaintStream( boost::uint16_t code, size_t totalSize ) : code_(code), totalSize_(totalSize), receivedSize_(0), chargedBytes_(0), state_(RECEIVING), progressAt_(time( NULL )) { }
+	~SharedPaintStream( void ) {
+		if( chargedBytes_ > 0 )
+			SharedPaintMemoryPtr()->release( SharedPaintMemory::OUTBOUND, chargedBytes_ );
+	}
+
+	// the whole packet was reserved when its header was read (SharedPaintClient::admitPacket),
+	// the stream holds it from now until its last recipient has it
+	void takeReserved( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		SharedPaintMemoryPtr()->move( SharedPaintMemory::RECEIVE, SharedPaintMemory::OUTBOUND, totalSize_ );
+		chargedBytes_ = totalSize_;
+	}
+
+	boost::uint16_t code( void ) const { return code_; }
+	size_t totalSize( void ) const { return totalSize_; }
+
+	void append( const Payload &chunk, bool last ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		chunks_.push_back( chunk );
+		receivedSize_ += chunk->size();
+		progressAt_ = time( NULL );
+		if( last )
+			state_ = COMPLETE;
+	}
+
+	// its recipients wait for the rest, the sender is checked by this (SharedPaintClient::onTimer)
+	bool isStalled( time_t now ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		return state_ == RECEIVING && now - progressAt_ >= CLIENT_STREAM_STALL_SEC;
+	}
+
+	void abort( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		if( state_ == RECEIVING )
+			state_ = ABORTED;
+	}
+
+	// <chunk> is empty when the chunk at <index> has not arrived
+	State chunk( size_t index, Payload &chunk ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		if( index < chunks_.size() )
+			chunk = chunks_[index];
+		return state_;
+	}
+
+private:
+	boost::uint16_t code_;
+	size_t totalSize_;
+	size_t receivedSize_;
+	size_t chargedBytes_;		// to SharedPaintMemory
+	std::vector<Payload> chunks_;
+	State state_;
+	time_t progressAt_;		// the last chunk
+	boost::mutex mutex_;
+};
+
+// the outbound packets of one client.
+// the payloads are shared by all the clients of a room cast, so a room cast costs one copy.
+// only a send window of them is handed to the socket writer (SharedPaintSocketWriter), the rest waits here where it can be counted.
+// the window is what the kernel has not taken yet, so the queue is as deep as the client is behind.
+//
+// when the client can't keep up, the view state (scroll, resize) is coalesced to the latest,
+// and the live strokes are dropped first (the final item replaces them anyway).
+// the sync packets are not limited, a joiner needs all of them.
+// a stream is not limited either, it can't be cut once started.
+// until its first chunk has come, only the later packets of its sender wait behind it, the other senders go on.
+// once started, nothing goes in between until it is complete. the packets held behind a stream are not counted
+// against the limit, the sender of a stalled stream is disconnected instead (CLIENT_STREAM_STALL_SEC).
+// the caller serializes the access (SharedPaintClient::mutex_).
+class SharedPaintOutboundQueue {
+public:
+	typedef boost::shared_ptr<const std::string> Payload;
+
+	struct Status {
+		Status( void ) : queuedBytes(0), queuedPackets(0), inFlightBytes(0), peakBytes(0),
+			sentPackets(0), sentBytes(0), droppedPackets(0), coalescedPackets(0), overLimitSince(0) { }
+		size_t queuedBytes;
+		size_t queuedPackets;
+		size_t inFlightBytes;
+		size_t peakBytes;
+		boost::uint64_t sentPackets;
+		boost::uint64_t sentBytes;
+		boost::uint64_t droppedPackets;
+		boost::uint64_t coalescedPackets;
+		time_t overLimitSince;	// 0 : under the limit
+	};
+
+	enum PushResult {
+		PUSH_QUEUED,
+		PUSH_COALESCED,
+		PUSH_DROPPED,
+	};
+
+	SharedPaintOutboundQueue( void ) : limitedBytes_(0), limitedPackets_(0), heldBytes_(0), heldPackets_(0), wireHeld_(false), chargedBytes_(0) { }
+	~SharedPaintOutboundQueue( void );
+
+	PushResult push( const Payload &payload, boost::uint16_t code, const std::string &fromId, bool sync );
+	void pushStream( const boost::shared_ptr<SharedPaintStream> &stream, const std::string &fromId );
+
+	// moves the packets that fit in the send window to out.
+	// false : a stream was aborted after a part of it was sent, the client can't read its next packet
+	bool pop( std::vector<Payload> &out );
+
+	// the kernel has taken all but <pendingBytes> of what the writer was handed
+	void onWritten( size_t pendingBytes ) { 
+		status_.inFlightBytes = pendingBytes; 
+		updateCharge();
+	}
+
+	bool isOverLimitTooLong( time_t now ) const {
+		return status_.overLimitSince != 0 && now - status_.overLimitSince >= CLIENT_QUEUE_OVER_LIMIT_SEC;
+	}
+
+	const Status &status( void ) const { return status_; }
+
+	void clear( void );
+
+private:
+	struct Entry {
+		Entry( void ) : code(0), sync(false), nextChunk(0) { }
+		Payload payload;
+		boost::uint16_t code;
+		std::string fromId;
+		bool sync;
+		boost::shared_ptr<SharedPaintStream> stream;	// instead of the payload
+		size_t nextChunk;
+	};
+
+	static bool isCoalescable( boost::uint16_t code );
+	static bool isDroppable( boost::uint16_t code );
+
+	bool isOverLimit( void ) const {
+		size_t bytes = limitedBytes_ - heldBytes_;
+		if( bytes > CLIENT_QUEUE_MAX_BYTES || limitedPackets_ - heldPackets_ > CLIENT_QUEUE_MAX_PACKETS )
+			return true;
+		// the process is out of memory, the clients most behind give it back first
+		return bytes > CLIENT_QUEUE_PRESSURE_BYTES && SharedPaintMemoryPtr()->isOverBudget();
+	}
+	bool isHeld( const Entry &entry ) const {
+		return wireHeld_ || heldSenders_.find( entry.fromId ) != heldSenders_.end();
+	}
+	bool fitsInWindow( size_t size ) const {
+		return status_.inFlightBytes == 0 || status_.inFlightBytes + size <= CLIENT_SEND_WINDOW_BYTES;	// at least one
+	}
+	void dropDroppables( void );
+	void add( const Entry &entry, int sign );
+	void updateHeld( void );
+	void updateLimitState( void );
+	void updateCharge( void );
+
+private:
+	std::deque<Entry> queue_;
+	size_t limitedBytes_;		// without the sync packets
+	size_t limitedPackets_;
+	size_t heldBytes_;			// of the limited, behind a stream waiting for its chunks
+	size_t heldPackets_;
+	std::set<std::string> heldSenders_;	// their stream has not started
+	bool wireHeld_;				// a started stream waits for its chunks, everything is behind it
+	size_t chargedBytes_;		// to SharedPaintMemory, the queued and in flight bytes
+	Status status_;
+};
@@ -1,4 +1,6 @@
 #include <Coconut.h>
+#include "SharedPaintLog.h"
+#include <algorithm>
 #include "SharedPaintProtocol.h"
 
 SharedPaintProtocol::~SharedPaintProtocol() { 
@@ -23,7 +25,8 @@ bool SharedPaintProtocol::processRead(boost::shared_ptr<BaseVirtualTransport> tr
 
 					currHeaderLen_ += readBuffer_->readInt16(currHeaderData_.magic);
 
-					if( (boost::uint16_t)SharedPaintHeader::NET_MAGIC_CODE_BIG == (boost::uint16_t)currHeaderData_.magic ) {
+					if( (boost::uint16_t)SharedPaintHeader::NET_MAGIC_CODE_BIG == (boost::uint16_t)currHeaderData_.magic
+						|| (boost::uint16_t)SharedPaintHeader::NET_MAGIC_CODE_HANDLE == (boost::uint16_t)currHeaderData_.magic ) {
 						state_ = Code;
 					} else {
 						// Invalid packet..
@@ -41,7 +44,10 @@ bool SharedPaintProtocol::processRead(boost::shared_ptr<BaseVirtualTransport> tr
 					currHeaderLen_ += readBuffer_->readInt16(currHeaderData_.code);
 
 					currIdLen_ = 0;
-					state_ = FromId;
+					if( (boost::uint16_t)SharedPaintHeader::NET_MAGIC_CODE_HANDLE == (boost::uint16_t)currHeaderData_.magic )
+						state_ = Handles;
+					else
+						state_ = FromId;
 				}
 			case FromId: 
 				if(FromId == state_) {
@@ -77,6 +83,15 @@ bool SharedPaintProtocol::processRead(boost::shared_ptr<BaseVirtualTransport> tr
 					currIdLen_ = 0;
 					state_ = BodyLength;
 				}
+			case Handles: 
+				if(Handles == state_) {
+					if( readBuffer_->remainingSize() < 8 )
+						break;
+
+					currHeaderLen_ += readBuffer_->readInt32(currHeaderData_.fromHandle);
+					currHeaderLen_ += readBuffer_->readInt32(currHeaderData_.toHandle);
+					state_ = BodyLength;
+				}
 			case BodyLength: 
 				if(BodyLength == state_) {
 					if( readBuffer_->remainingSize() < 4 )
@@ -92,12 +107,29 @@ bool SharedPaintProtocol::processRead(boost::shared_ptr<BaseVirtualTransport> tr
 					header_.setData( currHeaderData_ );
 
 					payload_pos_ += currHeaderLen_;
+
+					if( readListener_ && !readListener_->admitPacket( header_ ) ) {
+						invalidPacketRecved_ = true;
+						break;
+					}
+					if( readListener_ && currHeaderData_.blen >= CUT_THROUGH_MIN_BODY_SIZE )
+						cutThrough_ = readListener_->onStreamStart( header_ );
 				}
 			case Payload: 
 				if(Payload == state_) {
 					// readBuffer_ is BaseProtocol's readBuffer(or payload buffer)
 					// already tcp layer read and append to readBuffer_
 					// you just verify this readBuffer_..
+					if( cutThrough_ ) {
+						// what has arrived goes out now
+						size_t readSize = std::min( readBuffer_->totalSize() - startRead_pos_, (size_t)header_.totalLength() );
+						if( readSize > streamedSize_ ) {
+							readListener_->onStreamChunk( (const char*)readBuffer_->basePtr() + startRead_pos_ + streamedSize_, 
+								readSize - streamedSize_, readSize == (size_t)header_.totalLength() );
+							streamedSize_ = readSize;
+						}
+					}
+
 					int remain = header_.totalLength() - readBuffer_->totalSize();
 					if(remain > 0)
 						break; // need mode data..
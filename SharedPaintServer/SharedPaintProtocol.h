@@ -2,13 +2,41 @@
 
 #include <string>
 #include <vector>
+#include <cstring>
 #if ! defined(COCONUT_USE_PRECOMPILE)
 #include <boost/shared_ptr.hpp>
 #endif
+#include "SharedPaintLog.h"
 
 using namespace coconut;
 using namespace coconut::protocol;
 
+#ifndef CUT_THROUGH_MIN_BODY_SIZE
+#define CUT_THROUGH_MIN_BODY_SIZE	(256 * 1024)	// a bigger body is forwarded as it arrives
+#endif
+
+class SharedPaintHeader;
+
+// sees a packet while it is being read. a big one can be forwarded before it is complete
+class SharedPaintReadListener {
+public:
+	virtual ~SharedPaintReadListener( void ) { }
+
+	// false : the rest of the packet is not read, the connection is closed
+	virtual bool admitPacket( const SharedPaintHeader &header ) = 0;
+
+	// true : the packet is forwarded by its chunks
+	virtual bool onStreamStart( const SharedPaintHeader &header ) = 0;
+	// the next bytes of the packet, the header included
+	virtual void onStreamChunk( const void *ptr, size_t size, bool last ) = 0;
+};
+
+// the header of a packet :
+//   | 2byte magic (0xBEBE) | 2byte code | from id 1byte string | to id 1byte string | 4byte body length |
+// or, with a client which has asked for it (CAPS_SESSION_HANDLE), the handle header :
+//   | 2byte magic (0xBEBF) | 2byte code | 4byte from handle | 4byte to handle | 4byte body length |
+// a handle is given to a joiner by its room (SharedPaintRoom::allocHandle), 0 is the server, or everyone as the target.
+// the server writes its own packets with the id header, a client reads both.
 class SharedPaintHeader {
 public:
 	SharedPaintHeader() { }
@@ -16,14 +44,18 @@ public:
 	enum {
 		NET_MAGIC_CODE = 0xBE,
 		NET_MAGIC_CODE_BIG = 0xBEBE,
+		NET_MAGIC_CODE_HANDLE = 0xBEBF,
+		HANDLE_HEADER_SIZE = 2 + 2 + 4 + 4 + 4,
 	};
 
 	struct HeaderData {
-		HeaderData() : magic(NET_MAGIC_CODE_BIG), code(0), blen(0) { }
+		HeaderData() : magic(NET_MAGIC_CODE_BIG), code(0), fromHandle(0), toHandle(0), blen(0) { }
 		boost::uint16_t magic;
 		boost::uint16_t code;
 		std::string fromId;
 		std::string toId;
+		boost::uint32_t fromHandle;		// the handle header only
+		boost::uint32_t toHandle;
 		boost::uint32_t blen;
 	};
 
@@ -33,12 +65,21 @@ public:
 	const std::string fromId( void ) const { return data_.fromId; }
 	const std::string toId( void ) const { return data_.toId; }
 
+	bool isHandleForm( void ) const { return data_.magic == NET_MAGIC_CODE_HANDLE; }
+	boost::uint32_t fromHandle( void ) const { return data_.fromHandle; }
+	boost::uint32_t toHandle( void ) const { return data_.toHandle; }
+
+	// to everyone in the room
+	bool isBroadcast( void ) const { return isHandleForm() ? data_.toHandle == 0 : data_.toId.empty(); }
+
 	void setToId( const std::string &id ) { data_.toId = id; }
 
 	int totalLength() const {
 		return data_.blen + hlen_;
 	}
 
+	int headerLength() const { return hlen_; }
+
 	void setHeaderLength( int hlen ) { hlen_ = hlen; }
 
 	void setData( const struct HeaderData &data ) { data_ = data; }
@@ -53,6 +94,41 @@ public:
 		VirtualTransportHelper::writeInt32(buffer, payloadSize);
 	}
 
+	static bool isHandleForm( const std::string &packet ) {
+		boost::uint16_t magic = 0;
+		if( packet.size() >= 2 )
+			memcpy( &magic, packet.c_str(), 2 );
+		return magic == NET_MAGIC_CODE_HANDLE;
+	}
+
+	// the from handle of a handle header is the one of the sending session, not what it has written.
+	// <part> : some bytes of the packet from <offset>, the ones of the from handle among them are written over.
+	static void setFromHandle( std::string &part, size_t offset, boost::uint32_t handle ) {
+		const char *bytes = (const char *)&handle;
+		for( size_t i = 4; i < 4 + 4; i++ ) {
+			if( i >= offset && i < offset + part.size() )
+				part[i - offset] = bytes[i - 4];
+		}
+	}
+
+	// the same packet with the id header, for a client which can't read the handle header
+	static std::string toIdForm( const std::string &packet, const std::string &fromId, const std::string &toId ) {
+		boost::uint16_t magic = NET_MAGIC_CODE_BIG;
+		boost::uint8_t len = 0;
+		std::string res;
+		res.reserve( packet.size() - HANDLE_HEADER_SIZE + 2 + 2 + 1 + fromId.size() + 1 + toId.size() + 4 );
+		res.append( (const char *)&magic, 2 );
+		res.append( packet, 2, 2 );	// code
+		len = (boost::uint8_t)fromId.size();
+		res.append( (const char *)&len, 1 );
+		res.append( fromId );
+		len = (boost::uint8_t)toId.size();
+		res.append( (const char *)&len, 1 );
+		res.append( toId );
+		res.append( packet, 2 + 2 + 4 + 4, std::string::npos );	// body length, body
+		return res;
+	}
+
 private:
 	boost::uint32_t hlen_;	
 	struct HeaderData data_;
@@ -66,6 +142,7 @@ public:
 		Code,
 		FromId,
 		ToId,
+		Handles,
 		BodyLength,
 		Payload,
 		Complete
@@ -76,6 +153,9 @@ public:
 			, state_(Init)
 			, payload_pos_(0)
 			, invalidPacketRecved_(false) 
+			, readListener_(NULL)
+			, cutThrough_(false)
+			, streamedSize_(0)
 	{ 
 		LOG_TRACE("SharedPaintProtocol() : %p", this);
 	}
@@ -120,6 +200,11 @@ public:
 	const void * basePtr();
 	size_t totalSize();
 
+	void setReadListener( SharedPaintReadListener *listener ) { readListener_ = listener; }
+
+	// already forwarded by its chunks
+	bool isCutThrough( void ) const { return cutThrough_; }
+
 	void setPayload(const void *payload, size_t size) {
 		payload_.assign((char *)payload, size);
 	}
@@ -135,5 +220,8 @@ private:
 	bool invalidPacketRecved_;
 	boost::uint8_t currIdLen_;
 	int currHeaderLen_;
+	SharedPaintReadListener *readListener_;
+	bool cutThrough_;
+	size_t streamedSize_;
 };
 
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+#include "SharedPaintCodeDefine.h"
+
+// the rates a sender may relay to its room at, 0 : not limited
+#ifndef RATE_CLIENT_BYTES_PER_SEC
+#define RATE_CLIENT_BYTES_PER_SEC	(1024 * 1024)
+#endif
+#ifndef RATE_CLIENT_PACKETS_PER_SEC
+#define RATE_CLIENT_PACKETS_PER_SEC	300
+#endif
+#ifndef RATE_ROOM_BYTES_PER_SEC
+#define RATE_ROOM_BYTES_PER_SEC		(4 * 1024 * 1024)	// all the senders of a room
+#endif
+#ifndef RATE_ROOM_PACKETS_PER_SEC
+#define RATE_ROOM_PACKETS_PER_SEC	1000
+#endif
+#ifndef RATE_BURST_MSEC
+#define RATE_BURST_MSEC				2000	// a bucket holds this much of its rate
+#endif
+#ifndef RATE_MAX_DELAYED_BYTES
+#define RATE_MAX_DELAYED_BYTES		(4 * 1024 * 1024)	// a client which sends on with more than this waiting is disconnected
+#endif
+
+// refilled at its rate up to its burst. a packet bigger than the burst takes a full bucket and leaves a debt
+class SharedPaintTokenBucket
+{
+public:
+	SharedPaintTokenBucket( double rate ) : rate_(rate), burst_(rate * RATE_BURST_MSEC / 1000), tokens_(burst_), last_(0) { }
+
+	bool isLimited( void ) const { return rate_ > 0; }
+
+	bool has( double amount, boost::uint64_t now ) {
+		refill( now );
+		return !isLimited() || tokens_ >= std::min( amount, burst_ );
+	}
+
+	void take( double amount, boost::uint64_t now ) {
+		refill( now );
+		if( isLimited() )
+			tokens_ -= amount;
+	}
+
+	// until it has the amount
+	boost::uint64_t waitUsec( double amount, boost::uint64_t now ) {
+		refill( now );
+		double need = std::min( amount, burst_ ) - tokens_;
+		if( !isLimited() || need <= 0 )
+			return 0;
+		return (boost::uint64_t)(need * 1000000 / rate_) + 1;
+	}
+
+private:
+	void refill( boost::uint64_t now ) {
+		if( last_ != 0 && now > last_ )
+			tokens_ = std::min( burst_, tokens_ + (now - last_) * rate_ / 1000000 );
+		last_ = now;
+	}
+
+private:
+	double rate_;
+	double burst_;
+	double tokens_;
+	boost::uint64_t last_;
+};
+
+
+// the bytes and the packets per second of a sender, a client or all the clients of a room.
+// a packet over the rate waits for its tokens in the order it has come (SharedPaintClient::delayed_),
+// unless only the latest one of its kind matters, then it is dropped.
+class SharedPaintRateLimit
+{
+public:
+	enum Class {
+		CLASS_EXEMPT,		// not fanned out to the room
+		CLASS_DROPPABLE,	// a scroll or a window layout, the next one supersedes it
+		CLASS_DELAYED,		// a live stroke, an item, an image.. never dropped
+	};
+
+	struct Status {
+		Status( void ) : delayedPackets(0), droppedPackets(0) { }
+		boost::uint64_t delayedPackets;
+		boost::uint64_t droppedPackets;
+	};
+
+	SharedPaintRateLimit( double bytesPerSec, double packetsPerSec ) : bytes_(bytesPerSec), packets_(packetsPerSec) { }
+
+	static Class classOf( boost::uint16_t code, bool broadcast ) {
+		if( !broadcast )
+			return CLASS_EXEMPT;	// a sync upload or a file to one joiner
+		switch( code & ~CODE_FLAG_COMPRESSED ) {
+			case CODE_WINDOW_CHANGE_CANVAS_SCROLL_POS:
+			case CODE_WINDOW_RESIZE_MAIN_WND:
+			case CODE_WINDOW_RESIZE_WND_SPLITTER:
+				return CLASS_DROPPABLE;
+			default:
+				return CLASS_DELAYED;
+		}
+	}
+
+	bool has( size_t size, boost::uint64_t now ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		return bytes_.has( (double)size, now ) && packets_.has( 1, now );
+	}
+
+	// false : over the rate, nothing is taken
+	bool take( size_t size, boost::uint64_t now ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		if( !bytes_.has( (double)size, now ) || !packets_.has( 1, now ) )
+			return false;
+		bytes_.take( (double)size, now );
+		packets_.take( 1, now );
+		return true;
+	}
+
+	// already on its way, the tokens are owed
+	void charge( size_t size, boost::uint64_t now ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		bytes_.take( (double)size, now );
+		packets_.take( 1, now );
+	}
+
+	boost::uint64_t waitUsec( size_t size, boost::uint64_t now ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		return std::max( bytes_.waitUsec( (double)size, now ), packets_.waitUsec( 1, now ) );
+	}
+
+	void countDelayed( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		status_.delayedPackets++;
+	}
+
+	void countDropped( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		status_.droppedPackets++;
+	}
+
+	Status status( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		return status_;
+	}
+
+private:
+	SharedPaintTokenBucket bytes_;
+	SharedPaintTokenBucket packets_;
+	Status status_;
+	boost::mutex mutex_;
+};
@@ -1,36 +1,135 @@
 #include "Coconut.h"
+#include "SharedPaintLog.h"
 #include "SharedPaintRoom.h"
 #include "SharedPaintProtocol.h"
 #include "SystemPacketBuilder.h"
 #include "SharedPaintClient.h"
 
+// what a joiner sends of itself as it comes in (SharedPaintRoom::holdBehindPresence)
+static bool isGreeting( boost::uint16_t code ) {
+	return (code & ~CODE_FLAG_COMPRESSED) == CODE_SYSTEM_VERSION_INFO;
+}
+
 void SharedPaintRoom::addJoiner( boost::shared_ptr<SharedPaintClient> joiner, bool &firstFlag ) {
-	CLIENT_MAP::iterator itC = clientMap_.find( joiner->user()->userId() );
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( !journalLoaded_ ) {
+		journalLoaded_ = true;
+		restoreFromJournal();
+	}
+
+	const std::string &userid = joiner->user()->userId();
+	std::string serialized = joiner->user()->serialize();
+
+	CLIENT_MAP::iterator itC = clientMap_.find( userid );
 	if( itC == clientMap_.end() ) {
 		// new user
-		clientMap_.insert( CLIENT_MAP::value_type( joiner->user()->userId(), joiner ) );
+		clientMap_.insert( CLIENT_MAP::value_type( userid, joiner ) );
 		joiner->user()->setSyncComplete();	// first joiner is alway sync-complete status
+		joiner->setHandle( allocHandle( joiner ) );
+		joiner->setRoomRateLimit( rateLimit_ );
+
+		serializedUsers_[ userid ] = serialized;
+		if( !joinerListDirty_ )
+			joinerList_ += serialized;
 	} else { 
 
 		if( joiner != itC->second ) {
 			// already joined user. duplicate!
 			itC->second->setInvalidSessionFlag();
 			itC->second->tcpSocket()->close();
+			freeHandle( itC->second->handle() );
 			itC->second = joiner;	// overwrite
+			joiner->setHandle( allocHandle( joiner ) );
+			joiner->setRoomRateLimit( rateLimit_ );
+
+			serializedUsers_[ userid ] = serialized;
+			joinerListDirty_ = true;
 		} 
 	}
 
-	firstFlag = clientMap_.size() == 1 ? true : false;
+	// notification
+	std::string event;
+	SystemPacketBuilder::Presence::writeJoined( event, serialized );
+	castPresence( userid, SystemPacketBuilder::NewJoiner::make( joiner ), event );
+
+	// before anything of the joiner reaches them
+	if( joiner->handle() != 0 ) {
+		std::string entry;
+		SystemPacketBuilder::SessionHandle::writeEntry( entry, joiner->handle(), userid );
+		boost::shared_ptr<SharedPaintProtocol> handleProt = SystemPacketBuilder::SessionHandle::make( roomId_, 0, 1, entry );
+		SharedPaintOutboundQueue::Payload handlePayload = SharedPaintClient::makePayload( handleProt );
+		for( itC = clientMap_.begin(); itC != clientMap_.end(); itC++ ) {
+			if( itC->second != joiner && itC->second->acceptsHandles() ) {
+				itC->second->send( handlePayload, handleProt->code(), "" );
+				outCounter_.add( handlePayload->size() );
+			}
+		}
+	}
+
+	// a journaled canvas is synced to the first joiner too
+	firstFlag = clientMap_.size() == 1 && !snapshot_.isValid() ? true : false;
+}
+
+void SharedPaintRoom::restoreFromJournal( void ) {
+
+	std::vector<SharedPaintSnapshot::Packet> packets;
+	boost::uint32_t requiredCaps = 0;
+	if( !SharedPaintJournal::load( roomId_, packets, requiredCaps ) )
+		return;
+
+	snapshot_.restore( packets, requiredCaps );
+
+	// compacted into a base of this process, the next changes are appended to it
+	journal_.rebase( snapshot_.packets(), snapshot_.requiredCaps() );
+
+	LOG_INFO("ROOM RESTORED : %s, %d packets, %d bytes", roomId_.c_str(), (int)packets.size(), (int)snapshot_.size());
+}
+
+void SharedPaintRoom::evictSnapshot( boost::uint64_t seq ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	// somebody has joined since, or left again and a later eviction is on its way
+	if( !clientMap_.empty() || seq != evictSeq_ )
+		return;
+
+	size_t size = snapshot_.size();
+	snapshot_.reset();
+	journalLoaded_ = false;		// the next first joiner restores it
+
+	LOG_DEBUG("ROOM EVICTED : %s, %d bytes", roomId_.c_str(), (int)size);
 }
 
 
 void SharedPaintRoom::removeJoiner( boost::shared_ptr<SharedPaintClient> joiner ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
 
 	std::string userid = joiner->user()->userId();
 	CLIENT_MAP::iterator itC = clientMap_.find( userid );
 	if( itC != clientMap_.end() ) {
 
+		// what the leaver has sent goes out before it is gone
+		if( coalescer_.isOpen( userid ) ) {
+			forwardHeld( joiner );
+			coalescer_.close( userid );
+		}
+
+		freeHandle( itC->second->handle() );
 		clientMap_.erase( itC );
+		syncTargets_.erase( userid );
+		serializedUsers_.erase( userid );
+		joinerListDirty_ = true;
+
+		if( clientMap_.empty() && !SharedPaintJournal::isEnabled() ) {
+			snapshot_.reset();	// the next first joiner brings its own canvas
+		} else if( clientMap_.empty() && snapshot_.isValid() ) {
+			// the journal keeps the canvas of an empty room, the memory is given back once it is written (evictSnapshot)
+			if( journal_.isBroken() )
+				journal_.rebase( snapshot_.packets(), snapshot_.requiredCaps() );
+			journal_.evictWhenWritten( ++evictSeq_ );
+		} else if( snapshot_.isSeeding() && (clientMap_.empty() || snapshot_.seedRunner() == userid) ) {
+			snapshot_.abortSeed();
+		}
 
 		if( superPeerSession_ == joiner ) {
 			superPeerSession_ = boost::shared_ptr<SharedPaintClient>();	// clear
@@ -38,15 +137,27 @@ void SharedPaintRoom::removeJoiner( boost::shared_ptr<SharedPaintClient> joiner
 		}
 	
 		// notification
-		boost::shared_ptr<SharedPaintProtocol> prot = SystemPacketBuilder::LeftUser::make( roomId_, userid );
-		roomCast( userid, prot, false );
+		std::string event;
+		SystemPacketBuilder::Presence::writeLeft( event, userid );
+		castPresence( userid, SystemPacketBuilder::LeftUser::make( roomId_, userid ), event );
+
+		if( clientMap_.empty() ) {
+			presenceEvents_.clear();
+			presenceEventCount_ = 0;
+			presenceJoined_.clear();
+			presenceFollowers_.clear();
+			presenceTimerOwner_.clear();
+		} else if( presenceTimerOwner_ == userid ) {
+			startPresenceTimer( userid );	// its timer is gone with it
+		}
 
-		LOG_DEBUG("LEAVE ROOM : %s, %s, %d", roomId_.c_str(), userid.c_str(), clientMap_.size() );
+		LOG_DEBUG("LEAVE ROOM : %s, %s, %d", roomId_.c_str(), userid.c_str(), (int)clientMap_.size() );
 	}
 }
 
 
 boost::shared_ptr<SharedPaintClient> SharedPaintRoom::findUser( const std::string &userId ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
 	
 	CLIENT_MAP::iterator itC = clientMap_.find( userId );
 	if( itC != clientMap_.end() ) {
@@ -69,22 +180,240 @@ void SharedPaintRoom::tossSuperPeerRightToCandidates( void ) {
 }
 
 std::string SharedPaintRoom::serializeJoinerInfoPacket( void ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( joinerListDirty_ ) {
+		joinerList_.clear();
+		std::map<std::string, std::string>::iterator itU = serializedUsers_.begin();
+		for( ; itU != serializedUsers_.end(); itU++ ) {
+			joinerList_ += itU->second;
+		}
+		joinerListDirty_ = false;
+	}
 
 	int pos = 0;
 	std::string body;
 
 	pos += PacketBufferUtil::writeInt16( body, pos, clientMap_.size(), false );
 
-	std::string serializedUsers;
+	return body + joinerList_;
+}
+
+void SharedPaintRoom::updateJoiner( boost::shared_ptr<SharedPaintClient> joiner ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	CLIENT_MAP::iterator itC = clientMap_.find( joiner->user()->userId() );
+	if( itC == clientMap_.end() || itC->second != joiner )
+		return;
+
+	serializedUsers_[ itC->first ] = joiner->user()->serialize();
+	joinerListDirty_ = true;
+}
+
+void SharedPaintRoom::enableHandles( boost::shared_ptr<SharedPaintClient> joiner ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	CLIENT_MAP::iterator itC = clientMap_.find( joiner->user()->userId() );
+	if( itC == clientMap_.end() || itC->second != joiner || joiner->handle() == 0 || joiner->acceptsHandles() )
+		return;
+
+	std::string entries;
+	int count = 0;
+	for( itC = clientMap_.begin(); itC != clientMap_.end(); itC++ ) {
+		if( itC->second->handle() != 0 ) {
+			SystemPacketBuilder::SessionHandle::writeEntry( entries, itC->second->handle(), itC->first );
+			count++;
+		}
+	}
+	joiner->send( SystemPacketBuilder::SessionHandle::make( roomId_, joiner->handle(), count, entries ) );
+	joiner->setAcceptsHandles();
+}
+
+boost::uint32_t SharedPaintRoom::allocHandle( boost::shared_ptr<SharedPaintClient> client ) {
+
+	size_t slot;
+	if( !freeHandleSlots_.empty() ) {
+		slot = freeHandleSlots_.back();
+		freeHandleSlots_.pop_back();
+	} else if( handleSlots_.size() < 0xffff ) {
+		slot = handleSlots_.size();
+		handleSlots_.push_back( HandleSlot() );
+	} else {
+		return 0;	// the id header only
+	}
+
+	HandleSlot &s = handleSlots_[slot];
+	s.client = client;
+	s.generation++;
+	return ((boost::uint32_t)s.generation << 16) | (boost::uint32_t)(slot + 1);
+}
+
+void SharedPaintRoom::freeHandle( boost::uint32_t handle ) {
+	if( !findByHandle( handle ) )
+		return;
+
+	size_t slot = (handle & 0xffff) - 1;
+	handleSlots_[slot].client = boost::shared_ptr<SharedPaintClient>();
+	freeHandleSlots_.push_back( slot );
+}
+
+boost::shared_ptr<SharedPaintClient> SharedPaintRoom::findByHandle( boost::uint32_t handle ) {
+
+	size_t slot = (handle & 0xffff);
+	if( slot == 0 || slot > handleSlots_.size() )
+		return boost::shared_ptr<SharedPaintClient>();
+
+	const HandleSlot &s = handleSlots_[slot - 1];
+	if( s.generation != (handle >> 16) )
+		return boost::shared_ptr<SharedPaintClient>();
+	return s.client;
+}
+
+void SharedPaintRoom::castPresence( const std::string &userId, boost::shared_ptr<SharedPaintProtocol> prot, const std::string &event ) {
+
+	// the members which can't read a presence delta get it at once, as before
+	SharedPaintOutboundQueue::Payload payload = SharedPaintClient::makePayload( prot );
+	bool batched = false;
+
 	CLIENT_MAP::iterator itC = clientMap_.begin();
 	for( ; itC != clientMap_.end(); itC++ ) {
-		serializedUsers += itC->second->user()->serialize();
+		if( itC->first == userId )
+			continue;
+
+		if( itC->second->user()->capabilities() & CAPS_PRESENCE_DELTA ) {
+			batched = true;
+			continue;
+		}
+		itC->second->send( payload, prot->code(), userId );
+		outCounter_.add( payload->size() );
 	}
 
-	return body + serializedUsers;
+	if( !batched )
+		return;
+
+	if( presenceEventCount_ >= 0xffff )
+		flushPresence();
+
+	presenceEvents_ += event;
+	presenceEventCount_++;
+	if( prot->code() == CODE_SYSTEM_JOIN_TO_SERVER )
+		presenceJoined_.insert( userId );
+	else
+		presenceJoined_.erase( userId );
+
+	if( presenceTimerOwner_.empty() )
+		startPresenceTimer( userId );
+}
+
+void SharedPaintRoom::startPresenceTimer( const std::string &exceptId ) {
+
+	presenceTimerOwner_.clear();
+
+	CLIENT_MAP::iterator itC = clientMap_.begin();
+	for( ; itC != clientMap_.end(); itC++ ) {
+		if( itC->first != exceptId ) {
+			presenceTimerOwner_ = itC->first;
+			itC->second->startPresenceTimer();
+			return;
+		}
+	}
+}
+
+void SharedPaintRoom::onPresenceTimer( void ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+	flushPresence();
+}
+
+void SharedPaintRoom::flushPresence( void ) {
+
+	presenceTimerOwner_.clear();
+	if( presenceEventCount_ == 0 )
+		return;
+
+	boost::shared_ptr<SharedPaintProtocol> prot = SystemPacketBuilder::Presence::make( roomId_, presenceEventCount_, presenceEvents_ );
+	SharedPaintOutboundQueue::Payload payload = SharedPaintClient::makePayload( prot );
+
+	// one packet for all the events of the window, the same for every member
+	CLIENT_MAP::iterator itC = clientMap_.begin();
+	for( ; itC != clientMap_.end(); itC++ ) {
+		if( itC->second->user()->capabilities() & CAPS_PRESENCE_DELTA ) {
+			itC->second->send( payload, prot->code(), "" );
+			outCounter_.add( payload->size() );
+		}
+	}
+
+	LOG_DEBUG("PRESENCE : %s, %d events, %d bytes", roomId_.c_str(), presenceEventCount_, (int)payload->size());
+
+	presenceEvents_.clear();
+	presenceEventCount_ = 0;
+	presenceJoined_.clear();
+
+	// the members know the joiners now
+	std::vector<Follower> followers;
+	followers.swap( presenceFollowers_ );
+	for( size_t i = 0; i < followers.size(); i++ ) {
+		const Follower &follower = followers[i];
+		CLIENT_MAP::iterator itT = clientMap_.find( follower.to->user()->userId() );
+		if( itT == clientMap_.end() || itT->second != follower.to )
+			continue;	// left
+		SharedPaintOutboundQueue::Payload idForm;
+		deliver( follower.to, follower.code, follower.fromId, follower.toId, follower.payload, idForm, false );
+	}
+}
+
+void SharedPaintRoom::flushPresenceOf( const std::string &fromId ) {
+	if( presenceJoined_.find( fromId ) != presenceJoined_.end() )
+		flushPresence();
+}
+
+// a greeting of a joiner the members with CAPS_PRESENCE_DELTA have not heard of yet, it waits for the presence batch
+void SharedPaintRoom::holdBehindPresence( boost::shared_ptr<SharedPaintClient> to, boost::uint16_t code, const std::string &fromId, const std::string &toId, const SharedPaintOutboundQueue::Payload &payload ) {
+
+	if( !(to->user()->capabilities() & CAPS_PRESENCE_DELTA) ) {
+		SharedPaintOutboundQueue::Payload idForm;
+		deliver( to, code, fromId, toId, payload, idForm, false );	// it had the joiner at once
+		return;
+	}
+
+	Follower follower;
+	follower.to = to;
+	follower.code = code;
+	follower.fromId = fromId;
+	follower.toId = toId;
+	follower.payload = payload;
+	presenceFollowers_.push_back( follower );
 }
 
 void SharedPaintRoom::syncStart( const std::string &tartgetId ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	CLIENT_MAP::iterator itT = clientMap_.find( tartgetId );
+	if( itT == clientMap_.end() )
+		return;
+
+	boost::shared_ptr<SharedPaintClient> target = itT->second;
+	if( snapshot_.canServe( target->user()->capabilities() ) ) {
+
+		std::vector<SharedPaintSnapshot::Packet> packets = snapshot_.packets();
+
+		LOG_DEBUG("======================> SYNC FROM SNAPSHOT <================ : %s, %d packets", tartgetId.c_str(), (int)packets.size());
+
+		boost::posix_time::ptime startTime = boost::posix_time::microsec_clock::universal_time();
+
+		boost::shared_ptr<SharedPaintProtocol> startProt = SystemPacketBuilder::SyncStart::make( roomId_, tartgetId );
+		target->send( startProt, true );
+
+		for( size_t i = 0; i < packets.size(); i++ ) {
+			target->send( packets[i].payload, packets[i].code, "", true );
+			outCounter_.add( packets[i].size() );
+		}
+
+		boost::shared_ptr<SharedPaintProtocol> completeProt = SystemPacketBuilder::SyncComplete::make( tartgetId );
+		target->send( completeProt, true );
+
+		SharedPaintStatsPtr()->countSync( (int)(boost::posix_time::microsec_clock::universal_time() - startTime).total_milliseconds(), true );
+		return;
+	}
 
 	std::string runner;
 
@@ -115,31 +444,318 @@ void SharedPaintRoom::syncStart( const std::string &tartgetId ) {
 	if( runner.empty() )
 		return;	// exceptional case..
 
+	// capture this upload for the next joiners, instead of a seed of the first joiner that has not come
+	if( !snapshot_.isValid() && (!snapshot_.isSeeding() || !snapshot_.isSeedStarted()) )
+		snapshot_.beginSeed( runner, tartgetId, target->user()->capabilities() );
+
+	syncTargets_[ tartgetId ] = boost::posix_time::microsec_clock::universal_time();
+
+	// the runner knows the target first, the rest of the room hears of it when the presence window ends
+	CLIENT_MAP::iterator itR = clientMap_.find( runner );
+	if( presenceJoined_.find( tartgetId ) != presenceJoined_.end() && itR != clientMap_.end() 
+		&& (itR->second->user()->capabilities() & CAPS_PRESENCE_DELTA) ) {
+		std::string event;
+		SystemPacketBuilder::Presence::writeJoined( event, serializedUsers_[ tartgetId ] );
+		boost::shared_ptr<SharedPaintProtocol> presenceProt = SystemPacketBuilder::Presence::make( roomId_, 1, event );
+		itR->second->send( presenceProt );
+		outCounter_.add( presenceProt->totalSize() );
+	}
+
 	boost::shared_ptr<SharedPaintProtocol> prot = SystemPacketBuilder::RequestSync::make( roomId_, runner, tartgetId );
 	uniCast( prot );
 }
 
+void SharedPaintRoom::seedFromFirst( const std::string &runnerId ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	if( snapshot_.isValid() || snapshot_.isSeeding() )
+		return;
+	if( clientMap_.find( runnerId ) == clientMap_.end() )
+		return;
+
+	LOG_DEBUG("======================> SEED REQUEST <================ : %s -> %s", runnerId.c_str(), roomId_.c_str());
+
+	// encoded for no capabilities, any joiner can be served from it
+	snapshot_.beginSeed( runnerId, SNAPSHOT_SEED_TARGET_ID, 0 );
+	uniCast( SystemPacketBuilder::RequestSync::make( roomId_, runnerId, SNAPSHOT_SEED_TARGET_ID ) );
+}
+
 void SharedPaintRoom::uniCast( boost::shared_ptr<SharedPaintProtocol> prot ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	const SharedPaintHeader &header = prot->header();
+	if( header.isHandleForm() ) {
+		boost::shared_ptr<SharedPaintClient> from = findByHandle( header.fromHandle() );
+		boost::shared_ptr<SharedPaintClient> to = findByHandle( header.toHandle() );
+		if( from && to )
+			uniCast( to, prot->code(), from->user()->userId(), SharedPaintClient::makePayload( prot ) );
+		return;
+	}
 
-	CLIENT_MAP::iterator itC = clientMap_.find( prot->header().toId() );
-	if( itC != clientMap_.end() ) {
-		LOG_DEBUG("======================> UNICAST <================ : %d -> %s", prot->code(),  prot->header().toId().c_str());
-		itC->second->tcpSocket()->write( prot->basePtr(), prot->totalSize() );
+	CLIENT_MAP::iterator itC = clientMap_.find( header.toId() );
+	if( itC != clientMap_.end() )
+		uniCast( itC->second, prot->code(), header.fromId(), SharedPaintClient::makePayload( prot ) );
+}
+
+void SharedPaintRoom::uniCast( boost::shared_ptr<SharedPaintClient> to, boost::uint16_t code, const std::string &fromId, const SharedPaintOutboundQueue::Payload &payload ) {
+
+	const std::string &toId = to->user()->userId();
+	LOG_DEBUG("======================> UNICAST <================ : %d -> %s", code,  toId.c_str());
+
+	// the sync upload is not limited, the joiner needs all of it
+	std::map<std::string, boost::posix_time::ptime>::iterator itS = syncTargets_.find( toId );
+	bool sync = itS != syncTargets_.end();
+	if( sync && (code & ~CODE_FLAG_COMPRESSED) == CODE_SYSTEM_SYNC_COMPLETE ) {
+		SharedPaintStatsPtr()->countSync( (int)(boost::posix_time::microsec_clock::universal_time() - itS->second).total_milliseconds(), false );
+		syncTargets_.erase( itS );
+	}
+
+	SharedPaintOutboundQueue::Payload idForm;
+	deliver( to, code, fromId, toId, payload, idForm, sync );
+}
+
+void SharedPaintRoom::deliver( boost::shared_ptr<SharedPaintClient> to, boost::uint16_t code, const std::string &fromId, const std::string &toId, 
+							  const SharedPaintOutboundQueue::Payload &payload, SharedPaintOutboundQueue::Payload &idForm, bool sync ) {
+
+	// a client which has not asked for the handle header gets the id header, made once for all of them
+	if( !to->acceptsHandles() && SharedPaintHeader::isHandleForm( *payload ) ) {
+		if( !idForm )
+			idForm = SharedPaintOutboundQueue::Payload( new std::string( SharedPaintHeader::toIdForm( *payload, fromId, toId ) ) );
+		to->send( idForm, code, fromId, sync );
+		outCounter_.add( idForm->size() );
+		return;
+	}
+
+	to->send( payload, code, fromId, sync );
+	outCounter_.add( payload->size() );
+}
+
+void SharedPaintRoom::relay( boost::shared_ptr<SharedPaintClient> from, boost::shared_ptr<SharedPaintProtocol> prot ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	// one copy for the snapshot and all the outbound queues
+	SharedPaintOutboundQueue::Payload payload = SharedPaintClient::makePayload( prot );
+	inCounter_.add( payload->size() );
+
+	const std::string &fromId = from->user()->userId();
+	const SharedPaintHeader &header = prot->header();
+
+	// the handle header is routed by the index of the handle
+	std::string toId;
+	boost::shared_ptr<SharedPaintClient> to;
+	if( header.isHandleForm() ) {
+		// the receivers take the sender from it, it can't claim another one
+		if( header.fromHandle() != from->handle() ) {
+			std::string *stamped = new std::string( *payload );
+			SharedPaintHeader::setFromHandle( *stamped, 0, from->handle() );
+			payload = SharedPaintOutboundQueue::Payload( stamped );
+		}
+
+		if( header.toHandle() != 0 ) {
+			to = findByHandle( header.toHandle() );
+			if( !to )
+				return;	// left already
+			toId = to->user()->userId();
+		}
+	} else {
+		toId = header.toId();
+	}
+
+	std::string key;
+	size_t bodyOffset = header.headerLength();
+	bool superseding = toId.empty() && SharedPaintCoalescer::keyOf( prot->code(), *payload, bodyOffset, key );
+
+	if( coalescer_.isOpen( fromId ) ) {
+		if( superseding ) {
+			if( coalescer_.hold( fromId, key, prot->code(), payload, bodyOffset ) )
+				SharedPaintStatsPtr()->countCoalesced();
+			return;
+		}
+		forwardHeld( from );	// keep the order of the sender
+	} else if( superseding ) {
+		coalescer_.open( fromId );
+		from->startCoalesceTimer();
+	}
+
+	applyToSnapshot( from, prot->code(), toId, payload );
+
+	if( prot->isCutThrough() )
+		return;	// forwarded already (beginStream)
+
+	// the greeting of a joiner does not make the room hear of it before the presence window ends
+	bool greeting = isGreeting( prot->code() ) && presenceJoined_.find( fromId ) != presenceJoined_.end();
+
+	if( toId.empty() ) {
+		if( !greeting ) {
+			roomCast( fromId, prot->code(), payload, false );
+			return;
+		}
+		CLIENT_MAP::iterator itC = clientMap_.begin();
+		for( ; itC != clientMap_.end(); itC++ ) {
+			if( itC->first != fromId )
+				holdBehindPresence( itC->second, prot->code(), fromId, "", payload );
+		}
+		return;
+	}
+
+	if( !to ) {
+		CLIENT_MAP::iterator itC = clientMap_.find( toId );
+		if( itC == clientMap_.end() )
+			return;
+		to = itC->second;
+	}
+	if( greeting ) {
+		holdBehindPresence( to, prot->code(), fromId, toId, payload );
+		return;
 	}
+	flushPresenceOf( fromId );
+	uniCast( to, prot->code(), fromId, payload );
+}
+
+boost::shared_ptr<SharedPaintStream> SharedPaintRoom::beginStream( boost::shared_ptr<SharedPaintClient> from, const SharedPaintHeader &header, std::vector< boost::shared_ptr<SharedPaintClient> > &recipients ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	const std::string &fromId = from->user()->userId();
+	flushPresenceOf( fromId );
+
+	CLIENT_MAP::iterator itF = clientMap_.find( fromId );
+	if( itF == clientMap_.end() || itF->second != from )
+		return boost::shared_ptr<SharedPaintStream>();	// not joined
+
+	if( coalescer_.isOpen( fromId ) )
+		forwardHeld( from );	// keep the order of the sender
+
+	if( header.isBroadcast() ) {
+		CLIENT_MAP::iterator itC = clientMap_.begin();
+		for( ; itC != clientMap_.end(); itC++ ) {
+			if( itC->first != fromId )
+				recipients.push_back( itC->second );
+		}
+	} else if( header.isHandleForm() ) {
+		boost::shared_ptr<SharedPaintClient> to = findByHandle( header.toHandle() );
+		if( to )
+			recipients.push_back( to );
+	} else {
+		CLIENT_MAP::iterator itC = clientMap_.find( header.toId() );
+		if( itC != clientMap_.end() )
+			recipients.push_back( itC->second );
+	}
+
+	// the chunks go out as they are, a recipient which can't read the handle header gets it from relay()
+	if( header.isHandleForm() ) {
+		for( size_t i = 0; i < recipients.size(); i++ ) {
+			if( !recipients[i]->acceptsHandles() ) {
+				recipients.clear();
+				return boost::shared_ptr<SharedPaintStream>();
+			}
+		}
+	}
+
+	boost::shared_ptr<SharedPaintStream> stream(new SharedPaintStream( header.code(), header.totalLength() ));
+
+	for( size_t i = 0; i < recipients.size(); i++ ) {
+		recipients[i]->sendStream( stream, fromId );
+		outCounter_.add( stream->totalSize() );
+	}
+	return stream;
+}
+
+size_t SharedPaintRoom::forwardHeld( boost::shared_ptr<SharedPaintClient> from ) {
+
+	const std::string &fromId = from->user()->userId();
+	std::vector<SharedPaintCoalescer::Packet> held = coalescer_.take( fromId );
+
+	for( size_t i = 0; i < held.size(); i++ ) {
+		applyToSnapshot( from, held[i].code, "", held[i].payload );
+		roomCast( fromId, held[i].code, held[i].payload, false );
+	}
+	return held.size();
+}
+
+void SharedPaintRoom::applyToSnapshot( boost::shared_ptr<SharedPaintClient> from, boost::uint16_t code, const std::string &toId, const SharedPaintOutboundQueue::Payload &payload ) {
+
+	boost::uint32_t caps = from->user()->capabilities();
+
+	// the snapshot and the journal keep the id header, the handles are of this run of the room
+	SharedPaintOutboundQueue::Payload kept = payload;
+	if( SharedPaintSnapshot::isCanvasCode( code ) && SharedPaintHeader::isHandleForm( *payload ) )
+		kept = SharedPaintOutboundQueue::Payload( new std::string( SharedPaintHeader::toIdForm( *payload, from->user()->userId(), toId ) ) );
+
+	switch( snapshot_.onPacket( from->user()->userId(), caps, code, toId, kept ) ) {
+		case SharedPaintSnapshot::CHANGE_APPLIED:
+			if( journal_.shouldCompact( snapshot_.size() ) )
+				journal_.rebase( snapshot_.packets(), snapshot_.requiredCaps() );
+			else
+				journal_.append( SharedPaintSnapshot::Packet( code & ~CODE_FLAG_COMPRESSED, kept ), caps );
+			break;
+		case SharedPaintSnapshot::CHANGE_SEEDED:
+			journal_.rebase( snapshot_.packets(), snapshot_.requiredCaps() );
+			break;
+		case SharedPaintSnapshot::CHANGE_RESET:
+			journal_.drop();
+			break;
+		default:
+			break;
+	}
+}
+
+void SharedPaintRoom::onCoalesceTimer( boost::shared_ptr<SharedPaintClient> from ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	const std::string &fromId = from->user()->userId();
+	if( !coalescer_.isOpen( fromId ) )
+		return;
+
+	if( forwardHeld( from ) == 0 ) {
+		coalescer_.close( fromId );	// quiet for a whole window, the next event goes out at once
+		return;
+	}
+	from->startCoalesceTimer();
 }
 
 void SharedPaintRoom::roomCast( const std::string &fromid, boost::shared_ptr<SharedPaintProtocol> prot, bool sendMySelf ) {
+	roomCast( fromid, prot->code(), SharedPaintClient::makePayload( prot ), sendMySelf );
+}
+
+void SharedPaintRoom::roomCast( const std::string &fromid, boost::uint16_t code, const SharedPaintOutboundQueue::Payload &payload, bool sendMySelf ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	flushPresenceOf( fromid );
 	
+	SharedPaintOutboundQueue::Payload idForm;
 	CLIENT_MAP::iterator itC = clientMap_.begin();
 	for( ; itC != clientMap_.end(); itC++ ) {
 		if( !sendMySelf && itC->first == fromid )
 			continue;
 
-		itC->second->tcpSocket()->write( prot->basePtr(), prot->totalSize() );
+		deliver( itC->second, code, fromid, "", payload, idForm, false );
+	}
+}
+
+void SharedPaintRoom::collectStats( SharedPaintStats::RoomStats &stats ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	stats.roomId = roomId_;
+	stats.userCount = clientMap_.size();
+	stats.in = inCounter_;
+	stats.out = outCounter_;
+
+	SharedPaintRateLimit::Status rate = rateLimit_->status();
+	stats.delayedPackets = rate.delayedPackets;
+	stats.droppedPackets = rate.droppedPackets;
+
+	CLIENT_MAP::iterator itC = clientMap_.begin();
+	for( ; itC != clientMap_.end(); itC++ ) {
+		SharedPaintOutboundQueue::Status status = itC->second->queueStatus();
+		stats.queuedBytes += status.queuedBytes;
+		stats.queuedPackets += status.queuedPackets;
+		if( status.queuedBytes > stats.maxQueuedBytes )
+			stats.maxQueuedBytes = status.queuedBytes;
 	}
 }
 
 void SharedPaintRoom::setSuperPeerSession( boost::shared_ptr<SharedPaintClient> client ) {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
 
 	if( client != superPeerSession_ ) { 
 
@@ -157,5 +773,6 @@ void SharedPaintRoom::setSuperPeerSession( boost::shared_ptr<SharedPaintClient>
 }
 
 boost::shared_ptr<SharedPaintClient> SharedPaintRoom::currentSuperPeerSession() {
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
 	return superPeerSession_;
 }
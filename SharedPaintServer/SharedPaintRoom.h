@@ -1,7 +1,16 @@
 #pragma once
 
+#include <set>
+#include <boost/thread/recursive_mutex.hpp>
+#include "SharedPaintSnapshot.h"
+#include "SharedPaintStats.h"
+#include "SharedPaintCoalescer.h"
+#include "SharedPaintJournal.h"
+#include "SharedPaintRateLimit.h"
+
 class SharedPaintRoom;
 class SharedPaintProtocol;
+class SharedPaintHeader;
 class SharedPaintClient;
 
 typedef std::map<std::string, boost::shared_ptr<SharedPaintClient> > CLIENT_MAP;
@@ -10,16 +19,41 @@ typedef std::map<std::string, boost::shared_ptr<SharedPaintRoom> > ROOM_MAP;
 class SharedPaintRoom
 {
 public:
-	SharedPaintRoom( const std::string & roomid ) : roomId_(roomid), lastSyncRunnerIndex_(0) { }
+	SharedPaintRoom( const std::string & roomid ) : roomId_(roomid), lastSyncRunnerIndex_(0), journal_(roomid), journalLoaded_(false), evictSeq_(0), 
+		joinerListDirty_(false), presenceEventCount_(0), 
+		rateLimit_(new SharedPaintRateLimit( RATE_ROOM_BYTES_PER_SEC, RATE_ROOM_PACKETS_PER_SEC )) { }
 
+	// the members are told about it too
 	void addJoiner( boost::shared_ptr<SharedPaintClient> joiner, bool &firstFlag );
 
 	void removeJoiner( boost::shared_ptr<SharedPaintClient> joiner );
 
+	// the journal writer has written what the room had when it emptied
+	void evictSnapshot( boost::uint64_t seq );
+
 	void roomCast( const std::string &fromid, boost::shared_ptr<SharedPaintProtocol> prot, bool sendMySelf = false );
 
 	void uniCast( boost::shared_ptr<SharedPaintProtocol> prot );
 
+	// forwards a client packet and keeps the snapshot up to date
+	void relay( boost::shared_ptr<SharedPaintClient> from, boost::shared_ptr<SharedPaintProtocol> prot );
+
+	// starts forwarding a big packet while it is read, the recipients get it in the place of its header.
+	// relay() gets it once it is complete, for the snapshot only.
+	boost::shared_ptr<SharedPaintStream> beginStream( boost::shared_ptr<SharedPaintClient> from, const SharedPaintHeader &header, std::vector< boost::shared_ptr<SharedPaintClient> > &recipients );
+
+	// the coalescing window of the sender has ended
+	void onCoalesceTimer( boost::shared_ptr<SharedPaintClient> from );
+
+	// the presence delta window has ended
+	void onPresenceTimer( void );
+
+	// the user data of a joiner has changed, for the next joiner list
+	void updateJoiner( boost::shared_ptr<SharedPaintClient> joiner );
+
+	// sends the handles of the room to a joiner which can read the handle header, then uses it for the joiner
+	void enableHandles( boost::shared_ptr<SharedPaintClient> joiner );
+
 	void setSuperPeerSession( boost::shared_ptr<SharedPaintClient> client );
 
 	boost::shared_ptr<SharedPaintClient> currentSuperPeerSession( void );
@@ -28,17 +62,82 @@ public:
 
 	void syncStart( const std::string &tartgetId );
 
-	size_t userCount( void ) { return clientMap_.size(); }
+	// the first joiner uploads its canvas for the snapshot, to nobody (SNAPSHOT_SEED_TARGET_ID)
+	void seedFromFirst( const std::string &runnerId );
+
+	size_t userCount( void ) { 
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+		return clientMap_.size(); 
+	}
 
 	boost::shared_ptr<SharedPaintClient> findUser( const std::string &userId );
 
+	void collectStats( SharedPaintStats::RoomStats &stats );
+
 private:
 	void tossSuperPeerRightToCandidates( void );
+	void roomCast( const std::string &fromid, boost::uint16_t code, const SharedPaintOutboundQueue::Payload &payload, bool sendMySelf );
+	size_t forwardHeld( boost::shared_ptr<SharedPaintClient> from );
+	void applyToSnapshot( boost::shared_ptr<SharedPaintClient> from, boost::uint16_t code, const std::string &toId, const SharedPaintOutboundQueue::Payload &payload );
+	void restoreFromJournal( void );
+	void castPresence( const std::string &userId, boost::shared_ptr<SharedPaintProtocol> prot, const std::string &event );
+	void startPresenceTimer( const std::string &exceptId );
+	void flushPresence( void );
+	void flushPresenceOf( const std::string &fromId );
+	void holdBehindPresence( boost::shared_ptr<SharedPaintClient> to, boost::uint16_t code, const std::string &fromId, const std::string &toId, const SharedPaintOutboundQueue::Payload &payload );
+	void uniCast( boost::shared_ptr<SharedPaintClient> to, boost::uint16_t code, const std::string &fromId, const SharedPaintOutboundQueue::Payload &payload );
+	void deliver( boost::shared_ptr<SharedPaintClient> to, boost::uint16_t code, const std::string &fromId, const std::string &toId, 
+		const SharedPaintOutboundQueue::Payload &payload, SharedPaintOutboundQueue::Payload &idForm, bool sync );
+	boost::uint32_t allocHandle( boost::shared_ptr<SharedPaintClient> client );
+	void freeHandle( boost::uint32_t handle );
+	boost::shared_ptr<SharedPaintClient> findByHandle( boost::uint32_t handle );
 
 private:
 	std::string roomId_;
 	boost::shared_ptr<SharedPaintClient> superPeerSession_;
 	CLIENT_MAP clientMap_;
 	int lastSyncRunnerIndex_;
+	std::map<std::string, boost::posix_time::ptime> syncTargets_;	// joiners a client sync upload is running to, since when
+	SharedPaintStats::Counter inCounter_;
+	SharedPaintStats::Counter outCounter_;
+	SharedPaintSnapshot snapshot_;
+	SharedPaintCoalescer coalescer_;
+	SharedPaintJournal journal_;
+	bool journalLoaded_;
+	boost::uint64_t evictSeq_;		// of the last eviction asked of the journal writer
+
+	// the joiners by their handles, a handle is | 2byte generation | 2byte slot + 1 |
+	struct HandleSlot {
+		HandleSlot( void ) : generation(0) { }
+		boost::shared_ptr<SharedPaintClient> client;
+		boost::uint16_t generation;		// a stale handle of a left joiner does not match the next one
+	};
+	std::vector<HandleSlot> handleSlots_;
+	std::vector<size_t> freeHandleSlots_;
+
+	// the joiner list is kept serialized, only a leave or an update makes it rebuilt
+	std::map<std::string, std::string> serializedUsers_;
+	std::string joinerList_;
+	bool joinerListDirty_;
+
+	// the joins and leaves not yet sent to the members with CAPS_PRESENCE_DELTA
+	std::string presenceEvents_;
+	int presenceEventCount_;
+	std::set<std::string> presenceJoined_;		// the joiners in it, the members hear of them before anything they send
+	std::string presenceTimerOwner_;	// the member whose timer flushes them
+	struct Follower {
+		boost::shared_ptr<SharedPaintClient> to;
+		boost::uint16_t code;
+		std::string fromId;
+		std::string toId;
+		SharedPaintOutboundQueue::Payload payload;
+	};
+	std::vector<Follower> presenceFollowers_;	// the greetings of the joiners in it, they go right after it
+
+	// the rate of all the senders, each joiner checks it with its own before it relays
+	boost::shared_ptr<SharedPaintRateLimit> rateLimit_;
+
+	// all work on this room is serialized here, independent of the other rooms
+	boost::recursive_mutex mutex_;
 };
 
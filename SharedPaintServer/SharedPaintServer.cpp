@@ -1,8 +1,40 @@
 #include "Coconut.h"
+#include "SharedPaintLog.h"
 #include "SharedPaintServer.h"
 #include "SharedPaintClient.h"
+#include "SharedPaintStats.h"
+#include "SharedPaintMemory.h"
+
+#define STATS_CLOSE_TIMER		1
+#define STATS_CLOSE_DELAY_MSEC	1000	// let the report go out first
 
 boost::shared_ptr<coconut::ClientController> SharedPaintServer::onAccept(boost::shared_ptr<coconut::TcpSocket> socket) {
+	if( SharedPaintMemoryPtr()->isNearLimit() ) {
+		SharedPaintStatsPtr()->countRejectedConnection();
+		return boost::shared_ptr<SharedPaintBusyClient>(new SharedPaintBusyClient());
+	}
 	boost::shared_ptr<SharedPaintClient> newController(new SharedPaintClient()); 
 	return newController;
 }
+
+boost::shared_ptr<coconut::ClientController> SharedPaintStatsServer::onAccept(boost::shared_ptr<coconut::TcpSocket> socket) {
+	boost::shared_ptr<SharedPaintStatsClient> newController(new SharedPaintStatsClient()); 
+	return newController;
+}
+
+void SharedPaintBusyClient::onConnected( void ) {
+	LOG_INFO("CONNECTION REJECTED : %s, the memory budget is nearly used", tcpSocket()->peerAddress()->ip());
+	tcpSocket()->close();
+}
+
+void SharedPaintStatsClient::onConnected( void ) {
+	std::string report = SharedPaintStatsPtr()->report();
+	tcpSocket()->write( report.c_str(), report.size() );
+	setTimer( STATS_CLOSE_TIMER, STATS_CLOSE_DELAY_MSEC, false );
+}
+
+void SharedPaintStatsClient::onTimer(unsigned short id) {
+	if( STATS_CLOSE_TIMER != id )
+		return;
+	tcpSocket()->close();
+}
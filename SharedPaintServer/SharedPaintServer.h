@@ -1,7 +1,22 @@
 #include "Coconut.h"
 
 #define LISTEN_PORT	10888
+#define STATS_LISTEN_PORT	10889	// a plain text report for each connection, keep it behind the firewall
 
 class SharedPaintServer : public coconut::ServerController {
 	virtual boost::shared_ptr<coconut::ClientController> onAccept(boost::shared_ptr<coconut::TcpSocket> socket);
 };
+
+// the memory budget is nearly used, a new connection is closed at once
+class SharedPaintBusyClient : public coconut::ClientController {
+	void onConnected( void );
+};
+
+class SharedPaintStatsServer : public coconut::ServerController {
+	virtual boost::shared_ptr<coconut::ClientController> onAccept(boost::shared_ptr<coconut::TcpSocket> socket);
+};
+
+class SharedPaintStatsClient : public coconut::ClientController {
+	void onConnected( void );
+	void onTimer(unsigned short id);
+};
@@ -0,0 +1,183 @@
+#include "Coconut.h"
+#include "SharedPaintLog.h"
+#include "SharedPaintSnapshot.h"
+#include "SharedPaintCodeDefine.h"
+#include "SharedPaintMemory.h"
+
+void SharedPaintSnapshot::State::apply( const Packet &packet ) {
+
+	switch( packet.code ) {
+		case CODE_WINDOW_RESIZE_MAIN_WND:
+		case CODE_WINDOW_RESIZE_CANVAS:
+		case CODE_WINDOW_RESIZE_WND_SPLITTER:
+		case CODE_WINDOW_CHANGE_CANVAS_SCROLL_POS:
+		case CODE_PAINT_SET_BG_GRID_LINE:
+		case CODE_PAINT_SET_BG_COLOR:
+		case CODE_PAINT_SET_BG_IMAGE:
+		case CODE_SYSTEM_HISTORY_USER_LIST:
+			size -= latest[packet.code].size();
+			latest[packet.code] = packet;
+			size += packet.size();
+			break;
+		case CODE_PAINT_CLEAR_BG:
+			size -= latest[CODE_PAINT_SET_BG_IMAGE].size();
+			latest.erase( CODE_PAINT_SET_BG_IMAGE );
+			break;
+		case CODE_PAINT_CLEAR_SCREEN:
+			// same as the client's clearAllItems()
+			for( size_t i = 0; i < history.size(); i++ ) 
+				size -= history[i].size();
+			history.clear();
+			size -= latest[CODE_PAINT_SET_BG_COLOR].size() + latest[CODE_PAINT_SET_BG_IMAGE].size() + latest[CODE_SYSTEM_HISTORY_USER_LIST].size();
+			latest.erase( CODE_PAINT_SET_BG_COLOR );
+			latest.erase( CODE_PAINT_SET_BG_IMAGE );
+			latest.erase( CODE_SYSTEM_HISTORY_USER_LIST );
+			break;
+		case CODE_PAINT_CREATE_ITEM:
+		case CODE_TASK_EXECUTE:
+			history.push_back( packet );
+			size += packet.size();
+			break;
+		default:
+			break;	// not a part of the canvas
+	}
+}
+
+bool SharedPaintSnapshot::isCanvasCode( boost::uint16_t code ) {
+
+	switch( code & ~CODE_FLAG_COMPRESSED ) {
+		case CODE_WINDOW_RESIZE_MAIN_WND:
+		case CODE_WINDOW_RESIZE_CANVAS:
+		case CODE_WINDOW_RESIZE_WND_SPLITTER:
+		case CODE_WINDOW_CHANGE_CANVAS_SCROLL_POS:
+		case CODE_PAINT_SET_BG_GRID_LINE:
+		case CODE_PAINT_SET_BG_COLOR:
+		case CODE_PAINT_SET_BG_IMAGE:
+		case CODE_SYSTEM_HISTORY_USER_LIST:
+		case CODE_PAINT_CLEAR_BG:
+		case CODE_PAINT_CLEAR_SCREEN:
+		case CODE_PAINT_CREATE_ITEM:
+		case CODE_TASK_EXECUTE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+SharedPaintSnapshot::~SharedPaintSnapshot( void ) {
+	if( chargedBytes_ > 0 )
+		SharedPaintMemoryPtr()->release( SharedPaintMemory::SNAPSHOT, chargedBytes_ );
+}
+
+void SharedPaintSnapshot::updateCharge( void ) {
+	if( state_.size > chargedBytes_ )
+		SharedPaintMemoryPtr()->charge( SharedPaintMemory::SNAPSHOT, state_.size - chargedBytes_ );
+	else if( state_.size < chargedBytes_ )
+		SharedPaintMemoryPtr()->release( SharedPaintMemory::SNAPSHOT, chargedBytes_ - state_.size );
+	chargedBytes_ = state_.size;
+}
+
+void SharedPaintSnapshot::reset( void ) {
+	valid_ = false;
+	abortSeed();
+	state_.clear();
+	requiredCaps_ = 0;
+	updateCharge();
+}
+
+void SharedPaintSnapshot::beginSeed( const std::string &runnerId, const std::string &targetId, boost::uint32_t targetCaps ) {
+	seeding_ = true;
+	seedStarted_ = false;
+	seedRunner_ = runnerId;
+	seedTarget_ = targetId;
+	seedCaps_ = targetCaps;	// the runner encodes the upload for the target
+	pendingLive_.clear();
+	pendingCaps_ = 0;
+}
+
+void SharedPaintSnapshot::abortSeed( void ) {
+	seeding_ = false;
+	seedStarted_ = false;
+	seedRunner_.clear();
+	seedTarget_.clear();
+	pendingLive_.clear();
+	pendingCaps_ = 0;
+}
+
+SharedPaintSnapshot::Change SharedPaintSnapshot::onPacket( const std::string &senderId, boost::uint32_t senderCaps, boost::uint16_t code, const std::string &toId, const SharedPaintOutboundQueue::Payload &payload ) {
+
+	code &= ~CODE_FLAG_COMPRESSED;
+
+	Change change = CHANGE_NONE;
+	if( seeding_ && senderId == seedRunner_ && toId == seedTarget_ ) {
+		if( code == CODE_SYSTEM_SYNC_START ) {
+			state_.clear();
+			updateCharge();
+			seedStarted_ = true;
+			return CHANGE_NONE;
+		}
+
+		if( !seedStarted_ )
+			return CHANGE_NONE;
+
+		if( code == CODE_SYSTEM_SYNC_COMPLETE ) {
+			// the live packets relayed during the upload come after it
+			for( size_t i = 0; i < pendingLive_.size(); i++ ) 
+				state_.apply( pendingLive_[i] );
+
+			requiredCaps_ = seedCaps_ | pendingCaps_;
+			valid_ = true;
+			abortSeed();
+			change = CHANGE_SEEDED;
+			LOG_DEBUG("SNAPSHOT SEEDED : %d bytes", (int)state_.size);
+		} else {
+			state_.apply( Packet( code, payload ) );
+		}
+	} else if( toId.empty() ) {
+		if( seeding_ ) {
+			pendingLive_.push_back( Packet( code, payload ) );
+			pendingCaps_ |= senderCaps;
+			return CHANGE_NONE;
+		}
+
+		if( !valid_ )
+			return CHANGE_NONE;
+
+		state_.apply( Packet( code, payload ) );
+		requiredCaps_ |= senderCaps;
+		change = CHANGE_APPLIED;
+	}
+
+	if( state_.size > ROOM_SNAPSHOT_MAX_SIZE ) {
+		LOG_DEBUG("SNAPSHOT TOO BIG : %d bytes", (int)state_.size);
+		bool wasValid = valid_;
+		reset();
+		return wasValid ? CHANGE_RESET : CHANGE_NONE;
+	}
+	updateCharge();
+	return change;
+}
+
+void SharedPaintSnapshot::restore( const std::vector<Packet> &packets, boost::uint32_t requiredCaps ) {
+	reset();
+	for( size_t i = 0; i < packets.size(); i++ ) 
+		state_.apply( packets[i] );
+	requiredCaps_ = requiredCaps;
+	valid_ = true;
+	updateCharge();
+}
+
+std::vector<SharedPaintSnapshot::Packet> SharedPaintSnapshot::packets( void ) const {
+
+	std::vector<Packet> res;
+	res.reserve( state_.latest.size() + state_.history.size() );
+
+	std::map< boost::uint16_t, Packet >::const_iterator it = state_.latest.begin();
+	for( ; it != state_.latest.end(); it++ ) 
+		res.push_back( it->second );
+
+	for( size_t i = 0; i < state_.history.size(); i++ ) 
+		res.push_back( state_.history[i] );
+
+	return res;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include "SharedPaintOutboundQueue.h"
+
+#ifndef ROOM_SNAPSHOT_MAX_SIZE
+#define ROOM_SNAPSHOT_MAX_SIZE	(64 * 1024 * 1024)	// beyond this, the clients sync each other as before
+#endif
+
+#define SNAPSHOT_SEED_TARGET_ID	"@snapshot"		// the target of the upload the relay asks of a first joiner, no client has it
+
+// the paint state of a room, kept from the packets the relay forwards anyway.
+// a late joiner is synced from here without a round trip to another client.
+//
+// the relay never sees the canvas the first joiner brought with it,
+// so the snapshot becomes valid only after it has captured one client sync upload (the seed).
+// with the journal, the first joiner is asked for it at once (SharedPaintRoom::seedFromFirst), a room of one is journaled too.
+// the caller serializes the access (SharedPaintRoom::mutex_).
+class SharedPaintSnapshot {
+public:
+	SharedPaintSnapshot( void ) : valid_(false), seeding_(false), seedStarted_(false), seedCaps_(0), pendingCaps_(0), requiredCaps_(0), chargedBytes_(0) { }
+	~SharedPaintSnapshot( void );
+
+	void reset( void );
+
+	bool isValid( void ) const { return valid_; }
+
+	// the packets may use any encoding their senders know, so the joiner must know them all
+	bool canServe( boost::uint32_t caps ) const { return valid_ && (requiredCaps_ & ~caps) == 0; }
+
+	bool isSeeding( void ) const { return seeding_; }
+	bool isSeedStarted( void ) const { return seedStarted_; }
+	const std::string &seedRunner( void ) const { return seedRunner_; }
+	void beginSeed( const std::string &runnerId, const std::string &targetId, boost::uint32_t targetCaps );
+	void abortSeed( void );
+
+	enum Change {
+		CHANGE_NONE,
+		CHANGE_APPLIED,	// the packet went into the state
+		CHANGE_SEEDED,	// the state is valid from now
+		CHANGE_RESET,	// the state is gone
+	};
+
+	// a packet of this code changes the state
+	static bool isCanvasCode( boost::uint16_t code );
+
+	// every packet relayed in the room goes through here
+	Change onPacket( const std::string &senderId, boost::uint32_t senderCaps, boost::uint16_t code, const std::string &toId, const SharedPaintOutboundQueue::Payload &payload );
+
+	struct Packet {
+		Packet( void ) : code(0) { }
+		Packet( boost::uint16_t c, const SharedPaintOutboundQueue::Payload &p ) : code(c), payload(p) { }
+		boost::uint16_t code;
+		SharedPaintOutboundQueue::Payload payload;	// shared with the outbound queues
+		size_t size( void ) const { return payload ? payload->size() : 0; }
+	};
+
+	// the stored packets in order, without the sync start/complete
+	std::vector<Packet> packets( void ) const;
+
+	size_t size( void ) const { return state_.size; }
+	boost::uint32_t requiredCaps( void ) const { return requiredCaps_; }
+
+	// a valid state from the packets of packets(), or of onPacket() in order (SharedPaintJournal)
+	void restore( const std::vector<Packet> &packets, boost::uint32_t requiredCaps );
+
+private:
+	struct State {
+		State( void ) : size(0) { }
+		std::map< boost::uint16_t, Packet > latest;	// code => the last packet of it
+		std::vector< Packet > history;				// items and tasks in order
+		size_t size;
+
+		void clear( void ) { latest.clear(); history.clear(); size = 0; }
+		void apply( const Packet &packet );
+	};
+
+	void updateCharge( void );
+
+	bool valid_;
+	bool seeding_;
+	bool seedStarted_;
+	std::string seedRunner_;
+	std::string seedTarget_;
+	boost::uint32_t seedCaps_;
+	std::vector< Packet > pendingLive_;	// relayed while seeding
+	boost::uint32_t pendingCaps_;
+
+	State state_;
+	boost::uint32_t requiredCaps_;
+	size_t chargedBytes_;		// to SharedPaintMemory, the state
+};
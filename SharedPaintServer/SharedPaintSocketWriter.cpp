@@ -0,0 +1,225 @@
+#include "Coconut.h"
+#include "SharedPaintLog.h"
+#include "SharedPaintSocketWriter.h"
+#include <boost/bind.hpp>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstring>
+#include <algorithm>
+
+SharedPaintSocketWriter::SharedPaintSocketWriter( int fd, const boost::function<void (void)> &onDrained )
+	: fd_(-1), onDrained_(onDrained), offset_(0), pendingBytes_(0), watching_(false), closed_(false) {
+	if( fd >= 0 )
+		fd_ = ::dup( fd );
+	if( fd_ < 0 )
+		LOG_INFO("SOCKET WRITER FAILED : %d, %d", fd, errno);
+}
+
+SharedPaintSocketWriter::~SharedPaintSocketWriter( void ) {
+	if( fd_ >= 0 )
+		::close( fd_ );
+}
+
+void SharedPaintSocketWriter::write( const std::vector<Payload> &payloads ) {
+	if( payloads.empty() )
+		return;
+	{
+		boost::mutex::scoped_lock autolock(mutex_);
+		if( closed_ || fd_ < 0 )
+			return;
+
+		for( size_t i = 0; i < payloads.size(); i++ ) {
+			if( payloads[i]->empty() )
+				continue;
+			pending_.push_back( payloads[i] );
+			pendingBytes_ += payloads[i]->size();
+		}
+		if( watching_ )
+			return;	// behind the ones waiting for the socket
+
+		drain();
+		if( closed_ || pending_.empty() )
+			return;
+		watching_ = true;
+	}
+	SharedPaintWriteWatcherPtr()->watch( shared_from_this() );
+}
+
+void SharedPaintSocketWriter::close( void ) {
+	bool watching = false;
+	{
+		boost::mutex::scoped_lock autolock(mutex_);
+		if( closed_ )
+			return;
+		closed_ = true;
+		watching = watching_;
+		pending_.clear();
+		pendingBytes_ = 0;
+		offset_ = 0;
+		if( fd_ >= 0 )
+			::shutdown( fd_, SHUT_RDWR );	// the descriptor of the library is closed by it, the socket goes with this
+	}
+	if( watching )
+		SharedPaintWriteWatcherPtr()->wakeup();
+}
+
+void SharedPaintSocketWriter::onWritable( void ) {
+	size_t before = 0, after = 0;
+	bool rewatch = false;
+	{
+		boost::mutex::scoped_lock autolock(mutex_);
+		watching_ = false;
+		if( closed_ )
+			return;
+
+		before = pendingBytes_;
+		drain();
+		after = pendingBytes_;
+		if( !closed_ && !pending_.empty() ) {
+			watching_ = true;
+			rewatch = true;
+		}
+	}
+	if( rewatch )
+		SharedPaintWriteWatcherPtr()->watch( shared_from_this() );
+
+	// not under the own lock, the owner writes on from here
+	if( after < before && onDrained_ )
+		onDrained_();
+}
+
+// under the lock. false : the kernel has not taken all of it
+bool SharedPaintSocketWriter::drain( void ) {
+	struct iovec iov[SOCKET_WRITER_MAX_IOV];
+	while( !pending_.empty() ) {
+		size_t count = 0;
+		for( std::deque<Payload>::iterator it = pending_.begin(); it != pending_.end() && count < SOCKET_WRITER_MAX_IOV; it++, count++ ) {
+			size_t skip = (count == 0 ? offset_ : 0);
+			iov[count].iov_base = (void *)((*it)->c_str() + skip);
+			iov[count].iov_len = (*it)->size() - skip;
+		}
+
+		struct msghdr msg;
+		memset( &msg, 0, sizeof(msg) );
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t sent = ::sendmsg( fd_, &msg, MSG_NOSIGNAL | MSG_DONTWAIT );
+		if( sent < 0 ) {
+			if( errno == EINTR )
+				continue;
+			if( errno == EAGAIN || errno == EWOULDBLOCK )
+				return false;
+
+			// the library sees the broken connection on its side and closes the client
+			LOG_DEBUG("SOCKET WRITE FAILED : %d, %d", fd_, errno);
+			closed_ = true;
+			pending_.clear();
+			pendingBytes_ = 0;
+			offset_ = 0;
+			return true;
+		}
+
+		pendingBytes_ -= sent;
+		size_t rest = sent;
+		while( rest > 0 ) {
+			size_t size = std::min( rest, pending_.front()->size() - offset_ );
+			offset_ += size;
+			rest -= size;
+			if( offset_ == pending_.front()->size() ) {
+				pending_.pop_front();
+				offset_ = 0;
+			}
+		}
+	}
+	return true;
+}
+
+
+SharedPaintWriteWatcher::SharedPaintWriteWatcher( void ) {
+	if( ::pipe( pipe_ ) != 0 ) {
+		LOG_FATAL("WRITE WATCHER PIPE FAILED : %d", errno);
+		pipe_[0] = pipe_[1] = -1;
+		return;
+	}
+	::fcntl( pipe_[0], F_SETFL, ::fcntl( pipe_[0], F_GETFL ) | O_NONBLOCK );
+	::fcntl( pipe_[1], F_SETFL, ::fcntl( pipe_[1], F_GETFL ) | O_NONBLOCK );
+
+	thread_ = boost::shared_ptr<boost::thread>( new boost::thread( boost::bind( &SharedPaintWriteWatcher::run, this ) ) );
+}
+
+void SharedPaintWriteWatcher::watch( const boost::shared_ptr<SharedPaintSocketWriter> &writer ) {
+	{
+		boost::mutex::scoped_lock autolock(mutex_);
+		added_.push_back( writer );
+	}
+	wakeup();
+}
+
+void SharedPaintWriteWatcher::wakeup( void ) {
+	char c = 0;
+	if( ::write( pipe_[1], &c, 1 ) < 0 && errno != EAGAIN )
+		LOG_DEBUG("WRITE WATCHER WAKEUP FAILED : %d", errno);	// a full pipe wakes it anyway
+}
+
+void SharedPaintWriteWatcher::run( void ) {
+
+	std::vector< boost::shared_ptr<SharedPaintSocketWriter> > watched;
+	std::vector< boost::shared_ptr<SharedPaintSocketWriter> > ready;
+	std::vector< boost::shared_ptr<SharedPaintSocketWriter> > rest;
+	std::vector<struct pollfd> fds;
+	for( ;; ) {
+		{
+			boost::mutex::scoped_lock autolock(mutex_);
+			watched.insert( watched.end(), added_.begin(), added_.end() );
+			added_.clear();
+		}
+
+		fds.resize( 1 );
+		fds[0].fd = pipe_[0];
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		rest.clear();
+		for( size_t i = 0; i < watched.size(); i++ ) {
+			if( watched[i]->isClosed() )
+				continue;	// let go, its descriptor is closed with it
+			struct pollfd pfd;
+			pfd.fd = watched[i]->fd();
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			fds.push_back( pfd );
+			rest.push_back( watched[i] );
+		}
+		watched.swap( rest );
+
+		if( ::poll( &fds[0], fds.size(), -1 ) < 0 ) {
+			if( errno != EINTR )
+				LOG_INFO("WRITE WATCHER POLL FAILED : %d", errno);
+			continue;
+		}
+
+		if( fds[0].revents ) {
+			char buf[64];
+			while( ::read( pipe_[0], buf, sizeof(buf) ) > 0 )
+				;
+		}
+
+		// an error or a hang up is found by the next write too
+		ready.clear();
+		rest.clear();
+		for( size_t i = 0; i < watched.size(); i++ ) {
+			if( fds[i + 1].revents )
+				ready.push_back( watched[i] );
+			else
+				rest.push_back( watched[i] );
+		}
+		watched.swap( rest );
+
+		for( size_t i = 0; i < ready.size(); i++ )
+			ready[i]->onWritable();
+		ready.clear();
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include "Singleton.h"
+
+#define SharedPaintWriteWatcherPtr()	CSingleton<SharedPaintWriteWatcher>::Instance()
+
+#ifndef SOCKET_WRITER_MAX_IOV
+#define SOCKET_WRITER_MAX_IOV		64		// payloads per one sendmsg
+#endif
+
+// the output of a client socket, written by the relay itself rather than through the library,
+// so that it knows when the kernel has taken the bytes.
+// it keeps its own descriptor of the socket (a dup), so a close by the library does not make it write to another socket.
+// what the kernel does not take waits here, in the shared payloads, and the socket is watched until it is writable again
+// (SharedPaintWriteWatcher). the owner is told each time some of it has gone.
+// the payloads go to the kernel as they are, several in one vectored send, they are not copied into a batch.
+class SharedPaintSocketWriter : public boost::enable_shared_from_this<SharedPaintSocketWriter>
+{
+public:
+	typedef boost::shared_ptr<const std::string> Payload;
+
+	SharedPaintSocketWriter( int fd, const boost::function<void (void)> &onDrained );
+	~SharedPaintSocketWriter( void );
+
+	bool isOpen( void ) const { return fd_ >= 0; }
+
+	// in order, after the ones still pending
+	void write( const std::vector<Payload> &payloads );
+
+	// handed over, not taken by the kernel yet
+	size_t pendingBytes( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		return pendingBytes_;
+	}
+
+	// no more writes, the connection is shut down
+	void close( void );
+	bool isClosed( void ) {
+		boost::mutex::scoped_lock autolock(mutex_);
+		return closed_;
+	}
+
+	int fd( void ) const { return fd_; }
+
+	// the watcher thread
+	void onWritable( void );
+
+private:
+	bool drain( void );
+
+private:
+	int fd_;
+	boost::function<void (void)> onDrained_;
+	std::deque<Payload> pending_;
+	size_t offset_;			// sent of the front payload
+	size_t pendingBytes_;
+	bool watching_;
+	bool closed_;
+	boost::mutex mutex_;
+};
+
+
+// one thread which polls the sockets the kernel has not taken everything of, until they are writable.
+class SharedPaintWriteWatcher
+{
+public:
+	SharedPaintWriteWatcher( void );
+
+	void watch( const boost::shared_ptr<SharedPaintSocketWriter> &writer );
+
+	// a watched writer is closed, it is let go
+	void wakeup( void );
+
+private:
+	void run( void );
+
+private:
+	std::vector< boost::shared_ptr<SharedPaintSocketWriter> > added_;
+	int pipe_[2];
+	boost::mutex mutex_;
+	boost::shared_ptr<boost::thread> thread_;
+};
@@ -0,0 +1,160 @@
+#include "Coconut.h"
+#include <cstdarg>
+#include "SharedPaintStats.h"
+#include "SharedPaintCodeDefine.h"
+#include "SharedPaintManager.h"
+#include "SharedPaintMemory.h"
+
+SharedPaintStats::SharedPaintStats( void ) : local_(&SharedPaintStats::keep) {
+	startTime_ = lastReportTime_ = boost::posix_time::microsec_clock::universal_time();
+}
+
+SharedPaintStats::Counters &SharedPaintStats::local( void ) {
+	Counters *counters = local_.get();
+	if( !counters ) {
+		counters = new Counters;
+		local_.reset( counters );
+
+		boost::mutex::scoped_lock autolock(mutex_);
+		blocks_.push_back( counters );
+	}
+	return *counters;
+}
+
+void SharedPaintStats::sum( Counters &total ) {
+	for( size_t i = 0; i < blocks_.size(); i++ ) {
+		const Counters &c = *blocks_[i];
+		for( int code = 0; code < STATS_CODE_COUNT; code++ ) {
+			total.in[code].add( c.in[code].bytes, c.in[code].packets );
+			total.out[code].add( c.out[code].bytes, c.out[code].packets );
+		}
+		total.accepted += c.accepted;
+		total.closed += c.closed;
+		total.slowConsumers += c.slowConsumers;
+		total.coalesced += c.coalesced;
+		total.rejectedConnections += c.rejectedConnections;
+		total.rejectedJoins += c.rejectedJoins;
+		total.rejectedPackets += c.rejectedPackets;
+		total.throttleDelayed += c.throttleDelayed;
+		total.throttleDropped += c.throttleDropped;
+		total.throttleDisconnects += c.throttleDisconnects;
+		total.writes += c.writes;
+	}
+}
+
+void SharedPaintStats::countSync( int msec, bool fromSnapshot ) {
+	boost::mutex::scoped_lock autolock(mutex_);
+
+	Durations &stats = fromSnapshot ? snapshotSync_ : clientSync_;
+	stats.count++;
+	stats.total += msec;
+	if( msec > stats.max )
+		stats.max = msec;
+}
+
+void SharedPaintStats::countClusterHop( boost::uint64_t usec ) {
+	boost::mutex::scoped_lock autolock(mutex_);
+
+	clusterHop_.count++;
+	clusterHop_.total += usec;
+	if( (int)usec > clusterHop_.max )
+		clusterHop_.max = (int)usec;
+}
+
+static std::string format( const char *fmt, ... ) {
+	char buf[512];
+	va_list args;
+	va_start( args, fmt );
+	vsnprintf( buf, sizeof(buf), fmt, args );
+	va_end( args );
+	return buf;
+}
+
+static double rate( boost::uint64_t now, boost::uint64_t before, double sec ) {
+	return sec > 0 ? (double)(now - before) / sec : 0;
+}
+
+std::string SharedPaintStats::report( void ) {
+
+	// the rooms first, not to hold our lock under the room locks
+	std::vector<RoomStats> rooms;
+	SharedPaintManagerPtr()->collectRoomStats( rooms );
+
+	boost::mutex::scoped_lock autolock(mutex_);
+
+	Counters total;
+	sum( total );
+
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	double sec = (now - lastReportTime_).total_milliseconds() / 1000.0;
+
+	std::string res;
+	res += format( "uptime %d sec, interval %.1f sec\n", (int)(now - startTime_).total_seconds(), sec );
+	res += format( "connections active %d, accepted %llu, closed %llu, slow consumers %llu\n", 
+		(int)(total.accepted - total.closed), (unsigned long long)total.accepted, (unsigned long long)total.closed, (unsigned long long)total.slowConsumers );
+
+	Counter allIn, allOut, lastIn, lastOut;
+	for( int code = 0; code < STATS_CODE_COUNT; code++ ) {
+		allIn.add( total.in[code].bytes, total.in[code].packets );
+		allOut.add( total.out[code].bytes, total.out[code].packets );
+		lastIn.add( lastTotal_.in[code].bytes, lastTotal_.in[code].packets );
+		lastOut.add( lastTotal_.out[code].bytes, lastTotal_.out[code].packets );
+	}
+	SharedPaintMemory::Usage memory = SharedPaintMemoryPtr()->usage();
+	res += format( "memory receive %llu, outbound %llu, snapshot %llu, peak %llu of %llu bytes\n", 
+		(unsigned long long)memory.used[SharedPaintMemory::RECEIVE], (unsigned long long)memory.used[SharedPaintMemory::OUTBOUND], 
+		(unsigned long long)memory.used[SharedPaintMemory::SNAPSHOT], 
+		(unsigned long long)memory.peak, (unsigned long long)MEMORY_BUDGET_BYTES );
+	res += format( "rejected connections %llu, joins %llu, packets %llu\n", (unsigned long long)total.rejectedConnections, 
+		(unsigned long long)total.rejectedJoins, (unsigned long long)total.rejectedPackets );
+	res += format( "throttled delayed %llu, %.1f pkt/s, dropped %llu, %.1f pkt/s, disconnected %llu\n", 
+		(unsigned long long)total.throttleDelayed, rate( total.throttleDelayed, lastTotal_.throttleDelayed, sec ), 
+		(unsigned long long)total.throttleDropped, rate( total.throttleDropped, lastTotal_.throttleDropped, sec ), 
+		(unsigned long long)total.throttleDisconnects );
+	res += format( "coalesced %llu, %.1f pkt/s\n", (unsigned long long)total.coalesced, rate( total.coalesced, lastTotal_.coalesced, sec ) );
+	res += format( "total in %.1f pkt/s %.1f B/s, out %.1f pkt/s %.1f B/s\n", 
+		rate( allIn.packets, lastIn.packets, sec ), rate( allIn.bytes, lastIn.bytes, sec ), 
+		rate( allOut.packets, lastOut.packets, sec ), rate( allOut.bytes, lastOut.bytes, sec ) );
+
+	res += format( "socket writes %llu, %.1f /s, %.1f packets each\n", (unsigned long long)total.writes, rate( total.writes, lastTotal_.writes, sec ), 
+		total.writes > lastTotal_.writes ? (double)(allOut.packets - lastOut.packets) / (total.writes - lastTotal_.writes) : 0.0 );
+
+	res += "\n# code in_pkts in_bytes in_pkt/s in_B/s out_pkts out_bytes out_pkt/s out_B/s\n";
+	for( int code = 0; code < STATS_CODE_COUNT; code++ ) {
+		const Counter &in = total.in[code], &out = total.out[code];
+		if( in.packets == 0 && out.packets == 0 )
+			continue;
+		res += format( "code %d %llu %llu %.1f %.1f %llu %llu %.1f %.1f\n", code, 
+			(unsigned long long)in.packets, (unsigned long long)in.bytes, 
+			rate( in.packets, lastTotal_.in[code].packets, sec ), rate( in.bytes, lastTotal_.in[code].bytes, sec ),
+			(unsigned long long)out.packets, (unsigned long long)out.bytes, 
+			rate( out.packets, lastTotal_.out[code].packets, sec ), rate( out.bytes, lastTotal_.out[code].bytes, sec ) );
+	}
+
+	res += "\n# sync count avg_msec max_msec\n";
+	res += format( "sync client %llu %d %d\n", (unsigned long long)clientSync_.count, 
+		clientSync_.count ? (int)(clientSync_.total / clientSync_.count) : 0, clientSync_.max );
+	res += format( "sync snapshot %llu %d %d\n", (unsigned long long)snapshotSync_.count, 
+		snapshotSync_.count ? (int)(snapshotSync_.total / snapshotSync_.count) : 0, snapshotSync_.max );
+
+	res += format( "cluster hop %llu %d %d (usec)\n", (unsigned long long)clusterHop_.count, 
+		clusterHop_.count ? (int)(clusterHop_.total / clusterHop_.count) : 0, clusterHop_.max );
+
+	res += "\n# room users in_pkt/s in_B/s out_pkt/s out_B/s queued_bytes queued_pkts max_client_queued_bytes delayed_pkts dropped_pkts\n";
+	std::map< std::string, std::pair<Counter, Counter> > lastRooms;
+	for( size_t i = 0; i < rooms.size(); i++ ) {
+		const RoomStats &room = rooms[i];
+		std::pair<Counter, Counter> &last = lastRooms_[ room.roomId ];
+		res += format( "room %s %d %.1f %.1f %.1f %.1f %d %d %d %llu %llu\n", room.roomId.c_str(), (int)room.userCount,
+			rate( room.in.packets, last.first.packets, sec ), rate( room.in.bytes, last.first.bytes, sec ),
+			rate( room.out.packets, last.second.packets, sec ), rate( room.out.bytes, last.second.bytes, sec ),
+			(int)room.queuedBytes, (int)room.queuedPackets, (int)room.maxQueuedBytes, 
+			(unsigned long long)room.delayedPackets, (unsigned long long)room.droppedPackets );
+		lastRooms[ room.roomId ] = std::make_pair( room.in, room.out );
+	}
+
+	lastRooms_.swap( lastRooms );
+	lastTotal_ = total;
+	lastReportTime_ = now;
+	return res;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "Singleton.h"
+#include "SharedPaintCodeDefine.h"
+
+#define SharedPaintStatsPtr()		CSingleton<SharedPaintStats>::Instance()
+
+#ifndef STATS_CODE_COUNT
+#define STATS_CODE_COUNT	64		// the packet codes are indexed by their low bits
+#endif
+
+// the relay counters, cheap enough to stay on.
+// every io thread counts into its own block without a lock, the blocks are summed up when a report is made.
+// the room counters live in the rooms (SharedPaintRoom::inCounter_, outCounter_) under the room lock that is held anyway.
+class SharedPaintStats
+{
+public:
+	struct Counter {
+		Counter( void ) : packets(0), bytes(0) { }
+		boost::uint64_t packets;
+		boost::uint64_t bytes;
+		void add( size_t size, boost::uint64_t count = 1 ) { packets += count; bytes += size; }
+	};
+
+	struct Counters {
+		Counters( void ) : accepted(0), closed(0), slowConsumers(0), coalesced(0), 
+			rejectedConnections(0), rejectedJoins(0), rejectedPackets(0), 
+			throttleDelayed(0), throttleDropped(0), throttleDisconnects(0), writes(0) { }
+		Counter in[STATS_CODE_COUNT];
+		Counter out[STATS_CODE_COUNT];
+		boost::uint64_t accepted;
+		boost::uint64_t closed;
+		boost::uint64_t slowConsumers;
+		boost::uint64_t coalesced;
+		boost::uint64_t rejectedConnections;	// SharedPaintMemory
+		boost::uint64_t rejectedJoins;
+		boost::uint64_t rejectedPackets;
+		boost::uint64_t throttleDelayed;	// SharedPaintRateLimit
+		boost::uint64_t throttleDropped;
+		boost::uint64_t throttleDisconnects;
+		boost::uint64_t writes;		// to the client sockets, a batch of packets is one
+	};
+
+	struct RoomStats {
+		RoomStats( void ) : userCount(0), queuedBytes(0), maxQueuedBytes(0), queuedPackets(0), delayedPackets(0), droppedPackets(0) { }
+		std::string roomId;
+		size_t userCount;
+		Counter in;
+		Counter out;
+		size_t queuedBytes;		// all of its clients
+		size_t maxQueuedBytes;	// the most behind client
+		size_t queuedPackets;
+		boost::uint64_t delayedPackets;	// over the rate of the sender or of the room
+		boost::uint64_t droppedPackets;
+	};
+
+	SharedPaintStats( void );
+
+	void countIn( boost::uint16_t code, size_t size ) { local().in[ index( code ) ].add( size ); }
+	void countOut( boost::uint16_t code, size_t size ) { local().out[ index( code ) ].add( size ); }
+	void countAccepted( void ) { local().accepted++; }
+	void countClosed( void ) { local().closed++; }
+	void countSlowConsumer( void ) { local().slowConsumers++; }
+	void countCoalesced( void ) { local().coalesced++; }
+	void countRejectedConnection( void ) { local().rejectedConnections++; }
+	void countRejectedJoin( void ) { local().rejectedJoins++; }
+	void countRejectedPacket( void ) { local().rejectedPackets++; }
+	void countThrottleDelayed( void ) { local().throttleDelayed++; }
+	void countThrottleDropped( void ) { local().throttleDropped++; }
+	void countThrottleDisconnect( void ) { local().throttleDisconnects++; }
+	void countWrite( void ) { local().writes++; }
+
+	// a joiner has got the whole canvas, from a client upload or from the room snapshot
+	void countSync( int msec, bool fromSnapshot );
+
+	// one way between this node and a room owner node, measured by the link ping
+	void countClusterHop( boost::uint64_t usec );
+
+	static boost::uint64_t nowUsec( void ) {
+		static const boost::posix_time::ptime epoch( boost::gregorian::date( 1970, 1, 1 ) );
+		return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+	}
+
+	// plain text, the rates are per second since the previous report
+	std::string report( void );
+
+private:
+	static size_t index( boost::uint16_t code ) { return (code & ~CODE_FLAG_COMPRESSED) % STATS_CODE_COUNT; }
+	static void keep( Counters * ) { }	// the block outlives its thread, its counts still add up
+
+	Counters &local( void );
+	void sum( Counters &total );
+
+	struct Durations {
+		Durations( void ) : count(0), total(0), max(0) { }
+		boost::uint64_t count;
+		boost::uint64_t total;
+		int max;
+	};
+
+private:
+	boost::thread_specific_ptr<Counters> local_;
+	std::vector<Counters *> blocks_;
+	boost::mutex mutex_;
+
+	Durations clientSync_;		// in msec, like the snapshot sync
+	Durations snapshotSync_;
+	Durations clusterHop_;	// in usec
+
+	// the previous report
+	boost::posix_time::ptime startTime_;
+	boost::posix_time::ptime lastReportTime_;
+	Counters lastTotal_;
+	std::map< std::string, std::pair<Counter, Counter> > lastRooms_;
+};
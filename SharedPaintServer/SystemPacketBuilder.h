@@ -26,6 +26,29 @@ namespace SystemPacketBuilder {
 			}
 	};
 
+	class VersionInfo{
+		public:
+			// | version 1byte string | protocol version 1byte string | 4byte capabilities (optional) |
+			static bool parse( const std::string &body, boost::uint32_t &caps ) {
+
+				int pos = 0;
+				try
+				{
+					std::string version, protVersion;
+					pos += PacketBufferUtil::readString8( body, pos, version );
+					pos += PacketBufferUtil::readString8( body, pos, protVersion );
+
+					caps = 0;
+					if( body.size() >= (size_t)pos + 4 )
+						pos += PacketBufferUtil::readInt32( body, pos, caps, true );
+					return true;
+				}catch(...)
+				{
+				}
+				return false;
+			}
+	};
+
 	class ChangeSuperPeer{
 		public:
 			static boost::shared_ptr<SharedPaintProtocol> make( boost::shared_ptr<SharedPaintClient> superPeer ) {
@@ -79,6 +102,53 @@ namespace SystemPacketBuilder {
 
 	};
 
+	class SyncStart {
+		public:
+			static boost::shared_ptr<SharedPaintProtocol> make( const std::string &channel, const std::string &target )
+			{
+				int pos = 0;
+				try
+				{
+					boost::shared_ptr<SharedPaintProtocol> prot(new SharedPaintProtocol);
+
+					std::string body;
+					pos += PacketBufferUtil::writeString8( body, pos, channel );
+
+					SharedPaintHeader::HeaderData data;
+					data.code = CODE_SYSTEM_SYNC_START;
+					data.toId = target;
+					prot->header().setData( data );
+					prot->setPayload( body.c_str(), body.size() );
+					prot->processSerialize();
+					return prot;
+				}catch(...)
+				{
+				}
+				return boost::shared_ptr<SharedPaintProtocol>();
+			}
+	};
+
+	class SyncComplete {
+		public:
+			static boost::shared_ptr<SharedPaintProtocol> make( const std::string &target )
+			{
+				try
+				{
+					boost::shared_ptr<SharedPaintProtocol> prot(new SharedPaintProtocol);
+
+					SharedPaintHeader::HeaderData data;
+					data.code = CODE_SYSTEM_SYNC_COMPLETE;
+					data.toId = target;
+					prot->header().setData( data );
+					prot->processSerialize();
+					return prot;
+				}catch(...)
+				{
+				}
+				return boost::shared_ptr<SharedPaintProtocol>();
+			}
+	};
+
 	class ResponseJoin {
 		public:
 			static boost::shared_ptr<SharedPaintProtocol> make( const std::string &channel
@@ -159,4 +229,161 @@ namespace SystemPacketBuilder {
 				return boost::shared_ptr<SharedPaintProtocol>();
 			}
 	};
+
+	class Presence {
+		public:
+			enum {
+				EVENT_JOINED = 1,	// | type 1byte | user (CPaintUser::serialize()) |
+				EVENT_LEFT = 2,		// | type 1byte | user id 1byte string |
+			};
+
+			static void writeJoined( std::string &events, const std::string &serializedUser ) {
+				PacketBufferUtil::writeInt8( events, events.size(), EVENT_JOINED );
+				events += serializedUser;
+			}
+
+			static void writeLeft( std::string &events, const std::string &userId ) {
+				PacketBufferUtil::writeInt8( events, events.size(), EVENT_LEFT );
+				PacketBufferUtil::writeString8( events, events.size(), userId );
+			}
+
+			// | channel 1byte string | 2byte event count | events in order |
+			static boost::shared_ptr<SharedPaintProtocol> make( const std::string &channel, int count, const std::string &events )
+			{
+				int pos = 0;
+				try
+				{
+					boost::shared_ptr<SharedPaintProtocol> prot(new SharedPaintProtocol);
+
+					std::string body;
+					pos += PacketBufferUtil::writeString8( body, pos, channel );
+					pos += PacketBufferUtil::writeInt16( body, pos, count, false );
+					pos += PacketBufferUtil::writeBinary( body, pos, events.c_str(), events.size() );
+
+					SharedPaintHeader::HeaderData data;
+					data.code = CODE_SYSTEM_PRESENCE;
+					prot->header().setData( data );
+					prot->setPayload( body.c_str(), body.size() );
+					prot->processSerialize();
+					return prot;
+				}catch(...)
+				{
+				}
+				return boost::shared_ptr<SharedPaintProtocol>();
+			}
+	};
+
+	class SessionHandle {
+		public:
+			static void writeEntry( std::string &entries, boost::uint32_t handle, const std::string &userId ) {
+				PacketBufferUtil::writeInt32( entries, entries.size(), handle, true );
+				PacketBufferUtil::writeString8( entries, entries.size(), userId );
+			}
+
+			// | channel 1byte string | 4byte handle of the receiver (0 : unchanged) | 2byte count | (4byte handle | user id 1byte string) ... |
+			static boost::shared_ptr<SharedPaintProtocol> make( const std::string &channel, boost::uint32_t ownHandle, int count, const std::string &entries )
+			{
+				int pos = 0;
+				try
+				{
+					boost::shared_ptr<SharedPaintProtocol> prot(new SharedPaintProtocol);
+
+					std::string body;
+					pos += PacketBufferUtil::writeString8( body, pos, channel );
+					pos += PacketBufferUtil::writeInt32( body, pos, ownHandle, true );
+					pos += PacketBufferUtil::writeInt16( body, pos, count, false );
+					pos += PacketBufferUtil::writeBinary( body, pos, entries.c_str(), entries.size() );
+
+					SharedPaintHeader::HeaderData data;
+					data.code = CODE_SYSTEM_SESSION_HANDLE;
+					prot->header().setData( data );
+					prot->setPayload( body.c_str(), body.size() );
+					prot->processSerialize();
+					return prot;
+				}catch(...)
+				{
+				}
+				return boost::shared_ptr<SharedPaintProtocol>();
+			}
+	};
+
+	class JoinToServer {
+		public:
+			// the join of a proxied client, with the address the client has connected from.
+			// the rest of the body goes to the owner as it is.
+			static boost::shared_ptr<SharedPaintProtocol> make( const std::string &joinBody, const std::string &viewIp )
+			{
+				int pos = 0;
+				try
+				{
+					std::string roomId, userId, nickName, oldViewIp;
+					pos += PacketBufferUtil::readString8( joinBody, pos, roomId );
+					pos += PacketBufferUtil::readString8( joinBody, pos, userId );
+					pos += PacketBufferUtil::readString8( joinBody, pos, nickName );
+					pos += PacketBufferUtil::readString8( joinBody, pos, oldViewIp );
+
+					std::string body;
+					int wpos = 0;
+					wpos += PacketBufferUtil::writeString8( body, wpos, roomId );
+					wpos += PacketBufferUtil::writeString8( body, wpos, userId );
+					wpos += PacketBufferUtil::writeString8( body, wpos, nickName );
+					wpos += PacketBufferUtil::writeString8( body, wpos, viewIp );
+					body.append( joinBody, pos, std::string::npos );
+
+					boost::shared_ptr<SharedPaintProtocol> prot(new SharedPaintProtocol);
+					SharedPaintHeader::HeaderData data;
+					data.code = CODE_SYSTEM_JOIN_TO_SERVER;
+					prot->header().setData( data );
+					prot->setPayload( body.c_str(), body.size() );
+					prot->processSerialize();
+					return prot;
+				}catch(...)
+				{
+				}
+				return boost::shared_ptr<SharedPaintProtocol>();
+			}
+	};
+
+	class ClusterPing {
+		public:
+			// | 4byte high | 4byte low | of the sender's clock in usec. the receiver echoes it back.
+			static boost::shared_ptr<SharedPaintProtocol> make( boost::uint64_t usec )
+			{
+				int pos = 0;
+				try
+				{
+					boost::shared_ptr<SharedPaintProtocol> prot(new SharedPaintProtocol);
+
+					std::string body;
+					pos += PacketBufferUtil::writeInt32( body, pos, (boost::uint32_t)(usec >> 32), true );
+					pos += PacketBufferUtil::writeInt32( body, pos, (boost::uint32_t)usec, true );
+
+					SharedPaintHeader::HeaderData data;
+					data.code = CODE_SYSTEM_CLUSTER_PING;
+					prot->header().setData( data );
+					prot->setPayload( body.c_str(), body.size() );
+					prot->processSerialize();
+					return prot;
+				}catch(...)
+				{
+				}
+				return boost::shared_ptr<SharedPaintProtocol>();
+			}
+
+			static bool parse( const std::string &body, boost::uint64_t &usec ) {
+
+				int pos = 0;
+				try
+				{
+					boost::uint32_t high, low;
+					pos += PacketBufferUtil::readInt32( body, pos, high, true );
+					pos += PacketBufferUtil::readInt32( body, pos, low, true );
+					usec = ((boost::uint64_t)high << 32) | low;
+					return true;
+				}catch(...)
+				{
+				}
+				return false;
+			}
+	};
 };
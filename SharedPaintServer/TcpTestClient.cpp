@@ -1,4 +1,5 @@
 #include "Coconut.h"
+#include "SharedPaintLog.h"
 #include "TcpTestClient.h"
 
 void TcpTestClient::onConnected( void ) {
@@ -1,13 +1,68 @@
 #include "Coconut.h"
+#include "SharedPaintLog.h"
 #include "SharedPaintClient.h"
 #include "SharedPaintServer.h"
+#include "SharedPaintCluster.h"
+#include "SharedPaintJournal.h"
+
+static void usage( void ) {
+	fprintf( stderr, 
+		"usage : SharedPaintServer [-p port] [-c host:port,host:port,... -n index] [-j dir] [-l level]\n"
+		"  -p : the client port (%d), the stats port is the next one\n"
+		"  -c : all the nodes of the cluster, the same list on every node. the hosts are ip addresses\n"
+		"  -n : the index of this node in the list\n"
+		"  -j : keeps the room canvases in journals under this directory, the rooms are restored from them after a restart\n"
+		"  -l : trace, debug or info (debug)\n", LISTEN_PORT );
+}
 
 int main(int argc, char* argv[]) {
+
+	int listenPort = LISTEN_PORT;
+	std::string clusterNodes;
+	int nodeIndex = -1;
+	std::string journalDir;
+	int logLevel = SharedPaintLog::LEVEL_DEBUG;
+
+	for( int i = 1; i + 1 < argc; i += 2 ) {
+		if( strcmp( argv[i], "-p" ) == 0 )
+			listenPort = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-c" ) == 0 )
+			clusterNodes = argv[i + 1];
+		else if( strcmp( argv[i], "-n" ) == 0 )
+			nodeIndex = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-j" ) == 0 )
+			journalDir = argv[i + 1];
+		else if( strcmp( argv[i], "-l" ) == 0 ) {
+			if( !SharedPaintLog::parseLevel( argv[i + 1], logLevel ) ) {
+				usage();
+				return 1;
+			}
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if( argc % 2 == 0 || listenPort <= 0 ) {
+		usage();
+		return 1;
+	}
+	if( !clusterNodes.empty() && !SharedPaintClusterPtr()->configure( clusterNodes, nodeIndex ) ) {
+		usage();
+		return 1;
+	}
+	if( !journalDir.empty() && !SharedPaintJournalWriterPtr()->start( journalDir ) ) {
+		fprintf( stderr, "can not use the journal directory : %s\n", journalDir.c_str() );
+		return 1;
+	}
 	
 	coconut::IOServiceContainer ioServiceContainer(4);
 	ioServiceContainer.initialize();
 
-	coconut::logger::setLogLevel(coconut::logger::LEVEL_TRACE);
+	// the library logs synchronously, it is kept at the same level
+	coconut::logger::setLogLevel(logLevel == SharedPaintLog::LEVEL_TRACE ? coconut::logger::LEVEL_TRACE : 
+		logLevel == SharedPaintLog::LEVEL_DEBUG ? coconut::logger::LEVEL_DEBUG : coconut::logger::LEVEL_INFO);
+	SharedPaintLog::setLevel( logLevel );
+	SharedPaintLogPtr()->start( stdout );
 	coconut::setUseLittleEndianForNetwork( true );
 	coconut::setEnableDebugMode();
 
@@ -16,13 +71,17 @@ int main(int argc, char* argv[]) {
 	try {
 		boost::shared_ptr<SharedPaintServer> serverController(new SharedPaintServer);
 
-		coconut::NetworkHelper::listenTcp(&ioServiceContainer, LISTEN_PORT, serverController);
+		coconut::NetworkHelper::listenTcp(&ioServiceContainer, listenPort, serverController);
+
+		boost::shared_ptr<SharedPaintStatsServer> statsController(new SharedPaintStatsServer);
+		coconut::NetworkHelper::listenTcp(&ioServiceContainer, listenPort + (STATS_LISTEN_PORT - LISTEN_PORT), statsController);
 
 		LOG_INFO("tcpserver started..");
 		ioServiceContainer.run();
 	} catch(coconut::Exception &e) {
 		LOG_FATAL("Exception emitted : %s\n", e.what());
 	}
+	SharedPaintLogPtr()->stop();
 	return 0;
 }
 
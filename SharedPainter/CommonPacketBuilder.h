@@ -29,24 +29,156 @@
 
 #pragma once
 
+#include <QByteArray>
 #include "PacketBuffer.h"
+#include "PacketCodeDefine.h"
+
+#ifndef COMPRESS_THRESHOLD_SIZE
+#define COMPRESS_THRESHOLD_SIZE		512
+#endif
 
 
 namespace CommonPacketBuilder
 {
+	static std::string emptyString;
+
+	inline size_t headerSize( const std::string *fromId = NULL, const std::string *toId = NULL )
+	{
+		return 2 + 2 + (1 + (fromId ? fromId->size() : 0)) + (1 + (toId ? toId->size() : 0)) + 4;
+	}
+
+	inline size_t string8Size( const std::string &value ) { return 1 + value.size(); }
+	inline size_t string16Size( const std::string &value ) { return 2 + value.size(); }
+	inline size_t string32Size( const std::string &value ) { return 4 + value.size(); }
+
+	//
+	// append-only packet writer.
+	// the caller passes the final body size, so the header and the body go into one allocation.
+	// the body written must be exactly that size, the destructor checks it.
+	//
+	class CPacketWriter
+	{
+	public:
+		CPacketWriter( std::string &buf, boost::int16_t code, size_t bodySize, const std::string *fromId = NULL, const std::string *toId = NULL ) : buf_(buf)
+		{
+			end_ = buf_.size() + headerSize( fromId, toId ) + bodySize;
+			buf_.reserve( end_ );
+
+			writeInt16( NET_MAGIC_CODE );
+			writeInt16( code );
+			writeString8( fromId ? *fromId : emptyString );
+			writeString8( toId ? *toId : emptyString );
+			writeInt32( bodySize );
+		}
+
+		~CPacketWriter( void )
+		{
+			// a size function of the builder does not match what it writes
+			assert( std::uncaught_exception() || buf_.size() == end_ );
+		}
+
+		void writeDouble( double value ) { CPacketBufferUtil::writeDouble( buf_, buf_.size(), value, true ); }
+		void writeInt32( boost::uint32_t value ) { CPacketBufferUtil::writeInt32( buf_, buf_.size(), value, true ); }
+		void writeInt16( boost::uint16_t value ) { CPacketBufferUtil::writeInt16( buf_, buf_.size(), value, true ); }
+		void writeInt8( boost::uint8_t value ) { CPacketBufferUtil::writeInt8( buf_, buf_.size(), value ); }
+		void writeVarInt32( boost::uint32_t value ) { CPacketBufferUtil::writeVarInt32( buf_, buf_.size(), value ); }
+		void writeBinary( const void *data, size_t size ) { buf_.append( (const char *)data, size ); }
+		void writeBinary( const std::string &data ) { buf_.append( data ); }
+		void writeString8( const std::string &value ) { CPacketBufferUtil::writeString8( buf_, buf_.size(), value ); }
+		void writeString16( const std::string &value ) { CPacketBufferUtil::writeString16( buf_, buf_.size(), value, true ); }
+		void writeString32( const std::string &value ) { CPacketBufferUtil::writeString32( buf_, buf_.size(), value, true ); }
+
+	private:
+		std::string &buf_;
+		size_t end_;	// header + body
+	};
+
 	static std::string makePacket( boost::int16_t code, const std::string &body, const std::string *fromId = NULL, const std::string *toId = NULL )
 	{
-		static std::string emptyString;
 		std::string buf;
 
-		int pos = 0;
-		pos += CPacketBufferUtil::writeInt16( buf, pos, NET_MAGIC_CODE, true );
-		pos += CPacketBufferUtil::writeInt16( buf, pos, code, true );
-		pos += CPacketBufferUtil::writeString8( buf, pos, fromId ? *fromId : emptyString );
-		pos += CPacketBufferUtil::writeString8( buf, pos, toId ? *toId : emptyString );
-		pos += CPacketBufferUtil::writeInt32( buf, pos, body.size(), true );
-		buf += body;
+		CPacketWriter writer( buf, code, body.size(), fromId, toId );
+		writer.writeBinary( body );
 
 		return buf;
 	}
+
+	// the relay server handles the system codes by itself, so only the paint traffic is compressed.
+	inline bool isCompressibleCode( int code )
+	{
+		return code >= CODE_PAINT_SET_BG_IMAGE && code <= CODE_TASK_EXECUTE;
+	}
+
+	//
+	// deflate the body of one packet into <out> and set CODE_FLAG_COMPRESSED.
+	// returns false if the packet is small, not compressible, or does not shrink.
+	// compressed body : | 4byte original size (big endian) | zlib stream |  (qCompress format)
+	//
+	static bool compressPacket( const std::string &packet, std::string &out, int level, size_t threshold = COMPRESS_THRESHOLD_SIZE )
+	{
+		if( level <= 0 )
+			return false;
+
+		try
+		{
+			boost::uint16_t code = 0;
+			boost::uint32_t bodySize = 0;
+			std::string fromId, toId;
+			size_t pos = 2;
+
+			pos += CPacketBufferUtil::readInt16( packet, pos, code, true );
+			if( (code & CODE_FLAG_COMPRESSED) || !isCompressibleCode( code ) )
+				return false;
+
+			pos += CPacketBufferUtil::readString8( packet, pos, fromId );
+			pos += CPacketBufferUtil::readString8( packet, pos, toId );
+			pos += CPacketBufferUtil::readInt32( packet, pos, bodySize, true );
+
+			if( pos + bodySize != packet.size() )	// not a single packet
+				return false;
+			if( bodySize < threshold )
+				return false;
+
+			QByteArray body = qCompress( (const uchar *)packet.c_str() + pos, bodySize, level );
+			if( (size_t)body.size() >= bodySize )
+				return false;
+
+			out.clear();
+			CPacketWriter writer( out, code | CODE_FLAG_COMPRESSED, body.size(), &fromId, &toId );
+			writer.writeBinary( body.constData(), body.size() );
+			return true;
+		}catch(...)
+		{
+		}
+		return false;
+	}
+
+	// append <packet> to a package, compressed if it is worth it
+	inline void appendPacket( std::string &buf, const std::string &packet, int level )
+	{
+		std::string compressed;
+		if( compressPacket( packet, compressed, level ) )
+			buf += compressed;
+		else
+			buf += packet;
+	}
+
+	static bool uncompressBody( const char *data, size_t size, std::string &body, size_t maxSize )
+	{
+		if( size < 4 )
+			return false;
+
+		// do not trust the size prefix blindly
+		size_t origSize = ((size_t)(boost::uint8_t)data[0] << 24) | ((size_t)(boost::uint8_t)data[1] << 16)
+			| ((size_t)(boost::uint8_t)data[2] << 8) | (size_t)(boost::uint8_t)data[3];
+		if( origSize > maxSize )
+			return false;
+
+		QByteArray res = qUncompress( (const uchar *)data, size );
+		if( res.isEmpty() )
+			return false;
+
+		body.assign( res.constData(), res.size() );
+		return true;
+	}
 };
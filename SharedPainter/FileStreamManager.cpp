@@ -0,0 +1,271 @@
+/*                                                                                                                                           
+* Copyright (c) 2012, Eunhyuk Kim(gunoodaddy) 
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+*   * Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above copyright
+*     notice, this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*   * Neither the name of Redis nor the names of its contributors may be used
+*     to endorse or promote products derived from this software without
+*     specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "stdafx.h"
+#include "SharedPaintManager.h"
+#include "FileStreamManager.h"
+
+void CFileStreamManager::startSending( boost::shared_ptr<CFileItem> item, const std::string &targetId, boost::uint64_t offset )
+{
+	boost::shared_ptr<QFile> file(new QFile( item->path() ));
+	if( !file->open( QIODevice::ReadOnly ) || !file->seek( offset ) )
+	{
+		qDebug() << "CFileStreamManager::startSending : file open failed" << item->path();
+		return;
+	}
+
+	boost::shared_ptr<SSendStream> stream(new SSendStream);
+	stream->key = streamKey( item->owner(), item->itemId() ) + "/" + targetId;
+	stream->item = item;
+	stream->targetId = targetId;
+	stream->file = file;
+	stream->offset = offset;
+	stream->sendingCount = 0;
+
+	{
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+		sendStreamMap_[ stream->key ] = stream;	// a new request for the same target restarts it
+	}
+
+	_pump( stream->key );
+}
+
+void CFileStreamManager::stopSending( void )
+{
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+	sendStreamMap_.clear();
+	sendingPacketMap_.clear();
+}
+
+void CFileStreamManager::onPacketSent( int packetId )
+{
+	std::string key;
+	{
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+		SENDING_PACKET_MAP::iterator it = sendingPacketMap_.find( packetId );
+		if( it == sendingPacketMap_.end() )
+			return;
+		boost::shared_ptr<SSendStream> stream = it->second;
+		sendingPacketMap_.erase( it );
+
+		// the stream may have been restarted or stopped meanwhile
+		SEND_STREAM_MAP::iterator itS = sendStreamMap_.find( stream->key );
+		if( itS == sendStreamMap_.end() || itS->second != stream )
+			return;
+		stream->sendingCount--;
+		key = stream->key;
+	}
+
+	_pump( key );
+}
+
+void CFileStreamManager::onRequest( const std::string &requesterId, const std::string &owner, int itemId, boost::uint64_t offset )
+{
+	boost::shared_ptr<CPaintItem> item = spManager_->findPaintItem( owner, itemId );
+	if( !item || (item->type() != PT_FILE && item->type() != PT_IMAGE_FILE) )
+		return;
+
+	boost::shared_ptr<CFileItem> file = boost::static_pointer_cast<CFileItem>(item);
+	if( !file->isReceiveComplete() )
+		return;	// this copy is not complete yet. the requester has to ask the owner
+
+	startSending( file, requesterId, offset );
+}
+
+void CFileStreamManager::_pump( const std::string &key )
+{
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	SEND_STREAM_MAP::iterator it = sendStreamMap_.find( key );
+	if( it == sendStreamMap_.end() )
+		return;
+
+	boost::shared_ptr<SSendStream> stream = it->second;
+	const std::string *target = stream->targetId.empty() ? NULL : &stream->targetId;
+
+	std::vector<char> buf( CHUNK_SIZE );
+	while( stream->sendingCount < MAX_SENDING_CHUNK_COUNT && !stream->file->atEnd() )
+	{
+		qint64 size = stream->file->read( &buf[0], CHUNK_SIZE );
+		if( size <= 0 )
+			break;
+
+		std::string msg = PaintPacketBuilder::CFileChunk::make( stream->item->owner(), stream->item->itemId(), stream->offset, &buf[0], (size_t)size, target );
+		int packetId = spManager_->sendDataToUsers( msg );
+		if( packetId < 0 )
+		{
+			// not connected. the receivers will ask for the rest after the reconnect.
+			sendStreamMap_.erase( it );
+			return;
+		}
+
+		sendingPacketMap_[ packetId ] = stream;
+		stream->offset += size;
+		stream->sendingCount++;
+	}
+
+	if( stream->sendingCount <= 0 && stream->file->atEnd() )
+		sendStreamMap_.erase( it );
+}
+
+void CFileStreamManager::startReceiving( boost::shared_ptr<CFileItem> item, const std::string &sourceId, bool request )
+{
+	boost::shared_ptr<SRecvStream> stream;
+	std::string key = streamKey( item->owner(), item->itemId() );
+	{
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+		RECV_STREAM_MAP::iterator it = recvStreamMap_.find( key );
+		if( it != recvStreamMap_.end() 
+			&& it->second->fileName == item->fileName() 
+			&& it->second->fileSize == item->fileSize() )
+		{
+			// the same file again (sync after a reconnect) : resume the partial one
+			stream = it->second;
+		}
+		else
+		{
+			stream = boost::shared_ptr<SRecvStream>(new SRecvStream);
+			stream->fileName = item->fileName();
+			stream->fileSize = item->fileSize();
+			stream->receivedSize = 0;
+
+			QString fileName = QString::fromUtf8( stream->fileName.c_str(), stream->fileName.size() );
+			stream->path = Util::checkAndChangeSameFileName( Util::generateFileDownloadPath() + fileName );
+
+			stream->file = boost::shared_ptr<QFile>(new QFile( stream->path ));
+			if( !stream->file->open( QIODevice::WriteOnly ) )
+			{
+				qDebug() << "CFileStreamManager::startReceiving : file open failed" << stream->path;
+				return;
+			}
+			recvStreamMap_[ key ] = stream;
+		}
+
+		stream->item = item;
+		stream->sourceId = sourceId;
+
+		item->setPath( stream->path );
+		item->setReceivedSize( stream->receivedSize );
+	}
+
+	if( stream->receivedSize >= stream->fileSize )
+	{
+		_complete( stream );
+		return;
+	}
+
+	if( request || !item->isPushStream() )
+		_requestRest( stream );
+}
+
+void CFileStreamManager::stopReceiving( void )
+{
+	boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+	RECV_STREAM_MAP::iterator it = recvStreamMap_.begin();
+	for( ; it != recvStreamMap_.end(); it++ )
+	{
+		if( it->second->file )
+			it->second->file->close();
+	}
+	recvStreamMap_.clear();
+}
+
+void CFileStreamManager::onChunk( const std::string &owner, int itemId, boost::uint64_t offset, const char *data, size_t size )
+{
+	boost::shared_ptr<SRecvStream> stream;
+	{
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+		RECV_STREAM_MAP::iterator it = recvStreamMap_.find( streamKey( owner, itemId ) );
+		if( it == recvStreamMap_.end() )
+			return;
+
+		stream = it->second;
+
+		// chunks for somebody else, or a duplicate from a pushed stream and a requested one
+		if( offset != stream->receivedSize || !stream->file )
+			return;
+
+		if( stream->receivedSize + size > stream->fileSize 
+			|| stream->file->write( data, size ) != (qint64)size )
+		{
+			qDebug() << "CFileStreamManager::onChunk : write failed" << stream->path;
+			return;
+		}
+
+		stream->receivedSize += size;
+		if( stream->item )
+			stream->item->setReceivedSize( stream->receivedSize );
+	}
+
+	if( stream->item )
+		spManager_->caller_.performMainThread( boost::bind( &CPaintItem::drawSendingStatus, stream->item, (size_t)stream->receivedSize, (size_t)stream->fileSize ) );
+
+	if( stream->receivedSize >= stream->fileSize )
+		_complete( stream );
+}
+
+void CFileStreamManager::_requestRest( boost::shared_ptr<SRecvStream> stream )
+{
+	if( stream->sourceId.empty() || stream->sourceId == spManager_->myId() )
+		return;
+
+	std::string msg = PaintPacketBuilder::CFileRequest::make( stream->item->owner(), stream->item->itemId(), stream->receivedSize, spManager_->myId(), stream->sourceId );
+	spManager_->sendDataToUsers( msg );
+}
+
+void CFileStreamManager::_complete( boost::shared_ptr<SRecvStream> stream )
+{
+	{
+		boost::recursive_mutex::scoped_lock autolock(mutex_);
+
+		if( stream->file )
+		{
+			stream->file->close();
+			stream->file = boost::shared_ptr<QFile>();
+		}
+		recvStreamMap_.erase( streamKey( stream->item->owner(), stream->item->itemId() ) );
+	}
+
+	// an image file drawn before the data came must be drawn again
+	if( stream->item->type() == PT_IMAGE_FILE )
+		spManager_->caller_.performMainThread( boost::bind( &CFileStreamManager::_redraw, stream->item ) );
+}
+
+void CFileStreamManager::_redraw( boost::shared_ptr<CFileItem> item )
+{
+	if( !item->drawingObject() )
+		return;	// not on the canvas (removed or not drawn yet)
+
+	item->remove();
+	item->draw();
+}
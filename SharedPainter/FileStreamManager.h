@@ -0,0 +1,112 @@
+/*                                                                                                                                           
+* Copyright (c) 2012, Eunhyuk Kim(gunoodaddy) 
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+*   * Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above copyright
+*     notice, this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*   * Neither the name of Redis nor the names of its contributors may be used
+*     to endorse or promote products derived from this software without
+*     specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <boost/lexical_cast.hpp>
+#include "PaintItem.h"
+
+class CSharedPaintManager;
+
+//---------------------------------------------
+// chunked file transfer for CFileItem
+//---------------------------------------------
+//
+// the item header goes in CODE_PAINT_CREATE_ITEM (PT_FILE_STREAM) and the data follows in CODE_PAINT_FILE_CHUNK.
+// the sender reads the file chunk by chunk and keeps only a few chunks in flight.
+// the receiver writes each chunk to disk as it comes, so nothing holds the whole file.
+// a receiver keeps its partial file, and after a reconnect it asks the source for the rest (CODE_PAINT_FILE_REQUEST).
+//
+
+class CFileStreamManager
+{
+public:
+	enum { CHUNK_SIZE = 64 * 1024, MAX_SENDING_CHUNK_COUNT = 4 };
+
+	CFileStreamManager( CSharedPaintManager *spManager ) : spManager_(spManager) { }
+	~CFileStreamManager( void ) { }
+
+	// sender
+	void startSending( boost::shared_ptr<CFileItem> item, const std::string &targetId, boost::uint64_t offset );
+	void stopSending( void );
+	void onPacketSent( int packetId );
+	void onRequest( const std::string &requesterId, const std::string &owner, int itemId, boost::uint64_t offset );
+
+	// receiver
+	void startReceiving( boost::shared_ptr<CFileItem> item, const std::string &sourceId, bool request = false );
+	void stopReceiving( void );
+	void onChunk( const std::string &owner, int itemId, boost::uint64_t offset, const char *data, size_t size );
+
+private:
+	struct SSendStream
+	{
+		std::string key;
+		boost::shared_ptr<CFileItem> item;
+		std::string targetId;
+		boost::shared_ptr<QFile> file;
+		boost::uint64_t offset;
+		int sendingCount;
+	};
+
+	struct SRecvStream
+	{
+		boost::shared_ptr<CFileItem> item;
+		std::string sourceId;
+		std::string fileName;
+		boost::uint64_t fileSize;
+		QString path;
+		boost::shared_ptr<QFile> file;
+		boost::uint64_t receivedSize;
+	};
+
+	typedef std::map< std::string, boost::shared_ptr<SSendStream> > SEND_STREAM_MAP;
+	typedef std::map< std::string, boost::shared_ptr<SRecvStream> > RECV_STREAM_MAP;
+	typedef std::map< int, boost::shared_ptr<SSendStream> > SENDING_PACKET_MAP;
+
+	static std::string streamKey( const std::string &owner, int itemId )
+	{
+		std::string key = owner;
+		key += "/";
+		key += boost::lexical_cast<std::string>( itemId );
+		return key;
+	}
+
+	void _pump( const std::string &key );
+	void _requestRest( boost::shared_ptr<SRecvStream> stream );
+	void _complete( boost::shared_ptr<SRecvStream> stream );
+	static void _redraw( boost::shared_ptr<CFileItem> item );
+
+private:
+	CSharedPaintManager *spManager_;
+	boost::recursive_mutex mutex_;
+
+	SEND_STREAM_MAP sendStreamMap_;			// key : owner/item id/target id
+	SENDING_PACKET_MAP sendingPacketMap_;	// packet id => send stream
+	RECV_STREAM_MAP recvStreamMap_;			// key : owner/item id. kept after a disconnect for resuming
+};
@@ -45,7 +45,8 @@ class INetPeerSessionEvent
 public:
 	virtual void onINetPeerSessionEvent_Connected( CNetPeerSession *session ) = 0;
 	virtual void onINetPeerSessionEvent_ConnectFailed( CNetPeerSession *session ) = 0;
-	virtual void onINetPeerSessionEvent_Received( CNetPeerSession *session, const std::string buffer ) = 0;
+	virtual char * onINetPeerSessionEvent_PrepareReceive( CNetPeerSession *session, size_t &size, boost::shared_ptr<void> &owner ) = 0;	// in : wanted size, out : buffer size. owner keeps the buffer alive until the read completes
+	virtual void onINetPeerSessionEvent_Received( CNetPeerSession *session, size_t bytes ) = 0;
 	virtual void onINetPeerSessionEvent_Sending( CNetPeerSession *session, boost::shared_ptr<CNetPacketData> packet ) = 0;
 	virtual void onINetPeerSessionEvent_Disconnected( CNetPeerSession *session ) = 0;
 };
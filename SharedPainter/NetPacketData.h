@@ -29,19 +29,48 @@
 
 #pragma once
 
+#include <boost/shared_ptr.hpp>
+
+// one packet queued on one session.
+// the payload is immutable and can be shared by all sessions which send the same message,
+// so each session just keeps its own read cursor.
 class CNetPacketData
 {
 public:
-	CNetPacketData( boost::int32_t packetId, const std::string &body ) : packetId_(packetId)
+	typedef boost::shared_ptr<const std::string> payload_t;
+
+	CNetPacketData( boost::int32_t packetId, const std::string &body ) : packetId_(packetId), payload_(new std::string(body)), readPos_(0)
+	{
+	}
+
+	CNetPacketData( boost::int32_t packetId, payload_t payload ) : packetId_(packetId), payload_(payload), readPos_(0)
 	{
-		writeBuffer_.write( body.c_str(), body.size() );
 	}
 
 	int packetId( void ) { return packetId_; }
-		
-	CPacketBuffer &buffer( void ) { return writeBuffer_; }
+
+	const payload_t &payload( void ) { return payload_; }
+
+	size_t totalSize( void ) { return payload_->size(); }
+	size_t remainingSize( void ) { return payload_->size() - readPos_; }
+	size_t readPos( void ) { return readPos_; }
+
+	const void * peek( size_t &size )
+	{
+		if( remainingSize() < size )
+			size = remainingSize();
+		return payload_->c_str() + readPos_;
+	}
+
+	void fastforward( size_t size )
+	{
+		if( readPos_ + size > payload_->size() )
+			throw CPacketException("readpos exceed buffer size by fastforward");
+		readPos_ += size;
+	}
 
 private:
 	boost::int32_t packetId_;
-	CPacketBuffer writeBuffer_;
+	payload_t payload_;
+	size_t readPos_;
 };
@@ -39,6 +39,10 @@
 #include "DefferedCaller.h"
 #include "INetPeerEvent.h"
 
+#ifndef MAX_RECEIVE_BUFFER_SIZE
+#define MAX_RECEIVE_BUFFER_SIZE		(1024 * 1024)
+#endif
+
 using boost::asio::deadline_timer;
 using boost::asio::ip::tcp;
 
@@ -46,7 +50,8 @@ class CNetPeerSession : public boost::enable_shared_from_this<CNetPeerSession>
 {
 public:
 	CNetPeerSession( boost::asio::io_service& io_service, int sessionId ) 
-		: io_service_(io_service), sessionId_(sessionId), stopped_(true), connected_(false), evtTarget_(NULL), clientsocket_(io_service), deadline_(io_service) 
+		: io_service_(io_service), sessionId_(sessionId), stopped_(true), connected_(false), evtTarget_(NULL), clientsocket_(io_service), deadline_(io_service)
+		, recvSize_(_BUF_SIZE), maxRecvSize_(MAX_RECEIVE_BUFFER_SIZE), lastRecvBufSize_(0), recvDirect_(false)
 	{ 
 		//qDebug() << "CNetPeerSession(void) " << this;
 	}
@@ -64,6 +69,10 @@ public:
 
 	int sessionId( void ) { return sessionId_; }
 
+	// the receive size starts at _BUF_SIZE and doubles while reads fill the whole buffer, up to this cap.
+	void setMaxReceiveSize( size_t size ) { maxRecvSize_ = std::max( size, (size_t)_BUF_SIZE ); }
+	size_t maxReceiveSize( void ) { return maxRecvSize_; }
+
 	tcp::socket& socket() {
 		return clientsocket_;
 	}
@@ -128,7 +137,7 @@ public:
 	
 	void sendData( boost::shared_ptr<CNetPacketData> packet )
 	{
-		if( packet->buffer().totalSize() <= 0 )
+		if( packet->totalSize() <= 0 )
 			return;
 
 		boost::recursive_mutex::scoped_lock autolock(mutex_);
@@ -174,11 +183,27 @@ public:
 
 	void _start_read()
 	{
-		clientsocket_.async_receive(boost::asio::buffer(read_buffer_, _BUF_SIZE),
+		// read directly into the event target's buffer if it provides one
+		size_t size = recvSize_;
+		char *ptr = NULL;
+		boost::shared_ptr<void> owner;
+		if( evtTarget_ )
+			ptr = evtTarget_->onINetPeerSessionEvent_PrepareReceive( this, size, owner );
+		recvDirect_ = ( ptr && size > 0 );
+		if( !recvDirect_ )
+		{
+			ptr = read_buffer_;
+			size = std::min( recvSize_, (size_t)_BUF_SIZE );
+		}
+		lastRecvBufSize_ = size;
+
+		// the handler holds the owner of the buffer, the event target may be gone before the read completes
+		clientsocket_.async_receive(boost::asio::buffer(ptr, size),
 			boost::bind(&CNetPeerSession::_handle_read,
 			shared_from_this(),
 			boost::asio::placeholders::error,
-			boost::asio::placeholders::bytes_transferred));
+			boost::asio::placeholders::bytes_transferred,
+			owner));
 	}
 
 	void _start_write()
@@ -188,16 +213,33 @@ public:
 		if( write_buffer_list_.empty() )
 			return;
 
-		boost::shared_ptr<CNetPacketData> packet = write_buffer_list_.front();
+		// gather the queued packets directly from their own storage.
+		// the packets stay in write_buffer_list_ until _handle_write, so the memory is kept alive.
+		std::vector<boost::asio::const_buffer> buffers;
+		size_t gatherSize = 0;
+
+		std::deque< boost::shared_ptr<CNetPacketData> >::iterator it = write_buffer_list_.begin();
+		for( ; it != write_buffer_list_.end(); it++ )
+		{
+			if( buffers.size() >= _MAX_GATHER_COUNT || gatherSize >= _MAX_GATHER_SIZE )
+				break;
 
-		int readSize = packet->buffer().read( curr_write_buffer_, _BUF_SIZE );
-		assert( readSize > 0 );
+			size_t size = _MAX_GATHER_SIZE - gatherSize;
+			const void *ptr = (*it)->peek( size );
+			if( size <= 0 )
+				continue;
+
+			buffers.push_back( boost::asio::const_buffer( ptr, size ) );
+			gatherSize += size;
+		}
+		assert( gatherSize > 0 );
 
 		boost::asio::async_write(clientsocket_,
-			boost::asio::buffer(curr_write_buffer_, readSize),
+			buffers,
 			boost::bind(&CNetPeerSession::_handle_write,
 			shared_from_this(),
-			boost::asio::placeholders::error));
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
 	}
 
 	void _handle_connect(const boost::system::error_code& ec,
@@ -232,12 +274,19 @@ public:
 		}
 	}
 
-	void _handle_read( const boost::system::error_code& error, size_t bytes_transferred )
+	void _handle_read( const boost::system::error_code& error, size_t bytes_transferred, boost::shared_ptr<void> owner )
 	{ 
 		// the asynchronous read operation has now completed or failed and returned an error
 		if( !error )
 		{ 
-			fireReceivedEvent( read_buffer_, bytes_transferred );
+			// a full read means more is waiting : grow toward the cap. a short one falls back.
+			if( bytes_transferred >= lastRecvBufSize_ )
+				recvSize_ = std::min( recvSize_ * 2, maxRecvSize_ );
+			else if( bytes_transferred < _BUF_SIZE )
+				recvSize_ = _BUF_SIZE;
+
+			if( recvDirect_ )
+				fireReceivedEvent( bytes_transferred );
 
 			// read completed, so process the data
 			_start_read(); // start waiting for another asynchronous read again
@@ -246,23 +295,39 @@ public:
 			close();
 	}
 
-	void _handle_write( const boost::system::error_code& ec )
+	void _handle_write( const boost::system::error_code& ec, size_t bytes_transferred )
 	{
 		// the asynchronous read operation has now completed or failed and returned an error
 		if(!ec)
 		{
-			boost::shared_ptr<CNetPacketData> packet = write_buffer_list_.front();
-
-			fireSendingEvent( packet );
+			std::vector< boost::shared_ptr<CNetPacketData> > sentPackets;
 
 			mutex_.lock();
-			if(packet->buffer().remainingSize() <= 0)
-				write_buffer_list_.pop_front();
-			
+
+			// advance each gathered packet's read cursor by the bytes written from it
+			while( bytes_transferred > 0 && !write_buffer_list_.empty() )
+			{
+				boost::shared_ptr<CNetPacketData> packet = write_buffer_list_.front();
+
+				size_t size = std::min( bytes_transferred, packet->remainingSize() );
+				packet->fastforward( size );
+				bytes_transferred -= size;
+
+				sentPackets.push_back( packet );
+
+				if(packet->remainingSize() <= 0)
+					write_buffer_list_.pop_front();
+				else
+					break;
+			}
+
 			// write completed, so send next write data
 			if( !write_buffer_list_.empty() ) // if there is anthing left to be written
 				_start_write(); // then start sending the next item in the buffer
 			mutex_.unlock();
+
+			for( size_t i = 0; i < sentPackets.size(); i++ )
+				fireSendingEvent( sentPackets[i] );
 		}
 		else
 			close();
@@ -314,12 +379,11 @@ private:
 		}
 	}
 
-	void fireReceivedEvent( const char * buffer, size_t len )
+	void fireReceivedEvent( size_t len )
 	{
 		if( evtTarget_ )
 		{
-			std::string tempbuffer( buffer, len );
-			evtTarget_->onINetPeerSessionEvent_Received( this, tempbuffer );
+			evtTarget_->onINetPeerSessionEvent_Received( this, len );
 		}
 	}
 
@@ -332,7 +396,9 @@ private:
 	}
 
 private:
-	static const int _BUF_SIZE = 4096;
+	static const int _BUF_SIZE = 4096;		// initial receive size and the fallback buffer size
+	static const size_t _MAX_GATHER_SIZE = 256 * 1024;	// bytes per one async_write
+	static const size_t _MAX_GATHER_COUNT = 64;		// buffers per one async_write
 
 	boost::asio::io_service& io_service_;
 	int sessionId_;
@@ -343,9 +409,11 @@ private:
 	boost::asio::ip::tcp::socket clientsocket_;
 	boost::asio::deadline_timer deadline_;
 
-	char read_buffer_[_BUF_SIZE];
+	char read_buffer_[_BUF_SIZE];	// used only when there is no event target to read into
+	size_t recvSize_;
+	size_t maxRecvSize_;
+	size_t lastRecvBufSize_;
+	bool recvDirect_;
 	std::deque< boost::shared_ptr<CNetPacketData> > write_buffer_list_;
-
-	char curr_write_buffer_[_BUF_SIZE];
 	boost::recursive_mutex mutex_;
 };
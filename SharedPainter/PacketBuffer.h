@@ -175,6 +175,32 @@ public:
 		return 4 + value.size();
 	}
 
+	// 7bit groups, low group first. the high bit of a byte means "more bytes follow".
+	static size_t writeVarInt32( std::string &buf, size_t pos, boost::uint32_t value ) {
+		char bytes[5];
+		size_t len = 0;
+		while( value >= 0x80 ) {
+			bytes[len++] = (char)(value | 0x80);
+			value >>= 7;
+		}
+		bytes[len++] = (char)value;
+		buf.insert( pos, bytes, len );
+		return len;
+	}
+
+	static size_t varInt32Size( boost::uint32_t value ) {
+		size_t len = 1;
+		while( value >= 0x80 ) {
+			value >>= 7;
+			len++;
+		}
+		return len;
+	}
+
+	static boost::uint32_t zigzagEncode32( boost::int32_t value ) {
+		return ((boost::uint32_t)value << 1) ^ (boost::uint32_t)(value >> 31);
+	}
+
 	static size_t writeString32List( std::string &buf, size_t pos, const stringlist_t &list, bool LE ) {
 		pos += writeInt32( buf, pos, (boost::uint32_t)list.size(), LE );
 		for(size_t i = 0; i < list.size(); i++) {
@@ -274,6 +300,24 @@ public:
 		return 1;
 	}
 
+	static size_t readVarInt32( const std::string &buf, size_t pos, boost::uint32_t &value ) {
+		const boost::uint8_t *p = (const boost::uint8_t *)buf.c_str() + pos;
+		size_t avail = pos < buf.size() ? buf.size() - pos : 0;
+		boost::uint32_t res = 0;
+		for( size_t i = 0; i < 5 && i < avail; i++ ) {
+			res |= (boost::uint32_t)(p[i] & 0x7f) << (7 * i);
+			if( (p[i] & 0x80) == 0 ) {
+				value = res;
+				return i + 1;
+			}
+		}
+		throw CPacketException("readVarInt32 failed..");
+	}
+
+	static boost::int32_t zigzagDecode32( boost::uint32_t value ) {
+		return (boost::int32_t)(value >> 1) ^ -(boost::int32_t)(value & 1);
+	}
+
 	static boost::uint32_t readString32( const std::string &buf, size_t pos, std::string &value, bool LE ) {
 		boost::uint32_t len = 0;
 		pos += readInt32( buf, pos, len, LE );
@@ -301,251 +345,3 @@ public:
 		return 1 + len;
 	}
 };
-
-
-class CPacketBuffer 
-{
-public:
-	CPacketBuffer();
-	~CPacketBuffer();
-
-public:
-	int erase(size_t pos, size_t size);
-	int write(const char* ptr, size_t size);
-	int write(const void* ptr, size_t size);
-	int read(std::string &data, size_t size);
-	int read(void *ptr, size_t size);
-	const void * peek(size_t &size);
-	int peek(char *buffer, size_t size);
-	void throwAway(size_t size);
-	int insertInt8(size_t pos, boost::uint8_t value);
-
-	boost::uint32_t writeInt32(boost::uint32_t value) {
-		boost::uint32_t net;
-		if(littleEndianMode) {
-			net = (boost::uint32_t)value;
-		} else {
-			net = (boost::uint32_t)htonl(value);
-		}
-		write((boost::uint8_t*)&net, 4);
-		return 4;
-	}
-
-	boost::uint16_t writeInt16(boost::uint16_t value) {
-		boost::uint16_t net;
-		if(littleEndianMode) {
-			net = (boost::uint16_t)value;
-		} else {
-			net = (boost::uint16_t)htons(value);
-		}
-		write((boost::uint8_t*)&net, 2);
-		return 2;
-	}
-
-	boost::uint8_t writeInt8(boost::uint8_t value) {
-		write((boost::uint8_t*)&value, 1);
-		return 1;
-	}
-
-	boost::uint32_t writeBinary(const void *data, size_t size) {
-		boost::uint32_t pos = 0;
-		pos += write(data, size);
-		return pos;
-	}
-
-	boost::uint32_t writeString8(const std::string &value) {
-		boost::uint8_t pos = 0;
-		pos += writeInt8(value.size());
-		pos += write(value.c_str(), value.size());
-		return pos;
-	}
-
-	boost::uint32_t writeString16(const std::string &value) {
-		boost::uint16_t pos = 0;
-		pos += writeInt16(value.size());
-		pos += write(value.c_str(), value.size());
-		return pos;
-	}
-
-	boost::uint32_t writeString32(const std::string &value) {
-		boost::uint32_t pos = 0;
-		pos += writeInt32(value.size());
-		pos += write(value.c_str(), value.size());
-		return pos;
-	}
-
-	boost::uint32_t writeString32List(const stringlist_t &list) {
-		boost::uint32_t pos = 0;
-		pos += writeInt32((boost::uint32_t)list.size());
-		for(size_t i = 0; i < list.size(); i++) {
-			pos += writeString32(list[i]);
-		}
-		return pos;
-	}
-
-	// Reading helper method
-public:
-	boost::uint32_t readInt32(boost::uint32_t &value) {
-		union bytes {
-			boost::uint8_t b[4];
-			boost::uint32_t all;
-		} theBytes;
-
-		if(read((void *)theBytes.b, 4) != 4)
-			throw CPacketException("readInt32 failed..");
-		else {
-			if(littleEndianMode)
-				value = (boost::uint32_t)theBytes.all;
-			else
-				value = (boost::uint32_t)ntohl(theBytes.all);
-		}
-		return 4;
-	}
-
-	boost::uint32_t readInt32() {
-		union bytes {
-			boost::uint8_t b[4];
-			boost::uint32_t all;
-		} theBytes;
-
-		if(read((void *)theBytes.b, 4) != 4)
-			throw CPacketException("readInt32 failed..");
-		if(littleEndianMode) {
-			return (boost::uint32_t)theBytes.all;
-		} else {
-			return (boost::uint32_t)ntohl(theBytes.all);
-		}
-	}
-
-	boost::uint16_t readInt16(boost::uint16_t &value) {
-		union bytes {
-			boost::uint8_t b[2];
-			boost::uint16_t all;
-		} theBytes;
-
-		if(read((void *)theBytes.b, 2) != 2)
-			throw CPacketException("readInt16 failed..");
-		else {
-			if(littleEndianMode)
-				value = (boost::uint16_t)theBytes.all;
-			else
-				value = (boost::uint16_t)ntohs(theBytes.all);
-		}
-		return 2;
-	}
-
-	boost::uint16_t readInt16() {
-		union bytes {
-			boost::uint8_t b[2];
-			boost::uint16_t all;
-		} theBytes;
-
-		if(read((void *)theBytes.b, 2) != 2)
-			throw CPacketException("readInt16 failed..");
-		if(littleEndianMode) {
-			return (boost::uint16_t)theBytes.all;
-		} else {
-			return (boost::uint16_t)ntohs(theBytes.all);
-		}
-	}
-
-	boost::uint8_t readInt8(boost::uint8_t &value) {
-		boost::uint8_t b[1];
-		int res = read((void *)b, 1);
-		if(res != 1)
-			throw CPacketException("readInt8 failed..");
-		else
-			value = b[0];
-		return 1;
-	}
-
-	boost::uint8_t readInt8() {
-		boost::uint8_t b[1];
-		int res = read((void *)b, 1);
-		if(res != 1)
-			throw CPacketException("readInt8 failed..");
-		return b[0];
-	}
-
-	boost::uint32_t readString32(std::string &value) {
-		boost::uint32_t len = 0;
-		boost::uint32_t pos = 0;
-		pos += readInt32(len);
-		int nread = read(value, len);
-		if(nread != (int)len)
-			throw CPacketException("readString32 failed..");
-		return pos + len;
-	}
-
-	std::string readString32() {
-		std::string str;
-		size_t len = readInt8();
-		int nread = read(str, len);
-		if(nread != (int)len)
-			throw CPacketException("readString32 failed..");
-		return str;
-	}
-
-	boost::uint32_t readString16(std::string &value) {
-		boost::uint16_t len = 0;
-		boost::uint16_t pos = 0;
-		pos += readInt16(len);
-		int nread = read(value, len);
-		if(nread != len)
-			throw CPacketException("readString16 failed..");
-		return pos + len;
-	}
-
-	std::string readString16() {
-		std::string str;
-		size_t len = readInt16();
-		int nread = read(str, len);
-		if(nread != (int)len)
-			throw CPacketException("readString16 failed..");
-		return str;
-	}
-
-	boost::uint32_t readString8(std::string &value) {
-		boost::uint8_t len = 0;
-		boost::uint32_t pos = 0;
-		pos += readInt8(len);
-		int nread = read(value, len);
-		if(nread != len)
-			throw CPacketException("readString8 failed..");
-		return pos + len;
-	}
-
-	std::string readString8() {
-		std::string str;
-		size_t len = readInt8();
-		int nread = read(str, len);
-		if(nread != (int)len)
-			throw CPacketException("readString8 failed..");
-		return str;
-	}
-
-	std::string readString(size_t size);
-
-public:
-	size_t totalSize();
-	size_t remainingSize();
-	size_t readPos();
-	void setReadPos(size_t pos);
-
-	const void * basePtr();
-	const void * currentPtr();
-	std::string toStringFromBasePtr();
-	std::string toStringFromCurrentPtr();
-
-	void clear();
-	void rewind(size_t size);
-	void fastforward(size_t size);
-
-private:
-	std::string buffer_;
-	int readPos_;
-	/*int writePos_;*/	// write position is not necessary by using std::string
-	boost::recursive_mutex lock_;
-
-	static bool littleEndianMode;
-};
@@ -61,5 +61,25 @@ enum SharedPaintCodeType {
 	CODE_SCREENSHARE_CHANGE_RECORD_STATUS,
 	CODE_SCREENSHARE_CHANGE_SHOW_STREAM,
 	CODE_SCREENSHARE_RES_SHOW_STREAM,
+	CODE_PAINT_FILE_CHUNK,
+	CODE_PAINT_FILE_REQUEST,
+	CODE_PAINT_LIVE_STROKE,
+	CODE_SYSTEM_CLUSTER_PING,	// between the relay nodes only, a client never gets it
+	CODE_SYSTEM_PRESENCE,		// the joins and leaves of a room, batched by the relay
+	CODE_SYSTEM_SESSION_HANDLE,	// the handles of the joiners, from the relay
 	CODE_MAX,
 };
+
+// the high bit of the code marks a deflated body. see CommonPacketBuilder::compressPacket()
+#define CODE_FLAG_COMPRESSED	0x8000
+
+// capability flags, announced with CODE_SYSTEM_VERSION_INFO.
+// peers which do not send them are treated as having none.
+enum SharedPaintCapability {
+	CAPS_COMPRESSION		= 0x00000001,
+	CAPS_COMPACT_LINE		= 0x00000002,	// PT_LINE_COMPACT
+	CAPS_FILE_STREAM		= 0x00000004,	// PT_FILE_STREAM, CODE_PAINT_FILE_CHUNK, CODE_PAINT_FILE_REQUEST
+	CAPS_LIVE_STROKE		= 0x00000008,	// CODE_PAINT_LIVE_STROKE
+	CAPS_PRESENCE_DELTA		= 0x00000010,	// CODE_SYSTEM_PRESENCE instead of a CODE_SYSTEM_JOIN_TO_SERVER / CODE_SYSTEM_LEFT per user
+	CAPS_SESSION_HANDLE		= 0x00000020,	// CODE_SYSTEM_SESSION_HANDLE, the handle header with the relay
+};
@@ -0,0 +1,290 @@
+/*                                                                                                                                           
+* Copyright (c) 2012, Eunhyuk Kim(gunoodaddy) 
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+*   * Redistributions of source code must retain the above copyright notice,
+*     this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above copyright
+*     notice, this list of conditions and the following disclaimer in the
+*     documentation and/or other materials provided with the distribution.
+*   * Neither the name of Redis nor the names of its contributors may be used
+*     to endorse or promote products derived from this software without
+*     specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <boost/shared_ptr.hpp>
+#include <deque>
+#include <vector>
+
+//---------------------------------------------
+// chunked ring buffer for the packet slicer
+//---------------------------------------------
+//
+// received bytes are appended to fixed size chunks and consumed from the front.
+// a fully consumed chunk is recycled unless a parsed packet still references it,
+// so nothing is ever moved by erase() and a packet body can be handed out as a view.
+//
+
+class CPacketBufferChunk
+{
+public:
+	CPacketBufferChunk( size_t capacity ) : readPos_(0), writePos_(0)
+	{
+		data_.resize( capacity );
+	}
+
+	size_t capacity( void ) { return data_.size(); }
+	size_t readableSize( void ) { return writePos_ - readPos_; }
+	size_t writableSize( void ) { return data_.size() - writePos_; }
+
+	char * readPtr( void ) { return &data_[0] + readPos_; }
+	char * writePtr( void ) { return &data_[0] + writePos_; }
+
+	void commit( size_t size ) { writePos_ += size; }
+	void consume( size_t size ) { readPos_ += size; }
+
+	void reset( void ) { readPos_ = writePos_ = 0; }
+
+	// keeps the bytes, the pointers taken before are invalid
+	void grow( size_t capacity ) { data_.resize( capacity ); }
+
+	std::string &storage( void ) { return data_; }
+
+private:
+	std::string data_;
+	size_t readPos_;
+	size_t writePos_;
+};
+
+
+class CPacketBodyView
+{
+public:
+	CPacketBodyView( void ) : offset_(0), size_(0) { }
+
+	CPacketBodyView( boost::shared_ptr<CPacketBufferChunk> chunk, size_t offset, size_t size ) 
+		: chunk_(chunk), offset_(offset), size_(size) { }
+
+	const char * data( void ) const
+	{
+		if( !chunk_ )
+			return "";
+		return chunk_->storage().c_str() + offset_;
+	}
+
+	size_t size( void ) const { return size_; }
+
+	// move the bytes to <out>. the chunk storage is stolen when this view is its only owner.
+	void take( std::string &out )
+	{
+		if( chunk_ && chunk_.unique() && offset_ == 0 && size_ == chunk_->capacity() )
+			out.swap( chunk_->storage() );
+		else
+			out.assign( data(), size_ );
+
+		release();
+	}
+
+	void release( void )
+	{
+		chunk_ = boost::shared_ptr<CPacketBufferChunk>();
+		offset_ = size_ = 0;
+	}
+
+private:
+	boost::shared_ptr<CPacketBufferChunk> chunk_;
+	size_t offset_;
+	size_t size_;
+};
+
+
+class CPacketRingBuffer
+{
+public:
+	enum { DEFAULT_CHUNK_SIZE = 64 * 1024, MAX_FREE_CHUNK_COUNT = 4, CONTIGUOUS_RESERVE_SIZE = 4 * DEFAULT_CHUNK_SIZE };
+
+	CPacketRingBuffer( void ) : size_(0), contiguousLen_(0) { }
+
+	size_t size( void ) { return size_; }
+
+	void clear( void )
+	{
+		while( !chunks_.empty() )
+			_popFront();
+		size_ = 0;
+		contiguousLen_ = 0;
+	}
+
+	void write( const char *ptr, size_t len )
+	{
+		while( len > 0 )
+		{
+			boost::shared_ptr<CPacketBufferChunk> &chunk = _writableBack();
+			size_t size = std::min( len, chunk->writableSize() );
+			memcpy( chunk->writePtr(), ptr, size );
+			chunk->commit( size );
+
+			ptr += size;
+			len -= size;
+			size_ += size;
+		}
+	}
+
+	// returns the write pointer of the back chunk so that a socket can read into it directly.
+	// <size> is the wanted size on input and the writable size on output.
+	// nothing else may touch the buffer until commit() is called.
+	char * prepare( size_t &size )
+	{
+		boost::shared_ptr<CPacketBufferChunk> &chunk = _writableBack();
+		size = std::min( size, chunk->writableSize() );
+		return chunk->writePtr();
+	}
+
+	void commit( size_t len )
+	{
+		if( chunks_.empty() || len > chunks_.back()->writableSize() )
+			throw CPacketException("commit size greater than prepared size");
+
+		chunks_.back()->commit( len );
+		size_ += len;
+	}
+
+	// copy the front bytes without consuming them
+	size_t peek( void *out, size_t len )
+	{
+		size_t copied = 0;
+		for( size_t i = 0; i < chunks_.size() && copied < len; i++ )
+		{
+			size_t size = std::min( len - copied, chunks_[i]->readableSize() );
+			memcpy( (char *)out + copied, chunks_[i]->readPtr(), size );
+			copied += size;
+		}
+		return copied;
+	}
+
+	void consume( size_t len )
+	{
+		if( len > size_ )
+			throw CPacketException("consume size greater than buffer size");
+
+		size_ -= len;
+		while( len > 0 )
+		{
+			boost::shared_ptr<CPacketBufferChunk> &chunk = chunks_.front();
+			size_t size = std::min( len, chunk->readableSize() );
+			chunk->consume( size );
+			len -= size;
+
+			if( chunk->readableSize() <= 0 && chunk->writableSize() <= 0 )
+				_popFront();
+		}
+	}
+
+	// consume <len> bytes and return them as a view.
+	// no copy is made when the bytes are contiguous in one chunk.
+	CPacketBodyView read( size_t len )
+	{
+		if( len > size_ )
+			throw CPacketException("read size greater than buffer size");
+
+		contiguousLen_ = 0;
+		if( len <= 0 )
+			return CPacketBodyView();
+
+		boost::shared_ptr<CPacketBufferChunk> front = chunks_.front();
+		if( front->readableSize() >= len )
+		{
+			CPacketBodyView view( front, front->readPtr() - &front->storage()[0], len );
+			consume( len );
+			return view;
+		}
+
+		boost::shared_ptr<CPacketBufferChunk> chunk(new CPacketBufferChunk( len ));
+		peek( chunk->writePtr(), len );
+		chunk->commit( len );
+		consume( len );
+		return CPacketBodyView( chunk, 0, len );
+	}
+
+	// make sure that the next <len> bytes will be stored in one chunk.
+	// this is used for a big body whose header has been parsed already.
+	// the length comes from the peer, so the chunk is allocated a few chunks at a time and grows as the bytes arrive.
+	void reserveContiguous( size_t len )
+	{
+		if( len <= size_ )
+			return;	// already received
+
+		if( chunks_.size() == 1 && chunks_.front()->readableSize() + chunks_.front()->writableSize() >= len )
+			return;
+
+		size_t capacity = std::max( size_, std::min( len, (size_t)CONTIGUOUS_RESERVE_SIZE ) );
+		boost::shared_ptr<CPacketBufferChunk> chunk(new CPacketBufferChunk( capacity ));
+		size_t size = size_;
+		peek( chunk->writePtr(), size );
+		chunk->commit( size );
+
+		clear();
+		chunks_.push_back( chunk );
+		size_ = size;
+		contiguousLen_ = len;
+	}
+
+private:
+	// the back chunk with room to write in. the chunk of a reserved body is grown, up to the body length
+	boost::shared_ptr<CPacketBufferChunk> &_writableBack( void )
+	{
+		if( !chunks_.empty() && chunks_.back()->writableSize() <= 0 && chunks_.back()->capacity() < contiguousLen_ )
+			chunks_.back()->grow( std::min( contiguousLen_, chunks_.back()->capacity() * 2 ) );
+
+		if( chunks_.empty() || chunks_.back()->writableSize() <= 0 )
+			chunks_.push_back( _newChunk() );
+		return chunks_.back();
+	}
+
+	boost::shared_ptr<CPacketBufferChunk> _newChunk( void )
+	{
+		if( !freeChunks_.empty() )
+		{
+			boost::shared_ptr<CPacketBufferChunk> chunk = freeChunks_.back();
+			freeChunks_.pop_back();
+			return chunk;
+		}
+		return boost::shared_ptr<CPacketBufferChunk>(new CPacketBufferChunk( DEFAULT_CHUNK_SIZE ));
+	}
+
+	void _popFront( void )
+	{
+		boost::shared_ptr<CPacketBufferChunk> chunk = chunks_.front();
+		chunks_.pop_front();
+
+		// recycle only if no parsed packet refers to this chunk
+		if( chunk.unique() && chunk->capacity() == DEFAULT_CHUNK_SIZE && freeChunks_.size() < MAX_FREE_CHUNK_COUNT )
+		{
+			chunk->reset();
+			freeChunks_.push_back( chunk );
+		}
+	}
+
+private:
+	std::deque< boost::shared_ptr<CPacketBufferChunk> > chunks_;
+	std::vector< boost::shared_ptr<CPacketBufferChunk> > freeChunks_;
+	size_t size_;
+	size_t contiguousLen_;	// the body length reserveContiguous() was asked for, 0 : none
+};
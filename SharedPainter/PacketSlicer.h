@@ -33,7 +33,9 @@
 #include "PacketCodeDefine.h"
 #include "PaintItem.h"
 #include "PacketBuffer.h"
+#include "PacketRingBuffer.h"
 #include "NetPacketData.h"
+#include "CommonPacketBuilder.h"
 
 //---------------------------------------------
 // packet format
@@ -42,6 +44,9 @@
 // | 2byte magic | 2byte code | 4byte bodylen | from id 1byte string | to id 1byte string | (2byte paint type ) | body string ... |
 // <------------------------ HEADER ------------------------------------------------------> <----------------- BODY ---------------->
 //
+// from the relay server, after CODE_SYSTEM_SESSION_HANDLE :
+// | 2byte magic (NET_MAGIC_CODE_HANDLE) | 2byte code | 4byte from handle | 4byte to handle | 4byte bodylen | body string ... |
+//
 
 #ifndef MAX_PACKET_BODY_SIZE
 #define MAX_PACKET_BODY_SIZE	20000000
@@ -50,10 +55,40 @@
 class CPacketData
 {
 public:
+	CPacketData( void ) : code(0), fromHandle(0), toHandle(0) { }
+
 	boost::uint16_t code;
 	std::string fromId;
 	std::string toId;
-	std::string body;
+	boost::uint32_t fromHandle;		// the handle header, the ids are filled by CSessionHandleTable::resolve()
+	boost::uint32_t toHandle;
+
+	// the body refers to the slicer's buffer until someone needs a std::string.
+	const char * bodyPtr( void ) { return bodyView_.size() > 0 ? bodyView_.data() : body_.c_str(); }
+	size_t bodySize( void ) { return bodyView_.size() > 0 ? bodyView_.size() : body_.size(); }
+
+	const std::string & body( void )
+	{
+		if( bodyView_.size() > 0 )
+			bodyView_.take( body_ );
+		return body_;
+	}
+
+	void setBody( const CPacketBodyView &view )
+	{
+		body_.clear();
+		bodyView_ = view;
+	}
+
+	void setBody( std::string &body )
+	{
+		bodyView_.release();
+		body_.swap( body );
+	}
+
+private:
+	CPacketBodyView bodyView_;
+	std::string body_;
 };
 
 
@@ -61,35 +96,33 @@ class CPacketSlicer
 {
 public:
 	enum ParsingState {
-		STATE_INIT,
-		STATE_HEADER_MAGIC,
-		STATE_HEADER_CODE,
-		STATE_HEADER_FROMID,
-		STATE_HEADER_TOID,
-		STATE_HEADER_BLEN,
+		STATE_HEADER,
 		STATE_BODY
 	};
 
-	CPacketSlicer( void ) { init(); }
+	enum { MAX_HEADER_SIZE = 2 + 2 + (1 + 0xff) + (1 + 0xff) + 4 };
+
+	CPacketSlicer( void ) : strict_(false) { init(); }
 
 	~CPacketSlicer(void) { }
 
 	void init( void )
 	{
-		currHeaderLen_ = 0;
-		state_ = STATE_HEADER_MAGIC;
+		state_ = STATE_HEADER;
+		syncing_ = false;
 		buffer_.clear();
 		parsedItems_.clear();
 	}
 
-	const char * buffer_str( void )
+	// a body which can't be inflated fails the parse like a broken header, not only while a sync is read (a file import)
+	void setStrict( bool strict )
 	{
-		return (char *)buffer_.currentPtr();
+		strict_ = strict;
 	}
 
 	size_t buffer_size( void )
 	{
-		return buffer_.totalSize();
+		return buffer_.size();
 	}
 
 	void addBuffer( const std::string & buffer )
@@ -99,8 +132,19 @@ public:
 
 	void addBuffer( const char * buffer, size_t len )
 	{
-		std::string temp( buffer, len );
-		addBuffer( temp );
+		buffer_.write( buffer, len );
+	}
+
+	// direct feed : the receiver reads into prepareBuffer() and reports the count with commitBuffer().
+	// while a big body is in flight, the buffer is its own contiguous chunk, so the writable size grows with it.
+	char * prepareBuffer( size_t &size )
+	{
+		return buffer_.prepare( size );
+	}
+
+	void commitBuffer( size_t len )
+	{
+		buffer_.commit( len );
 	}
 
 	bool parse( void )
@@ -128,25 +172,73 @@ public:
 	}
 
 private:
-
-	bool _readString8( boost::uint8_t &len, std::string &str )
+	// returns the header length, 0 if more bytes are needed, -1 if the header is invalid.
+	int _parseHeader( void )
 	{
-		if( len <= 0 )
-		{
-			if( buffer_.remainingSize() < 1 )
-				return false;
-			currHeaderLen_ += buffer_.readInt8( len );
-		}
-		
-		if( len > 0 )
+		char header[MAX_HEADER_SIZE];
+		size_t size = buffer_.peek( header, sizeof(header) );
+		size_t pos = 0;
+
+		boost::uint16_t magic = 0x0;
+		if( size < pos + 4 )
+			return 0;
+		memcpy( &magic, header + pos, 2 );
+		memcpy( &currCode_, header + pos + 2, 2 );
+		pos += 4;
+
+		if( magic != NET_MAGIC_CODE && magic != NET_MAGIC_CODE_HANDLE )
+			return -1;
+
+		currCompressed_ = (currCode_ & CODE_FLAG_COMPRESSED) ? true : false;
+		currCode_ &= ~CODE_FLAG_COMPRESSED;
+
+		//qDebug() << "CPacketSlicer::packet recved " << currCode_;
+		if( currCode_ >= CODE_MAX )
+			return -1;
+
+		currFromHandle_ = 0;
+		currToHandle_ = 0;
+		if( magic == NET_MAGIC_CODE_HANDLE )
 		{
-			if( buffer_.remainingSize() < (size_t)len )
-				return false;
-
-			currHeaderLen_ += buffer_.read( str, len );
+			if( size < pos + 12 )
+				return 0;
+			memcpy( &currFromHandle_, header + pos, 4 );
+			memcpy( &currToHandle_, header + pos + 4, 4 );
+			memcpy( &currBodyLen_, header + pos + 8, 4 );
+			pos += 12;
+
+			currFromId_.clear();
+			currToId_.clear();
+			if( currBodyLen_ > MAX_PACKET_BODY_SIZE )
+				return -1;
+			return (int)pos;
 		}
 
-		return true;
+		if( size < pos + 1 )
+			return 0;
+		boost::uint8_t len = (boost::uint8_t)header[pos];
+		if( size < pos + 1 + len )
+			return 0;
+		currFromId_.assign( header + pos + 1, len );
+		pos += 1 + len;
+
+		if( size < pos + 1 )
+			return 0;
+		len = (boost::uint8_t)header[pos];
+		if( size < pos + 1 + len )
+			return 0;
+		currToId_.assign( header + pos + 1, len );
+		pos += 1 + len;
+
+		if( size < pos + 4 )
+			return 0;
+		memcpy( &currBodyLen_, header + pos, 4 );
+		pos += 4;
+
+		if( currBodyLen_ > MAX_PACKET_BODY_SIZE )	// 20MB
+			return -1;
+
+		return (int)pos;
 	}
 
 	bool doParse( void )
@@ -154,66 +246,26 @@ private:
 		try{
 			switch( state_ )
 			{
-			case STATE_INIT:
-				init();
-				state_ = STATE_HEADER_MAGIC;
-			case STATE_HEADER_MAGIC:
+			case STATE_HEADER:
 				{
-					currFromIdLen_ = currToIdLen_ = 0;
-					currHeaderLen_ = 0;
-					if( buffer_.remainingSize() < 2 )
-						return false;
-
-					boost::uint16_t magic = 0x0;
-					currHeaderLen_ += buffer_.readInt16( magic );
-
-					if( (boost::uint16_t)magic != NET_MAGIC_CODE )
+					int headerLen = _parseHeader();
+					if( headerLen < 0 )
 					{
 						init();
 						return false;
 					}
-				}
-				state_ = STATE_HEADER_CODE;
-			case STATE_HEADER_CODE:
-				if( buffer_.remainingSize() < 2 )
-					return false;
-
-				currHeaderLen_ += buffer_.readInt16( currCode_ );
-				//qDebug() << "CPacketSlicer::packet recved " << currCode_;
-				if( currCode_ >= CODE_MAX )
-				{
-					init();
-					return false;
-				}
-				state_ = STATE_HEADER_FROMID;
-			case STATE_HEADER_FROMID:
-				{
-					if( ! _readString8( currFromIdLen_, currFromId_ ) )
-						return false;
-
-					state_ = STATE_HEADER_TOID;
-				}
-			case STATE_HEADER_TOID:
-				{
-					if( ! _readString8( currToIdLen_, currToId_ ) )
+					if( headerLen == 0 )
 						return false;
 
-					state_ = STATE_HEADER_BLEN;
-				}
-			case STATE_HEADER_BLEN:
-				if( buffer_.remainingSize() < 4 )
-					return false;
-
-				currHeaderLen_ += buffer_.readInt32( currBodyLen_ );
+					buffer_.consume( headerLen );
 
-				if( currBodyLen_ > MAX_PACKET_BODY_SIZE )	// 20MB
-				{
-					init();
-					return false;
+					// a big body goes to its own chunk, so it can be handed over without copy.
+					if( currBodyLen_ > CPacketRingBuffer::DEFAULT_CHUNK_SIZE )
+						buffer_.reserveContiguous( currBodyLen_ );
 				}
 				state_ = STATE_BODY;
 			case STATE_BODY:
-				if( buffer_.remainingSize() < (size_t)currBodyLen_ )
+				if( buffer_.size() < (size_t)currBodyLen_ )
 				{
 					return false;
 				}
@@ -222,16 +274,36 @@ private:
 				data->code = currCode_;
 				data->fromId = currFromId_;
 				data->toId = currToId_;
-				data->body.assign( (const char *)buffer_.basePtr() + currHeaderLen_, currBodyLen_ );
+				data->fromHandle = currFromHandle_;
+				data->toHandle = currToHandle_;
+				data->setBody( buffer_.read( currBodyLen_ ) );
 
-				parsedItems_.push_back( data );
+				state_ = STATE_HEADER;
 
-				// read buffer init..
-				buffer_.erase( 0, currHeaderLen_ + currBodyLen_ );
-				buffer_.setReadPos( 0 );
-				currHeaderLen_ = 0;
+				if( currCode_ == CODE_SYSTEM_SYNC_START )
+					syncing_ = true;
+				else if( currCode_ == CODE_SYSTEM_SYNC_COMPLETE )
+					syncing_ = false;
 
-				state_ = STATE_HEADER_MAGIC;
+				if( currCompressed_ )
+				{
+					std::string body;
+					if( !CommonPacketBuilder::uncompressBody( data->bodyPtr(), data->bodySize(), body, MAX_PACKET_BODY_SIZE ) )
+					{
+						qDebug() << "CPacketSlicer : inflate failed, code" << currCode_ << ", body" << currBodyLen_ << (syncing_ || strict_ ? ", parse failed" : ", dropped");
+
+						// a canvas missing a part of it is worse than no canvas
+						if( syncing_ || strict_ )
+						{
+							init();
+							return false;
+						}
+						return true;	// a live packet, drop this one only
+					}
+					data->setBody( body );
+				}
+
+				parsedItems_.push_back( data );
 				return true;
 			}
 		} catch(CPacketException &e) {
@@ -244,15 +316,17 @@ private:
 	}
 
 private:
-	CPacketBuffer buffer_;
+	CPacketRingBuffer buffer_;
 	std::vector< boost::shared_ptr<CPacketData> > parsedItems_;
 
 	ParsingState state_;
-	boost::uint8_t currFromIdLen_;
-	boost::uint8_t currToIdLen_;
 	std::string currFromId_;
 	std::string currToId_;
-	boost::uint16_t currHeaderLen_;
+	boost::uint32_t currFromHandle_;
+	boost::uint32_t currToHandle_;
 	boost::uint16_t currCode_;
 	boost::uint32_t currBodyLen_;
+	bool currCompressed_;
+	bool syncing_;		// between CODE_SYSTEM_SYNC_START and CODE_SYSTEM_SYNC_COMPLETE
+	bool strict_;
 };
@@ -30,7 +30,7 @@
 #pragma once
 
 #include "Util.h"
-#include "PacketBuffer.h"
+#include "CommonPacketBuilder.h"
 #include <boost/enable_shared_from_this.hpp>
 #include <set>
 
@@ -51,6 +51,8 @@ enum PaintItemType {
 	PT_FILE,
 	PT_IMAGE_FILE,
 	PT_TEXT,
+	PT_LINE_COMPACT,	// wire type only : a CLineItem in the compact encoding. see CLineItem::serializeCompactTo()
+	PT_FILE_STREAM,		// wire type only : a CFileItem header. the data follows in CODE_PAINT_FILE_CHUNK
 	PT_MAX 
 };
 
@@ -76,6 +78,8 @@ public:
 	virtual void setBackgroundColor( int r, int g, int b, int a ) = 0;
 	virtual void drawBackgroundGridLine( int size ) = 0;
 	virtual void drawBackgroundImage( boost::shared_ptr<CBackgroundImageItem> line ) = 0;
+	virtual void drawLiveStroke( const std::string &owner, int strokeId, int startIndex, const QColor &clr, int width, const std::vector<QPointF> &points ) = 0;
+	virtual void clearLiveStroke( const std::string &owner ) = 0;
 };
 
 struct SPaintData
@@ -187,21 +191,19 @@ public:
 		return true;
 	}
 
-	static std::string serializeBasicData( const struct SPaintData &data, int *writePos = NULL )
+	static size_t basicDataSize( const struct SPaintData &data )
 	{
-		int pos = writePos ? *writePos : 0;
-		std::string buf;
-
-		pos += CPacketBufferUtil::writeString8( buf, pos, data.owner );
-		pos += CPacketBufferUtil::writeInt32( buf, pos, data.itemId, true );
-		pos += CPacketBufferUtil::writeInt8( buf, pos, data.posSetFlag ? 1 : 0 );
-		pos += CPacketBufferUtil::writeDouble( buf, pos, data.posX, true );
-		pos += CPacketBufferUtil::writeDouble( buf, pos, data.posY, true );
-		pos += CPacketBufferUtil::writeDouble( buf, pos, data.scale, true );
+		return CommonPacketBuilder::string8Size( data.owner ) + 4 + 1 + 8 * 3;
+	}
 
-		if( writePos )
-			*writePos = pos;
-		return buf;
+	static void writeBasicData( CommonPacketBuilder::CPacketWriter &writer, const struct SPaintData &data )
+	{
+		writer.writeString8( data.owner );
+		writer.writeInt32( data.itemId );
+		writer.writeInt8( data.posSetFlag ? 1 : 0 );
+		writer.writeDouble( data.posX );
+		writer.writeDouble( data.posY );
+		writer.writeDouble( data.scale );
 	}
 
 protected:
@@ -224,9 +226,15 @@ public:
 		return deserializeBasicData( data, data_, readPos );
 	}
 
-	virtual std::string serialize( int *writePos = NULL ) const
+	// the body is written straight into the packet. serializedSize() must match what serializeTo() writes.
+	virtual size_t serializedSize( void ) const
 	{
-		return serializeBasicData( data_, writePos );
+		return basicDataSize( data_ );
+	}
+
+	virtual void serializeTo( CommonPacketBuilder::CPacketWriter &writer ) const
+	{
+		writeBasicData( writer, data_ );
 	}
 
 	virtual PaintItemType type( void ) const = 0;
@@ -338,16 +346,17 @@ public:
 		return true;
 	}
 
-	std::string serialize( int *writePos = NULL ) const
+	size_t serializedSize( void ) const
 	{
-		int pos = 0;
-		std::string data;
+		return CPaintItem::serializedSize() + 4 + byteArray_.size();
+	}
 
-		data = CPaintItem::serialize( &pos );
+	void serializeTo( CommonPacketBuilder::CPacketWriter &writer ) const
+	{
+		CPaintItem::serializeTo( writer );
 
-		std::string pixmapBuf( byteArray_.data(), byteArray_.size() );
-		pos += CPacketBufferUtil::writeString32( data, pos, pixmapBuf, true );
-		return data;
+		writer.writeInt32( byteArray_.size() );
+		writer.writeBinary( byteArray_.constData(), byteArray_.size() );
 	}
 
 	virtual void copyToClipboard( bool firstItem = true )
@@ -464,25 +473,132 @@ public:
 		return true;
 	}
 
-	std::string serialize( int *writePos = NULL ) const
+	// this encoding cannot hold more than 65535 points
+	size_t pointCount( void ) const { return std::min( listList_.size(), (size_t)0xffff ); }
+
+	size_t serializedSize( void ) const
+	{
+		return CPaintItem::serializedSize() + 2 * 6 + pointCount() * 8 * 2;
+	}
+
+	void serializeTo( CommonPacketBuilder::CPacketWriter &writer ) const
 	{
-		int pos = 0;
-		std::string data;
+		CPaintItem::serializeTo( writer );
 
-		data = CPaintItem::serialize( &pos );
+		writer.writeInt16( clr_.red() );
+		writer.writeInt16( clr_.green() );
+		writer.writeInt16( clr_.blue() );
+		writer.writeInt16( clr_.alpha() );
+		writer.writeInt16( w_ );
 
-		pos += CPacketBufferUtil::writeInt16( data, pos, clr_.red(), true );
-		pos += CPacketBufferUtil::writeInt16( data, pos, clr_.green(), true );
-		pos += CPacketBufferUtil::writeInt16( data, pos, clr_.blue(), true );
-		pos += CPacketBufferUtil::writeInt16( data, pos, clr_.alpha(), true );
-		pos += CPacketBufferUtil::writeInt16( data, pos, w_, true );
-		pos += CPacketBufferUtil::writeInt16( data, pos, listList_.size(), true );
+		size_t ptCnt = pointCount();
+		writer.writeInt16( ptCnt );
+		for( size_t i = 0; i < ptCnt; i++ )
+		{
+			writer.writeDouble( listList_[i].x() );
+			writer.writeDouble( listList_[i].y() );
+		}
+	}
+
+	//
+	// compact encoding for PT_LINE_COMPACT
+	// | basic data | rgba 1byte each | varint width | 1byte fraction bits | varint point count | first point | deltas ... |
+	// a point is a pair of zigzag varints in fixed point. the first one is absolute, the others are deltas.
+	//
+	enum { COMPACT_FRACTION_BITS = 4 };	// 1/16 pixel
+
+	// the varint lengths of the points depend on the deltas, so the size walks them once
+	size_t compactSize( void ) const
+	{
+		size_t size = CPaintItem::serializedSize() + 4 + CPacketBufferUtil::varInt32Size( w_ ) + 1 + CPacketBufferUtil::varInt32Size( listList_.size() );
+
+		const double scale = (double)(1 << COMPACT_FRACTION_BITS);
+		boost::int32_t prevX = 0, prevY = 0;
 		for( size_t i = 0; i < listList_.size(); i++ )
 		{
-			pos += CPacketBufferUtil::writeDouble( data, pos, listList_[i].x(), true );
-			pos += CPacketBufferUtil::writeDouble( data, pos, listList_[i].y(), true );
+			boost::int32_t x = (boost::int32_t)floor( listList_[i].x() * scale + 0.5 );
+			boost::int32_t y = (boost::int32_t)floor( listList_[i].y() * scale + 0.5 );
+
+			size += CPacketBufferUtil::varInt32Size( CPacketBufferUtil::zigzagEncode32( x - prevX ) );
+			size += CPacketBufferUtil::varInt32Size( CPacketBufferUtil::zigzagEncode32( y - prevY ) );
+			prevX = x;
+			prevY = y;
 		}
-		return data;
+		return size;
+	}
+
+	void serializeCompactTo( CommonPacketBuilder::CPacketWriter &writer ) const
+	{
+		CPaintItem::serializeTo( writer );
+
+		writer.writeInt8( clr_.red() );
+		writer.writeInt8( clr_.green() );
+		writer.writeInt8( clr_.blue() );
+		writer.writeInt8( clr_.alpha() );
+		writer.writeVarInt32( w_ );
+		writer.writeInt8( COMPACT_FRACTION_BITS );
+		writer.writeVarInt32( listList_.size() );
+
+		const double scale = (double)(1 << COMPACT_FRACTION_BITS);
+		boost::int32_t prevX = 0, prevY = 0;
+		for( size_t i = 0; i < listList_.size(); i++ )
+		{
+			boost::int32_t x = (boost::int32_t)floor( listList_[i].x() * scale + 0.5 );
+			boost::int32_t y = (boost::int32_t)floor( listList_[i].y() * scale + 0.5 );
+
+			writer.writeVarInt32( CPacketBufferUtil::zigzagEncode32( x - prevX ) );
+			writer.writeVarInt32( CPacketBufferUtil::zigzagEncode32( y - prevY ) );
+			prevX = x;
+			prevY = y;
+		}
+	}
+
+	bool deserializeCompact( const std::string & data )
+	{
+		try
+		{
+			boost::uint8_t r, g, b, a, fractionBits;
+			boost::uint32_t w, ptCnt, v;
+			int pos = 0;
+
+			if( ! CPaintItem::deserialize( data, &pos ) )
+				return false;
+
+			pos += CPacketBufferUtil::readInt8( data, pos, r );
+			pos += CPacketBufferUtil::readInt8( data, pos, g );
+			pos += CPacketBufferUtil::readInt8( data, pos, b );
+			pos += CPacketBufferUtil::readInt8( data, pos, a );
+			pos += CPacketBufferUtil::readVarInt32( data, pos, w );
+			pos += CPacketBufferUtil::readInt8( data, pos, fractionBits );
+			pos += CPacketBufferUtil::readVarInt32( data, pos, ptCnt );
+
+			if( fractionBits > 16 || ptCnt > data.size() )	// a point takes 2 bytes at least
+				return false;
+
+			const double unit = 1.0 / (double)(1 << fractionBits);
+			boost::int32_t x = 0, y = 0;
+
+			listList_.clear();
+			listList_.reserve( ptCnt );
+			for( boost::uint32_t i = 0; i < ptCnt; i++ )
+			{
+				pos += CPacketBufferUtil::readVarInt32( data, pos, v );
+				x += CPacketBufferUtil::zigzagDecode32( v );
+				pos += CPacketBufferUtil::readVarInt32( data, pos, v );
+				y += CPacketBufferUtil::zigzagDecode32( v );
+
+				listList_.push_back( QPointF( x * unit, y * unit ) );
+			}
+
+			clr_ = QColor( r, g, b, a );
+			w_ = w;
+		} catch(CPacketException &e) {
+			(void)e;
+			// nothing to do
+			return false;
+		}
+
+		return true;
 	}
 
 private:
@@ -496,8 +612,8 @@ private:
 class CFileItem : public CPaintItem
 {
 public:
-	CFileItem( void ) : CPaintItem() { }
-	CFileItem( const QString &path ) : CPaintItem(), path_(path) { }
+	CFileItem( void ) : CPaintItem(), streaming_(false), pushFlag_(false), fileSize_(0), receivedSize_(0), fileRead_(false) { }
+	CFileItem( const QString &path ) : CPaintItem(), path_(path), streaming_(false), pushFlag_(false), fileSize_(0), receivedSize_(0), fileRead_(false) { }
 	virtual ~CFileItem( void ) 
 	{ 
 		qDebug() << "CFileItem deleted.. " << this; 
@@ -509,6 +625,16 @@ public:
 
 	const QString &path( void ) const { return path_; }
 
+	// streaming transfer. see CFileStreamManager
+	bool isStreaming( void ) const { return streaming_; }
+	bool isPushStream( void ) const { return pushFlag_; }
+	const std::string &fileName( void ) const { return fileName_; }
+	boost::uint64_t fileSize( void ) const { return fileSize_; }
+	boost::uint64_t receivedSize( void ) const { return receivedSize_; }
+	bool isReceiveComplete( void ) const { return !streaming_ || receivedSize_ >= fileSize_; }
+	void setPath( const QString &path ) { path_ = path; }
+	void setReceivedSize( boost::uint64_t size ) { receivedSize_ = size; }
+
 	virtual void draw( void )
 	{
 		if( canvas_ )
@@ -571,26 +697,90 @@ public:
 		return true;
 	}
 
-	std::string serialize( int *writePos = NULL ) const
+	// the file is read in serializedSize(), its size is not known before that.
+	// 0 : the file cannot be read. serializeTo() writes nothing then.
+	size_t serializedSize( void ) const
 	{
-		QFileInfo pathInfo( path_ );
-		QString fileName( pathInfo.fileName() );
+		fileData_.clear();
+		fileRead_ = false;
 
 		QFile f( path_ );
 		if( !f.open( QIODevice::ReadOnly ) )
-			return "";
+			return 0;
 
-		QByteArray byteArray;
-		byteArray = f.readAll();
+		fileData_ = f.readAll();
+		fileRead_ = true;
+		return CPaintItem::serializedSize() + CommonPacketBuilder::string16Size( Util::toUtf8StdString(QFileInfo( path_ ).fileName()) ) + 4 + fileData_.size();
+	}
 
-		int pos = 0;
-		std::string data;
-		data = CPaintItem::serialize( &pos );
-	
-		pos += CPacketBufferUtil::writeString16( data, pos, Util::toUtf8StdString(fileName), true );
-		pos += CPacketBufferUtil::writeInt32( data, pos, byteArray.size(), true );
-		pos += CPacketBufferUtil::writeBinary( data, pos, byteArray.data(), byteArray.size() );
-		return data;
+	void serializeTo( CommonPacketBuilder::CPacketWriter &writer ) const
+	{
+		if( !fileRead_ )
+			return;
+
+		CPaintItem::serializeTo( writer );
+
+		writer.writeString16( Util::toUtf8StdString(QFileInfo( path_ ).fileName()) );
+		writer.writeInt32( fileData_.size() );
+		writer.writeBinary( fileData_.constData(), fileData_.size() );
+
+		fileData_.clear();	// not kept with the item
+		fileRead_ = false;
+	}
+
+	//
+	// stream header for PT_FILE_STREAM. the file itself is not read here.
+	// | basic data | 2byte name length | name | 4byte size high | 4byte size low | 1byte push flag |
+	// push flag 1 : the sender pushes the chunks right after this. 0 : the receiver requests them.
+	//
+	size_t streamHeaderSize( void ) const
+	{
+		return CPaintItem::serializedSize() + CommonPacketBuilder::string16Size( Util::toUtf8StdString(QFileInfo( path_ ).fileName()) ) + 4 + 4 + 1;
+	}
+
+	void serializeStreamHeaderTo( CommonPacketBuilder::CPacketWriter &writer, bool pushFlag ) const
+	{
+		QFileInfo pathInfo( path_ );
+		boost::uint64_t size = pathInfo.size();
+
+		CPaintItem::serializeTo( writer );
+
+		writer.writeString16( Util::toUtf8StdString(pathInfo.fileName()) );
+		writer.writeInt32( (boost::uint32_t)(size >> 32) );
+		writer.writeInt32( (boost::uint32_t)size );
+		writer.writeInt8( pushFlag ? 1 : 0 );
+	}
+
+	bool deserializeStreamHeader( const std::string & data )
+	{
+		try
+		{
+			boost::uint32_t high, low;
+			boost::uint8_t push;
+			int pos = 0;
+
+			if( ! CPaintItem::deserialize( data, &pos ) )
+				return false;
+
+			pos += CPacketBufferUtil::readString16( data, pos, fileName_, true );
+			pos += CPacketBufferUtil::readInt32( data, pos, high, true );
+			pos += CPacketBufferUtil::readInt32( data, pos, low, true );
+			pos += CPacketBufferUtil::readInt8( data, pos, push );
+
+			// a name must not lead out of the download folder
+			if( fileName_.find_first_of( "/\\:" ) != std::string::npos || fileName_ == ".." )
+				return false;
+
+			fileSize_ = ((boost::uint64_t)high << 32) | low;
+			pushFlag_ = (push == 1);
+			receivedSize_ = 0;
+			streaming_ = true;
+		} catch(CPacketException &e) {
+			(void)e;
+			// nothing to do
+			return false;
+		}
+		return true;
 	}
 
 	virtual void copyToClipboard( bool firstItem = true )
@@ -602,6 +792,16 @@ public:
 
 protected:
 	QString path_;
+
+	bool streaming_;
+	bool pushFlag_;
+	std::string fileName_;
+	boost::uint64_t fileSize_;
+	boost::uint64_t receivedSize_;
+
+	// read by serializedSize() for serializeTo()
+	mutable QByteArray fileData_;
+	mutable bool fileRead_;
 };
 
 
@@ -700,23 +900,25 @@ public:
 		return true;
 	}
 
-	std::string serialize( int *writePos = NULL ) const
+	size_t serializedSize( void ) const
 	{
-		int pos = 0;
-		std::string data;
+		return CPaintItem::serializedSize() + 2 * 5
+			+ CommonPacketBuilder::string16Size( Util::toUtf8StdString(text_) )
+			+ CommonPacketBuilder::string16Size( Util::toUtf8StdString(font_.family()) ) + 1;
+	}
 
-		data = CPaintItem::serialize( &pos );
+	void serializeTo( CommonPacketBuilder::CPacketWriter &writer ) const
+	{
+		CPaintItem::serializeTo( writer );
 
-		pos += CPacketBufferUtil::writeInt16( data, pos, clr_.red(), true );
-		pos += CPacketBufferUtil::writeInt16( data, pos, clr_.green(), true );
-		pos += CPacketBufferUtil::writeInt16( data, pos, clr_.blue(), true );
-		pos += CPacketBufferUtil::writeInt16( data, pos, clr_.alpha(), true );
-		pos += CPacketBufferUtil::writeInt16( data, pos, font_.pixelSize(), true );
-		pos += CPacketBufferUtil::writeString16( data, pos, Util::toUtf8StdString(text_), true );
-		pos += CPacketBufferUtil::writeString16( data, pos, Util::toUtf8StdString(font_.family()), true );
-		pos += CPacketBufferUtil::writeInt8( data, pos, font_.bold() ? 1 : 0 );
-	
-		return data;
+		writer.writeInt16( clr_.red() );
+		writer.writeInt16( clr_.green() );
+		writer.writeInt16( clr_.blue() );
+		writer.writeInt16( clr_.alpha() );
+		writer.writeInt16( font_.pixelSize() );
+		writer.writeString16( Util::toUtf8StdString(text_) );
+		writer.writeString16( Util::toUtf8StdString(font_.family()) );
+		writer.writeInt8( font_.bold() ? 1 : 0 );
 	}
 
 	virtual void copyToClipboard( bool firstItem = true )
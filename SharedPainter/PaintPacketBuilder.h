@@ -40,13 +40,13 @@ namespace PaintPacketBuilder
 	public:
 		static std::string make( int size, const std::string *target = NULL )
 		{		
-			std::string data;
-			int pos = 0;
+			std::string packet;
 			try
 			{
-				pos += CPacketBufferUtil::writeInt16( data, pos, size, true );
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_PAINT_SET_BG_GRID_LINE, 2, NULL, target );
+				writer.writeInt16( size );
 
-				return CommonPacketBuilder::makePacket( CODE_PAINT_SET_BG_GRID_LINE, data, NULL, target );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -77,16 +77,16 @@ namespace PaintPacketBuilder
 	public:
 		static std::string make( int r, int g, int b, int a, const std::string *target = NULL )
 		{		
-			std::string data;
-			int pos = 0;
+			std::string packet;
 			try
 			{
-				pos += CPacketBufferUtil::writeInt16( data, pos, r, true );
-				pos += CPacketBufferUtil::writeInt16( data, pos, g, true );
-				pos += CPacketBufferUtil::writeInt16( data, pos, b, true );
-				pos += CPacketBufferUtil::writeInt16( data, pos, a, true );
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_PAINT_SET_BG_COLOR, 2 * 4, NULL, target );
+				writer.writeInt16( r );
+				writer.writeInt16( g );
+				writer.writeInt16( b );
+				writer.writeInt16( a );
 
-				return CommonPacketBuilder::makePacket( CODE_PAINT_SET_BG_COLOR, data, NULL, target );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -122,11 +122,14 @@ namespace PaintPacketBuilder
 	public:
 		static std::string make( boost::shared_ptr<CBackgroundImageItem> item, const std::string *target = NULL )
 		{		
-			std::string data = item->serialize();
+			std::string packet;
 
 			try
 			{
-				return CommonPacketBuilder::makePacket( CODE_PAINT_SET_BG_IMAGE, data, NULL, target );
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_PAINT_SET_BG_IMAGE, item->serializedSize(), NULL, target );
+				item->serializeTo( writer );
+
+				return packet;
 			}catch(...)
 			{
 
@@ -162,8 +165,9 @@ namespace PaintPacketBuilder
 		{		
 			try
 			{
-				std::string body;
-				return CommonPacketBuilder::makePacket( CODE_PAINT_CLEAR_BG, body );
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_PAINT_CLEAR_BG, 0 );
+				return packet;
 			}catch(...)
 			{
 
@@ -189,18 +193,49 @@ namespace PaintPacketBuilder
 	class CCreateItem
 	{
 	public:
-		static std::string make( boost::shared_ptr<CPaintItem> item, const std::string *target = NULL )
+		// <caps> : the capabilities of the receivers. they choose the optional encodings.
+		// a streamed file item needs <fromId>, the receivers request the chunks from there.
+		static std::string make( boost::shared_ptr<CPaintItem> item, const std::string *target = NULL, boost::uint32_t caps = 0, const std::string *fromId = NULL, bool pushFlag = false )
 		{		
-			std::string body;
-			std::string data = item->serialize();
+			boost::uint16_t type = item->type();
+			boost::uint16_t streamType = 0;
+			size_t dataSize = 0;
+			if( (caps & CAPS_COMPACT_LINE) && type == PT_LINE )
+			{
+				type = PT_LINE_COMPACT;
+				dataSize = boost::static_pointer_cast<CLineItem>(item)->compactSize();
+			}
+			else if( (caps & CAPS_FILE_STREAM) && fromId && (type == PT_FILE || type == PT_IMAGE_FILE) )
+			{
+				streamType = type;
+				type = PT_FILE_STREAM;
+				dataSize = boost::static_pointer_cast<CFileItem>(item)->streamHeaderSize();
+			}
+			else
+			{
+				dataSize = item->serializedSize();
+				if( dataSize == 0 )
+					return "";	// the file of a file item cannot be read
+			}
+
+			std::string packet;
 
-			int pos = 0;
 			try
 			{
-				pos += CPacketBufferUtil::writeInt16( body, pos, item->type(), true );
-				body += data;
+				size_t bodySize = 2 + (type == PT_FILE_STREAM ? 2 : 0) + dataSize;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_PAINT_CREATE_ITEM, bodySize, fromId, target );
+				writer.writeInt16( type );
+				if( type == PT_LINE_COMPACT )
+					boost::static_pointer_cast<CLineItem>(item)->serializeCompactTo( writer );
+				else if( type == PT_FILE_STREAM )
+				{
+					writer.writeInt16( streamType );
+					boost::static_pointer_cast<CFileItem>(item)->serializeStreamHeaderTo( writer, pushFlag );
+				}
+				else
+					item->serializeTo( writer );
 
-				return CommonPacketBuilder::makePacket( CODE_PAINT_CREATE_ITEM, body, NULL, target );
+				return packet;
 			}catch(...)
 			{
 				
@@ -209,6 +244,18 @@ namespace PaintPacketBuilder
 			return "";
 		}
 
+		static bool isCompactLine( const std::string &body )
+		{
+			boost::uint16_t type = 0;
+			try
+			{
+				CPacketBufferUtil::readInt16( body, 0, type, true );
+			}catch(...)
+			{
+			}
+			return type == PT_LINE_COMPACT;
+		}
+
 		static boost::shared_ptr<CPaintItem> parse( const std::string &body )
 		{		
 			boost::shared_ptr< CPaintItem > item;
@@ -221,9 +268,34 @@ namespace PaintPacketBuilder
 
 				PaintItemType type = (PaintItemType)temptype;
 
-				item = CPaintItemFactory::createItem( type );
+				if( type == PT_FILE_STREAM )
+				{
+					boost::uint16_t streamType;
+					pos += CPacketBufferUtil::readInt16( body, pos, streamType, true );
+					if( streamType != PT_FILE && streamType != PT_IMAGE_FILE )
+						return boost::shared_ptr<CPaintItem>();
+
+					boost::shared_ptr<CFileItem> file = boost::static_pointer_cast<CFileItem>( CPaintItemFactory::createItem( (PaintItemType)streamType ) );
+					std::string itemData( (const char *)body.c_str() + pos, body.size() - pos );
+					if( !file->deserializeStreamHeader( itemData ) )
+						return boost::shared_ptr<CPaintItem>();
+					return file;
+				}
 
 				std::string itemData( (const char *)body.c_str() + pos, body.size() - pos );
+
+				if( type == PT_LINE_COMPACT )
+				{
+					boost::shared_ptr<CLineItem> line(new CLineItem);
+					if( !line->deserializeCompact( itemData ) )
+						return boost::shared_ptr<CPaintItem>();
+					return line;
+				}
+
+				item = CPaintItemFactory::createItem( type );
+				if( !item )
+					return boost::shared_ptr<CPaintItem>();
+
 				if( !item->deserialize( itemData ) )
 				{
 					return boost::shared_ptr<CPaintItem>();
@@ -237,6 +309,107 @@ namespace PaintPacketBuilder
 		}
 	};
 
+	//
+	// | owner 1byte string | 4byte item id | 4byte offset high | 4byte offset low | data ... |
+	//
+	class CFileChunk
+	{
+	public:
+		enum { MAX_HEADER_SIZE = (1 + 0xff) + 4 + 4 + 4 };
+
+		static std::string make( const std::string &owner, int itemId, boost::uint64_t offset, const char *data, size_t size, const std::string *target = NULL )
+		{		
+			std::string packet;
+			try
+			{
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_PAINT_FILE_CHUNK, CommonPacketBuilder::string8Size( owner ) + 12 + size, NULL, target );
+				writer.writeString8( owner );
+				writer.writeInt32( itemId );
+				writer.writeInt32( (boost::uint32_t)(offset >> 32) );
+				writer.writeInt32( (boost::uint32_t)offset );
+				writer.writeBinary( data, size );
+
+				return packet;
+			}catch(...)
+			{
+			}
+
+			return "";
+		}
+
+		// only the header is parsed. the data starts at <headerSize> of the body.
+		static bool parse( const char *body, size_t bodySize, std::string &owner, int &itemId, boost::uint64_t &offset, size_t &headerSize )
+		{		
+			try
+			{
+				std::string header( body, std::min( bodySize, (size_t)MAX_HEADER_SIZE ) );
+				boost::uint32_t id, high, low;
+				int pos = 0;
+
+				pos += CPacketBufferUtil::readString8( header, pos, owner );
+				pos += CPacketBufferUtil::readInt32( header, pos, id, true );
+				pos += CPacketBufferUtil::readInt32( header, pos, high, true );
+				pos += CPacketBufferUtil::readInt32( header, pos, low, true );
+
+				itemId = id;
+				offset = ((boost::uint64_t)high << 32) | low;
+				headerSize = pos;
+				return true;
+			}catch(...)
+			{
+			}
+			return false;
+		}
+	};
+
+	//
+	// | owner 1byte string | 4byte item id | 4byte offset high | 4byte offset low |
+	// asks the receiver (the to id) to send the file from the offset. the answer goes to the from id.
+	//
+	class CFileRequest
+	{
+	public:
+		static std::string make( const std::string &owner, int itemId, boost::uint64_t offset, const std::string &fromId, const std::string &target )
+		{		
+			std::string packet;
+			try
+			{
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_PAINT_FILE_REQUEST, CommonPacketBuilder::string8Size( owner ) + 12, &fromId, &target );
+				writer.writeString8( owner );
+				writer.writeInt32( itemId );
+				writer.writeInt32( (boost::uint32_t)(offset >> 32) );
+				writer.writeInt32( (boost::uint32_t)offset );
+
+				return packet;
+			}catch(...)
+			{
+			}
+
+			return "";
+		}
+
+		static bool parse( const std::string &body, std::string &owner, int &itemId, boost::uint64_t &offset )
+		{		
+			try
+			{
+				boost::uint32_t id, high, low;
+				int pos = 0;
+
+				pos += CPacketBufferUtil::readString8( body, pos, owner );
+				pos += CPacketBufferUtil::readInt32( body, pos, id, true );
+				pos += CPacketBufferUtil::readInt32( body, pos, high, true );
+				pos += CPacketBufferUtil::readInt32( body, pos, low, true );
+
+				itemId = id;
+				offset = ((boost::uint64_t)high << 32) | low;
+				return true;
+			}catch(...)
+			{
+			}
+			return false;
+		}
+	};
+
 	class CClearScreen
 	{
 	public:
@@ -244,8 +417,9 @@ namespace PaintPacketBuilder
 		{		
 			try
 			{
-				std::string body;
-				return CommonPacketBuilder::makePacket( CODE_PAINT_CLEAR_SCREEN, body );
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_PAINT_CLEAR_SCREEN, 0 );
+				return packet;
 			}catch(...)
 			{
 
@@ -267,4 +441,102 @@ namespace PaintPacketBuilder
 			return true;
 		}
 	};
+	//
+	// | owner 1byte string | 4byte stroke id | 4byte start index | rgba 1byte each | varint width | varint point count | points |
+	// a part of the stroke being drawn. points are in the PT_LINE_COMPACT encoding (first absolute, then deltas).
+	// it is only drawn provisionally, the CLineItem made on pen up replaces it.
+	//
+	class CLiveStroke
+	{
+	public:
+		static std::string make( const std::string &owner, int strokeId, boost::shared_ptr<CLineItem> line, size_t startIndex, size_t count, const std::string *target = NULL )
+		{
+			std::string data;
+			int pos = 0;
+			data.reserve( 4 + 5 + 5 + count * 4 );
+
+			pos += CPacketBufferUtil::writeInt8( data, pos, line->color().red() );
+			pos += CPacketBufferUtil::writeInt8( data, pos, line->color().green() );
+			pos += CPacketBufferUtil::writeInt8( data, pos, line->color().blue() );
+			pos += CPacketBufferUtil::writeInt8( data, pos, line->color().alpha() );
+			pos += CPacketBufferUtil::writeVarInt32( data, pos, line->width() );
+			pos += CPacketBufferUtil::writeVarInt32( data, pos, count );
+
+			const double scale = (double)(1 << CLineItem::COMPACT_FRACTION_BITS);
+			boost::int32_t prevX = 0, prevY = 0;
+			for( size_t i = startIndex; i < startIndex + count && i < line->pointCount(); i++ )
+			{
+				boost::int32_t x = (boost::int32_t)floor( line->point( i )->x() * scale + 0.5 );
+				boost::int32_t y = (boost::int32_t)floor( line->point( i )->y() * scale + 0.5 );
+
+				pos += CPacketBufferUtil::writeVarInt32( data, pos, CPacketBufferUtil::zigzagEncode32( x - prevX ) );
+				pos += CPacketBufferUtil::writeVarInt32( data, pos, CPacketBufferUtil::zigzagEncode32( y - prevY ) );
+				prevX = x;
+				prevY = y;
+			}
+
+			std::string packet;
+			try
+			{
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_PAINT_LIVE_STROKE, CommonPacketBuilder::string8Size( owner ) + 8 + data.size(), NULL, target );
+				writer.writeString8( owner );
+				writer.writeInt32( strokeId );
+				writer.writeInt32( startIndex );
+				writer.writeBinary( data );
+
+				return packet;
+			}catch(...)
+			{
+			}
+
+			return "";
+		}
+
+		static bool parse( const std::string &body, std::string &owner, int &strokeId, int &startIndex, QColor &clr, int &width, std::vector<QPointF> &points )
+		{
+			try
+			{
+				boost::uint32_t id, index, w, ptCnt, v;
+				boost::uint8_t r, g, b, a;
+				int pos = 0;
+
+				pos += CPacketBufferUtil::readString8( body, pos, owner );
+				pos += CPacketBufferUtil::readInt32( body, pos, id, true );
+				pos += CPacketBufferUtil::readInt32( body, pos, index, true );
+				pos += CPacketBufferUtil::readInt8( body, pos, r );
+				pos += CPacketBufferUtil::readInt8( body, pos, g );
+				pos += CPacketBufferUtil::readInt8( body, pos, b );
+				pos += CPacketBufferUtil::readInt8( body, pos, a );
+				pos += CPacketBufferUtil::readVarInt32( body, pos, w );
+				pos += CPacketBufferUtil::readVarInt32( body, pos, ptCnt );
+
+				if( ptCnt > body.size() )	// a point takes 2 bytes at least
+					return false;
+
+				const double unit = 1.0 / (double)(1 << CLineItem::COMPACT_FRACTION_BITS);
+				boost::int32_t x = 0, y = 0;
+
+				points.clear();
+				points.reserve( ptCnt );
+				for( boost::uint32_t i = 0; i < ptCnt; i++ )
+				{
+					pos += CPacketBufferUtil::readVarInt32( body, pos, v );
+					x += CPacketBufferUtil::zigzagDecode32( v );
+					pos += CPacketBufferUtil::readVarInt32( body, pos, v );
+					y += CPacketBufferUtil::zigzagDecode32( v );
+
+					points.push_back( QPointF( x * unit, y * unit ) );
+				}
+
+				strokeId = id;
+				startIndex = index;
+				clr = QColor( r, g, b, a );
+				width = w;
+				return true;
+			}catch(...)
+			{
+			}
+			return false;
+		}
+	};
 };
@@ -29,12 +29,134 @@
 
 #pragma once
 
+#include <map>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
 #include "PacketSlicer.h"
 #include "NetPeerSession.h"
 
 class CPaintSession;
 
+//
+// the handles the relay server has given the joiners of the room (CODE_SYSTEM_SESSION_HANDLE).
+// once it has them, the packets to the server may have the handle header, which the server routes by an index.
+//
+class CSessionHandleTable
+{
+public:
+	typedef std::vector< std::pair<boost::uint32_t, std::string> > ENTRY_LIST;
+
+	CSessionHandleTable( void ) : ownHandle_(0) { }
+
+	// ownHandle 0 : only more joiners
+	void add( boost::uint32_t ownHandle, const ENTRY_LIST &entries )
+	{
+		boost::mutex::scoped_lock autolock(mutex_);
+
+		if( ownHandle != 0 )
+			ownHandle_ = ownHandle;
+
+		for( size_t i = 0; i < entries.size(); i++ )
+		{
+			std::map<std::string, boost::uint32_t>::iterator it = handles_.find( entries[i].second );
+			if( it != handles_.end() )
+				ids_.erase( it->second );	// joined again
+
+			handles_[ entries[i].second ] = entries[i].first;
+			ids_[ entries[i].first ] = entries[i].second;
+		}
+	}
+
+	void remove( const std::string &userId )
+	{
+		boost::mutex::scoped_lock autolock(mutex_);
+
+		std::map<std::string, boost::uint32_t>::iterator it = handles_.find( userId );
+		if( it == handles_.end() )
+			return;
+		ids_.erase( it->second );
+		handles_.erase( it );
+	}
+
+	// the ids of a packet with the handle header
+	void resolve( CPacketData &data )
+	{
+		if( data.fromHandle == 0 && data.toHandle == 0 )
+			return;
+
+		boost::mutex::scoped_lock autolock(mutex_);
+
+		std::map<boost::uint32_t, std::string>::iterator it = ids_.find( data.fromHandle );
+		if( it != ids_.end() )
+			data.fromId = it->second;
+
+		it = ids_.find( data.toHandle );
+		if( it != ids_.end() )
+			data.toId = it->second;
+	}
+
+	// a single packet with the id header into <out> with the handle header.
+	// false : not a single packet, no handles yet, or the target has none
+	bool encode( const std::string &packet, std::string &out )
+	{
+		try
+		{
+			boost::uint16_t magic = 0, code = 0;
+			boost::uint32_t bodySize = 0;
+			std::string fromId, toId;
+			size_t pos = 0;
+
+			pos += CPacketBufferUtil::readInt16( packet, pos, magic, true );
+			if( magic != NET_MAGIC_CODE )
+				return false;
+			pos += CPacketBufferUtil::readInt16( packet, pos, code, true );
+			pos += CPacketBufferUtil::readString8( packet, pos, fromId );
+			pos += CPacketBufferUtil::readString8( packet, pos, toId );
+			pos += CPacketBufferUtil::readInt32( packet, pos, bodySize, true );
+
+			if( pos + bodySize != packet.size() )	// not a single packet
+				return false;
+
+			boost::uint32_t ownHandle = 0, toHandle = 0;
+			{
+				boost::mutex::scoped_lock autolock(mutex_);
+
+				ownHandle = ownHandle_;
+				if( ownHandle == 0 )
+					return false;
+
+				if( !toId.empty() )
+				{
+					std::map<std::string, boost::uint32_t>::iterator it = handles_.find( toId );
+					if( it == handles_.end() )
+						return false;
+					toHandle = it->second;
+				}
+			}
+
+			out.clear();
+			out.reserve( 2 + 2 + 4 + 4 + 4 + bodySize );
+			CPacketBufferUtil::writeInt16( out, out.size(), NET_MAGIC_CODE_HANDLE, true );
+			CPacketBufferUtil::writeInt16( out, out.size(), code, true );
+			CPacketBufferUtil::writeInt32( out, out.size(), ownHandle, true );
+			CPacketBufferUtil::writeInt32( out, out.size(), toHandle, true );
+			CPacketBufferUtil::writeInt32( out, out.size(), bodySize, true );
+			out.append( packet, pos, bodySize );
+			return true;
+
+		}catch(...)
+		{
+		}
+		return false;
+	}
+
+private:
+	boost::uint32_t ownHandle_;
+	std::map<std::string, boost::uint32_t> handles_;
+	std::map<boost::uint32_t, std::string> ids_;
+	boost::mutex mutex_;
+};
+
 class IPaintSessionEvent
 {
 public:
@@ -48,7 +170,7 @@ public:
 class CPaintSession : public boost::enable_shared_from_this<CPaintSession>, INetPeerSessionEvent
 {
 public:
-	CPaintSession( boost::shared_ptr<CNetPeerSession> session, IPaintSessionEvent *evt ) : session_(session), evtTarget_(evt)
+	CPaintSession( boost::shared_ptr<CNetPeerSession> session, IPaintSessionEvent *evt ) : session_(session), evtTarget_(evt), packetSlicer_(new CPacketSlicer)
 	{
 		session_->setEvent( this );
 		//qDebug() << "CPaintSession(void) " << this;
@@ -77,6 +199,11 @@ public:
 		return session_;
 	}
 
+	CSessionHandleTable &handles( void )
+	{
+		return handles_;
+	}
+
 	virtual void onINetPeerSessionEvent_Connected( CNetPeerSession *session )
 	{
 		if( evtTarget_ )
@@ -87,16 +214,21 @@ public:
 		if( evtTarget_ )
 			evtTarget_->onIPaintSessionEvent_ConnectFailed( this );
 	}
-	virtual void onINetPeerSessionEvent_Received( CNetPeerSession *session, const std::string buffer )
+	virtual char * onINetPeerSessionEvent_PrepareReceive( CNetPeerSession *session, size_t &size, boost::shared_ptr<void> &owner )
 	{
-		packetSlicer_.addBuffer( buffer );
+		owner = packetSlicer_;
+		return packetSlicer_->prepareBuffer( size );
+	}
+	virtual void onINetPeerSessionEvent_Received( CNetPeerSession *session, size_t bytes )
+	{
+		packetSlicer_->commitBuffer( bytes );
 
-		if( packetSlicer_.parse() == false )
+		if( packetSlicer_->parse() == false )
 			return;
 
-		for( size_t i = 0; i < packetSlicer_.parsedItemCount(); i++ )
+		for( size_t i = 0; i < packetSlicer_->parsedItemCount(); i++ )
 		{
-			boost::shared_ptr<CPacketData> data = packetSlicer_.parsedItem( i );
+			boost::shared_ptr<CPacketData> data = packetSlicer_->parsedItem( i );
 
 			if ( ! session_->isConnected() )
 			{
@@ -104,6 +236,8 @@ public:
 				break;
 			}
 
+			handles_.resolve( *data );
+
 			if( evtTarget_ )
 				evtTarget_->onIPaintSessionEvent_ReceivedPacket( this, data );
 		}
@@ -122,7 +256,8 @@ public:
 private:
 	boost::shared_ptr<CNetPeerSession> session_;
 	IPaintSessionEvent *evtTarget_;
-	CPacketSlicer packetSlicer_;
+	boost::shared_ptr<CPacketSlicer> packetSlicer_;	// shared with a pending read, which may outlive this session
+	CSessionHandleTable handles_;
 
 	std::deque< boost::shared_ptr<CNetPacketData> > packetList_;
 };
@@ -29,7 +29,7 @@
 
 #pragma once
 
-#include "PacketBuffer.h"
+#include "CommonPacketBuilder.h"
 
 struct SPaintUserInfoData
 {
@@ -54,8 +54,8 @@ typedef std::vector<boost::shared_ptr<CPaintUser> > USER_LIST;
 class CPaintUser
 {
 public:
-	CPaintUser( bool myself ) : mySelfFlag_(myself), screenStreamListenPort_(0) { }
-	CPaintUser( void ) : mySelfFlag_(false) { }
+	CPaintUser( bool myself ) : mySelfFlag_(myself), screenStreamListenPort_(0), capabilities_(0) { }
+	CPaintUser( void ) : mySelfFlag_(false), capabilities_(0) { }
 	~CPaintUser( void ) { }
 
 	// session id is only used for "always p2p mode"
@@ -74,6 +74,7 @@ public:
 	void setScreenStreaming( bool status ) { data_.screenStreaming = status; }
 	void setScreenStreamingReceiver( bool status ) { data_.screenStreamingReceiver = status; }
 	void setScreenStreamListenPort( boost::uint16_t port ) { screenStreamListenPort_ = port; }
+	void setCapabilities( boost::uint32_t caps ) { capabilities_ = caps; }	// not serialized. see CODE_SYSTEM_VERSION_INFO
 
 	bool isMyself( void ) { return mySelfFlag_; }
 	const struct SPaintUserInfoData &data( void ) { return data_; }
@@ -90,21 +91,26 @@ public:
 	
 	bool isAvailableRecvScreenStream( void ) { return screenStreamListenPort_ != 0; }
 	boost::uint16_t screenStreamListenPort( void ) { return screenStreamListenPort_; }
+	boost::uint32_t capabilities( void ) { return capabilities_; }
+	bool hasCapability( boost::uint32_t caps ) { return (capabilities_ & caps) == caps; }
 
 
-	std::string serialize( void ) {
-		std::string body;
-		int pos = 0;
-		pos += CPacketBufferUtil::writeString8( body, pos, data_.channel );
-		pos += CPacketBufferUtil::writeString8( body, pos, data_.userId );
-		pos += CPacketBufferUtil::writeString8( body, pos, data_.nickName );
-		pos += CPacketBufferUtil::writeString8( body, pos, data_.viewIp );
-		pos += CPacketBufferUtil::writeString8( body, pos, data_.localIp );
-		pos += CPacketBufferUtil::writeInt16( body, pos, data_.listenTcpPort, true );
-		pos += CPacketBufferUtil::writeInt8( body, pos, data_.superPeerCandidate ? 1 : 0 );
-		pos += CPacketBufferUtil::writeInt8( body, pos, data_.screenRecording ? 1 : 0 );
-		pos += CPacketBufferUtil::writeInt8( body, pos, data_.screenStreamingReceiver ? 1 : 0 );
-		return body;
+	size_t serializedSize( void ) {
+		return CommonPacketBuilder::string8Size( data_.channel ) + CommonPacketBuilder::string8Size( data_.userId )
+			+ CommonPacketBuilder::string8Size( data_.nickName ) + CommonPacketBuilder::string8Size( data_.viewIp )
+			+ CommonPacketBuilder::string8Size( data_.localIp ) + 2 + 1 + 1 + 1;
+	}
+
+	void serializeTo( CommonPacketBuilder::CPacketWriter &writer ) {
+		writer.writeString8( data_.channel );
+		writer.writeString8( data_.userId );
+		writer.writeString8( data_.nickName );
+		writer.writeString8( data_.viewIp );
+		writer.writeString8( data_.localIp );
+		writer.writeInt16( data_.listenTcpPort );
+		writer.writeInt8( data_.superPeerCandidate ? 1 : 0 );
+		writer.writeInt8( data_.screenRecording ? 1 : 0 );
+		writer.writeInt8( data_.screenStreamingReceiver ? 1 : 0 );
 	}        
 
 	bool deserialize( const std::string & data, int *readPos = NULL ) {
@@ -135,6 +141,7 @@ public:
 private:
 	bool mySelfFlag_;
 	boost::uint16_t screenStreamListenPort_;
+	boost::uint32_t capabilities_;
 	int sessionId_;
 	SPaintUserInfoData data_;
 };
@@ -20,6 +20,7 @@ void PreferencesDialog::loadGeneral( void )
 	ui.checkBoxServerConnOnStart->setCheckState( SettingManagerPtr()->isRelayServerConnectOnStarting() ? Qt::Checked : Qt::Unchecked );
 	ui.checkBoxBlinkLastItem->setCheckState( SettingManagerPtr()->isBlinkLastItem() ? Qt::Checked : Qt::Unchecked );
 	ui.checkBoxAutoSaveData->setCheckState( SettingManagerPtr()->isAutoSaveData() ? Qt::Checked : Qt::Unchecked );
+	ui.checkBoxCompactExportData->setCheckState( SettingManagerPtr()->isCompactExportData() ? Qt::Checked : Qt::Unchecked );
 	ui.checkBoxHighQualityMoveItem->setCheckState( SettingManagerPtr()->isHighQualityMoveItemMode() ? Qt::Checked : Qt::Unchecked );
 }
 
@@ -39,6 +40,9 @@ void PreferencesDialog::onOK( void )
 	enable = ui.checkBoxAutoSaveData->checkState() == Qt::Checked ? true : false;
 	SettingManagerPtr()->setAutoSaveData( enable );
 
+	enable = ui.checkBoxCompactExportData->checkState() == Qt::Checked ? true : false;
+	SettingManagerPtr()->setCompactExportData( enable );
+
 	enable = ui.checkBoxHighQualityMoveItem->checkState() == Qt::Checked ? true : false;
 	SettingManagerPtr()->setHighQualityMoveItemMode( enable );
 
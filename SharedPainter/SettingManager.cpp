@@ -73,6 +73,7 @@ void CSettingManager::load( void )
 	serverConnectOnStart_ = settings.value( "serverConnectOnStart", true ).toBool();
 	blinkLastItem_ = settings.value( "blinkLastItem", true ).toBool();
 	autoSaveData_ = settings.value( "autoSaveData", true ).toBool();
+	compactExportData_ = settings.value( "compactExportData", false ).toBool();
 	hiqhQualityMoveItemMode_ = settings.value( "highQualityMoveItem", false ).toBool();
 	settings.endGroup();
 
@@ -103,6 +104,7 @@ void CSettingManager::save( void )
 	settings.setValue( "serverConnectOnStart", serverConnectOnStart_ );
 	settings.setValue( "blinkLastItem", blinkLastItem_ );
 	settings.setValue( "autoSaveData", autoSaveData_ );
+	settings.setValue( "compactExportData", compactExportData_ );
 	settings.setValue( "highQualityMoveItem", hiqhQualityMoveItemMode_ );
 	settings.endGroup();
 
@@ -71,6 +71,9 @@ public:
 	bool isAutoSaveData( void ) { return autoSaveData_; }
 	void setAutoSaveData( bool enabled ) { autoSaveData_ = enabled; }
 
+	bool isCompactExportData( void ) { return compactExportData_; }
+	void setCompactExportData( bool enabled ) { compactExportData_ = enabled; }
+
 	bool isHighQualityMoveItemMode( void ) { return hiqhQualityMoveItemMode_; }
 	void setHighQualityMoveItemMode( bool enabled ) { hiqhQualityMoveItemMode_ = enabled; }
 
@@ -92,6 +95,7 @@ private:
 	bool serverConnectOnStart_;
 	bool blinkLastItem_;
 	bool autoSaveData_;
+	bool compactExportData_;
 	bool hiqhQualityMoveItemMode_;
 
 	QTimer *timer_;
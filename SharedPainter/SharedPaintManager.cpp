@@ -39,7 +39,7 @@
 
 #define	TIMEOUT_SYNC_MSEC	5000
 
-CSharedPaintManager::CSharedPaintManager( void ) : enabled_(true), syncStartedFlag_(false), commandMngr_(this), canvas_(NULL)
+CSharedPaintManager::CSharedPaintManager( void ) : enabled_(true), syncStartedFlag_(false), commandMngr_(this), fileStreamMngr_(this), liveStrokeId_(0), canvas_(NULL)
 , listenTcpPort_(-1), listenUdpPort_(-1), retryServerReconnectCount_(0), lastConnectMode_(INIT_MODE), lastConnectPort_(-1)
 , findingServerMode_(false)
 , lastWindowWidth_(0), lastWindowHeight_(0), lastCanvasWidth_(0), lastCanvasHeight_(0), lastScrollHPos_(-1), lastScrollVPos_(-1), gridLineSize_(0)
@@ -298,6 +298,7 @@ int CSharedPaintManager::sendResponseShowScreenStream( const std::string &toId,
 bool CSharedPaintManager::deserializeData( const char * data, size_t size )
 {
 	CPacketSlicer slicer;
+	slicer.setStrict( true );
 	slicer.addBuffer( data, size );
 
 	if( slicer.parse() == false )
@@ -312,7 +313,7 @@ bool CSharedPaintManager::deserializeData( const char * data, size_t size )
 	}
 
 	std::string version, protocolVersion;
-	if( ! SystemPacketBuilder::CVersionInfo::parse( packetData->body, version, protocolVersion ) )
+	if( ! SystemPacketBuilder::CVersionInfo::parse( packetData->body(), version, protocolVersion ) )
 	{
 		return false;
 	}
@@ -330,16 +331,35 @@ bool CSharedPaintManager::deserializeData( const char * data, size_t size )
 			break;
 	}
 
-	std::string allData(data, size);
+	// the file may hold compressed packets, so rebuild them for the current joiners.
+	int compressLevel = isCompressionAvailable() ? COMPRESS_LEVEL_SYNC : 0;
+	bool compactLine = isCapabilityAvailable( CAPS_COMPACT_LINE );
+	std::string allData;
+	allData.reserve( size );
+	for( size_t i = 0; i < slicer.parsedItemCount(); i++ )
+	{
+		boost::shared_ptr<CPacketData> data = slicer.parsedItem( i );
+		std::string msg;
+		if( !compactLine && data->code == CODE_PAINT_CREATE_ITEM && PaintPacketBuilder::CCreateItem::isCompactLine( data->body() ) )
+		{
+			boost::shared_ptr<CPaintItem> item = PaintPacketBuilder::CCreateItem::parse( data->body() );
+			if( item )
+				msg = PaintPacketBuilder::CCreateItem::make( item, data->toId.empty() ? NULL : &data->toId );	// no caps : the full line
+		}
+		else
+			msg = CommonPacketBuilder::makePacket( data->code, data->body(), &data->fromId, &data->toId );
+		CommonPacketBuilder::appendPacket( allData, msg, compressLevel );
+	}
 	sendDataToUsers( allData );
 
 	return true;
 }
 
 
-std::string CSharedPaintManager::serializeData( const std::string *target )
+std::string CSharedPaintManager::serializeData( const std::string *target, boost::uint32_t caps )
 {
 	std::string allData;
+	int compressLevel = (caps & CAPS_COMPRESSION) ? COMPRESS_LEVEL_SYNC : 0;
 
 	allData += SystemPacketBuilder::CVersionInfo::make( VERSION_TEXT, PROTOCOL_VERSION_TEXT );
 
@@ -365,7 +385,7 @@ std::string CSharedPaintManager::serializeData( const std::string *target )
 
 	// Background Image
 	if( backgroundImageItem_ )
-		allData += PaintPacketBuilder::CSetBackgroundImage::make( backgroundImageItem_, target );
+		CommonPacketBuilder::appendPacket( allData, PaintPacketBuilder::CSetBackgroundImage::make( backgroundImageItem_, target ), compressLevel );
 
 	// History all drawer (joiner)
 	allData += serializeHistoryJoinerList();
@@ -377,9 +397,16 @@ std::string CSharedPaintManager::serializeData( const std::string *target )
 	ITEM_SET::const_iterator itItem = set.begin();
 	for( ; itItem != set.end(); itItem++ )
 	{
-		std::string msg = PaintPacketBuilder::CCreateItem::make( *itItem, target );
-		allData += msg;
-		itemSize += msg.size();
+		// a streamed file is requested from whoever has the complete copy
+		const std::string *fromId = &myId();
+		if( ((*itItem)->type() == PT_FILE || (*itItem)->type() == PT_IMAGE_FILE) 
+			&& !boost::static_pointer_cast<CFileItem>(*itItem)->isReceiveComplete() )
+			fromId = &(*itItem)->owner();
+
+		std::string msg = PaintPacketBuilder::CCreateItem::make( *itItem, target, caps, fromId );
+		size_t prevSize = allData.size();
+		CommonPacketBuilder::appendPacket( allData, msg, compressLevel );
+		itemSize += allData.size() - prevSize;
 	}
 	commandMngr_.unlock();
 
@@ -391,8 +418,9 @@ std::string CSharedPaintManager::serializeData( const std::string *target )
 	for( ; itTask != taskList.end(); itTask++ )
 	{
 		std::string msg = TaskPacketBuilder::CExecuteTask::make( boost::const_pointer_cast<CSharedPaintTask>(*itTask), target );
-		allData += msg;
-		taskSize += msg.size();
+		size_t prevSize = allData.size();
+		CommonPacketBuilder::appendPacket( allData, msg, compressLevel );
+		taskSize += allData.size() - prevSize;
 	}
 	commandMngr_.unlock();
 
@@ -446,12 +474,19 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 		{
 			bool error = false;
 			std::string version, protVersion;
-			if( SystemPacketBuilder::CVersionInfo::parse( packetData->body, version, protVersion ) )
+			boost::uint32_t caps = 0;
+			if( SystemPacketBuilder::CVersionInfo::parse( packetData->body(), version, protVersion, &caps ) )
 			{
 				if( 0 != Util::compareVersion( PROTOCOL_VERSION_TEXT, protVersion ) )
 				{
 					error = true;
 				}
+				else if( !packetData->fromId.empty() )
+				{
+					boost::shared_ptr<CPaintUser> user = findUser( packetData->fromId );
+					if( user )
+						user->setCapabilities( caps );
+				}
 			}
 			else
 			{
@@ -477,7 +512,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_SYSTEM_CHANGE_NICKNAME:
 		{
 			std::string userid, nickname;
-			if( SystemPacketBuilder::CChangeNickName::parse( packetData->body,  userid, nickname ) )
+			if( SystemPacketBuilder::CChangeNickName::parse( packetData->body(),  userid, nickname ) )
 			{
 				boost::shared_ptr<CPaintUser> joiner = findUser( userid );
 				if( joiner )
@@ -491,18 +526,21 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 		break;
 	case CODE_SYSTEM_JOIN_TO_SERVER:
 		{
-			boost::shared_ptr<CPaintUser> user = SystemPacketBuilder::CJoinToServer::parse( packetData->body );
+			boost::shared_ptr<CPaintUser> user = SystemPacketBuilder::CJoinToServer::parse( packetData->body() );
 			if( !user )
 				break;
 
 			assert( isRelayServerSession( session ) );
 		
 			addUser( user );
+
+			if( user->userId() != myId() )
+				sendMyCapabilities( user->userId() );
 		}
 		break;
 	case CODE_SYSTEM_JOIN_TO_SUPERPEER:
 		{
-			boost::shared_ptr<CPaintUser> user = SystemPacketBuilder::CJoinerToSuperPeer::parse( packetData->body );
+			boost::shared_ptr<CPaintUser> user = SystemPacketBuilder::CJoinerToSuperPeer::parse( packetData->body() );
 
 			if( user )
 			{
@@ -514,6 +552,10 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 				boost::shared_ptr<CPaintUser> joiner = findUser( user->userId() );
 				if( joiner )
 					joiner->setSessionId( session->sessionId() );
+
+				// the joiner list in a sync package comes in this code too. answer the real joiner only.
+				if( joiner && joiner->userId() != myId() && !syncStartedFlag_ )
+					sendMyCapabilities( joiner->userId() );
 			}
 		}
 		break;
@@ -523,7 +565,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 			bool firstUserFlag = false;
 			std::string channel, superId;
 			USER_LIST list;
-			if( SystemPacketBuilder::CResponseJoin::parse( packetData->body, channel, firstUserFlag, list, superId ) )
+			if( SystemPacketBuilder::CResponseJoin::parse( packetData->body(), channel, firstUserFlag, list, superId ) )
 			{
 				for( size_t i = 0; i < list.size(); i++ )
 					addUser( list[i] );
@@ -554,7 +596,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_SYSTEM_CHANGE_SUPERPEER:
 		{
 			std::string userid;
-			if( SystemPacketBuilder::CChangeSuperPeer::parse( packetData->body, userid ) )
+			if( SystemPacketBuilder::CChangeSuperPeer::parse( packetData->body(), userid ) )
 			{
 				if( userid != myUserInfo_->userId() )
 				{
@@ -571,7 +613,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_SYSTEM_TCPSYN:
 		{
 			assert( relayServerSession_ );
-			if( SystemPacketBuilder::CTcpSyn::parse( packetData->body ) )
+			if( SystemPacketBuilder::CTcpSyn::parse( packetData->body() ) )
 			{
 				// SEND ACK PACKET TO SERVER
 				std::string msg = SystemPacketBuilder::CTcpAck::make();
@@ -582,7 +624,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_SYSTEM_SYNC_START:
 		{
 			std::string channel;
-			if( SystemPacketBuilder::CSyncStart::parse( packetData->body, channel ) )
+			if( SystemPacketBuilder::CSyncStart::parse( packetData->body(), channel ) )
 			{
 				syncStartedFlag_ = true;
 				caller_.performMainThread( boost::bind( &CSharedPaintManager::fireObserver_SyncStart, this ) );
@@ -591,7 +633,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 		break;
 	case CODE_SYSTEM_SYNC_COMPLETE:
 		{
-			if( SystemPacketBuilder::CSyncComplete::parse( packetData->body ) )
+			if( SystemPacketBuilder::CSyncComplete::parse( packetData->body() ) )
 			{
 				syncStartedFlag_ = false;
 				caller_.performMainThread( boost::bind( &CSharedPaintManager::fireObserver_SyncComplete, this ) );
@@ -601,11 +643,11 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_SYSTEM_SYNC_REQUEST:
 		{
 			std::string channel, target;
-			if( SystemPacketBuilder::CSyncRequest::parse( packetData->body, channel, target ) )
+			if( SystemPacketBuilder::CSyncRequest::parse( packetData->body(), channel, target ) )
 			{
 				std::string packetPackage;
 				packetPackage += SystemPacketBuilder::CSyncStart::make( channel, myUserInfo_->userId(), target );
-				packetPackage += serializeData( &target );
+				packetPackage += serializeData( &target, capabilitiesOf( target ) );
 				packetPackage += SystemPacketBuilder::CSyncComplete::make( target );
 
 				qDebug() << "CODE_SYSTEM_SYNC_REQUEST" << packetPackage.size() << target.c_str() << joinerMap_.size();
@@ -636,16 +678,53 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_SYSTEM_LEFT:
 		{
 			std::string userId, channel;
-			if( SystemPacketBuilder::CLeftUser::parse( packetData->body, channel, userId ) )
+			if( SystemPacketBuilder::CLeftUser::parse( packetData->body(), channel, userId ) )
 			{
 				removeUser( userId );
+				session->handles().remove( userId );
+			}
+		}
+		break;
+	case CODE_SYSTEM_PRESENCE:
+		{
+			std::string channel;
+			std::vector<SystemPacketBuilder::CPresence::SEvent> events;
+			if( !SystemPacketBuilder::CPresence::parse( packetData->body(), channel, events ) )
+				break;
+
+			// in the order the relay has seen them
+			for( size_t i = 0; i < events.size(); i++ )
+			{
+				if( events[i].type == SystemPacketBuilder::CPresence::EVENT_JOINED )
+				{
+					addUser( events[i].user );
+
+					if( events[i].userId != myId() )
+						sendMyCapabilities( events[i].userId );
+				}
+				else
+				{
+					removeUser( events[i].userId );
+					session->handles().remove( events[i].userId );
+				}
+			}
+		}
+		break;
+	case CODE_SYSTEM_SESSION_HANDLE:
+		{
+			std::string channel;
+			boost::uint32_t ownHandle = 0;
+			CSessionHandleTable::ENTRY_LIST entries;
+			if( isRelayServerSession( session ) && SystemPacketBuilder::CSessionHandle::parse( packetData->body(), channel, ownHandle, entries ) )
+			{
+				session->handles().add( ownHandle, entries );
 			}
 		}
 		break;
 	case CODE_SYSTEM_CHAT_MESSAGE:
 		{
 			std::string userId, nickName, msg;
-			if( SystemPacketBuilder::CChatMessage::parse( packetData->body, userId, nickName, msg ) )
+			if( SystemPacketBuilder::CChatMessage::parse( packetData->body(), userId, nickName, msg ) )
 			{
 				caller_.performMainThread( boost::bind( &CSharedPaintManager::fireObserver_ReceivedChatMessage, this, userId, nickName, msg ) );
 			}
@@ -653,7 +732,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 		break;
 	case CODE_SYSTEM_HISTORY_USER_LIST:
 		{
-			USER_LIST list = SystemPacketBuilder::CHistoryUserList::parse( packetData->body );
+			USER_LIST list = SystemPacketBuilder::CHistoryUserList::parse( packetData->body() );
 			for( size_t i = 0; i < list.size(); i++ )
 			{
 				boost::shared_ptr<CPaintUser> user = findHistoryUser( list[i]->userId() );
@@ -664,26 +743,26 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 		break;
 	case CODE_PAINT_CLEAR_SCREEN:
 		{
-			PaintPacketBuilder::CClearScreen::parse( packetData->body );	// nothing to do..
+			PaintPacketBuilder::CClearScreen::parse( packetData->body() );	// nothing to do..
 			caller_.performMainThread( boost::bind( &CSharedPaintManager::fireObserver_ClearScreen, this ) );
 		}
 		break;
 	case CODE_PAINT_CLEAR_BG:
 		{
-			PaintPacketBuilder::CClearScreen::parse( packetData->body );	// nothing to do..
+			PaintPacketBuilder::CClearScreen::parse( packetData->body() );	// nothing to do..
 			caller_.performMainThread( boost::bind( &CSharedPaintManager::fireObserver_ClearBackground, this ) );
 		}
 		break;
 	case CODE_PAINT_SET_BG_IMAGE:
 		{
-			boost::shared_ptr<CBackgroundImageItem> image = PaintPacketBuilder::CSetBackgroundImage::parse( packetData->body );
+			boost::shared_ptr<CBackgroundImageItem> image = PaintPacketBuilder::CSetBackgroundImage::parse( packetData->body() );
 			caller_.performMainThread( boost::bind( &CSharedPaintManager::fireObserver_SetBackgroundImage, this, image ) );
 		}
 		break;
 	case CODE_PAINT_SET_BG_GRID_LINE:
 		{
 			int size;
-			if( PaintPacketBuilder::CSetBackgroundGridLine::parse( packetData->body, size ) )
+			if( PaintPacketBuilder::CSetBackgroundGridLine::parse( packetData->body(), size ) )
 			{
 				caller_.performMainThread( boost::bind( &CSharedPaintManager::fireObserver_SetBackgroundGridLine, this, size ) );
 			}
@@ -692,7 +771,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_PAINT_SET_BG_COLOR:
 		{
 			int r, g, b, a;
-			if( PaintPacketBuilder::CSetBackgroundColor::parse( packetData->body, r, g, b, a ) )
+			if( PaintPacketBuilder::CSetBackgroundColor::parse( packetData->body(), r, g, b, a ) )
 			{
 				caller_.performMainThread( boost::bind( &CSharedPaintManager::fireObserver_SetBackgroundColor, this, r, g, b, a ) );
 			}
@@ -700,16 +779,59 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 		break;	
 	case CODE_PAINT_CREATE_ITEM:
 		{
-			boost::shared_ptr<CPaintItem> item = PaintPacketBuilder::CCreateItem::parse( packetData->body );
+			boost::shared_ptr<CPaintItem> item = PaintPacketBuilder::CCreateItem::parse( packetData->body() );
 			if( item )
 			{
 				commandMngr_.addHistoryItem( item );
+
+				if( item->type() == PT_FILE || item->type() == PT_IMAGE_FILE )
+				{
+					boost::shared_ptr<CFileItem> file = boost::static_pointer_cast<CFileItem>(item);
+					// a sync from the relay's snapshot carries the header as it was pushed live, so ask for the data
+					if( file->isStreaming() )
+						fileStreamMngr_.startReceiving( file, packetData->fromId.empty() ? file->owner() : packetData->fromId, syncStartedFlag_ );
+				}
+			}
+		}
+		break;
+	case CODE_PAINT_FILE_CHUNK:
+		{
+			std::string owner;
+			int itemId;
+			boost::uint64_t offset;
+			size_t headerSize;
+
+			// the data is written straight from the packet body
+			if( PaintPacketBuilder::CFileChunk::parse( packetData->bodyPtr(), packetData->bodySize(), owner, itemId, offset, headerSize ) )
+				fileStreamMngr_.onChunk( owner, itemId, offset, packetData->bodyPtr() + headerSize, packetData->bodySize() - headerSize );
+		}
+		break;
+	case CODE_PAINT_LIVE_STROKE:
+		{
+			std::string owner;
+			int strokeId, startIndex, width;
+			QColor clr;
+			std::vector<QPointF> points;
+			if( PaintPacketBuilder::CLiveStroke::parse( packetData->body(), owner, strokeId, startIndex, clr, width, points ) )
+			{
+				if( owner == myId() || ! canvas_ )
+					break;
+				caller_.performMainThread( boost::bind( &IGluePaintCanvas::drawLiveStroke, canvas_, owner, strokeId, startIndex, clr, width, points ) );
 			}
 		}
 		break;
+	case CODE_PAINT_FILE_REQUEST:
+		{
+			std::string owner;
+			int itemId;
+			boost::uint64_t offset;
+			if( PaintPacketBuilder::CFileRequest::parse( packetData->body(), owner, itemId, offset ) )
+				fileStreamMngr_.onRequest( packetData->fromId, owner, itemId, offset );
+		}
+		break;
 	case CODE_TASK_EXECUTE:
 		{
-			boost::shared_ptr<CSharedPaintTask> task = TaskPacketBuilder::CExecuteTask::parse( packetData->body );
+			boost::shared_ptr<CSharedPaintTask> task = TaskPacketBuilder::CExecuteTask::parse( packetData->body() );
 			if( task )
 			{
 				task->setSharedPaintManager( this );
@@ -721,7 +843,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_WINDOW_RESIZE_MAIN_WND:
 		{
 			int width, height;
-			if( WindowPacketBuilder::CResizeMainWindow::parse( packetData->body, width, height ) )
+			if( WindowPacketBuilder::CResizeMainWindow::parse( packetData->body(), width, height ) )
 			{
 				if( width <= 0 || height <= 0 )
 					break;
@@ -732,7 +854,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_WINDOW_RESIZE_WND_SPLITTER:
 		{
 			std::vector<int> sizes;
-			if( WindowPacketBuilder::CResizeWindowSplitter::parse( packetData->body, sizes ) )
+			if( WindowPacketBuilder::CResizeWindowSplitter::parse( packetData->body(), sizes ) )
 			{
 				if( sizes.size() <= 0 )
 					break;
@@ -743,7 +865,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_WINDOW_RESIZE_CANVAS:
 		{
 			int width, height;
-			if( WindowPacketBuilder::CResizeCanvas::parse( packetData->body, width, height ) )
+			if( WindowPacketBuilder::CResizeCanvas::parse( packetData->body(), width, height ) )
 			{
 				if( width <= 0 || height <= 0 )
 					break;
@@ -754,7 +876,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 	case CODE_WINDOW_CHANGE_CANVAS_SCROLL_POS:
 		{
 			boost::int16_t posH, posV;
-			if( WindowPacketBuilder::CChangeCanvasScrollPos::parse( packetData->body, posH, posV ) )
+			if( WindowPacketBuilder::CChangeCanvasScrollPos::parse( packetData->body(), posH, posV ) )
 			{
 				if( posH < 0 || posV < 0 )
 					break;
@@ -766,7 +888,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 		{
 			std::string fromId = packetData->fromId;
 			bool status;
-			if( ScreenSharePacketBuilder::CChangeRecordStatus::parse( packetData->body, status ) )
+			if( ScreenSharePacketBuilder::CChangeRecordStatus::parse( packetData->body(), status ) )
 			{
 				boost::shared_ptr<CPaintUser> joiner = findUser( fromId );
 				if( joiner )
@@ -782,7 +904,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 			std::string fromId = packetData->fromId;
 			int port;
 			bool sender, status;
-			if( ScreenSharePacketBuilder::CChangeShowStream::parse( packetData->body, sender, status ) )
+			if( ScreenSharePacketBuilder::CChangeShowStream::parse( packetData->body(), sender, status ) )
 			{
 				boost::shared_ptr<CPaintUser> joiner = findUser( fromId );
 				if( joiner )
@@ -806,7 +928,7 @@ bool CSharedPaintManager::dispatchPaintPacket( CPaintSession * session, boost::s
 			std::string fromId = packetData->fromId;
 			bool accept;
 			int port;
-			if( ScreenSharePacketBuilder::CResShowStream::parse( packetData->body, accept, port ) )
+			if( ScreenSharePacketBuilder::CResShowStream::parse( packetData->body(), accept, port ) )
 			{
 				boost::shared_ptr<CPaintUser> joiner = findUser( fromId );
 				if( joiner )
@@ -840,7 +962,7 @@ void CSharedPaintManager::dispatchUdpPacket( CNetUdpSession *session, boost::sha
 		{
 			std::string addr, paintChannel;
 			int port;
-			if( UdpPacketBuilder::CServerInfo::parse( packetData->body, paintChannel, addr, port ) )
+			if( UdpPacketBuilder::CServerInfo::parse( packetData->body(), paintChannel, addr, port ) )
 			{
 				qDebug() << "CODE_UDP_SERVER_INFO : " << paintChannel.c_str() << addr.c_str() << port;
 				if( myUserInfo_->channel() != paintChannel )
@@ -862,7 +984,7 @@ void CSharedPaintManager::dispatchBroadCastPacket( CNetBroadCastSession *session
 			std::string addr;
 			int port;
 			std::string paintChannel;
-			if( BroadCastPacketBuilder::CProbeServer::parse( packetData->body, paintChannel, addr, port ) )
+			if( BroadCastPacketBuilder::CProbeServer::parse( packetData->body(), paintChannel, addr, port ) )
 			{
 				qDebug() << "CODE_BROAD_PROBE_SERVER : " << myUserInfo_->channel().c_str() << paintChannel.c_str() << addr.c_str() << port;
 				if( myUserInfo_->channel() != paintChannel )
@@ -883,7 +1005,7 @@ void CSharedPaintManager::dispatchBroadCastPacket( CNetBroadCastSession *session
 	case CODE_BROAD_TEXT_MESSAGE:
 		{
 			std::string message, paintChannel, fromId, nickName;
-			if( BroadCastPacketBuilder::CTextMessage::parse( packetData->body, paintChannel, fromId, nickName, message ) )
+			if( BroadCastPacketBuilder::CTextMessage::parse( packetData->body(), paintChannel, fromId, nickName, message ) )
 			{
 				if( myUserInfo_->channel() != paintChannel )
 					return;
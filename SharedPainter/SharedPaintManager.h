@@ -43,6 +43,7 @@
 #include "SharedPaintPolicy.h"
 #include "DefferedCaller.h"
 #include "SharedPaintCommandManager.h"
+#include "FileStreamManager.h"
 #include "PaintSession.h"
 #include "NetPeerServer.h"
 #include "NetBroadCastSession.h"
@@ -130,6 +131,7 @@ public:
 		clearAllUsers();
 		clearAllSessions();
 		stopFindingServer();
+		fileStreamMngr_.stopSending();
 
 		syncStartedFlag_ = false;
 		findingServerMode_ = false;
@@ -144,6 +146,7 @@ public:
 
 		clearScreen( false );	// DO NOT NOTIFY TO OTHERS.. JUST TRIGGER CLEAR SCREEN EVENT
 		clearAllItems();
+		fileStreamMngr_.stopReceiving();	// no more resuming
 
 		closeSession();
 	}
@@ -322,10 +325,13 @@ public:
 			lastPacketId_ = packetId;
 			mutexSendInfo_.unlock();
 			
+			// all sessions share one immutable payload. each packet only keeps its own read cursor.
+			CNetPacketData::payload_t payload( new std::string( msg ) );
+
 			// MUST send after above codes for preventing from race condition..
 			for( size_t i = 0; i < sendableSessionList.size(); i++ )
 			{
-				boost::shared_ptr<CNetPacketData> packet = boost::shared_ptr<CNetPacketData>(new CNetPacketData( packetId, msg ) );
+				boost::shared_ptr<CNetPacketData> packet = boost::shared_ptr<CNetPacketData>(new CNetPacketData( packetId, payload ) );
 				sendableSessionList[i]->session()->sendData( packet );
 			}
 		}
@@ -357,7 +363,94 @@ public:
 		else
 			return -1;
 
-		return sendDataToUsers( sessionList, msg, toSessionId );
+		const std::string *packet = &msg;
+		std::string compressed;
+		if( canCompressTo( msg ) && CommonPacketBuilder::compressPacket( msg, compressed, COMPRESS_LEVEL_LIVE ) )
+			packet = &compressed;
+
+		// the relay server routes the handle header by an index, without reading the ids
+		std::string encoded;
+		if( sessionList[0] == relayServerSession_ && relayServerSession_->handles().encode( *packet, encoded ) )
+			return sendDataToUsers( sessionList, encoded, toSessionId );
+
+		return sendDataToUsers( sessionList, *packet, toSessionId );
+	}
+
+	// an optional encoding is used only if every joiner (or the target) has announced its capability
+	bool isCapabilityAvailable( boost::uint32_t caps, const std::string *target = NULL )
+	{
+		boost::recursive_mutex::scoped_lock autolock(mutexUser_);
+
+		if( target )
+		{
+			boost::shared_ptr<CPaintUser> user = findUser( *target );
+			return user && user->hasCapability( caps );
+		}
+
+		USER_MAP::iterator it = joinerMap_.begin();
+		for( ; it != joinerMap_.end(); it++ )
+		{
+			if( !it->second->isMyself() && !it->second->hasCapability( caps ) )
+				return false;
+		}
+		return true;
+	}
+
+	// an old build rejects a code with CODE_FLAG_COMPRESSED, so only toward the peers known to inflate it.
+	// a broadcast : every other joiner has announced it, and there is one at least.
+	bool isCompressionAvailable( const std::string *target = NULL )
+	{
+		boost::recursive_mutex::scoped_lock autolock(mutexUser_);
+
+		if( target && !target->empty() )
+			return isCapabilityAvailable( CAPS_COMPRESSION, target );
+
+		bool known = false;
+		USER_MAP::iterator it = joinerMap_.begin();
+		for( ; it != joinerMap_.end(); it++ )
+		{
+			if( it->second->isMyself() )
+				continue;
+			if( !it->second->hasCapability( CAPS_COMPRESSION ) )
+				return false;
+			known = true;
+		}
+		return known;
+	}
+
+	// the receivers of one packet, by its to id
+	bool canCompressTo( const std::string &packet )
+	{
+		std::string fromId, toId;
+		try
+		{
+			size_t pos = 4;
+			pos += CPacketBufferUtil::readString8( packet, pos, fromId );
+			pos += CPacketBufferUtil::readString8( packet, pos, toId );
+		}catch(...)
+		{
+			return false;
+		}
+		return isCompressionAvailable( &toId );
+	}
+
+	// the capabilities every joiner has
+	boost::uint32_t roomCapabilities( void )
+	{
+		boost::uint32_t caps = 0;
+		for( boost::uint32_t cap = 0x1; cap != 0 && cap <= PROTOCOL_CAPABILITIES; cap <<= 1 )
+		{
+			if( (PROTOCOL_CAPABILITIES & cap) && isCapabilityAvailable( cap ) )
+				caps |= cap;
+		}
+		return caps;
+	}
+
+	boost::uint32_t capabilitiesOf( const std::string &userId )
+	{
+		boost::recursive_mutex::scoped_lock autolock(mutexUser_);
+		boost::shared_ptr<CPaintUser> user = findUser( userId );
+		return user ? user->capabilities() : 0;
 	}
 
 	void sendChatMessage( const std::string &msg );	// channel chatting API
@@ -406,7 +499,7 @@ public:
 
 	bool deserializeData( const char * data, size_t size );	// TODO throw exception logic
 	
-	std::string serializeData( const std::string *target = NULL );
+	std::string serializeData( const std::string *target = NULL, boost::uint32_t caps = 0 );	// <caps> : the optional encodings the target understands
 
 	boost::shared_ptr<CPaintItem> findPaintItem( const std::string & owner, int itemId )
 	{
@@ -420,15 +513,33 @@ public:
 
 		item->setItemId( commandMngr_.generateItemId() );
 
-		std::string msg = PaintPacketBuilder::CCreateItem::make( item );
+		boost::uint32_t caps = roomCapabilities();
+		std::string msg = PaintPacketBuilder::CCreateItem::make( item, NULL, caps, &myId(), true );
 		sendDataToUsers( msg );
 
 		commandMngr_.addHistoryItem( item );
 
+		// the header went first. now push the file data
+		if( (caps & CAPS_FILE_STREAM) && (item->type() == PT_FILE || item->type() == PT_IMAGE_FILE) )
+			fileStreamMngr_.startSending( boost::static_pointer_cast<CFileItem>(item), "", 0 );
+
 		boost::shared_ptr<CAddItemCommand> command = boost::shared_ptr<CAddItemCommand>(new CAddItemCommand( item ));
 		return commandMngr_.executeCommand( command );
 	}
 
+	// a part of the stroke being drawn. <startIndex> 0 begins a new stroke.
+	void sendLiveStroke( boost::shared_ptr<CLineItem> line, size_t startIndex, size_t count )
+	{
+		if( ! enabled_ || ! isCapabilityAvailable( CAPS_LIVE_STROKE ) )
+			return;
+
+		if( startIndex == 0 )
+			liveStrokeId_++;
+
+		std::string msg = PaintPacketBuilder::CLiveStroke::make( myId(), liveStrokeId_, line, startIndex, count );
+		sendDataToUsers( msg );
+	}
+
 	void updatePaintItem( boost::shared_ptr< CPaintItem > item )
 	{
 		if( ! enabled_ )
@@ -621,9 +732,11 @@ private:
 		if( isAlwaysP2PMode() == false )
 			return;
 
+		boost::shared_ptr<CPaintUser> user = findUser( toSessionId );
+
 		std::string packetPackage;
 		packetPackage += SystemPacketBuilder::CSyncStart::make( myUserInfo_->channel(), myUserInfo_->userId(), "" );
-		packetPackage += serializeData();
+		packetPackage += serializeData( NULL, user ? user->capabilities() : 0 );
 		packetPackage += serializeJoinerList();
 		packetPackage += SystemPacketBuilder::CSyncComplete::make( "" );
 
@@ -663,9 +776,18 @@ private:
 		else
 			msg = SystemPacketBuilder::CJoinerToSuperPeer::make( myUserInfo_ );
 
+		// let the others know what this build understands
+		msg += SystemPacketBuilder::CVersionInfo::make( VERSION_TEXT, PROTOCOL_VERSION_TEXT, PROTOCOL_CAPABILITIES, &myUserInfo_->userId() );
+
 		session->session()->sendData( msg );
 	}
 
+	void sendMyCapabilities( const std::string &targetId )
+	{
+		std::string msg = SystemPacketBuilder::CVersionInfo::make( VERSION_TEXT, PROTOCOL_VERSION_TEXT, PROTOCOL_CAPABILITIES, &myUserInfo_->userId(), &targetId );
+		sendDataToUsers( msg );
+	}
+
 	void notifyRemoveUserInfo( boost::shared_ptr<CPaintUser> user )
 	{
 		std::string msg = SystemPacketBuilder::CLeftUser::make( user->channel(), user->userId() );
@@ -692,6 +814,8 @@ private:
 			res.first->second->setData( user->data() );	// overwrite;
 			firstFlag = false;
 		}
+		else if( !user->isMyself() )
+			user->setCapabilities( 0 );	// the history user may come back with another build, it announces them again
 		mutexUser_.unlock();
 
 		if( !user->isMyself() )
@@ -1164,6 +1288,9 @@ private:
 	}
 	void fireObserver_LeavePaintUser( boost::shared_ptr<CPaintUser> user )
 	{
+		if( canvas_ )
+			canvas_->clearLiveStroke( user->userId() );
+
 		std::list<ISharedPaintEvent *> observers = observers_;
 		for( std::list<ISharedPaintEvent *>::iterator it = observers.begin(); it != observers.end(); it++ )
 		{
@@ -1420,13 +1547,19 @@ protected:
 			}
 		}
 
-		std::string msg = CommonPacketBuilder::makePacket( data->code, data->body );
-		sendDataToUsers( list, msg );
+		// keep the sender id. the others need it to know whose capabilities they are.
+		std::string msg = CommonPacketBuilder::makePacket( data->code, data->body(), &data->fromId, &data->toId );
+
+		std::string compressed;
+		if( canCompressTo( msg ) && CommonPacketBuilder::compressPacket( msg, compressed, COMPRESS_LEVEL_LIVE ) )
+			sendDataToUsers( list, compressed );
+		else
+			sendDataToUsers( list, msg );
 	}
 
 	virtual void onIPaintSessionEvent_SendingPacket( CPaintSession * session, const boost::shared_ptr<CNetPacketData> packet )
 	{
-		//qDebug() << "Packet sending " << packet->packetId() << packet->buffer().remainingSize() << packet->buffer().totalSize();
+		//qDebug() << "Packet sending " << packet->packetId() << packet->remainingSize() << packet->totalSize();
 		if( packet->packetId() < 0 )
 		{
 			qDebug() << "onIPaintSessionEvent_SendingPacket error : packet id < 0";
@@ -1452,7 +1585,7 @@ protected:
 			{
 				if( (*itD).session == session )
 				{
-					(*itD).wroteBytes = packet->buffer().totalSize() -  packet->buffer().remainingSize();
+					(*itD).wroteBytes = packet->readPos();
 					break;
 				}
 			}
@@ -1471,6 +1604,9 @@ protected:
 			}
 		}
 
+		if( totalBytes <= wroteBytes )
+			fileStreamMngr_.onPacketSent( packet->packetId() );
+
 		caller_.performMainThread( boost::bind( &CSharedPaintManager::fireObserver_SendingPacket, this, packet->packetId(), wroteBytes, totalBytes ) );
 	}
 
@@ -1480,6 +1616,7 @@ private:
 	friend class CRemoveItemTask;
 	friend class CUpdateItemTask;
 	friend class CMoveItemTask;
+	friend class CFileStreamManager;
 
 	CDefferedCaller caller_;
 	bool enabled_;
@@ -1491,6 +1628,12 @@ private:
 	// my action command
 	CSharedPaintCommandManager commandMngr_;
 
+	// chunked file transfer
+	CFileStreamManager fileStreamMngr_;
+
+	// my stroke being drawn
+	int liveStrokeId_;
+
 	// paint item
 	IGluePaintCanvas *canvas_;
 
@@ -60,9 +60,22 @@
 #endif
 
 #define NET_MAGIC_CODE	0xBEBE
+#define NET_MAGIC_CODE_HANDLE	0xBEBF	// the handle header of the relay server. see CSessionHandleTable
 
 #define MAX_PACKET_BODY_SIZE				200000000	// 2OOMB
 
+#define PROTOCOL_CAPABILITIES				(CAPS_COMPRESSION | CAPS_COMPACT_LINE | CAPS_FILE_STREAM | CAPS_LIVE_STROKE | CAPS_PRESENCE_DELTA | CAPS_SESSION_HANDLE)	// what this build announces. see PacketCodeDefine.h
+#define EXPORT_CAPABILITIES					(CAPS_COMPRESSION | CAPS_COMPACT_LINE)	// the compact file, opt-in (CSettingManager::isCompactExportData) : the older builds can't read it
+
+#define COMPRESS_THRESHOLD_SIZE				512		// smaller bodies are sent as they are
+#define COMPRESS_LEVEL_LIVE					1		// fast deflate for the live paint traffic
+#define COMPRESS_LEVEL_SYNC					9		// strong deflate for the sync package and the exported file
+
+#define LIVE_STROKE_INTERVAL_MSEC			50		// a drawing stroke is sent at most this often..
+#define LIVE_STROKE_MAX_POINTS				32		// ..or when this many points are waiting
+
+#define MAX_RECEIVE_BUFFER_SIZE				(1024 * 1024)	// upper bound of one socket read
+
 #define DEFAULT_RECONNECT_TRY_COUNT			3
 
 #define DEFAULT_UPGRADE_CHECK_SECOND		20
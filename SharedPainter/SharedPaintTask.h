@@ -88,21 +88,26 @@ public:
 		return true;
 	}
 
-	static std::string serializeBasicData( const struct STaskData &data, int *writePos = NULL )
+	static size_t basicDataSize( const struct STaskData &data )
 	{
-		int pos = writePos ? *writePos : 0;
-		std::string buf;
-
-		pos += CPacketBufferUtil::writeString8( buf, pos, data.owner );
-		pos += CPacketBufferUtil::writeInt32( buf, pos, data.itemId, true );
-		if( writePos )
-			*writePos = pos;
-		return buf;
+		return CommonPacketBuilder::string8Size( data.owner ) + 4;
 	}
 
-	virtual std::string serialize( int *writePos = NULL )
+	static void writeBasicData( CommonPacketBuilder::CPacketWriter &writer, const struct STaskData &data )
 	{
-		return serializeBasicData( data_, writePos );	
+		writer.writeString8( data.owner );
+		writer.writeInt32( data.itemId );
+	}
+
+	// written straight into the packet, see TaskPacketBuilder::CExecuteTask
+	virtual size_t serializedSize( void )
+	{
+		return basicDataSize( data_ );
+	}
+
+	virtual void serializeTo( CommonPacketBuilder::CPacketWriter &writer )
+	{
+		writeBasicData( writer, data_ );
 	}
 
 	virtual bool deserialize( const std::string & data, int *readPos = NULL )
@@ -170,14 +175,16 @@ public:
 	virtual bool execute( void );
 	virtual void rollback( void );
 
-	virtual std::string serialize( int *writePos = NULL )
+	virtual size_t serializedSize( void )
 	{
-		std::string data;
+		return CSharedPaintTask::serializedSize() + CPaintItem::basicDataSize( prevPaintData_ ) + CPaintItem::basicDataSize( paintData_ );
+	}
 
-		data = CSharedPaintTask::serialize();
-		data += CPaintItem::serializeBasicData( prevPaintData_ );
-		data += CPaintItem::serializeBasicData( paintData_ );
-		return data;
+	virtual void serializeTo( CommonPacketBuilder::CPacketWriter &writer )
+	{
+		CSharedPaintTask::serializeTo( writer );
+		CPaintItem::writeBasicData( writer, prevPaintData_ );
+		CPaintItem::writeBasicData( writer, paintData_ );
 	}
 
 	virtual bool deserialize( const std::string & data, int *readPos = NULL )
@@ -219,17 +226,18 @@ public:
 	virtual bool execute( void );
 	virtual void rollback( void );
 
-	virtual std::string serialize( int *writePos = NULL )
+	virtual size_t serializedSize( void )
+	{
+		return CSharedPaintTask::serializedSize() + 8 * 4;
+	}
+
+	virtual void serializeTo( CommonPacketBuilder::CPacketWriter &writer )
 	{
-		int pos = 0;
-		std::string data;
-
-		data = CSharedPaintTask::serialize( &pos );
-		pos += CPacketBufferUtil::writeDouble( data, pos, prevPosX_, true );
-		pos += CPacketBufferUtil::writeDouble( data, pos, prevPosY_, true );
-		pos += CPacketBufferUtil::writeDouble( data, pos, posX_, true );
-		pos += CPacketBufferUtil::writeDouble( data, pos, posY_, true );
-		return data;
+		CSharedPaintTask::serializeTo( writer );
+		writer.writeDouble( prevPosX_ );
+		writer.writeDouble( prevPosY_ );
+		writer.writeDouble( posX_ );
+		writer.writeDouble( posY_ );
 	}
 
 	virtual bool deserialize( const std::string & data, int *readPos = NULL )
@@ -524,7 +524,7 @@ void SharedPainter::actionImportFile( void )
 
 void SharedPainter::actionExportFile( void )
 {
-	std::string allData = SharePaintManagerPtr()->serializeData();
+	std::string allData = SharePaintManagerPtr()->serializeData( NULL, exportCapabilities() );
 
 	QString path;
 	path = QFileDialog::getSaveFileName( this, tr("Export to file"), "", tr("Shared Paint Data File (*.sp)") );
@@ -990,6 +990,12 @@ void SharedPainter::importFromFile( const QString & path )
 }
 
 
+boost::uint32_t SharedPainter::exportCapabilities( void )
+{
+	// the plain packets by default, any build can import them
+	return SettingManagerPtr()->isCompactExportData() ? EXPORT_CAPABILITIES : 0;
+}
+
 void SharedPainter::exportToFile( const std::string &data, const QString & path )
 {
 	QFile f(path);
@@ -1033,7 +1039,7 @@ void SharedPainter::autoExportToFile( void )
 
 	qDebug() << "autoExportToFile" << autoPath;
 
-	std::string allData = SharePaintManagerPtr()->serializeData();
+	std::string allData = SharePaintManagerPtr()->serializeData( NULL, exportCapabilities() );
 	exportToFile( allData, autoPath );
 
 	SettingManagerPtr()->setLastAutoSavePath( Util::toUtf8StdString(autoPath) );
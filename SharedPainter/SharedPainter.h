@@ -289,6 +289,7 @@ private:
 	void addYourChatMessage( const QString & userId, const QString &nickName, const QString &chatMsg );
 	void addMyChatMessage( const QString & userId, const QString &nickName, const QString &chatMsg );
 	void addBroadcastChatMessage(  const QString & channel, const QString & userId, const QString &nickName, const QString &chatMsg );
+	boost::uint32_t exportCapabilities( void );
 	void exportToFile( const std::string &data, const QString & path );
 	void importFromFile( const QString & path );
 	void autoExportToFile( void );
@@ -388,6 +389,10 @@ protected:
 		return SharePaintManagerPtr()->findPaintItem( owner, itemId );
 	}
 	virtual QString onICanvasViewEvent_GetToolTipText( CSharedPainterScene *view, boost::shared_ptr<CPaintItem> item );
+	virtual void onICanvasViewEvent_DrawLiveStroke( CSharedPainterScene *view, boost::shared_ptr<CLineItem> line, size_t startIndex, size_t count )
+	{
+		SharePaintManagerPtr()->sendLiveStroke( line, startIndex, count );
+	}
 
 	// ISharedPaintEvent
 	virtual void onISharedPaintEvent_ShowErrorMessage( CSharedPaintManager *self, const std::string &error )
@@ -17,12 +17,12 @@ SOURCES +=  \
     stdafx.cpp \
     SharedPaintManager.cpp \
     SharedPaintCommandManager.cpp \
+    FileStreamManager.cpp \
     SharedPainterScene.cpp \
     SharedPainter.cpp \
     SharedPaintCommand.cpp \
     SharedPaintTask.cpp \
     SettingManager.cpp \
-    PacketBuffer.cpp \
     DefferedCaller.cpp \
     Util.cpp \
     TextItemDialog.cpp \
@@ -57,6 +57,7 @@ HEADERS  += \
     SharedPainterScene.h \
     SharedPainter.h \
     SharedPaintCommandManager.h \
+    FileStreamManager.h \
     SharedPaintCommand.h \
     SharedPaintTask.h \
     SettingManager.h \
@@ -67,6 +68,7 @@ HEADERS  += \
     PaintItemFactory.h \
     PaintItem.h \
     PacketSlicer.h \
+    PacketRingBuffer.h \
     PacketCodeDefine.h \
     PacketBuffer.h \
     NetServiceRunner.h \
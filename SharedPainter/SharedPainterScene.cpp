@@ -191,7 +191,7 @@ private:
 
 CSharedPainterScene::CSharedPainterScene(void )
 : eventTarget_(NULL), freezeActionFlag_(false), drawFlag_(false), freePenMode_(false)
-, hiqhQualityMoveItemMode_(false)
+, hiqhQualityMoveItemMode_(false), liveStrokeSentCount_(0), liveStrokeSentTime_(0)
 , currentZValue_(ZVALUE_NORMAL), gridLineSize_(0)
 , lastCoverGraphicsItem_(NULL), timeoutRemoveLastCoverItem_(0), lastTempBlinkShowFlag_(false), showLastAddItemBorderFlag_(false)
 {
@@ -580,6 +580,10 @@ void CSharedPainterScene::drawText( boost::shared_ptr<CTextItem> text )
 
 void CSharedPainterScene::drawLine( boost::shared_ptr<CLineItem> line )
 {
+	// the finished stroke replaces the provisional one
+	if( !line->isMyItem() )
+		clearLiveStroke( line->owner() );
+
 	if( line->pointCount() <= 0 )
 		return;
 
@@ -686,6 +690,101 @@ void CSharedPainterScene::drawLineTo( const QPointF &pt1, const QPointF &pt2, co
 	tempLineItemList_.push_back( item );
 }
 
+void CSharedPainterScene::drawLiveStroke( const std::string &owner, int strokeId, int startIndex, const QColor &clr, int width, const std::vector<QPointF> &points )
+{
+	if( points.size() <= 0 )
+		return;
+
+	LIVE_STROKE_MAP::iterator it = liveStrokeMap_.find( owner );
+	if( it != liveStrokeMap_.end() && it->second.strokeId != strokeId )
+	{
+		clearLiveStroke( owner );	// the previous one was never finished
+		it = liveStrokeMap_.end();
+	}
+
+	if( it == liveStrokeMap_.end() )
+	{
+		SLiveStroke stroke;
+		stroke.strokeId = strokeId;
+		stroke.nextIndex = 0;
+		stroke.zValue = currentZValue();
+		it = liveStrokeMap_.insert( LIVE_STROKE_MAP::value_type( owner, stroke ) ).first;
+	}
+
+	SLiveStroke &stroke = it->second;
+	QPen pen( clr, width, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin );
+
+	// connect to the previous part only if nothing is missing between them
+	size_t i = 0;
+	if( stroke.nextIndex <= 0 || stroke.nextIndex != startIndex )
+	{
+		double x = points[0].x() - (double(width) / 2.f);
+		double y = points[0].y() - (double(width) / 2.f);
+
+		QGraphicsEllipseItem *item = addEllipse( QRectF( x, y, width, width ), QPen(clr, 1), QBrush(clr) );
+		item->setZValue( stroke.zValue );
+		stroke.items.push_back( item );
+
+		stroke.lastPoint = points[0];
+		i = 1;
+	}
+
+	if( i < points.size() )
+	{
+		QPainterPath painterPath;
+		painterPath.moveTo( stroke.lastPoint );
+		for( ; i < points.size(); i++ )
+			painterPath.lineTo( points[i] );
+
+		QGraphicsPathItem *item = addPath( painterPath, pen );
+		item->setZValue( stroke.zValue );
+		stroke.items.push_back( item );
+	}
+
+	stroke.lastPoint = points.back();
+	stroke.nextIndex = startIndex + points.size();
+}
+
+void CSharedPainterScene::clearLiveStroke( const std::string &owner )
+{
+	LIVE_STROKE_MAP::iterator it = liveStrokeMap_.find( owner );
+	if( it == liveStrokeMap_.end() )
+		return;
+
+	for( size_t i = 0; i < it->second.items.size(); i++ )
+	{
+		QGraphicsScene::removeItem( it->second.items[i] );
+		delete it->second.items[i];
+	}
+	liveStrokeMap_.erase( it );
+}
+
+void CSharedPainterScene::clearAllLiveStrokes( void )
+{
+	while( liveStrokeMap_.size() > 0 )
+		clearLiveStroke( liveStrokeMap_.begin()->first );
+}
+
+void CSharedPainterScene::sendLiveStroke( void )
+{
+	if( !currLineItem_ )
+		return;
+
+	if( currLineItem_->pointCount() <= liveStrokeSentCount_ )
+		return;
+	size_t pending = currLineItem_->pointCount() - liveStrokeSentCount_;
+
+	qint64 now = QDateTime::currentDateTime().toMSecsSinceEpoch();
+	// bounded packet rate : one per interval, unless the points pile up (fast moving pen)
+	if( pending < (size_t)LIVE_STROKE_MAX_POINTS && now - liveStrokeSentTime_ < LIVE_STROKE_INTERVAL_MSEC )
+		return;
+
+	fireEvent_DrawLiveStroke( currLineItem_, liveStrokeSentCount_, pending );
+
+	liveStrokeSentCount_ = currLineItem_->pointCount();
+	liveStrokeSentTime_ = now;
+}
+
 
 void CSharedPainterScene::resizeImage(QImage *image, const QSize &newSize)
 {
@@ -890,6 +989,9 @@ void CSharedPainterScene::mousePressEvent( QGraphicsSceneMouseEvent *evt )
 
 		currentLineZValue_ = currentZValue();
 
+		liveStrokeSentCount_ = 0;
+		liveStrokeSentTime_ = QDateTime::currentDateTime().toMSecsSinceEpoch();
+
 		drawLineStart( prevPos_, currLineItem_->color(), currLineItem_->width() );
 	}
 }
@@ -914,6 +1016,8 @@ void CSharedPainterScene::mouseMoveEvent( QGraphicsSceneMouseEvent *evt )
 	{
 		drawLineTo( prevPos_, to, currLineItem_->color(), currLineItem_->width() );
 		currLineItem_->addPoint( to );
+
+		sendLiveStroke();
 	}
 
 	prevPos_ = to;
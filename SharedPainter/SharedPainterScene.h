@@ -44,6 +44,7 @@ public:
 	virtual void onICanvasViewEvent_RemoveItem( CSharedPainterScene *view, boost::shared_ptr<CPaintItem> item ) = 0;
 	virtual boost::shared_ptr<CPaintItem> onICanvasViewEvent_FindItem( CSharedPainterScene *view, const std::string &owner, int itemId ) = 0;
 	virtual QString onICanvasViewEvent_GetToolTipText( CSharedPainterScene *view, boost::shared_ptr<CPaintItem> item ) = 0;
+	virtual void onICanvasViewEvent_DrawLiveStroke( CSharedPainterScene *view, boost::shared_ptr<CLineItem> line, size_t startIndex, size_t count ) = 0;
 };
 
 class CSharedPainterScene : public QGraphicsScene, public IGluePaintCanvas
@@ -206,8 +207,11 @@ public:
 		currentZValue_ = ZVALUE_NORMAL;
 		clearLastItemBorderRect();
 		clearBackgroundImage();
+		clearAllLiveStrokes();
 	}
 	virtual void setBackgroundColor( int r, int g, int b, int a );
+	virtual void drawLiveStroke( const std::string &owner, int strokeId, int startIndex, const QColor &clr, int width, const std::vector<QPointF> &points );
+	virtual void clearLiveStroke( const std::string &owner );
 
 
 private slots:
@@ -252,6 +256,8 @@ private:
 	void drawLineStart( const QPointF &pt, const QColor &clr, int width );
 	void drawLineTo( const QPointF &pt1, const QPointF &pt2, const QColor &clr, int width );
 	void doLowQualityMoveItems( void );
+	void sendLiveStroke( void );
+	void clearAllLiveStrokes( void );
 	void setScaleImageFileItem( boost::shared_ptr<CImageFileItem> image, QGraphicsPixmapItem *pixmapItem );
 	void commonAddItem( boost::shared_ptr<CPaintItem> item, QGraphicsItem *drawingItem, int borderType );
 	void internalDrawGridLine( QPainter *painter, const QRectF &rect, int gridLineSize );
@@ -262,6 +268,23 @@ private:
 			eventTarget_->onICanvasViewEvent_DrawItem( this, item );
 	}
 
+	inline void fireEvent_DrawLiveStroke( boost::shared_ptr<CLineItem> line, size_t startIndex, size_t count )
+	{
+		if(eventTarget_)
+			eventTarget_->onICanvasViewEvent_DrawLiveStroke( this, line, startIndex, count );
+	}
+
+	// other users' strokes being drawn
+	struct SLiveStroke
+	{
+		int strokeId;
+		int nextIndex;
+		QPointF lastPoint;
+		qreal zValue;
+		std::vector< QGraphicsItem * > items;
+	};
+	typedef std::map< std::string, SLiveStroke > LIVE_STROKE_MAP;
+
 private:
 	ICanvasViewEvent *eventTarget_;
 	QColor penClr_;
@@ -278,6 +301,9 @@ private:
 	boost::shared_ptr<CLineItem> currLineItem_;
 
 	std::vector< QGraphicsItem * > tempLineItemList_;
+	size_t liveStrokeSentCount_;
+	qint64 liveStrokeSentTime_;
+	LIVE_STROKE_MAP liveStrokeMap_;
 	ITEM_SET tempMovingItemList_;
 
 	QFileIconProvider fileIconProvider_;
@@ -39,15 +39,17 @@ namespace SystemPacketBuilder
 	public:
 		static std::string make( const std::string &id, const std::string &nick, const std::string &msg )
 		{
-			int pos = 0;
 			try
 			{
-				std::string body;
-				pos += CPacketBufferUtil::writeString8( body, pos, id );
-				pos += CPacketBufferUtil::writeString8( body, pos, nick );
-				pos += CPacketBufferUtil::writeString8( body, pos, msg );
+				std::string packet;
+				size_t bodySize = CommonPacketBuilder::string8Size( id ) + CommonPacketBuilder::string8Size( nick ) + CommonPacketBuilder::string8Size( msg );
+
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_CHAT_MESSAGE, bodySize );
+				writer.writeString8( id );
+				writer.writeString8( nick );
+				writer.writeString8( msg );
 
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_CHAT_MESSAGE, body );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -72,29 +74,40 @@ namespace SystemPacketBuilder
 
 	class CVersionInfo {
 	public:
-		static std::string make( const std::string &version, const std::string &protVersion )
+		// <caps> is appended after the version strings. old peers just ignore it.
+		static std::string make( const std::string &version, const std::string &protVersion, boost::uint32_t caps = 0, const std::string *fromId = NULL, const std::string *toId = NULL )
 		{
 			try
 			{
-				int pos = 0;
-				std::string body;
-				pos += CPacketBufferUtil::writeString8( body, pos, version );
-				pos += CPacketBufferUtil::writeString8( body, pos, protVersion );
+				std::string packet;
+				size_t bodySize = CommonPacketBuilder::string8Size( version ) + CommonPacketBuilder::string8Size( protVersion ) + 4;
 
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_VERSION_INFO, body );
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_VERSION_INFO, bodySize, fromId, toId );
+				writer.writeString8( version );
+				writer.writeString8( protVersion );
+				writer.writeInt32( caps );
+
+				return packet;
 			}catch(...)
 			{
 			}
 			return "";
 		}
 
-		static bool parse( const std::string &body, std::string &version, std::string &protVersion )
+		static bool parse( const std::string &body, std::string &version, std::string &protVersion, boost::uint32_t *caps = NULL )
 		{
 			try
 			{
 				int pos = 0;
 				pos += CPacketBufferUtil::readString8( body, pos, version );
 				pos += CPacketBufferUtil::readString8( body, pos, protVersion );
+
+				if( caps )
+				{
+					*caps = 0;
+					if( body.size() >= (size_t)pos + 4 )
+						pos += CPacketBufferUtil::readInt32( body, pos, *caps, true );
+				}
 				return true;
 
 			}catch(...)
@@ -110,12 +123,14 @@ namespace SystemPacketBuilder
 		{
 			try
 			{
-				int pos = 0;
-				std::string body;
-				pos += CPacketBufferUtil::writeString8( body, pos, userid );
-				pos += CPacketBufferUtil::writeString8( body, pos, nickName );
+				std::string packet;
+				size_t bodySize = CommonPacketBuilder::string8Size( userid ) + CommonPacketBuilder::string8Size( nickName );
+
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_CHANGE_NICKNAME, bodySize );
+				writer.writeString8( userid );
+				writer.writeString8( nickName );
 
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_CHANGE_NICKNAME, body );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -162,9 +177,12 @@ namespace SystemPacketBuilder
 		{
 			try
 			{
-				std::string body = user->serialize();
+				std::string packet;
 
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_JOIN_TO_SERVER, body );
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_JOIN_TO_SERVER, user->serializedSize() );
+				user->serializeTo( writer );
+
+				return packet;
 			}catch(...)
 			{
 			}
@@ -193,9 +211,12 @@ namespace SystemPacketBuilder
 		{
 			try
 			{
-				std::string body = user->serialize();
+				std::string packet;
+
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_JOIN_TO_SUPERPEER, user->serializedSize() );
+				user->serializeTo( writer );
 
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_JOIN_TO_SUPERPEER, body );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -224,7 +245,9 @@ namespace SystemPacketBuilder
 		{
 			try
 			{
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_SYNC_REQUEST, "" );
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_SYNC_REQUEST, 0 );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -254,11 +277,12 @@ namespace SystemPacketBuilder
 		{
 			try
 			{
-				int pos = 0;
-				std::string body;
-				pos += CPacketBufferUtil::writeString8( body, pos, channel );
+				std::string packet;
+
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_SYNC_START, CommonPacketBuilder::string8Size( channel ), &fromId, &toId );
+				writer.writeString8( channel );
 
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_SYNC_START, body, &fromId, &toId );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -287,7 +311,9 @@ namespace SystemPacketBuilder
 		{
 			try
 			{
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_SYNC_COMPLETE, "", NULL, &targetId );
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_SYNC_COMPLETE, 0, NULL, &targetId );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -332,7 +358,9 @@ namespace SystemPacketBuilder
 		{
 			try
 			{
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_TCPACK, "" );
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_TCPACK, 0 );
+				return packet;
 
 			}catch(...)
 			{
@@ -383,14 +411,16 @@ namespace SystemPacketBuilder
 	public:
 		static std::string make( const std::string &channel, const std::string &userId )
 		{
-			int pos = 0;
 			try
 			{
-				std::string body;
-				pos += CPacketBufferUtil::writeString8( body, pos, channel );
-				pos += CPacketBufferUtil::writeString8( body, pos, userId );
+				std::string packet;
+				size_t bodySize = CommonPacketBuilder::string8Size( channel ) + CommonPacketBuilder::string8Size( userId );
+
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_LEFT, bodySize );
+				writer.writeString8( channel );
+				writer.writeString8( userId );
 
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_LEFT, body );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -413,6 +443,94 @@ namespace SystemPacketBuilder
 		}
 	};
 
+	class CPresence
+	{
+	public:
+		enum {
+			EVENT_JOINED = 1,	// | type 1byte | user (CPaintUser::serializeTo()) |
+			EVENT_LEFT = 2,		// | type 1byte | user id 1byte string |
+		};
+
+		struct SEvent
+		{
+			int type;
+			boost::shared_ptr<CPaintUser> user;		// EVENT_JOINED
+			std::string userId;
+		};
+
+		// | channel 1byte string | 2byte event count | events in order |
+		static bool parse( const std::string &body, std::string &channel, std::vector<SEvent> &events )
+		{
+			int pos = 0;
+			try
+			{
+				boost::uint16_t count = 0;
+				pos += CPacketBufferUtil::readString8( body, pos, channel );
+				pos += CPacketBufferUtil::readInt16( body, pos, count, false );
+
+				for( int i = 0; i < count; i++ )
+				{
+					boost::uint8_t type = 0;
+					pos += CPacketBufferUtil::readInt8( body, pos, type );
+
+					SEvent event;
+					event.type = type;
+					if( type == EVENT_JOINED )
+					{
+						event.user = boost::shared_ptr<CPaintUser>(new CPaintUser);
+						event.user->deserialize( body, &pos );
+						event.userId = event.user->userId();
+					}
+					else if( type == EVENT_LEFT )
+					{
+						pos += CPacketBufferUtil::readString8( body, pos, event.userId );
+					}
+					else
+					{
+						return false;	// the length of an unknown event is not known
+					}
+					events.push_back( event );
+				}
+				return true;
+
+			}catch(...)
+			{
+			}
+			return false;
+		}
+	};
+
+	class CSessionHandle
+	{
+	public:
+		// | channel 1byte string | 4byte handle of the receiver (0 : unchanged) | 2byte count | (4byte handle | user id 1byte string) ... |
+		static bool parse( const std::string &body, std::string &channel, boost::uint32_t &ownHandle, std::vector< std::pair<boost::uint32_t, std::string> > &entries )
+		{
+			int pos = 0;
+			try
+			{
+				boost::uint16_t count = 0;
+				pos += CPacketBufferUtil::readString8( body, pos, channel );
+				pos += CPacketBufferUtil::readInt32( body, pos, ownHandle, true );
+				pos += CPacketBufferUtil::readInt16( body, pos, count, false );
+
+				for( int i = 0; i < count; i++ )
+				{
+					boost::uint32_t handle = 0;
+					std::string userId;
+					pos += CPacketBufferUtil::readInt32( body, pos, handle, true );
+					pos += CPacketBufferUtil::readString8( body, pos, userId );
+					entries.push_back( std::make_pair( handle, userId ) );
+				}
+				return true;
+
+			}catch(...)
+			{
+			}
+			return false;
+		}
+	};
+
 	class CHistoryUserList
 	{
 	public:
@@ -420,16 +538,18 @@ namespace SystemPacketBuilder
 		{
 			try
 			{
-				int pos = 0;
-				std::string body;
-				pos += CPacketBufferUtil::writeInt16( body, pos, (boost::uint16_t)list.size(), true );
+				size_t bodySize = 2;
+				for( size_t i = 0; i < list.size(); i++ )
+					bodySize += list[i]->serializedSize();
+
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_SYSTEM_HISTORY_USER_LIST, bodySize );
+				writer.writeInt16( (boost::uint16_t)list.size() );
 
 				for( size_t i = 0; i < list.size(); i++ )
-				{
-					body += list[i]->serialize();
-				}
+					list[i]->serializeTo( writer );
 
-				return CommonPacketBuilder::makePacket( CODE_SYSTEM_HISTORY_USER_LIST, body );
+				return packet;
 			}catch(...)
 			{
 			}
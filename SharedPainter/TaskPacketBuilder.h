@@ -39,16 +39,15 @@ namespace TaskPacketBuilder
 	public:
 		static std::string make( boost::shared_ptr<CSharedPaintTask> task, const std::string *target = NULL )
 		{
-			std::string body;
-			std::string data = task->serialize();
+			std::string packet;
 
-			int pos = 0;
 			try
 			{
-				pos += CPacketBufferUtil::writeInt16( body, pos, task->type(), true );
-				body += data;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_TASK_EXECUTE, 2 + task->serializedSize(), NULL, target );
+				writer.writeInt16( task->type() );
+				task->serializeTo( writer );
 
-				return CommonPacketBuilder::makePacket( CODE_TASK_EXECUTE, body, NULL, target );
+				return packet;
 			}catch(...)
 			{
 				
@@ -38,14 +38,14 @@ namespace WindowPacketBuilder
 	public:
 		static std::string make( boost::int16_t scrollH, boost::int16_t scrollV, const std::string *target = NULL )
 		{
-			int pos = 0;
 			try
 			{
-				std::string body;
-				pos += CPacketBufferUtil::writeInt16( body, pos, scrollH, true );
-				pos += CPacketBufferUtil::writeInt16( body, pos, scrollV, true );
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_WINDOW_CHANGE_CANVAS_SCROLL_POS, 2 * 2, NULL, target );
+				writer.writeInt16( scrollH );
+				writer.writeInt16( scrollV );
 
-				return CommonPacketBuilder::makePacket( CODE_WINDOW_CHANGE_CANVAS_SCROLL_POS, body, NULL, target );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -75,17 +75,17 @@ namespace WindowPacketBuilder
 	public:
 		static std::string make( const std::vector<int> &sizes, const std::string *target = NULL )
 		{
-			int pos = 0;
 			try
 			{
-				std::string body;
-				pos += CPacketBufferUtil::writeInt16( body, pos, sizes.size(), true );
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_WINDOW_RESIZE_WND_SPLITTER, 2 + 2 * sizes.size(), NULL, target );
+				writer.writeInt16( sizes.size() );
 				for( size_t i = 0; i < sizes.size(); i++ ) 
 				{
-					pos += CPacketBufferUtil::writeInt16( body, pos, sizes[i], true );
+					writer.writeInt16( sizes[i] );
 				}
 
-				return CommonPacketBuilder::makePacket( CODE_WINDOW_RESIZE_WND_SPLITTER, body, NULL, target );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -117,14 +117,14 @@ namespace WindowPacketBuilder
 	public:
 		static std::string make( int width, int height, const std::string *target = NULL )
 		{
-			int pos = 0;
 			try
 			{
-				std::string body;
-				pos += CPacketBufferUtil::writeInt16( body, pos, width, true );
-				pos += CPacketBufferUtil::writeInt16( body, pos, height, true );
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_WINDOW_RESIZE_CANVAS, 2 * 2, NULL, target );
+				writer.writeInt16( width );
+				writer.writeInt16( height );
 
-				return CommonPacketBuilder::makePacket( CODE_WINDOW_RESIZE_CANVAS, body, NULL, target );
+				return packet;
 			}catch(...)
 			{
 			}
@@ -154,14 +154,14 @@ namespace WindowPacketBuilder
 	public:
 		static std::string make( int width, int height, const std::string *target = NULL )
 		{
-			int pos = 0;
 			try
 			{
-				std::string body;
-				pos += CPacketBufferUtil::writeInt16( body, pos, width, true );
-				pos += CPacketBufferUtil::writeInt16( body, pos, height, true );
+				std::string packet;
+				CommonPacketBuilder::CPacketWriter writer( packet, CODE_WINDOW_RESIZE_MAIN_WND, 2 * 2, NULL, target );
+				writer.writeInt16( width );
+				writer.writeInt16( height );
 
-				return CommonPacketBuilder::makePacket( CODE_WINDOW_RESIZE_MAIN_WND, body, NULL, target );
+				return packet;
 			}catch(...)
 			{
 			}